@@ -24,12 +24,27 @@
 
 /* Minimal cJSON implementation for ROJ */
 
-static void *cJSON_malloc(size_t size) {
-    return malloc(size);
+static void *(*cJSON_malloc_fn)(size_t size) = malloc;
+static void (*cJSON_free_fn)(void *ptr) = free;
+
+void cJSON_InitHooks(cJSON_Hooks *hooks) {
+    cJSON_malloc_fn = (hooks && hooks->malloc_fn) ? hooks->malloc_fn : malloc;
+    cJSON_free_fn = (hooks && hooks->free_fn) ? hooks->free_fn : free;
+}
+
+void *cJSON_malloc(size_t size) {
+    return cJSON_malloc_fn(size);
+}
+
+void cJSON_free(void *ptr) {
+    if (ptr) cJSON_free_fn(ptr);
 }
 
-static void cJSON_free(void *ptr) {
-    free(ptr);
+static char *cJSON_strdup(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = (char *)cJSON_malloc(len);
+    if (copy) memcpy(copy, str, len);
+    return copy;
 }
 
 static cJSON *cJSON_New_Item(void) {
@@ -255,7 +270,7 @@ static char *print_number(const cJSON *item) {
 }
 
 static char *print_string_ptr(const char *str) {
-    if (!str) return strdup("\"\"");
+    if (!str) return cJSON_strdup("\"\"");
     size_t len = strlen(str) + 3;
     char *out = (char *)cJSON_malloc(len);
     if (!out) return NULL;
@@ -274,7 +289,7 @@ static char *print_array(const cJSON *item, int fmt) {
     cJSON *c = child;
     int numentries = 0;
     while (c) { numentries++; c = c->next; }
-    if (!numentries) return strdup("[]");
+    if (!numentries) return cJSON_strdup("[]");
 
     char **entries = (char **)cJSON_malloc(numentries * sizeof(char *));
     if (!entries) return NULL;
@@ -309,7 +324,7 @@ static char *print_object(const cJSON *item, int fmt) {
     int numentries = 0;
     cJSON *c = child;
     while (c) { numentries++; c = c->next; }
-    if (!numentries) return strdup("{}");
+    if (!numentries) return cJSON_strdup("{}");
 
     char **names = (char **)cJSON_malloc(numentries * sizeof(char *));
     char **entries = (char **)cJSON_malloc(numentries * sizeof(char *));
@@ -355,9 +370,9 @@ static char *print_value(const cJSON *item, int fmt) {
     (void)fmt;
     if (!item) return NULL;
     switch ((item->type) & 0xFF) {
-        case cJSON_NULL: return strdup("null");
-        case cJSON_False: return strdup("false");
-        case cJSON_True: return strdup("true");
+        case cJSON_NULL: return cJSON_strdup("null");
+        case cJSON_False: return cJSON_strdup("false");
+        case cJSON_True: return cJSON_strdup("true");
         case cJSON_Number: return print_number(item);
         case cJSON_String: return print_string_ptr(item->valuestring);
         case cJSON_Array: return print_array(item, fmt);
@@ -389,7 +404,7 @@ cJSON *cJSON_CreateString(const char *string) {
     cJSON *item = cJSON_New_Item();
     if (item) {
         item->type = cJSON_String;
-        item->valuestring = string ? strdup(string) : strdup("");
+        item->valuestring = string ? cJSON_strdup(string) : cJSON_strdup("");
     }
     return item;
 }
@@ -426,7 +441,7 @@ int cJSON_AddItemToArray(cJSON *array, cJSON *item) {
 int cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item) {
     if (!item || !object) return 0;
     if (item->string) cJSON_free(item->string);
-    item->string = strdup(string);
+    item->string = cJSON_strdup(string);
     return add_item_to_array(object, item);
 }
 
@@ -76,6 +76,13 @@ typedef struct cJSON_Hooks
 #define cJSON_IsObject(item) ((item) != NULL && ((item)->type & 0xFF) == cJSON_Object)
 #define cJSON_IsRaw(item) ((item) != NULL && ((item)->type & 0xFF) == cJSON_Raw)
 
+/* Route every allocation through hooks (NULL restores malloc and free) */
+void cJSON_InitHooks(cJSON_Hooks *hooks);
+
+/* Allocate and free with the installed hooks; free printed strings with cJSON_free */
+void *cJSON_malloc(size_t size);
+void cJSON_free(void *ptr);
+
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. */
 cJSON *cJSON_Parse(const char *value);
 
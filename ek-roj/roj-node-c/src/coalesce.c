@@ -0,0 +1,221 @@
+/*
+ * ROJ Coalesce - per-destination VOTE/COMMIT aggregation implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "coalesce.h"
+#include "proposal_table.h"
+
+void coalesce_init(roj_coalesce_t* co, roj_coalesce_send send, void* ctx) {
+    memset(co, 0, sizeof(*co));
+    co->send = send;
+    co->send_ctx = ctx;
+}
+
+static void send_out(roj_coalesce_t* co, const roj_message_t* msg,
+                     const roj_coalesce_dest_t* d) {
+    co->send(msg, &d->addr, d->wire, co->send_ctx);
+    co->datagrams++;
+}
+
+/* Aggregates carry IDs as integers, so only IDs that survive the round trip */
+static bool canonical_id(const char* proposal_id, uint64_t* id) {
+    char back[ROJ_PROPOSAL_ID_LEN];
+
+    *id = proposal_id_from_str(proposal_id);
+    proposal_id_to_str(*id, back);
+    return strcmp(back, proposal_id) == 0;
+}
+
+static roj_coalesce_dest_t* find_dest(roj_coalesce_t* co, const struct sockaddr_in* to,
+                                      roj_wire_t wire) {
+    for (int i = 0; i < co->dest_count; i++) {
+        roj_coalesce_dest_t* d = &co->dests[i];
+        if (d->addr.sin_addr.s_addr == to->sin_addr.s_addr &&
+            d->addr.sin_port == to->sin_port && d->wire == wire) {
+            return d;
+        }
+    }
+    if (co->dest_count == ROJ_MAX_PEERS) {
+        return NULL;
+    }
+
+    roj_coalesce_dest_t* d = &co->dests[co->dest_count++];
+    d->addr = *to;
+    d->wire = wire;
+    d->votes.type = MSG_VOTE_AGG;
+    d->votes.data.vote_agg.count = 0;
+    d->votes.data.vote_agg.ids = d->ids;
+    d->commits.type = MSG_COMMIT_AGG;
+    d->commits.data.commit_agg.count = 0;
+    d->commits.data.commit_agg.items = d->items;
+    d->commits.data.commit_agg.voter_count = 0;
+    return d;
+}
+
+static void flush_votes(roj_coalesce_t* co, roj_coalesce_dest_t* d) {
+    int count = d->votes.data.vote_agg.count;
+
+    if (count == 0) {
+        return;
+    }
+    if (count > 1) {
+        send_out(co, &d->votes, d);
+    } else {
+        roj_message_t vote;
+        memset(&vote, 0, sizeof(vote));
+        vote.type = MSG_VOTE;
+        proposal_id_to_str(d->votes.data.vote_agg.ids[0], vote.data.vote.proposal_id);
+        vote.data.vote.from = d->votes.data.vote_agg.from;
+        vote.data.vote.vote = (d->votes.data.vote_agg.accept_bits & 1) ? VOTE_ACCEPT
+                                                                        : VOTE_REJECT;
+        send_out(co, &vote, d);
+    }
+    co->pending -= count;
+    d->votes.data.vote_agg.count = 0;
+    d->votes.data.vote_agg.accept_bits = 0;
+}
+
+static void flush_commits(roj_coalesce_t* co, roj_coalesce_dest_t* d) {
+    int count = d->commits.data.commit_agg.count;
+
+    if (count == 0) {
+        return;
+    }
+    if (count > 1) {
+        send_out(co, &d->commits, d);
+    } else {
+        const roj_commit_item_t* item = &d->commits.data.commit_agg.items[0];
+        roj_message_t commit;
+        memset(&commit, 0, sizeof(commit));
+        commit.type = MSG_COMMIT;
+        proposal_id_to_str(item->id, commit.data.commit.proposal_id);
+        commit.data.commit.key = item->key;
+        commit.data.commit.value = item->value;
+        for (int v = 0; v < d->commits.data.commit_agg.voter_count; v++) {
+            if (item->voter_bits & (1u << v)) {
+                commit.data.commit.voters[commit.data.commit.voter_count++] =
+                    d->commits.data.commit_agg.voters[v];
+            }
+        }
+        send_out(co, &commit, d);
+    }
+    co->pending -= count;
+    d->commits.data.commit_agg.count = 0;
+    d->commits.data.commit_agg.voter_count = 0;
+}
+
+void coalesce_vote(roj_coalesce_t* co, const roj_message_t* vote,
+                   const struct sockaddr_in* to, roj_wire_t wire) {
+    uint64_t id;
+    roj_coalesce_dest_t* d;
+
+    co->queued++;
+    if (!canonical_id(vote->data.vote.proposal_id, &id) || !(d = find_dest(co, to, wire))) {
+        co->send(vote, to, wire, co->send_ctx);
+        co->datagrams++;
+        return;
+    }
+
+    /* One aggregate speaks for one voter */
+    if (d->votes.data.vote_agg.count > 0 && d->votes.data.vote_agg.from != vote->data.vote.from) {
+        flush_votes(co, d);
+    }
+
+    int i = d->votes.data.vote_agg.count++;
+    d->votes.data.vote_agg.from = vote->data.vote.from;
+    d->votes.data.vote_agg.ids[i] = id;
+    if (vote->data.vote.vote == VOTE_ACCEPT) {
+        d->votes.data.vote_agg.accept_bits |= 1u << i;
+    }
+    co->pending++;
+
+    if (d->votes.data.vote_agg.count == ROJ_MAX_AGG) {
+        flush_votes(co, d);
+    }
+}
+
+/* Index of voter in the shared list, adding it if there is room (-1 if not) */
+static int voter_index(roj_message_t* agg, roj_sym_t voter) {
+    int n = agg->data.commit_agg.voter_count;
+
+    for (int v = 0; v < n; v++) {
+        if (agg->data.commit_agg.voters[v] == voter) {
+            return v;
+        }
+    }
+    if (n == ROJ_MAX_VOTERS) {
+        return -1;
+    }
+    agg->data.commit_agg.voters[n] = voter;
+    agg->data.commit_agg.voter_count = n + 1;
+    return n;
+}
+
+/* Voter bits for commit in agg's voter list; false if the list would overflow */
+static bool map_voters(roj_message_t* agg, const roj_message_t* commit, uint32_t* bits) {
+    *bits = 0;
+    for (int v = 0; v < commit->data.commit.voter_count; v++) {
+        int index = voter_index(agg, commit->data.commit.voters[v]);
+        if (index < 0) {
+            return false;
+        }
+        *bits |= 1u << index;
+    }
+    return true;
+}
+
+void coalesce_commit(roj_coalesce_t* co, const roj_message_t* commit,
+                     const struct sockaddr_in* to, roj_wire_t wire) {
+    uint64_t id;
+    uint32_t bits;
+    roj_coalesce_dest_t* d;
+
+    co->queued++;
+    if (!canonical_id(commit->data.commit.proposal_id, &id) || !(d = find_dest(co, to, wire))) {
+        co->send(commit, to, wire, co->send_ctx);
+        co->datagrams++;
+        return;
+    }
+
+    /* Voters outside the shared list: start a fresh aggregate (voters are
+     * only appended, so the bits of queued items stay valid) */
+    if (!map_voters(&d->commits, commit, &bits)) {
+        flush_commits(co, d);
+        map_voters(&d->commits, commit, &bits);
+    }
+
+    roj_commit_item_t* item = &d->commits.data.commit_agg.items[d->commits.data.commit_agg.count++];
+    item->id = id;
+    item->key = commit->data.commit.key;
+    item->value = commit->data.commit.value;
+    item->voter_bits = bits;
+    co->pending++;
+
+    if (d->commits.data.commit_agg.count == ROJ_MAX_AGG) {
+        flush_commits(co, d);
+    }
+}
+
+int coalesce_flush(roj_coalesce_t* co) {
+    uint64_t before = co->datagrams;
+
+    for (int i = 0; i < co->dest_count; i++) {
+        flush_votes(co, &co->dests[i]);
+        flush_commits(co, &co->dests[i]);
+    }
+    co->dest_count = 0;
+    return (int)(co->datagrams - before);
+}
+
+int coalesce_pending(const roj_coalesce_t* co) {
+    return co->pending;
+}
+
+void coalesce_print_stats(const roj_coalesce_t* co) {
+    printf("  coalesce: %llu votes/commits in %llu datagrams\n",
+           (unsigned long long)co->queued, (unsigned long long)co->datagrams);
+}
@@ -0,0 +1,64 @@
+/*
+ * ROJ Coalesce - per-destination VOTE/COMMIT aggregation
+ *
+ * VOTEs and COMMITs headed for the same peer within one flush window are
+ * folded into a single VOTE_AGG or COMMIT_AGG carrying binary proposal IDs.
+ * A destination with one pending message at flush time gets the plain
+ * VOTE/COMMIT, and an aggregate is sent early once it fills up. Only
+ * canonical 16-hex-digit proposal IDs are aggregated; anything else is sent
+ * straight through.
+ *
+ * Event loop thread only. Callers decide which peers support "agg/1".
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_COALESCE_H
+#define ROJ_COALESCE_H
+
+#include "types.h"
+
+typedef void (*roj_coalesce_send)(const roj_message_t* msg, const struct sockaddr_in* to,
+                                  roj_wire_t wire, void* ctx);
+
+/* Aggregates being built for one peer */
+typedef struct {
+    struct sockaddr_in addr;
+    roj_wire_t wire;
+    roj_message_t votes;     /* MSG_VOTE_AGG */
+    roj_message_t commits;   /* MSG_COMMIT_AGG */
+    uint64_t ids[ROJ_MAX_AGG];             /* votes' array */
+    roj_commit_item_t items[ROJ_MAX_AGG];  /* commits' array */
+} roj_coalesce_dest_t;
+
+typedef struct {
+    roj_coalesce_send send;
+    void* send_ctx;
+    roj_coalesce_dest_t dests[ROJ_MAX_PEERS];
+    int dest_count;
+    int pending;
+    uint64_t queued;        /* VOTEs and COMMITs handed to us */
+    uint64_t datagrams;     /* messages we put on the wire */
+} roj_coalesce_t;
+
+/* Set the function that puts finished messages on the wire (called with ctx) */
+void coalesce_init(roj_coalesce_t* co, roj_coalesce_send send, void* ctx);
+
+/* Queue a MSG_VOTE for to */
+void coalesce_vote(roj_coalesce_t* co, const roj_message_t* vote,
+                   const struct sockaddr_in* to, roj_wire_t wire);
+
+/* Queue a MSG_COMMIT for to */
+void coalesce_commit(roj_coalesce_t* co, const roj_message_t* commit,
+                     const struct sockaddr_in* to, roj_wire_t wire);
+
+/* Send everything queued, returns the number of datagrams */
+int coalesce_flush(roj_coalesce_t* co);
+
+/* Number of queued VOTEs and COMMITs */
+int coalesce_pending(const roj_coalesce_t* co);
+
+/* Print messages queued vs datagrams sent */
+void coalesce_print_stats(const roj_coalesce_t* co);
+
+#endif /* ROJ_COALESCE_H */
@@ -0,0 +1,547 @@
+/*
+ * ROJ Codec Bench - encode/decode cost of every message codec
+ *
+ * Times each codec the node ships on one sample of every message type
+ * (COMMIT with 1 to 16 voters) and reports ns/op, encoded bytes/op and
+ * heap allocations/op:
+ *
+ *   cjson      message_to_json / message_from_json (cJSON tree in the JSON arena)
+ *   json       json_encode_message without templates / json_decode_message
+ *   json-tmpl  json_encode_message with this node's templates (encode only)
+ *   binary     message_to_binary / message_from_binary
+ *
+ * Results print as a table, CSV or JSON. A CSV from an earlier run can be
+ * given as --baseline to show the change per row.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "symtab.h"
+#include "transport.h"
+#include "json_encode.h"
+#include "json_decode.h"
+#include "payload.h"
+#include "wire.h"
+#include "json_arena.h"
+
+#define BENCH_BUF_SIZE      ROJ_MSG_MAX_SIZE
+#define BENCH_MAX_CASES     64
+#define BENCH_MAX_RESULTS   (BENCH_MAX_CASES * 8)
+#define BENCH_NODE_ID       "bench-node"
+
+/* Heap allocations since start. With glibc every malloc in the process is
+ * counted; elsewhere only cJSON's (the one codec that allocates) that its
+ * arena could not serve. */
+#ifdef __GLIBC__
+static uint64_t g_allocs;
+static uint64_t g_alloc_bytes;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+    g_allocs++;
+    g_alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    g_allocs++;
+    g_alloc_bytes += n * size;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    g_allocs++;
+    g_alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+static void read_allocs(uint64_t* allocs, uint64_t* bytes) {
+    *allocs = g_allocs;
+    *bytes = g_alloc_bytes;
+}
+#else
+static void read_allocs(uint64_t* allocs, uint64_t* bytes) {
+    roj_json_arena_stats_t stats;
+    json_arena_get_stats(&stats);
+    *allocs = stats.heap_allocs;
+    *bytes = stats.heap_bytes;
+}
+#endif
+
+typedef struct {
+    char name[32];
+    roj_message_t msg;
+    roj_payload_t payload;      /* msg's array, if its type has one */
+} bench_case_t;
+
+typedef int (*bench_encode_fn)(const roj_message_t* msg, char* buf, size_t size);
+typedef int (*bench_decode_fn)(const char* buf, size_t len, roj_message_t* msg);
+
+typedef struct {
+    const char* name;
+    bench_encode_fn encode;
+    bench_decode_fn decode;     /* NULL: encode only */
+} bench_codec_t;
+
+typedef struct {
+    const char* codec;
+    const char* message;
+    const char* op;
+    double ns;
+    int bytes;
+    double allocs;
+    double alloc_bytes;
+    uint64_t iterations;
+    double baseline_ns;         /* 0 = not in the baseline */
+} bench_result_t;
+
+typedef struct {
+    uint64_t target_ns;
+    int repeat;
+    const char* format;
+    const char* baseline;
+    const char* filter;
+} bench_options_t;
+
+static roj_json_templates_t g_templates;
+
+/* Codecs */
+
+static int cjson_encode(const roj_message_t* msg, char* buf, size_t size) {
+    return message_to_json(msg, buf, size);
+}
+
+static int cjson_decode(const char* buf, size_t len, roj_message_t* msg) {
+    (void)len;
+    return message_from_json(buf, msg);
+}
+
+static int direct_encode(const roj_message_t* msg, char* buf, size_t size) {
+    return json_encode_message(NULL, msg, buf, size);
+}
+
+static int template_encode(const roj_message_t* msg, char* buf, size_t size) {
+    return json_encode_message(&g_templates, msg, buf, size);
+}
+
+static int direct_decode(const char* buf, size_t len, roj_message_t* msg) {
+    return json_decode_message(buf, len, msg, ROJ_INTERN_ALL);
+}
+
+static int binary_encode(const roj_message_t* msg, char* buf, size_t size) {
+    return message_to_binary(msg, (uint8_t*)buf, size);
+}
+
+static int binary_decode(const char* buf, size_t len, roj_message_t* msg) {
+    return message_from_binary((const uint8_t*)buf, len, msg, ROJ_INTERN_ALL);
+}
+
+static const bench_codec_t g_codecs[] = {
+    { "cjson", cjson_encode, cjson_decode },
+    { "json", direct_encode, direct_decode },
+    { "json-tmpl", template_encode, NULL },
+    { "binary", binary_encode, binary_decode },
+};
+
+/* Sample messages: realistic IDs, keys and values, all from BENCH_NODE_ID
+ * so the template encoder takes its fast path where it has one */
+
+static roj_sym_t voter(int i) {
+    char id[24];
+    snprintf(id, sizeof(id), "node-%d", i + 1);
+    return symtab_intern_str(id);
+}
+
+static roj_sym_t key(int i) {
+    char k[32];
+    snprintf(k, sizeof(k), "sensor.%d.temperature", i);
+    return symtab_intern_str(k);
+}
+
+static bench_case_t* add_case(bench_case_t* cases, int* count, roj_msg_type_t type,
+                              const char* name) {
+    bench_case_t* c = &cases[(*count)++];
+    memset(c, 0, sizeof(*c));
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->msg.type = type;
+    message_set_payload(&c->msg, &c->payload);
+    return c;
+}
+
+static int build_cases(bench_case_t* cases) {
+    static const char* proposal_id = "5a3f00000000012c";
+    roj_sym_t self = symtab_intern_str(BENCH_NODE_ID);
+    int64_t now = 1760000000;
+    char name[32];
+    int n = 0;
+    roj_message_t* m;
+
+    m = &add_case(cases, &n, MSG_ANNOUNCE, "ANNOUNCE")->msg;
+    m->data.announce.node_id = self;
+    m->data.announce.lang = LANG_C;
+    m->data.announce.caps = ROJ_CAP_CONSENSUS | ROJ_CAP_WIRE_BIN | ROJ_CAP_BATCH | ROJ_CAP_AGG;
+    strcpy(m->data.announce.version, ROJ_VERSION);
+    json_encode_set_announce(&g_templates, m);
+
+    m = &add_case(cases, &n, MSG_PROPOSE, "PROPOSE")->msg;
+    strcpy(m->data.propose.proposal_id, proposal_id);
+    m->data.propose.from = self;
+    m->data.propose.key = key(0);
+    m->data.propose.value = 2150;
+    m->data.propose.timestamp = now;
+
+    m = &add_case(cases, &n, MSG_VOTE, "VOTE")->msg;
+    strcpy(m->data.vote.proposal_id, proposal_id);
+    m->data.vote.from = self;
+    m->data.vote.vote = VOTE_ACCEPT;
+
+    for (int voters = 1; voters <= ROJ_MAX_VOTERS; voters *= 2) {
+        snprintf(name, sizeof(name), "COMMIT/%dv", voters);
+        m = &add_case(cases, &n, MSG_COMMIT, name)->msg;
+        strcpy(m->data.commit.proposal_id, proposal_id);
+        m->data.commit.key = key(0);
+        m->data.commit.value = 2150;
+        for (int i = 0; i < voters; i++) {
+            m->data.commit.voters[i] = voter(i);
+        }
+        m->data.commit.voter_count = voters;
+    }
+
+    m = &add_case(cases, &n, MSG_PROPOSE_BATCH, "PROPOSE_BATCH/32")->msg;
+    strcpy(m->data.propose_batch.proposal_id, proposal_id);
+    m->data.propose_batch.from = self;
+    m->data.propose_batch.timestamp = now;
+    m->data.propose_batch.count = ROJ_MAX_BATCH;
+    for (int i = 0; i < ROJ_MAX_BATCH; i++) {
+        m->data.propose_batch.entries[i].key = key(i);
+        m->data.propose_batch.entries[i].value = 2000 + i;
+    }
+
+    m = &add_case(cases, &n, MSG_COMMIT_BATCH, "COMMIT_BATCH/32")->msg;
+    strcpy(m->data.commit_batch.proposal_id, proposal_id);
+    m->data.commit_batch.count = ROJ_MAX_BATCH;
+    for (int i = 0; i < ROJ_MAX_BATCH; i++) {
+        m->data.commit_batch.entries[i].key = key(i);
+        m->data.commit_batch.entries[i].value = 2000 + i;
+    }
+    for (int i = 0; i < 4; i++) {
+        m->data.commit_batch.voters[i] = voter(i);
+    }
+    m->data.commit_batch.voter_count = 4;
+
+    m = &add_case(cases, &n, MSG_VOTE_AGG, "VOTE_AGG/32")->msg;
+    m->data.vote_agg.from = self;
+    m->data.vote_agg.count = ROJ_MAX_AGG;
+    m->data.vote_agg.accept_bits = 0xFFFFFFFFu;
+    for (int i = 0; i < ROJ_MAX_AGG; i++) {
+        m->data.vote_agg.ids[i] = 0x5a3f000000000100ULL + (uint64_t)i;
+    }
+
+    m = &add_case(cases, &n, MSG_COMMIT_AGG, "COMMIT_AGG/32")->msg;
+    m->data.commit_agg.count = ROJ_MAX_AGG;
+    for (int i = 0; i < 4; i++) {
+        m->data.commit_agg.voters[i] = voter(i);
+    }
+    m->data.commit_agg.voter_count = 4;
+    for (int i = 0; i < ROJ_MAX_AGG; i++) {
+        m->data.commit_agg.items[i].id = 0x5a3f000000000100ULL + (uint64_t)i;
+        m->data.commit_agg.items[i].key = key(i);
+        m->data.commit_agg.items[i].value = 2000 + i;
+        m->data.commit_agg.items[i].voter_bits = 0xF;
+    }
+
+    m = &add_case(cases, &n, MSG_REQUEST_VOTE, "REQUEST_VOTE")->msg;
+    m->data.request_vote.term = 7;
+    m->data.request_vote.candidate_id = self;
+    m->data.request_vote.last_log_index = 48213;
+    m->data.request_vote.last_log_term = 6;
+
+    m = &add_case(cases, &n, MSG_VOTE_RESPONSE, "VOTE_RESPONSE")->msg;
+    m->data.vote_response.term = 7;
+    m->data.vote_response.voter_id = self;
+    m->data.vote_response.vote_granted = true;
+
+    for (int entries = 0; entries <= ROJ_MAX_BATCH; entries += ROJ_MAX_BATCH) {
+        snprintf(name, sizeof(name), "APPEND_ENTRIES/%d", entries);
+        m = &add_case(cases, &n, MSG_APPEND_ENTRIES, name)->msg;
+        m->data.append_entries.term = 7;
+        m->data.append_entries.leader_id = self;
+        m->data.append_entries.prev_log_index = 48213;
+        m->data.append_entries.prev_log_term = 7;
+        m->data.append_entries.leader_commit = 48210;
+        m->data.append_entries.count = entries;
+        for (int i = 0; i < entries; i++) {
+            m->data.append_entries.entries[i].term = 7;
+            m->data.append_entries.entries[i].key = key(i);
+            m->data.append_entries.entries[i].value = 2000 + i;
+        }
+    }
+
+    m = &add_case(cases, &n, MSG_APPEND_ENTRIES_RESPONSE, "APPEND_ENTRIES_RESPONSE")->msg;
+    m->data.append_response.term = 7;
+    m->data.append_response.follower_id = self;
+    m->data.append_response.success = true;
+    m->data.append_response.match_index = 48245;
+
+    m = &add_case(cases, &n, MSG_FORWARD, "FORWARD/32")->msg;
+    m->data.forward.from = self;
+    m->data.forward.count = ROJ_MAX_BATCH;
+    for (int i = 0; i < ROJ_MAX_BATCH; i++) {
+        m->data.forward.entries[i].key = key(i);
+        m->data.forward.entries[i].value = 2000 + i;
+    }
+
+    return n;
+}
+
+/* Measurement */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Run iters operations; returns elapsed ns and leaves counters in r */
+static uint64_t run_op(const bench_codec_t* codec, bool decode, const roj_message_t* msg,
+                       char* buf, size_t size, int len, uint64_t iters,
+                       bench_result_t* r) {
+    roj_message_t out;
+    uint64_t allocs, alloc_bytes, allocs_end, alloc_bytes_end;
+    read_allocs(&allocs, &alloc_bytes);
+    uint64_t start = now_ns();
+
+    if (decode) {
+        for (uint64_t i = 0; i < iters; i++) {
+            codec->decode(buf, (size_t)len, &out);
+        }
+    } else {
+        for (uint64_t i = 0; i < iters; i++) {
+            codec->encode(msg, buf, size);
+        }
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    read_allocs(&allocs_end, &alloc_bytes_end);
+    r->allocs = (double)(allocs_end - allocs) / (double)iters;
+    r->alloc_bytes = (double)(alloc_bytes_end - alloc_bytes) / (double)iters;
+    return elapsed;
+}
+
+/* Calibrate to target_ns per run, keep the fastest of repeat runs */
+static void measure(const bench_options_t* opt, const bench_codec_t* codec, bool decode,
+                    const roj_message_t* msg, char* buf, size_t size, int len,
+                    bench_result_t* r) {
+    uint64_t iters = 1000;
+    uint64_t elapsed = run_op(codec, decode, msg, buf, size, len, iters, r);
+
+    if (elapsed > 0 && elapsed < opt->target_ns) {
+        iters = iters * opt->target_ns / elapsed;
+    }
+    r->iterations = iters;
+    r->ns = 0;
+    for (int i = 0; i < opt->repeat; i++) {
+        double ns = (double)run_op(codec, decode, msg, buf, size, len, iters, r) /
+                    (double)iters;
+        if (r->ns == 0 || ns < r->ns) {
+            r->ns = ns;
+        }
+    }
+}
+
+/* Encode, decode and encode again: both encodings must match */
+static bool round_trips(const bench_codec_t* codec, const roj_message_t* msg) {
+    static char first[BENCH_BUF_SIZE], second[BENCH_BUF_SIZE];
+    roj_message_t decoded;
+
+    int len = codec->encode(msg, first, sizeof(first));
+    if (len < 0 || codec->decode(first, (size_t)len, &decoded) != 0) {
+        return false;
+    }
+    return codec->encode(&decoded, second, sizeof(second)) == len &&
+           memcmp(first, second, (size_t)len) == 0;
+}
+
+static int bench_case(const bench_options_t* opt, const bench_case_t* c,
+                      bench_result_t* results, int count) {
+    static char buf[BENCH_BUF_SIZE];
+
+    for (size_t k = 0; k < sizeof(g_codecs) / sizeof(g_codecs[0]); k++) {
+        const bench_codec_t* codec = &g_codecs[k];
+        int len = codec->encode(&c->msg, buf, sizeof(buf));
+        if (len < 0) {
+            fprintf(stderr, "[WARN] %s cannot encode %s\n", codec->name, c->name);
+            continue;
+        }
+        if (codec->decode && !round_trips(codec, &c->msg)) {
+            fprintf(stderr, "[WARN] %s does not round-trip %s\n", codec->name, c->name);
+        }
+
+        for (int decode = 0; decode <= (codec->decode ? 1 : 0); decode++) {
+            bench_result_t* r = &results[count++];
+            memset(r, 0, sizeof(*r));
+            r->codec = codec->name;
+            r->message = c->name;
+            r->op = decode ? "decode" : "encode";
+            r->bytes = len;
+            /* Decoding needs the encoded bytes in buf, encoding rewrites them */
+            codec->encode(&c->msg, buf, sizeof(buf));
+            measure(opt, codec, decode, &c->msg, buf, sizeof(buf), len, r);
+        }
+    }
+    return count;
+}
+
+/* Baseline: CSV written by an earlier --format csv run */
+
+static void apply_baseline(const char* path, bench_result_t* results, int count) {
+    FILE* f = fopen(path, "r");
+    char line[256];
+
+    if (!f) {
+        fprintf(stderr, "[WARN] Cannot read baseline %s\n", path);
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char codec[32], message[32], op[16];
+        double ns;
+        if (sscanf(line, "%31[^,],%31[^,],%15[^,],%lf", codec, message, op, &ns) != 4) {
+            continue;       /* header or foreign line */
+        }
+        for (int i = 0; i < count; i++) {
+            if (strcmp(results[i].codec, codec) == 0 &&
+                strcmp(results[i].message, message) == 0 &&
+                strcmp(results[i].op, op) == 0) {
+                results[i].baseline_ns = ns;
+            }
+        }
+    }
+    fclose(f);
+}
+
+/* Output */
+
+static void print_table(const bench_result_t* results, int count, bool baseline) {
+    printf("%-10s %-24s %-7s %10s %8s %9s %12s%s\n",
+           "codec", "message", "op", "ns/op", "bytes", "allocs", "alloc_bytes",
+           baseline ? "   vs base" : "");
+    for (int i = 0; i < count; i++) {
+        const bench_result_t* r = &results[i];
+        printf("%-10s %-24s %-7s %10.1f %8d %9.2f %12.1f",
+               r->codec, r->message, r->op, r->ns, r->bytes, r->allocs, r->alloc_bytes);
+        if (baseline && r->baseline_ns > 0) {
+            printf("   %+6.1f%%", (r->ns - r->baseline_ns) * 100.0 / r->baseline_ns);
+        }
+        printf("\n");
+    }
+}
+
+static void print_csv(const bench_result_t* results, int count) {
+    printf("codec,message,op,ns_per_op,bytes_per_op,allocs_per_op,alloc_bytes_per_op,"
+           "iterations\n");
+    for (int i = 0; i < count; i++) {
+        const bench_result_t* r = &results[i];
+        printf("%s,%s,%s,%.2f,%d,%.3f,%.1f,%llu\n",
+               r->codec, r->message, r->op, r->ns, r->bytes, r->allocs, r->alloc_bytes,
+               (unsigned long long)r->iterations);
+    }
+}
+
+static void print_json(const bench_result_t* results, int count) {
+    printf("[\n");
+    for (int i = 0; i < count; i++) {
+        const bench_result_t* r = &results[i];
+        printf("  {\"codec\":\"%s\",\"message\":\"%s\",\"op\":\"%s\",\"ns_per_op\":%.2f,"
+               "\"bytes_per_op\":%d,\"allocs_per_op\":%.3f,\"alloc_bytes_per_op\":%.1f,"
+               "\"iterations\":%llu",
+               r->codec, r->message, r->op, r->ns, r->bytes, r->allocs, r->alloc_bytes,
+               (unsigned long long)r->iterations);
+        if (r->baseline_ns > 0) {
+            printf(",\"baseline_ns_per_op\":%.2f", r->baseline_ns);
+        }
+        printf("}%s\n", i + 1 < count ? "," : "");
+    }
+    printf("]\n");
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [--time <ms>] [--repeat <n>] [--format table|csv|json] "
+           "[--baseline <csv>] [--filter <message>]\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    static bench_case_t cases[BENCH_MAX_CASES];
+    static bench_result_t results[BENCH_MAX_RESULTS];
+    bench_options_t opt = { 200 * 1000000ull, 3, "table", NULL, NULL };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            opt.target_ns = strtoull(argv[++i], NULL, 10) * 1000000ull;
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            opt.repeat = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            opt.format = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            opt.baseline = argv[++i];
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            opt.filter = argv[++i];
+        }
+        else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0 ? 0 : 1;
+        }
+    }
+    if (opt.repeat < 1 || opt.target_ns == 0 ||
+        (strcmp(opt.format, "table") != 0 && strcmp(opt.format, "csv") != 0 &&
+         strcmp(opt.format, "json") != 0)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    /* As a node does: cJSON trees come from the per-thread arena */
+    json_arena_install();
+    if (symtab_init() != 0) {
+        fprintf(stderr, "[ERROR] Failed to initialize symbol table\n");
+        return 1;
+    }
+    json_encode_init(&g_templates, BENCH_NODE_ID);
+
+    int case_count = build_cases(cases);
+    int count = 0;
+    for (int i = 0; i < case_count; i++) {
+        if (!opt.filter || strstr(cases[i].name, opt.filter)) {
+            count = bench_case(&opt, &cases[i], results, count);
+        }
+    }
+    if (opt.baseline) {
+        apply_baseline(opt.baseline, results, count);
+    }
+
+    if (strcmp(opt.format, "csv") == 0) {
+        print_csv(results, count);
+    } else if (strcmp(opt.format, "json") == 0) {
+        print_json(results, count);
+    } else {
+        print_table(results, count, opt.baseline != NULL);
+    }
+
+    symtab_free();
+    return 0;
+}
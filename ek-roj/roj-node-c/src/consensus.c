@@ -9,185 +9,617 @@
 #include <string.h>
 #include <time.h>
 #include "consensus.h"
+#include "state_store.h"
+#include "proposal_table.h"
+#include "symtab.h"
+#include "logger.h"
+#include "history.h"
+#include "wal.h"
+#include "snapshot.h"
+
+#define VOTER_NAMES_SIZE 160    /* what a log record keeps of the voter list */
+
+int consensus_init(roj_consensus_t* cs, const char* node_id) {
+    memset(cs, 0, sizeof(*cs));
+    cs->batch_max = 1;
+    cs->node_id = symtab_intern_str(node_id);
+
+    /* Sequence numbers start from the wall clock so a restarted node does
+     * not reuse recent IDs */
+    cs->origin = proposal_origin_of(node_id);
+    cs->proposal_seq = (uint64_t)time(NULL) << 16;
+
+    if (proposal_table_init(&cs->proposals, 0) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Failed to allocate proposal table");
+        return -1;
+    }
 
-static char g_node_id[ROJ_NODE_ID_MAX];
-static roj_proposal_t g_proposals[ROJ_MAX_PROPOSALS];
-static roj_state_entry_t g_state[ROJ_MAX_STATE];
-static int g_state_count = 0;
-static int g_proposal_counter = 0;
+    if (state_store_init(&cs->state, 0) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Failed to allocate state store");
+        return -1;
+    }
 
-int consensus_init(const char* node_id) {
-    strncpy(g_node_id, node_id, ROJ_NODE_ID_MAX - 1);
-    g_node_id[ROJ_NODE_ID_MAX - 1] = '\0';
+    ROJ_HISTORY_THREAD_INIT();
+    return 0;
+}
 
-    memset(g_proposals, 0, sizeof(g_proposals));
-    memset(g_state, 0, sizeof(g_state));
-    g_state_count = 0;
-    g_proposal_counter = 0;
+void consensus_free(roj_consensus_t* cs) {
+    for (uint32_t slot = 0; slot < cs->proposals.used; slot++) {
+        if (proposal_hot(&cs->proposals, slot)->in_use) {
+            free(proposal_cold(&cs->proposals, slot)->batch);
+        }
+    }
+    proposal_table_free(&cs->proposals);
+    state_store_free(&cs->state);
+    free(cs->sym_voter);
+    cs->sym_voter = NULL;
+    cs->sym_voter_cap = 0;
+    cs->voter_count = 0;
+    cs->pending_count = 0;
+}
 
-    return 0;
+void consensus_set_timer_wheel(roj_consensus_t* cs, roj_timer_wheel_t* wheel) {
+    cs->wheel = wheel;
+}
+
+void consensus_set_wal(roj_consensus_t* cs, roj_wal_t* wal) {
+    cs->wal = wal;
+}
+
+void consensus_set_apply_hook(roj_consensus_t* cs, roj_apply_fn fn, void* ctx) {
+    cs->on_apply = fn;
+    cs->on_apply_ctx = ctx;
+}
+
+void consensus_set_outcome_hook(roj_consensus_t* cs, roj_outcome_fn fn, void* ctx) {
+    cs->on_outcome = fn;
+    cs->on_outcome_ctx = ctx;
+}
+
+void consensus_set_metrics(roj_consensus_t* cs, roj_metrics_t* m) {
+    cs->metrics = m;
+}
+
+void consensus_set_origin(roj_consensus_t* cs, uint16_t origin) {
+    cs->origin = origin;
+}
+
+void consensus_seed(roj_consensus_t* cs, uint64_t seed) {
+    cs->proposal_seq = seed << 16;
+}
+
+void consensus_set_batching(roj_consensus_t* cs, int max_batch) {
+    if (max_batch < 1) max_batch = 1;
+    if (max_batch > ROJ_MAX_BATCH) max_batch = ROJ_MAX_BATCH;
+    cs->batch_max = max_batch;
+}
+
+int consensus_batch_full(const roj_consensus_t* cs) {
+    return cs->pending_count >= cs->batch_max;
+}
+
+/* Remove a proposal and the batch it owns */
+static void remove_proposal(roj_consensus_t* cs, uint32_t slot) {
+    roj_proposal_t* p = proposal_cold(&cs->proposals, slot);
+    free(p->batch);
+    p->batch = NULL;
+    proposal_table_remove(&cs->proposals, slot);
 }
 
-static roj_proposal_t* find_proposal(const char* proposal_id) {
-    for (int i = 0; i < ROJ_MAX_PROPOSALS; i++) {
-        if (g_proposals[i].active &&
-            strcmp(g_proposals[i].proposal_id, proposal_id) == 0) {
-            return &g_proposals[i];
+static void on_proposal_expired(void* ctx, uint64_t id) {
+    roj_consensus_t* cs = ctx;
+    uint32_t slot = proposal_table_find(&cs->proposals, id);
+    if (slot == ROJ_PROPOSAL_NONE) {
+        return;
+    }
+
+    roj_proposal_t* p = proposal_cold(&cs->proposals, slot);
+    if (cs->metrics) {
+        metrics_inc(p->created_ns ? &cs->metrics->proposals_expired
+                                  : &cs->metrics->peer_proposals_expired, 1);
+    }
+    if (p->own) {
+        ROJ_HISTORY_PROPOSAL(ROJ_HISTORY_FAIL, cs->origin, p);
+        if (cs->on_outcome) {
+            cs->on_outcome(id, false, cs->on_outcome_ctx);
         }
     }
-    return NULL;
+    if (p->batch) {
+        ROJ_LOG(ROJ_LOG_WARN, "Consensus: Proposal %s expired (batch of %d, %d votes)",
+                p->proposal_id, p->batch_count,
+                proposal_hot(&cs->proposals, slot)->vote_count);
+    } else {
+        ROJ_LOG(ROJ_LOG_WARN, "Consensus: Proposal %s expired (%s=%lld, %d votes)",
+                p->proposal_id, symtab_str(p->key), (long long)p->value,
+                proposal_hot(&cs->proposals, slot)->vote_count);
+    }
+    remove_proposal(cs, slot);
+}
+
+static void arm_deadline(roj_consensus_t* cs, uint32_t slot, uint64_t timeout_ms) {
+    if (cs->wheel) {
+        proposal_cold(&cs->proposals, slot)->deadline_timer =
+            timer_wheel_add(cs->wheel, timeout_ms, on_proposal_expired, cs,
+                            proposal_hot(&cs->proposals, slot)->id);
+    }
 }
 
-static roj_proposal_t* alloc_proposal(void) {
-    for (int i = 0; i < ROJ_MAX_PROPOSALS; i++) {
-        if (!g_proposals[i].active) {
-            return &g_proposals[i];
+static void drop_proposal(roj_consensus_t* cs, uint32_t slot) {
+    if (cs->wheel) {
+        timer_wheel_cancel(cs->wheel, proposal_cold(&cs->proposals, slot)->deadline_timer);
+    }
+    remove_proposal(cs, slot);
+}
+
+static int lowest_bit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Release every slot that no live proposal holds a vote in. Such a slot
+ * has no bits set anywhere, so it can be handed out again as is. */
+static int reclaim_voter_slots(roj_consensus_t* cs) {
+    uint64_t live[ROJ_VOTER_WORDS] = { 0 };
+    int freed = 0;
+
+    for (uint32_t slot = 0; slot < cs->proposals.used; slot++) {
+        if (proposal_hot(&cs->proposals, slot)->in_use) {
+            const roj_proposal_votes_t* pv = proposal_votes(&cs->proposals, slot);
+            for (int w = 0; w < ROJ_VOTER_WORDS; w++) {
+                live[w] |= pv->voted[w];
+            }
+        }
+    }
+    for (uint32_t v = 0; v < cs->voter_count; v++) {
+        roj_sym_t sym = cs->voter_syms[v];
+        if (sym != ROJ_SYM_EMPTY && !(live[v >> 6] & (1ULL << (v & 63)))) {
+            cs->sym_voter[sym] = 0;
+            cs->voter_syms[v] = ROJ_SYM_EMPTY;
+            freed++;
         }
     }
-    return NULL;
+    return freed;
 }
 
-static void generate_proposal_id(char* buf) {
-    /* Simple incrementing ID with random component */
-    unsigned int r = (unsigned int)time(NULL) ^ g_proposal_counter++;
-    snprintf(buf, ROJ_PROPOSAL_ID_LEN, "%08x", r);
+static int free_voter_slot(roj_consensus_t* cs) {
+    if (cs->voter_count < ROJ_MAX_VOTER_SLOTS) {
+        return (int)cs->voter_count++;
+    }
+    for (int v = 0; v < ROJ_MAX_VOTER_SLOTS; v++) {
+        if (cs->voter_syms[v] == ROJ_SYM_EMPTY) {
+            return v;
+        }
+    }
+    return -1;
 }
 
-int consensus_create_proposal(const char* key, int64_t value, roj_message_t* msg) {
-    roj_proposal_t* p = alloc_proposal();
-    if (!p) {
-        fprintf(stderr, "[WARN] No space for new proposal\n");
+/* Voter slot for a node ID, assigned on first sight. Once every slot has
+ * been handed out, slots of voters that no live proposal remembers (peers
+ * long gone, stray IDs) are reclaimed; -1 only while all are in use. */
+static int voter_slot(roj_consensus_t* cs, roj_sym_t node_id) {
+    if (node_id < cs->sym_voter_cap && cs->sym_voter[node_id] != 0) {
+        return cs->sym_voter[node_id] - 1;
+    }
+    if (node_id == ROJ_SYM_EMPTY) {
         return -1;
     }
 
-    memset(p, 0, sizeof(*p));
-    generate_proposal_id(p->proposal_id);
-    strncpy(p->key, key, ROJ_KEY_MAX - 1);
-    p->value = value;
+    if (node_id >= cs->sym_voter_cap) {
+        uint32_t cap = cs->sym_voter_cap ? cs->sym_voter_cap : 64;
+        while (cap <= node_id) cap *= 2;
+        uint16_t* map = realloc(cs->sym_voter, (size_t)cap * sizeof(*map));
+        if (!map) return -1;
+        memset(map + cs->sym_voter_cap, 0, (size_t)(cap - cs->sym_voter_cap) * sizeof(*map));
+        cs->sym_voter = map;
+        cs->sym_voter_cap = cap;
+    }
+
+    int v = free_voter_slot(cs);
+    if (v < 0 && reclaim_voter_slots(cs) > 0) {
+        v = free_voter_slot(cs);
+    }
+    if (v < 0) {
+        return -1;
+    }
+    cs->voter_syms[v] = node_id;
+    cs->sym_voter[node_id] = (uint16_t)(v + 1);
+    return v;
+}
+
+/* Record a vote in O(1); returns 1 for a duplicate, -1 if the voter cannot be tracked */
+static int record_vote(roj_consensus_t* cs, uint32_t slot, roj_sym_t node_id, roj_vote_t vote) {
+    int v = voter_slot(cs, node_id);
+    if (v < 0) {
+        ROJ_LOG(ROJ_LOG_WARN, "Too many distinct voters in open proposals, ignoring %s",
+                symtab_str(node_id));
+        return -1;
+    }
+
+    roj_proposal_votes_t* pv = proposal_votes(&cs->proposals, slot);
+    uint64_t bit = 1ULL << (v & 63);
+    if (pv->voted[v >> 6] & bit) {
+        return 1;
+    }
+    pv->voted[v >> 6] |= bit;
+
+    roj_proposal_hot_t* h = proposal_hot(&cs->proposals, slot);
+    h->vote_count++;
+    if (vote == VOTE_ACCEPT) {
+        pv->accepted[v >> 6] |= bit;
+        h->accepts++;
+    } else {
+        h->rejects++;
+    }
+    return 0;
+}
+
+/* A commit the WAL refused is neither applied nor reported */
+static int log_commit(roj_consensus_t* cs, roj_sym_t key, int64_t value) {
+    if (cs->wal && wal_append_commit(cs->wal, symtab_str(key), value) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Failed to log commit of %s, not applying it", symtab_str(key));
+        return -1;
+    }
+    return 0;
+}
+
+static void apply_logged(roj_consensus_t* cs, roj_sym_t key, int64_t value) {
+    if (state_store_put(&cs->state, symtab_str(key), value) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Out of memory committing %s", symtab_str(key));
+    }
+    if (cs->metrics) {
+        metrics_inc(&cs->metrics->commits_applied, 1);
+    }
+    if (cs->on_apply) {
+        cs->on_apply(key, value, cs->on_apply_ctx);
+    }
+}
+
+static int apply_commit(roj_consensus_t* cs, roj_sym_t key, int64_t value) {
+    if (log_commit(cs, key, value) != 0) {
+        return -1;
+    }
+    apply_logged(cs, key, value);
+    return 0;
+}
+
+int consensus_load_snapshot(roj_consensus_t* cs, roj_snapshot_t* snap, const char* dir) {
+    return snapshot_load(snap, dir, &cs->state);
+}
+
+int consensus_snapshot(roj_consensus_t* cs, roj_snapshot_t* snap, const char* dir) {
+    return snapshot_start(snap, dir, &cs->state);
+}
+
+uint64_t consensus_next_id(roj_consensus_t* cs) {
+    return proposal_id_make(cs->origin, ++cs->proposal_seq);
+}
+
+int consensus_apply(roj_consensus_t* cs, roj_sym_t key, int64_t value) {
+    return apply_commit(cs, key, value);
+}
+
+void consensus_restore(const char* key, int64_t value, void* ctx) {
+    roj_consensus_t* cs = ctx;
+    if (state_store_put(&cs->state, key, value) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Out of memory restoring %s", key);
+    }
+}
+
+/* All or nothing: no entry is applied unless every one was logged */
+static int apply_batch(roj_consensus_t* cs, const roj_kv_t* entries, int count) {
+    for (int i = 0; i < count; i++) {
+        if (log_commit(cs, entries[i].key, entries[i].value) != 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        apply_logged(cs, entries[i].key, entries[i].value);
+    }
+    return 0;
+}
+
+static uint32_t find_proposal(roj_consensus_t* cs, const char* proposal_id) {
+    return proposal_table_find(&cs->proposals, proposal_id_from_str(proposal_id));
+}
+
+/* Register a new own proposal and collect our own accept */
+static roj_proposal_t* open_proposal(roj_consensus_t* cs) {
+    uint64_t id = proposal_id_make(cs->origin, ++cs->proposal_seq);
+    uint32_t slot = proposal_table_insert(&cs->proposals, id);
+    if (slot == ROJ_PROPOSAL_NONE) {
+        ROJ_LOG(ROJ_LOG_WARN, "No space for new proposal");
+        return NULL;
+    }
+
+    roj_proposal_t* p = proposal_cold(&cs->proposals, slot);
+    proposal_id_to_str(id, p->proposal_id);
     p->timestamp = (int64_t)time(NULL);
-    p->active = true;
+    p->own = true;
+    if (cs->metrics) {
+        metrics_inc(&cs->metrics->proposals_created, 1);
+        p->created_ns = metrics_now_ns();
+    }
+    arm_deadline(cs, slot, ROJ_VOTE_TIMEOUT_MS);
+    record_vote(cs, slot, cs->node_id, VOTE_ACCEPT);
+    return p;
+}
 
-    printf("[INFO] Consensus: Proposing %s=%lld (id=%s)\n",
-           key, (long long)value, p->proposal_id);
+static int propose_single(roj_consensus_t* cs, roj_sym_t key, int64_t value, roj_message_t* msg) {
+    roj_proposal_t* p = open_proposal(cs);
+    if (!p) {
+        return -1;
+    }
+    p->key = key;
+    p->value = value;
+    ROJ_HISTORY_PROPOSAL(ROJ_HISTORY_INVOKE, cs->origin, p);
+
+    ROJ_LOG(ROJ_LOG_INFO, "Consensus: Proposing %s=%lld (id=%s)",
+            symtab_str(p->key), (long long)value, p->proposal_id);
 
     /* Create PROPOSE message */
     memset(msg, 0, sizeof(*msg));
     msg->type = MSG_PROPOSE;
     strcpy(msg->data.propose.proposal_id, p->proposal_id);
-    strcpy(msg->data.propose.from, g_node_id);
-    strcpy(msg->data.propose.key, key);
+    msg->data.propose.from = cs->node_id;
+    msg->data.propose.key = p->key;
     msg->data.propose.value = value;
     msg->data.propose.timestamp = p->timestamp;
 
     return 0;
 }
 
-int consensus_handle_propose(const roj_message_t* propose, roj_message_t* vote) {
-    printf("[INFO] Consensus: Received PROPOSE %s=%lld from %s\n",
-           propose->data.propose.key,
-           (long long)propose->data.propose.value,
-           propose->data.propose.from);
+static int propose_batch(roj_consensus_t* cs, const roj_kv_t* entries, int count,
+                         roj_message_t* msg) {
+    roj_kv_t* batch = malloc((size_t)count * sizeof(*batch));
+    if (!batch) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Out of memory for proposal batch");
+        return -1;
+    }
+    roj_proposal_t* p = open_proposal(cs);
+    if (!p) {
+        free(batch);
+        return -1;
+    }
+    memcpy(batch, entries, (size_t)count * sizeof(*batch));
+    p->batch = batch;
+    p->batch_count = count;
+    ROJ_HISTORY_PROPOSAL(ROJ_HISTORY_INVOKE, cs->origin, p);
+
+    ROJ_LOG(ROJ_LOG_INFO, "Consensus: Proposing batch of %d updates (id=%s)",
+            count, p->proposal_id);
+
+    memset(msg, 0, sizeof(*msg));
+    msg->type = MSG_PROPOSE_BATCH;
+    strcpy(msg->data.propose_batch.proposal_id, p->proposal_id);
+    msg->data.propose_batch.from = cs->node_id;
+    msg->data.propose_batch.timestamp = p->timestamp;
+    msg->data.propose_batch.count = count;
+    msg->data.propose_batch.entries = p->batch;
+
+    return 0;
+}
+
+int consensus_create_proposal(roj_consensus_t* cs, const char* key, int64_t value,
+                              roj_message_t* msg) {
+    roj_sym_t sym = symtab_intern_str(key);
+
+    if (cs->batch_max <= 1) {
+        return propose_single(cs, sym, value, msg);
+    }
+
+    /* A later write to a key already queued just replaces its value */
+    for (int i = 0; i < cs->pending_count; i++) {
+        if (cs->pending[i].key == sym) {
+            cs->pending[i].value = value;
+            return 1;
+        }
+    }
+
+    if (cs->pending_count == ROJ_MAX_BATCH) {
+        ROJ_LOG(ROJ_LOG_WARN, "Proposal batch full, dropping %s", key);
+        return -1;
+    }
+
+    cs->pending[cs->pending_count].key = sym;
+    cs->pending[cs->pending_count].value = value;
+    cs->pending_count++;
+    return 1;
+}
+
+int consensus_flush_proposals(roj_consensus_t* cs, roj_message_t* msg, bool batch) {
+    int taken;
+    int rc;
+
+    if (cs->pending_count == 0) {
+        return -1;
+    }
 
-    /* Store proposal */
-    roj_proposal_t* p = alloc_proposal();
-    if (p) {
-        memset(p, 0, sizeof(*p));
-        strcpy(p->proposal_id, propose->data.propose.proposal_id);
-        strcpy(p->key, propose->data.propose.key);
-        p->value = propose->data.propose.value;
-        p->timestamp = propose->data.propose.timestamp;
-        p->active = true;
+    if (batch && cs->pending_count > 1) {
+        taken = cs->pending_count < cs->batch_max ? cs->pending_count : cs->batch_max;
+        rc = propose_batch(cs, cs->pending, taken, msg);
+    } else {
+        /* One update, or peers that only understand PROPOSE */
+        taken = 1;
+        rc = propose_single(cs, cs->pending[0].key, cs->pending[0].value, msg);
+    }
+
+    cs->pending_count -= taken;
+    memmove(cs->pending, cs->pending + taken, (size_t)cs->pending_count * sizeof(*cs->pending));
+    return rc == 0 ? 0 : 1;
+}
+
+/* Store a peer's proposal and vote on it; entries is NULL for PROPOSE */
+static void accept_proposal(roj_consensus_t* cs, const char* proposal_id, int64_t timestamp,
+                            roj_sym_t key, int64_t value,
+                            const roj_kv_t* entries, int count,
+                            roj_message_t* vote) {
+    /* Store proposal (a retransmitted PROPOSE keeps the existing entry) */
+    uint32_t slot = proposal_table_insert(&cs->proposals, proposal_id_from_str(proposal_id));
+    if (slot != ROJ_PROPOSAL_NONE) {
+        roj_proposal_t* p = proposal_cold(&cs->proposals, slot);
+        strcpy(p->proposal_id, proposal_id);
+        p->key = key;
+        p->value = value;
+        p->timestamp = timestamp;
+        if (entries) {
+            p->batch = malloc((size_t)count * sizeof(*entries));
+            if (p->batch) {
+                memcpy(p->batch, entries, (size_t)count * sizeof(*entries));
+                p->batch_count = count;
+            }
+        }
+        if (entries && !p->batch) {
+            /* Cannot apply it later: forget it rather than commit half */
+            ROJ_LOG(ROJ_LOG_ERROR, "Out of memory for proposal batch");
+            proposal_table_remove(&cs->proposals, slot);
+        } else {
+            arm_deadline(cs, slot, ROJ_PROPOSAL_TIMEOUT_MS);
+            record_vote(cs, slot, cs->node_id, VOTE_ACCEPT);
+        }
     }
 
     /* Always accept for demo */
-    printf("[INFO] Consensus: VOTE accept for %s (2/3 threshold)\n",
-           propose->data.propose.proposal_id);
+    ROJ_LOG(ROJ_LOG_INFO, "Consensus: VOTE accept for %s (2/3 threshold)", proposal_id);
 
     /* Create VOTE message */
     memset(vote, 0, sizeof(*vote));
     vote->type = MSG_VOTE;
-    strcpy(vote->data.vote.proposal_id, propose->data.propose.proposal_id);
-    strcpy(vote->data.vote.from, g_node_id);
+    strcpy(vote->data.vote.proposal_id, proposal_id);
+    vote->data.vote.from = cs->node_id;
     vote->data.vote.vote = VOTE_ACCEPT;
+}
+
+int consensus_handle_propose(roj_consensus_t* cs, const roj_message_t* propose,
+                             roj_message_t* vote) {
+    if (propose->type == MSG_PROPOSE_BATCH) {
+        ROJ_LOG(ROJ_LOG_INFO, "Consensus: Received PROPOSE_BATCH of %d updates from %s",
+                propose->data.propose_batch.count,
+                symtab_str(propose->data.propose_batch.from));
+
+        accept_proposal(cs, propose->data.propose_batch.proposal_id,
+                        propose->data.propose_batch.timestamp,
+                        ROJ_SYM_EMPTY, 0,
+                        propose->data.propose_batch.entries,
+                        propose->data.propose_batch.count, vote);
+        return 0;
+    }
 
+    ROJ_LOG(ROJ_LOG_INFO, "Consensus: Received PROPOSE %s=%lld from %s",
+            symtab_str(propose->data.propose.key),
+            (long long)propose->data.propose.value,
+            symtab_str(propose->data.propose.from));
+
+    accept_proposal(cs, propose->data.propose.proposal_id,
+                    propose->data.propose.timestamp,
+                    propose->data.propose.key, propose->data.propose.value,
+                    NULL, 0, vote);
     return 0;
 }
 
-int consensus_handle_vote(const roj_message_t* vote_msg, roj_message_t* commit,
-                          int peer_count) {
-    printf("[INFO] Consensus: Received VOTE %s from %s for %s\n",
-           vote_to_str(vote_msg->data.vote.vote),
-           vote_msg->data.vote.from,
-           vote_msg->data.vote.proposal_id);
-
-    roj_proposal_t* p = find_proposal(vote_msg->data.vote.proposal_id);
-    if (!p) {
+/* Count one vote; returns 0 with commit filled once the threshold is met */
+static int tally_vote(roj_consensus_t* cs, uint32_t slot, roj_sym_t from, roj_vote_t vote,
+                      roj_message_t* commit, int peer_count) {
+    /* A retransmitted VOTE must not count twice */
+    int recorded = record_vote(cs, slot, from, vote);
+    if (recorded != 0) {
+        if (recorded > 0) {
+            ROJ_LOG(ROJ_LOG_INFO, "Consensus: Ignoring duplicate VOTE from %s", symtab_str(from));
+        }
         return -1;
     }
 
-    /* Record vote */
-    if (p->vote_count < ROJ_MAX_VOTERS) {
-        strncpy(p->votes[p->vote_count].node_id, vote_msg->data.vote.from,
-                ROJ_NODE_ID_MAX - 1);
-        p->votes[p->vote_count].vote = vote_msg->data.vote.vote;
-        p->vote_count++;
-    }
-
-    /* Count accepts */
-    int accept_count = 0;
-    for (int i = 0; i < p->vote_count; i++) {
-        if (p->votes[i].vote == VOTE_ACCEPT) {
-            accept_count++;
-        }
+    roj_proposal_t* p = proposal_cold(&cs->proposals, slot);
+    uint64_t elapsed = 0;
+    if (cs->metrics && p->created_ns) {
+        elapsed = metrics_now_ns() - p->created_ns;
+        histogram_record(&cs->metrics->vote_rtt, elapsed);
     }
 
+    int accept_count = proposal_hot(&cs->proposals, slot)->accepts;
     int total = peer_count + 1;  /* Include ourselves */
     int threshold = (int)(total * ROJ_VOTE_THRESHOLD + 0.5);
 
-    printf("[INFO] Consensus: %d/%d votes (%d needed for threshold)\n",
-           accept_count, total, threshold);
+    ROJ_LOG(ROJ_LOG_INFO, "Consensus: %d/%d votes (%d needed for threshold)",
+            accept_count, total, threshold);
 
     if (accept_count >= threshold) {
-        /* Commit locally */
-        if (g_state_count < ROJ_MAX_STATE) {
-            /* Check if key exists */
-            int found = -1;
-            for (int i = 0; i < g_state_count; i++) {
-                if (strcmp(g_state[i].key, p->key) == 0) {
-                    found = i;
-                    break;
+        roj_sym_t* voters;
+        int* voter_count;
+
+        /* Commit locally, the whole batch in one step. What cannot be
+         * logged is not committed anywhere: no COMMIT goes out. */
+        if ((p->batch ? apply_batch(cs, p->batch, p->batch_count)
+                      : apply_commit(cs, p->key, p->value)) != 0) {
+            if (p->own) {
+                ROJ_HISTORY_PROPOSAL(ROJ_HISTORY_FAIL, cs->origin, p);
+                if (cs->on_outcome) {
+                    cs->on_outcome(proposal_hot(&cs->proposals, slot)->id, false,
+                                   cs->on_outcome_ctx);
                 }
             }
-            if (found >= 0) {
-                g_state[found].value = p->value;
-            } else {
-                strcpy(g_state[g_state_count].key, p->key);
-                g_state[g_state_count].value = p->value;
-                g_state_count++;
-            }
+            drop_proposal(cs, slot);
+            return -1;
         }
 
-        printf("[INFO] Consensus: COMMIT %s=%lld\n", p->key, (long long)p->value);
-
-        /* Create COMMIT message */
         memset(commit, 0, sizeof(*commit));
-        commit->type = MSG_COMMIT;
-        strcpy(commit->data.commit.proposal_id, p->proposal_id);
-        strcpy(commit->data.commit.key, p->key);
-        commit->data.commit.value = p->value;
-
-        /* Add voters */
-        commit->data.commit.voter_count = 0;
-        for (int i = 0; i < p->vote_count && commit->data.commit.voter_count < ROJ_MAX_VOTERS; i++) {
-            if (p->votes[i].vote == VOTE_ACCEPT) {
-                strcpy(commit->data.commit.voters[commit->data.commit.voter_count],
-                       p->votes[i].node_id);
-                commit->data.commit.voter_count++;
+        if (p->batch) {
+            ROJ_LOG(ROJ_LOG_INFO, "Consensus: COMMIT batch %s (%d updates)",
+                    p->proposal_id, p->batch_count);
+
+            commit->type = MSG_COMMIT_BATCH;
+            strcpy(commit->data.commit_batch.proposal_id, p->proposal_id);
+            commit->data.commit_batch.count = p->batch_count;
+            memcpy(cs->commit_entries, p->batch, (size_t)p->batch_count * sizeof(*p->batch));
+            commit->data.commit_batch.entries = cs->commit_entries;
+            voters = commit->data.commit_batch.voters;
+            voter_count = &commit->data.commit_batch.voter_count;
+        } else {
+            ROJ_LOG(ROJ_LOG_INFO, "Consensus: COMMIT %s=%lld",
+                    symtab_str(p->key), (long long)p->value);
+
+            /* Create COMMIT message */
+            commit->type = MSG_COMMIT;
+            strcpy(commit->data.commit.proposal_id, p->proposal_id);
+            commit->data.commit.key = p->key;
+            commit->data.commit.value = p->value;
+            voters = commit->data.commit.voters;
+            voter_count = &commit->data.commit.voter_count;
+        }
+
+        /* Add voters: walk the set bits of the accept bitset */
+        const roj_proposal_votes_t* pv = proposal_votes(&cs->proposals, slot);
+        *voter_count = 0;
+        for (int w = 0; w < ROJ_VOTER_WORDS; w++) {
+            uint64_t bits = pv->accepted[w];
+            while (bits && *voter_count < ROJ_MAX_VOTERS) {
+                int v = w * 64 + lowest_bit(bits);
+                bits &= bits - 1;
+                voters[(*voter_count)++] = cs->voter_syms[v];
+            }
+        }
+
+        if (cs->metrics && p->created_ns) {
+            metrics_inc(&cs->metrics->proposals_committed, 1);
+            histogram_record(&cs->metrics->commit_latency, elapsed);
+        }
+        if (p->own) {
+            ROJ_HISTORY_PROPOSAL(ROJ_HISTORY_OK, cs->origin, p);
+            if (cs->on_outcome) {
+                cs->on_outcome(proposal_hot(&cs->proposals, slot)->id, true,
+                               cs->on_outcome_ctx);
             }
         }
 
         /* Clear proposal */
-        p->active = false;
+        drop_proposal(cs, slot);
 
         return 0;  /* Have commit message */
     }
@@ -195,56 +627,145 @@ int consensus_handle_vote(const roj_message_t* vote_msg, roj_message_t* commit,
     return -1;  /* No commit yet */
 }
 
-void consensus_handle_commit(const roj_message_t* commit) {
-    printf("[INFO] Consensus: COMMIT %s=%lld (voters: ",
-           commit->data.commit.key, (long long)commit->data.commit.value);
+int consensus_handle_vote(roj_consensus_t* cs, const roj_message_t* vote_msg, roj_message_t* commit,
+                          int peer_count) {
+    ROJ_LOG(ROJ_LOG_INFO, "Consensus: Received VOTE %s from %s for %s",
+            vote_to_str(vote_msg->data.vote.vote),
+            symtab_str(vote_msg->data.vote.from),
+            vote_msg->data.vote.proposal_id);
 
-    for (int i = 0; i < commit->data.commit.voter_count; i++) {
-        printf("%s%s", i > 0 ? ", " : "", commit->data.commit.voters[i]);
+    uint32_t slot = find_proposal(cs, vote_msg->data.vote.proposal_id);
+    if (slot == ROJ_PROPOSAL_NONE) {
+        return -1;
     }
-    printf(")\n");
+    return tally_vote(cs, slot, vote_msg->data.vote.from, vote_msg->data.vote.vote,
+                      commit, peer_count);
+}
 
-    /* Apply to local state */
-    int found = -1;
-    for (int i = 0; i < g_state_count; i++) {
-        if (strcmp(g_state[i].key, commit->data.commit.key) == 0) {
-            found = i;
-            break;
+int consensus_handle_vote_agg(roj_consensus_t* cs, const roj_message_t* agg, int peer_count,
+                              roj_commit_fn on_commit, void* ctx) {
+    int commits = 0;
+
+    ROJ_LOG(ROJ_LOG_INFO, "Consensus: Received VOTE_AGG from %s (%d votes)",
+            symtab_str(agg->data.vote_agg.from), agg->data.vote_agg.count);
+
+    /* IDs are already binary: straight to the index, no string parsing */
+    for (int i = 0; i < agg->data.vote_agg.count; i++) {
+        uint32_t slot = proposal_table_find(&cs->proposals, agg->data.vote_agg.ids[i]);
+        if (slot == ROJ_PROPOSAL_NONE) {
+            continue;
+        }
+
+        roj_vote_t vote = (agg->data.vote_agg.accept_bits >> i) & 1 ? VOTE_ACCEPT
+                                                                      : VOTE_REJECT;
+        roj_message_t commit;
+        if (tally_vote(cs, slot, agg->data.vote_agg.from, vote, &commit, peer_count) == 0) {
+            on_commit(&commit, ctx);
+            commits++;
         }
     }
+    return commits;
+}
 
-    if (found >= 0) {
-        g_state[found].value = commit->data.commit.value;
-    } else if (g_state_count < ROJ_MAX_STATE) {
-        strcpy(g_state[g_state_count].key, commit->data.commit.key);
-        g_state[g_state_count].value = commit->data.commit.value;
-        g_state_count++;
+/* Voter names as "a, b, c" for a log line */
+static const char* join_voters(char* buf, size_t size, const roj_sym_t* voters, int count) {
+    size_t used = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < count && used < size; i++) {
+        int n = snprintf(buf + used, size - used, "%s%s", i > 0 ? ", " : "",
+                         symtab_str(voters[i]));
+        if (n < 0) {
+            break;
+        }
+        used += (size_t)n;
     }
+    return buf;
+}
 
-    /* Clear any matching proposal */
-    roj_proposal_t* p = find_proposal(commit->data.commit.proposal_id);
-    if (p) {
-        p->active = false;
+static void handle_commit_agg(roj_consensus_t* cs, const roj_message_t* agg) {
+    for (int i = 0; i < agg->data.commit_agg.count; i++) {
+        const roj_commit_item_t* item = &agg->data.commit_agg.items[i];
+        roj_sym_t voters[ROJ_MAX_VOTERS];
+        int voter_count = 0;
+
+        for (int v = 0; v < agg->data.commit_agg.voter_count; v++) {
+            if (item->voter_bits & (1u << v)) {
+                voters[voter_count++] = agg->data.commit_agg.voters[v];
+            }
+        }
+        if (roj_log_enabled(ROJ_LOG_INFO)) {
+            char names[VOTER_NAMES_SIZE];
+            roj_log_write(ROJ_LOG_INFO, "Consensus: COMMIT %s=%lld (voters: %s)",
+                          symtab_str(item->key), (long long)item->value,
+                          join_voters(names, sizeof(names), voters, voter_count));
+        }
+
+        apply_commit(cs, item->key, item->value);
+
+        uint32_t slot = proposal_table_find(&cs->proposals, item->id);
+        if (slot != ROJ_PROPOSAL_NONE) {
+            drop_proposal(cs, slot);
+        }
     }
 }
 
-int consensus_get_state(const char* key, int64_t* value) {
-    for (int i = 0; i < g_state_count; i++) {
-        if (strcmp(g_state[i].key, key) == 0) {
-            *value = g_state[i].value;
-            return 0;
+void consensus_handle_commit(roj_consensus_t* cs, const roj_message_t* commit) {
+    const char* proposal_id;
+
+    if (commit->type == MSG_COMMIT_AGG) {
+        handle_commit_agg(cs, commit);
+        return;
+    }
+
+    if (commit->type == MSG_COMMIT_BATCH) {
+        if (roj_log_enabled(ROJ_LOG_INFO)) {
+            char names[VOTER_NAMES_SIZE];
+            roj_log_write(ROJ_LOG_INFO, "Consensus: COMMIT batch %s (%d updates, voters: %s)",
+                          commit->data.commit_batch.proposal_id,
+                          commit->data.commit_batch.count,
+                          join_voters(names, sizeof(names), commit->data.commit_batch.voters,
+                                      commit->data.commit_batch.voter_count));
         }
+
+        /* Apply to local state */
+        apply_batch(cs, commit->data.commit_batch.entries, commit->data.commit_batch.count);
+        proposal_id = commit->data.commit_batch.proposal_id;
+    } else {
+        if (roj_log_enabled(ROJ_LOG_INFO)) {
+            char names[VOTER_NAMES_SIZE];
+            roj_log_write(ROJ_LOG_INFO, "Consensus: COMMIT %s=%lld (voters: %s)",
+                          symtab_str(commit->data.commit.key),
+                          (long long)commit->data.commit.value,
+                          join_voters(names, sizeof(names), commit->data.commit.voters,
+                                      commit->data.commit.voter_count));
+        }
+
+        /* Apply to local state */
+        apply_commit(cs, commit->data.commit.key, commit->data.commit.value);
+        proposal_id = commit->data.commit.proposal_id;
     }
-    return -1;
+
+    /* Clear any matching proposal */
+    uint32_t slot = find_proposal(cs, proposal_id);
+    if (slot != ROJ_PROPOSAL_NONE) {
+        drop_proposal(cs, slot);
+    }
+}
+
+int consensus_get_state(const roj_consensus_t* cs, const char* key, int64_t* value) {
+    return state_store_get(&cs->state, key, value);
 }
 
-void consensus_print_state(void) {
+static void print_entry(const char* key, int64_t value, void* ctx) {
+    (void)ctx;
+    printf("  %s = %lld\n", key, (long long)value);
+}
+
+void consensus_print_state(const roj_consensus_t* cs) {
     printf("Committed state:\n");
-    if (g_state_count == 0) {
+    if (state_store_count(&cs->state) == 0) {
         printf("  (empty)\n");
         return;
     }
-    for (int i = 0; i < g_state_count; i++) {
-        printf("  %s = %lld\n", g_state[i].key, (long long)g_state[i].value);
-    }
+    state_store_foreach(&cs->state, print_entry, NULL);
 }
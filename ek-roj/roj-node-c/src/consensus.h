@@ -8,30 +8,143 @@
 #define ROJ_CONSENSUS_H
 
 #include "types.h"
+#include "timer_wheel.h"
+#include "proposal_table.h"
+#include "state_store.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "metrics.h"
 
-#define ROJ_MAX_PROPOSALS 16
-#define ROJ_MAX_STATE     64
+/* Sees each key update as it is committed to local state */
+typedef void (*roj_apply_fn)(roj_sym_t key, int64_t value, void* ctx);
+
+/* Sees each own proposal resolve: committed, or expired short of its
+ * threshold (it then never commits anywhere) */
+typedef void (*roj_outcome_fn)(uint64_t id, bool committed, void* ctx);
+
+typedef struct {
+    roj_sym_t node_id;
+    roj_proposal_table_t proposals;
+    roj_state_store_t state;
+    uint16_t origin;
+    uint64_t proposal_seq;
+    roj_timer_wheel_t* wheel;
+    roj_wal_t* wal;                 /* commits are logged here, NULL = none */
+    roj_apply_fn on_apply;          /* sees every applied commit, NULL = none */
+    void* on_apply_ctx;
+    roj_outcome_fn on_outcome;      /* NULL = none */
+    void* on_outcome_ctx;
+    roj_metrics_t* metrics;         /* NULL = not recorded */
+
+    /* Voter slots: each node ID that votes gets a bit index in the
+     * per-proposal vote bitsets, looked up directly by its symbol handle.
+     * Slots no open proposal refers to are reclaimed once all are taken. */
+    uint16_t* sym_voter;            /* sym -> voter slot + 1, 0 = none */
+    uint32_t sym_voter_cap;
+    roj_sym_t voter_syms[ROJ_MAX_VOTER_SLOTS];  /* ROJ_SYM_EMPTY = free */
+    uint32_t voter_count;           /* slots handed out at least once */
+
+    /* Nagle-style batching: updates wait here until the batch fills or the
+     * caller's flush window closes, then go out as one proposal */
+    roj_kv_t pending[ROJ_MAX_BATCH];
+    int pending_count;
+    int batch_max;                  /* 1 = propose every update on its own */
+
+    /* Array of the last COMMIT_BATCH built: the proposal's own copy is
+     * freed with it before the commit goes out */
+    roj_kv_t commit_entries[ROJ_MAX_BATCH];
+} roj_consensus_t;
+
+/* Receives each COMMIT produced while unpacking an aggregated message */
+typedef void (*roj_commit_fn)(const roj_message_t* commit, void* ctx);
 
 /* Initialize consensus */
-int consensus_init(const char* node_id);
+int consensus_init(roj_consensus_t* cs, const char* node_id);
+
+/* Free proposals and committed state */
+void consensus_free(roj_consensus_t* cs);
+
+/* Log every commit to wal before applying it; one it refuses is dropped
+ * (NULL = keep committed state in memory only) */
+void consensus_set_wal(roj_consensus_t* cs, roj_wal_t* wal);
+
+/* Call fn for every commit applied from here on (not for WAL replay) */
+void consensus_set_apply_hook(roj_consensus_t* cs, roj_apply_fn fn, void* ctx);
+
+/* Call fn as each own proposal commits, or expires or cannot be logged */
+void consensus_set_outcome_hook(roj_consensus_t* cs, roj_outcome_fn fn, void* ctx);
+
+/* Count proposals and commits and time own proposals in m (NULL = off) */
+void consensus_set_metrics(roj_consensus_t* cs, roj_metrics_t* m);
+
+/* Use origin instead of the one folded from the node ID (harnesses that
+ * number every member) */
+void consensus_set_origin(roj_consensus_t* cs, uint16_t origin);
 
-/* Create a new proposal */
-int consensus_create_proposal(const char* key, int64_t value, roj_message_t* msg);
+/* Restart proposal sequence numbers from seed instead of the wall clock,
+ * for reproducible runs */
+void consensus_seed(roj_consensus_t* cs, uint64_t seed);
 
-/* Handle incoming PROPOSE, returns VOTE message */
-int consensus_handle_propose(const roj_message_t* propose, roj_message_t* vote);
+/* Attach the timer wheel that owns proposal deadlines (NULL = no expiry) */
+void consensus_set_timer_wheel(roj_consensus_t* cs, roj_timer_wheel_t* wheel);
+
+/* Queue up to max_batch updates per proposal (1, the default, disables) */
+void consensus_set_batching(roj_consensus_t* cs, int max_batch);
+
+/* Create a new proposal. Returns 0 with msg filled, or with batching on
+ * 1 when the update was queued for consensus_flush_proposals, -1 on error. */
+int consensus_create_proposal(roj_consensus_t* cs, const char* key, int64_t value,
+                              roj_message_t* msg);
+
+/* True once max_batch updates are queued */
+int consensus_batch_full(const roj_consensus_t* cs);
+
+/* Turn queued updates into the next proposal: one PROPOSE_BATCH when batch
+ * is true (every peer supports it), otherwise one PROPOSE per update.
+ * Returns 0 with msg filled, 1 if the updates could not be proposed and
+ * were dropped, -1 once nothing is queued. */
+int consensus_flush_proposals(roj_consensus_t* cs, roj_message_t* msg, bool batch);
+
+/* Handle incoming PROPOSE or PROPOSE_BATCH, returns VOTE message */
+int consensus_handle_propose(roj_consensus_t* cs, const roj_message_t* propose,
+                             roj_message_t* vote);
 
 /* Handle incoming VOTE, returns COMMIT message if threshold reached */
-int consensus_handle_vote(const roj_message_t* vote, roj_message_t* commit,
+int consensus_handle_vote(roj_consensus_t* cs, const roj_message_t* vote, roj_message_t* commit,
                           int peer_count);
 
-/* Handle incoming COMMIT */
-void consensus_handle_commit(const roj_message_t* commit);
+/* Handle incoming VOTE_AGG, calls on_commit for every proposal it completes.
+ * Returns the number of commits. */
+int consensus_handle_vote_agg(roj_consensus_t* cs, const roj_message_t* agg, int peer_count,
+                              roj_commit_fn on_commit, void* ctx);
+
+/* Handle incoming COMMIT, COMMIT_BATCH or COMMIT_AGG */
+void consensus_handle_commit(roj_consensus_t* cs, const roj_message_t* commit);
+
+/* Serve committed state from the snapshot in dir, if any (0 mapped,
+ * 1 none, -1 unusable); call before replaying the WAL */
+int consensus_load_snapshot(roj_consensus_t* cs, roj_snapshot_t* snap, const char* dir);
+
+/* Start writing a snapshot of committed state in the background
+ * (0 started, 1 one is already running, -1 error) */
+int consensus_snapshot(roj_consensus_t* cs, roj_snapshot_t* snap, const char* dir);
+
+/* A fresh ID from this node's proposal ID space; leader mode names its log
+ * entries with these */
+uint64_t consensus_next_id(roj_consensus_t* cs);
+
+/* Apply a value committed by the replicated log (leader mode); -1 if the
+ * WAL refused it, in which case it is not applied */
+int consensus_apply(roj_consensus_t* cs, roj_sym_t key, int64_t value);
+
+/* Load one committed value without logging it (WAL replay callback,
+ * ctx is the roj_consensus_t) */
+void consensus_restore(const char* key, int64_t value, void* ctx);
 
 /* Get committed state value (returns 0 if found, -1 if not) */
-int consensus_get_state(const char* key, int64_t* value);
+int consensus_get_state(const roj_consensus_t* cs, const char* key, int64_t* value);
 
 /* Print current state */
-void consensus_print_state(void);
+void consensus_print_state(const roj_consensus_t* cs);
 
 #endif /* ROJ_CONSENSUS_H */
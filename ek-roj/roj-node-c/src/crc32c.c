@@ -0,0 +1,33 @@
+/*
+ * ROJ CRC-32C - Castagnoli checksum implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdbool.h>
+#include "crc32c.h"
+
+static uint32_t g_table[256];
+static bool g_ready = false;
+
+static void build_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+        }
+        g_table[i] = c;
+    }
+    g_ready = true;
+}
+
+uint32_t crc32c(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint32_t c = 0xFFFFFFFFu;
+
+    if (!g_ready) build_table();
+    while (len--) {
+        c = g_table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
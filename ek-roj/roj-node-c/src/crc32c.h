@@ -0,0 +1,16 @@
+/*
+ * ROJ CRC-32C - Castagnoli checksum for on-disk records
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_CRC32C_H
+#define ROJ_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-32C of len bytes (table-driven; the table is built on first use) */
+uint32_t crc32c(const void* data, size_t len);
+
+#endif /* ROJ_CRC32C_H */
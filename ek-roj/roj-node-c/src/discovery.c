@@ -9,63 +9,119 @@
 #include <string.h>
 #include <time.h>
 #include "discovery.h"
+#include "proposal_table.h"
+#include "symtab.h"
+#include "logger.h"
 
-static char g_node_id[ROJ_NODE_ID_MAX];
-static roj_lang_t g_lang;
-static roj_peer_list_t g_peers;
 
-int discovery_init(const char* node_id, roj_lang_t lang) {
-    strncpy(g_node_id, node_id, ROJ_NODE_ID_MAX - 1);
-    g_node_id[ROJ_NODE_ID_MAX - 1] = '\0';
-    g_lang = lang;
+static roj_wire_t negotiate_wire(const roj_discovery_t* d, uint32_t peer_caps) {
+    /* Binary only when both sides speak it; Rust/Go peers stay on JSON */
+    if ((d->caps & ROJ_CAP_WIRE_BIN) && (peer_caps & ROJ_CAP_WIRE_BIN)) {
+        return WIRE_BINARY;
+    }
+    return WIRE_JSON;
+}
 
-    memset(&g_peers, 0, sizeof(g_peers));
+static void on_peer_timeout(void* ctx, uint64_t index) {
+    roj_discovery_t* d = ctx;
+    roj_peer_t* peer = &d->peers.peers[index];
+
+    peer->active = false;
+    peer->liveness_timer = 0;
+    ROJ_LOG(ROJ_LOG_WARN, "Discovery: Peer \"%s\" timed out", symtab_str(peer->node_id));
+}
 
-    printf("[INFO] Discovery initialized for \"%s\" (%s)\n",
-           g_node_id, lang_to_str(g_lang));
+/* Push back the peer's liveness deadline; every ANNOUNCE counts as a heartbeat */
+static void touch_peer(roj_discovery_t* d, int index) {
+    roj_peer_t* peer = &d->peers.peers[index];
+
+    peer->last_seen = time(NULL);
+    if (d->wheel) {
+        timer_wheel_cancel(d->wheel, peer->liveness_timer);
+        peer->liveness_timer = timer_wheel_add(d->wheel, ROJ_PEER_TIMEOUT_MS,
+                                               on_peer_timeout, d, (uint64_t)index);
+    }
+}
+
+int discovery_init(roj_discovery_t* d, const char* node_id, roj_lang_t lang) {
+    d->node_id = symtab_intern_str(node_id);
+    d->lang = lang;
+    d->caps = ROJ_CAP_CONSENSUS | ROJ_CAP_WIRE_BIN | ROJ_CAP_BATCH | ROJ_CAP_AGG;
+    d->wheel = NULL;
+
+    memset(&d->peers, 0, sizeof(d->peers));
+
+    ROJ_LOG(ROJ_LOG_INFO, "Discovery initialized for \"%s\" (%s)",
+            symtab_str(d->node_id), lang_to_str(d->lang));
 
     return 0;
 }
 
-void discovery_shutdown(void) {
-    memset(&g_peers, 0, sizeof(g_peers));
+void discovery_shutdown(roj_discovery_t* d) {
+    memset(&d->peers, 0, sizeof(d->peers));
 }
 
-roj_peer_list_t* discovery_get_peers(void) {
-    return &g_peers;
+void discovery_set_timer_wheel(roj_discovery_t* d, roj_timer_wheel_t* wheel) {
+    d->wheel = wheel;
 }
 
-void discovery_update_peer(const char* node_id, roj_lang_t lang,
-                          const struct sockaddr_in* addr, const char* version) {
+void discovery_set_capabilities(roj_discovery_t* d, uint32_t caps) {
+    d->caps = caps;
+}
+
+void discovery_build_announce(const roj_discovery_t* d, roj_message_t* msg) {
+    memset(msg, 0, sizeof(*msg));
+    msg->type = MSG_ANNOUNCE;
+    msg->data.announce.node_id = d->node_id;
+    msg->data.announce.lang = d->lang;
+    msg->data.announce.caps = d->caps;
+    strcpy(msg->data.announce.version, ROJ_VERSION);
+}
+
+roj_peer_list_t* discovery_get_peers(roj_discovery_t* d) {
+    return &d->peers;
+}
+
+int discovery_update_peer(roj_discovery_t* d, roj_sym_t node_id, roj_lang_t lang,
+                          const struct sockaddr_in* addr, const char* version,
+                          uint32_t caps) {
     /* Don't add ourselves */
-    if (strcmp(node_id, g_node_id) == 0) {
-        return;
+    if (node_id == d->node_id) {
+        return 0;
     }
 
     /* Check if peer already exists */
-    for (int i = 0; i < g_peers.count; i++) {
-        if (strcmp(g_peers.peers[i].node_id, node_id) == 0) {
+    for (int i = 0; i < d->peers.count; i++) {
+        if (d->peers.peers[i].node_id == node_id) {
             /* Update existing peer */
-            g_peers.peers[i].lang = lang;
-            g_peers.peers[i].addr = *addr;
-            g_peers.peers[i].last_seen = time(NULL);
+            d->peers.peers[i].lang = lang;
+            d->peers.peers[i].addr = *addr;
+            d->peers.peers[i].caps = caps;
+            touch_peer(d, i);
             if (version) {
-                strncpy(g_peers.peers[i].version, version, 15);
+                strncpy(d->peers.peers[i].version, version, 15);
             }
-            return;
+            if (!d->peers.peers[i].active) {
+                /* Back from a timeout: answer like a new peer */
+                d->peers.peers[i].active = true;
+                ROJ_LOG(ROJ_LOG_INFO, "Discovery: Peer \"%s\" is back", symtab_str(node_id));
+                return 1;
+            }
+            return 0;
         }
     }
 
     /* Add new peer */
-    if (g_peers.count < ROJ_MAX_PEERS) {
-        roj_peer_t* peer = &g_peers.peers[g_peers.count];
+    if (d->peers.count < ROJ_MAX_PEERS) {
+        roj_peer_t* peer = &d->peers.peers[d->peers.count];
 
-        strncpy(peer->node_id, node_id, ROJ_NODE_ID_MAX - 1);
-        peer->node_id[ROJ_NODE_ID_MAX - 1] = '\0';
+        peer->node_id = node_id;
         peer->lang = lang;
         peer->addr = *addr;
-        peer->last_seen = time(NULL);
+        peer->caps = caps;
         peer->active = true;
+        peer->liveness_timer = 0;
+        touch_peer(d, d->peers.count);
 
         if (version) {
             strncpy(peer->version, version, 15);
@@ -74,26 +130,103 @@ void discovery_update_peer(const char* node_id, roj_lang_t lang,
             strcpy(peer->version, ROJ_VERSION);
         }
 
-        g_peers.count++;
+        d->peers.count++;
 
         char addr_str[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &addr->sin_addr, addr_str, sizeof(addr_str));
 
-        printf("[INFO] mDNS: Discovered \"%s\" (%s) at %s:%d\n",
-               node_id, lang_to_str(lang), addr_str, ntohs(addr->sin_port));
+        ROJ_LOG(ROJ_LOG_INFO, "mDNS: Discovered \"%s\" (%s) at %s:%d [%s]",
+                symtab_str(node_id), lang_to_str(lang), addr_str, ntohs(addr->sin_port),
+                negotiate_wire(d, caps) == WIRE_BINARY ? "binary" : "json");
+        return 1;
     }
+    return 0;
 }
 
-int discovery_peer_count(void) {
-    return g_peers.count;
+roj_sym_t discovery_origin_clash(const roj_discovery_t* d, roj_sym_t node_id) {
+    if (node_id == d->node_id) {
+        return ROJ_SYM_EMPTY;
+    }
+    for (int i = 0; i < d->peers.count; i++) {
+        if (d->peers.peers[i].node_id == node_id) {
+            return ROJ_SYM_EMPTY;     /* checked when it was added */
+        }
+    }
+
+    uint16_t origin = proposal_origin_of(symtab_str(node_id));
+    if (proposal_origin_of(symtab_str(d->node_id)) == origin) {
+        return d->node_id;
+    }
+    for (int i = 0; i < d->peers.count; i++) {
+        if (proposal_origin_of(symtab_str(d->peers.peers[i].node_id)) == origin) {
+            return d->peers.peers[i].node_id;
+        }
+    }
+    return ROJ_SYM_EMPTY;
 }
 
-int discovery_get_peer_addrs(struct sockaddr_in* addrs, int max_addrs) {
+int discovery_peer_count(const roj_discovery_t* d) {
     int count = 0;
-    for (int i = 0; i < g_peers.count && count < max_addrs; i++) {
-        if (g_peers.peers[i].active) {
-            addrs[count++] = g_peers.peers[i].addr;
+    for (int i = 0; i < d->peers.count; i++) {
+        if (d->peers.peers[i].active) {
+            count++;
         }
     }
     return count;
 }
+
+bool discovery_peers_support(const roj_discovery_t* d, uint32_t caps) {
+    for (int i = 0; i < d->peers.count; i++) {
+        if (d->peers.peers[i].active && (d->peers.peers[i].caps & caps) != caps) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int discovery_get_peer_addrs(const roj_discovery_t* d, struct sockaddr_in* addrs,
+                             int max_addrs) {
+    int count = 0;
+    for (int i = 0; i < d->peers.count && count < max_addrs; i++) {
+        if (d->peers.peers[i].active) {
+            addrs[count++] = d->peers.peers[i].addr;
+        }
+    }
+    return count;
+}
+
+int discovery_get_peer_targets(const roj_discovery_t* d, struct sockaddr_in* addrs,
+                               roj_wire_t* wires, int max_addrs) {
+    int count = 0;
+    for (int i = 0; i < d->peers.count && count < max_addrs; i++) {
+        if (d->peers.peers[i].active) {
+            addrs[count] = d->peers.peers[i].addr;
+            wires[count] = negotiate_wire(d, d->peers.peers[i].caps);
+            count++;
+        }
+    }
+    return count;
+}
+
+static const roj_peer_t* find_peer_by_addr(const roj_discovery_t* d,
+                                           const struct sockaddr_in* addr) {
+    for (int i = 0; i < d->peers.count; i++) {
+        const roj_peer_t* peer = &d->peers.peers[i];
+        if (peer->active &&
+            peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            peer->addr.sin_port == addr->sin_port) {
+            return peer;
+        }
+    }
+    return NULL;
+}
+
+roj_wire_t discovery_wire_for_addr(const roj_discovery_t* d, const struct sockaddr_in* addr) {
+    const roj_peer_t* peer = find_peer_by_addr(d, addr);
+    return peer ? negotiate_wire(d, peer->caps) : WIRE_JSON;
+}
+
+uint32_t discovery_caps_for_addr(const roj_discovery_t* d, const struct sockaddr_in* addr) {
+    const roj_peer_t* peer = find_peer_by_addr(d, addr);
+    return peer ? peer->caps : 0;
+}
@@ -11,24 +11,61 @@
 #define ROJ_DISCOVERY_H
 
 #include "types.h"
+#include "timer_wheel.h"
+
+typedef struct {
+    roj_sym_t node_id;
+    roj_lang_t lang;
+    roj_peer_list_t peers;
+    uint32_t caps;              /* advertised in our ANNOUNCE */
+    roj_timer_wheel_t* wheel;
+} roj_discovery_t;
 
 /* Initialize discovery subsystem */
-int discovery_init(const char* node_id, roj_lang_t lang);
+int discovery_init(roj_discovery_t* d, const char* node_id, roj_lang_t lang);
 
 /* Shutdown discovery */
-void discovery_shutdown(void);
+void discovery_shutdown(roj_discovery_t* d);
+
+/* Attach the timer wheel that owns peer liveness deadlines (NULL = none) */
+void discovery_set_timer_wheel(roj_discovery_t* d, roj_timer_wheel_t* wheel);
 
 /* Get peer list */
-roj_peer_list_t* discovery_get_peers(void);
+roj_peer_list_t* discovery_get_peers(roj_discovery_t* d);
+
+/* Set capabilities advertised by this node (default: consensus + binary wire + batch + agg) */
+void discovery_set_capabilities(roj_discovery_t* d, uint32_t caps);
+
+/* Build this node's ANNOUNCE message */
+void discovery_build_announce(const roj_discovery_t* d, roj_message_t* msg);
+
+/* Add/update a peer from an ANNOUNCE message, returns 1 if the peer is new */
+int discovery_update_peer(roj_discovery_t* d, roj_sym_t node_id, roj_lang_t lang,
+                          const struct sockaddr_in* addr, const char* version,
+                          uint32_t caps);
 
-/* Add/update a peer from an ANNOUNCE message */
-void discovery_update_peer(const char* node_id, roj_lang_t lang,
-                          const struct sockaddr_in* addr, const char* version);
+/* For a node ID not yet among the peers: the node (this one or a peer)
+ * whose proposal origin it shares, else ROJ_SYM_EMPTY */
+roj_sym_t discovery_origin_clash(const roj_discovery_t* d, roj_sym_t node_id);
 
-/* Get peer count */
-int discovery_peer_count(void);
+/* Get active peer count */
+int discovery_peer_count(const roj_discovery_t* d);
+
+/* True if every active peer advertises all bits of caps */
+bool discovery_peers_support(const roj_discovery_t* d, uint32_t caps);
 
 /* Get addresses for broadcasting */
-int discovery_get_peer_addrs(struct sockaddr_in* addrs, int max_addrs);
+int discovery_get_peer_addrs(const roj_discovery_t* d, struct sockaddr_in* addrs,
+                             int max_addrs);
+
+/* Get addresses plus the negotiated wire encoding for each peer */
+int discovery_get_peer_targets(const roj_discovery_t* d, struct sockaddr_in* addrs,
+                               roj_wire_t* wires, int max_addrs);
+
+/* Negotiated wire encoding for a peer address (JSON if unknown) */
+roj_wire_t discovery_wire_for_addr(const roj_discovery_t* d, const struct sockaddr_in* addr);
+
+/* Capabilities advertised by a peer address (0 if unknown) */
+uint32_t discovery_caps_for_addr(const roj_discovery_t* d, const struct sockaddr_in* addr);
 
 #endif /* ROJ_DISCOVERY_H */
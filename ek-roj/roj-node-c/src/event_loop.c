@@ -0,0 +1,470 @@
+/*
+ * ROJ Event Loop - epoll/timerfd implementation with select() fallback
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include "event_loop.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#include <conio.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <unistd.h>
+#include <time.h>
+#include <sys/select.h>
+#endif
+
+#define EVLOOP_MAX_FDS     64
+#define EVLOOP_MAX_EVENTS  64
+#define EVLOOP_TIMER_TAG   0xFFFFFFFFu
+
+typedef struct {
+    int fd;
+    roj_io_cb cb;
+    void* ctx;
+    int active;
+} evloop_fd_t;
+
+typedef struct {
+    uint64_t deadline;
+    uint64_t period;
+    roj_timer_cb cb;
+    void* ctx;
+    int heap_pos;   /* -1 when not queued */
+    int in_use;
+} evloop_timer_t;
+
+struct roj_evloop {
+    evloop_fd_t fds[EVLOOP_MAX_FDS];
+    int fd_count;
+
+    evloop_timer_t* timers;
+    int* heap;              /* timer slots ordered by deadline */
+    int timer_cap;
+    int heap_size;
+
+    volatile sig_atomic_t stop;
+    roj_evloop_stats_t stats;
+    roj_clock_ms_fn clock;
+    int manual;             /* caller-driven clock: no fds, never sleeps */
+
+#ifdef __linux__
+    int epfd;
+    int timerfd;
+    uint64_t armed;         /* deadline the timerfd is armed for */
+#endif
+};
+
+uint64_t evloop_now_ms(void) {
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+#endif
+}
+
+/* Timer heap */
+
+static void heap_swap(roj_evloop_t* loop, int a, int b) {
+    int t = loop->heap[a];
+    loop->heap[a] = loop->heap[b];
+    loop->heap[b] = t;
+    loop->timers[loop->heap[a]].heap_pos = a;
+    loop->timers[loop->heap[b]].heap_pos = b;
+}
+
+static uint64_t heap_deadline(const roj_evloop_t* loop, int pos) {
+    return loop->timers[loop->heap[pos]].deadline;
+}
+
+static void heap_up(roj_evloop_t* loop, int pos) {
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (heap_deadline(loop, parent) <= heap_deadline(loop, pos)) break;
+        heap_swap(loop, pos, parent);
+        pos = parent;
+    }
+}
+
+static void heap_down(roj_evloop_t* loop, int pos) {
+    for (;;) {
+        int l = pos * 2 + 1, r = l + 1, min = pos;
+        if (l < loop->heap_size && heap_deadline(loop, l) < heap_deadline(loop, min)) min = l;
+        if (r < loop->heap_size && heap_deadline(loop, r) < heap_deadline(loop, min)) min = r;
+        if (min == pos) break;
+        heap_swap(loop, pos, min);
+        pos = min;
+    }
+}
+
+static void heap_push(roj_evloop_t* loop, int slot) {
+    int pos = loop->heap_size++;
+    loop->heap[pos] = slot;
+    loop->timers[slot].heap_pos = pos;
+    heap_up(loop, pos);
+}
+
+static void heap_remove(roj_evloop_t* loop, int slot) {
+    int pos = loop->timers[slot].heap_pos;
+    if (pos < 0) return;
+
+    loop->timers[slot].heap_pos = -1;
+    loop->heap_size--;
+    if (pos != loop->heap_size) {
+        loop->heap[pos] = loop->heap[loop->heap_size];
+        loop->timers[loop->heap[pos]].heap_pos = pos;
+        heap_up(loop, pos);
+        heap_down(loop, loop->timers[loop->heap[pos]].heap_pos);
+    }
+}
+
+/* Point the kernel timer at the earliest deadline (or disarm it) */
+static void rearm(roj_evloop_t* loop) {
+#ifdef __linux__
+    if (loop->manual) return;
+
+    uint64_t next = loop->heap_size > 0 ? loop->timers[loop->heap[0]].deadline : 0;
+    if (next == loop->armed) return;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (next > 0) {
+        /* Absolute CLOCK_MONOTONIC; a zero value would disarm */
+        its.it_value.tv_sec = (time_t)(next / 1000u);
+        its.it_value.tv_nsec = (long)(next % 1000u) * 1000000L;
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    loop->armed = next;
+#endif
+}
+
+static void run_timers(roj_evloop_t* loop) {
+    uint64_t now = loop->clock();
+
+    while (loop->heap_size > 0 && loop->timers[loop->heap[0]].deadline <= now) {
+        int slot = loop->heap[0];
+        evloop_timer_t* t = &loop->timers[slot];
+        heap_remove(loop, slot);
+
+        /* Requeue periodic timers before the callback so it may cancel them */
+        if (t->period > 0) {
+            t->deadline += t->period;
+            if (t->deadline <= now) {
+                t->deadline = now + t->period;
+            }
+            heap_push(loop, slot);
+        } else {
+            t->in_use = 0;
+        }
+
+        loop->stats.timer_fires++;
+        t->cb(t->ctx);
+    }
+
+    rearm(loop);
+}
+
+roj_evloop_t* evloop_new(void) {
+    roj_evloop_t* loop = calloc(1, sizeof(*loop));
+    if (!loop) {
+        fprintf(stderr, "[ERROR] Failed to allocate event loop\n");
+        return NULL;
+    }
+    loop->clock = evloop_now_ms;
+
+#ifdef __linux__
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        fprintf(stderr, "[ERROR] epoll_create1 failed\n");
+        free(loop);
+        return NULL;
+    }
+
+    loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (loop->timerfd < 0) {
+        fprintf(stderr, "[ERROR] timerfd_create failed\n");
+        close(loop->epfd);
+        free(loop);
+        return NULL;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = EVLOOP_TIMER_TAG;
+    epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timerfd, &ev);
+#endif
+
+    return loop;
+}
+
+roj_evloop_t* evloop_new_manual(roj_clock_ms_fn clock) {
+    roj_evloop_t* loop = calloc(1, sizeof(*loop));
+    if (!loop) {
+        fprintf(stderr, "[ERROR] Failed to allocate event loop\n");
+        return NULL;
+    }
+    loop->clock = clock;
+    loop->manual = 1;
+    return loop;
+}
+
+void evloop_free(roj_evloop_t* loop) {
+    if (!loop) return;
+#ifdef __linux__
+    if (!loop->manual) {
+        close(loop->timerfd);
+        close(loop->epfd);
+    }
+#endif
+    free(loop->timers);
+    free(loop->heap);
+    free(loop);
+}
+
+int evloop_get_fd(const roj_evloop_t* loop) {
+#ifdef __linux__
+    return loop->manual ? -1 : loop->epfd;
+#else
+    (void)loop;
+    return -1;
+#endif
+}
+
+int evloop_add_fd(roj_evloop_t* loop, int fd, roj_io_cb cb, void* ctx) {
+    int slot = -1;
+    if (loop->manual) return -1;
+
+    for (int i = 0; i < loop->fd_count; i++) {
+        if (!loop->fds[i].active) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        if (loop->fd_count >= EVLOOP_MAX_FDS) return -1;
+        slot = loop->fd_count++;
+    }
+
+#ifdef __linux__
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)slot;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        return -1;
+    }
+#endif
+
+    loop->fds[slot].fd = fd;
+    loop->fds[slot].cb = cb;
+    loop->fds[slot].ctx = ctx;
+    loop->fds[slot].active = 1;
+    return 0;
+}
+
+void evloop_remove_fd(roj_evloop_t* loop, int fd) {
+    for (int i = 0; i < loop->fd_count; i++) {
+        if (loop->fds[i].active && loop->fds[i].fd == fd) {
+#ifdef __linux__
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+            loop->fds[i].active = 0;
+            return;
+        }
+    }
+}
+
+int evloop_add_timer(roj_evloop_t* loop, uint64_t delay_ms, uint64_t period_ms,
+                     roj_timer_cb cb, void* ctx) {
+    int slot = -1;
+    for (int i = 0; i < loop->timer_cap; i++) {
+        if (!loop->timers[i].in_use) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot < 0) {
+        int cap = loop->timer_cap ? loop->timer_cap * 2 : 16;
+        evloop_timer_t* timers = realloc(loop->timers, (size_t)cap * sizeof(*timers));
+        if (!timers) return -1;
+        loop->timers = timers;
+        int* heap = realloc(loop->heap, (size_t)cap * sizeof(*heap));
+        if (!heap) return -1;
+        loop->heap = heap;
+        memset(&loop->timers[loop->timer_cap], 0,
+               (size_t)(cap - loop->timer_cap) * sizeof(*timers));
+        slot = loop->timer_cap;
+        loop->timer_cap = cap;
+    }
+
+    evloop_timer_t* t = &loop->timers[slot];
+    t->deadline = loop->clock() + delay_ms;
+    t->period = period_ms;
+    t->cb = cb;
+    t->ctx = ctx;
+    t->in_use = 1;
+    heap_push(loop, slot);
+    rearm(loop);
+
+    return slot + 1;
+}
+
+void evloop_cancel_timer(roj_evloop_t* loop, int timer_id) {
+    int slot = timer_id - 1;
+    if (slot < 0 || slot >= loop->timer_cap || !loop->timers[slot].in_use) return;
+
+    heap_remove(loop, slot);
+    loop->timers[slot].in_use = 0;
+    rearm(loop);
+}
+
+void evloop_stop(roj_evloop_t* loop) {
+    loop->stop = 1;
+}
+
+void evloop_get_stats(const roj_evloop_t* loop, roj_evloop_stats_t* stats) {
+    *stats = loop->stats;
+}
+
+uint64_t evloop_next_deadline(const roj_evloop_t* loop) {
+    return loop->heap_size > 0 ? heap_deadline(loop, 0) : UINT64_MAX;
+}
+
+/* Manual loops have nothing to wait for: fire what is due and return */
+static int run_manual(roj_evloop_t* loop) {
+    loop->stats.wakeups++;
+    run_timers(loop);
+    return 0;
+}
+
+static void dispatch_fd(roj_evloop_t* loop, int slot) {
+    if (slot < loop->fd_count && loop->fds[slot].active) {
+        loop->stats.io_events++;
+        loop->fds[slot].cb(loop->fds[slot].fd, loop->fds[slot].ctx);
+    }
+}
+
+#ifdef __linux__
+
+int evloop_run_once(roj_evloop_t* loop, int timeout_ms) {
+    struct epoll_event events[EVLOOP_MAX_EVENTS];
+
+    if (loop->manual) {
+        return run_manual(loop);
+    }
+
+    int n = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    loop->stats.wakeups++;
+
+    for (int i = 0; i < n && !loop->stop; i++) {
+        if (events[i].data.u32 == EVLOOP_TIMER_TAG) {
+            uint64_t expirations;
+            if (read(loop->timerfd, &expirations, sizeof(expirations)) < 0) {
+                /* EAGAIN: already consumed */
+            }
+            loop->armed = 0;
+            run_timers(loop);
+        } else {
+            dispatch_fd(loop, (int)events[i].data.u32);
+        }
+    }
+    return 0;
+}
+
+#else
+
+int evloop_run_once(roj_evloop_t* loop, int timeout_ms) {
+    fd_set readfds;
+    int maxfd = -1;
+    int watch_stdin = 0;
+    FD_ZERO(&readfds);
+
+    if (loop->manual) {
+        return run_manual(loop);
+    }
+
+    for (int i = 0; i < loop->fd_count; i++) {
+        if (!loop->fds[i].active) continue;
+#ifdef _WIN32
+        /* select() only accepts sockets on Windows; stdin is polled */
+        if (loop->fds[i].fd == 0) {
+            watch_stdin = 1;
+            continue;
+        }
+#endif
+        FD_SET(loop->fds[i].fd, &readfds);
+        if (loop->fds[i].fd > maxfd) maxfd = loop->fds[i].fd;
+    }
+
+    struct timeval tv, *tvp = NULL;
+    uint64_t wait_ms = timeout_ms < 0 ? UINT64_MAX : (uint64_t)timeout_ms;
+    if (loop->heap_size > 0) {
+        uint64_t now = loop->clock();
+        uint64_t next = heap_deadline(loop, 0);
+        uint64_t until = next > now ? next - now : 0;
+        if (until < wait_ms) wait_ms = until;
+    }
+    if (watch_stdin && wait_ms > 100) {
+        wait_ms = 100;
+    }
+    if (wait_ms != UINT64_MAX) {
+        tv.tv_sec = (long)(wait_ms / 1000u);
+        tv.tv_usec = (long)(wait_ms % 1000u) * 1000L;
+        tvp = &tv;
+    }
+
+    int ret = select(maxfd + 1, &readfds, NULL, NULL, tvp);
+    if (ret < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    loop->stats.wakeups++;
+
+    for (int i = 0; i < loop->fd_count && !loop->stop; i++) {
+        if (!loop->fds[i].active) continue;
+#ifdef _WIN32
+        if (loop->fds[i].fd == 0) {
+            if (_kbhit()) dispatch_fd(loop, i);
+            continue;
+        }
+#endif
+        if (FD_ISSET(loop->fds[i].fd, &readfds)) {
+            dispatch_fd(loop, i);
+        }
+    }
+
+    run_timers(loop);
+    return 0;
+}
+
+#endif
+
+int evloop_run(roj_evloop_t* loop) {
+    while (!loop->stop) {
+        if (evloop_run_once(loop, -1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * ROJ Event Loop - fd readiness callbacks and timers
+ *
+ * Linux uses epoll plus a single timerfd armed for the earliest deadline in
+ * a timer heap, so an idle node sleeps until the next socket event or timer.
+ * Other platforms fall back to select() with the same API.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_EVENT_LOOP_H
+#define ROJ_EVENT_LOOP_H
+
+#include <stdint.h>
+#include "timer_wheel.h"
+
+typedef void (*roj_io_cb)(int fd, void* ctx);
+typedef void (*roj_timer_cb)(void* ctx);
+
+typedef struct {
+    uint64_t wakeups;       /* returns from epoll_wait/select */
+    uint64_t io_events;     /* fd callbacks dispatched */
+    uint64_t timer_fires;   /* timer callbacks dispatched */
+} roj_evloop_stats_t;
+
+/* One loop with its own fds, timers and counters (opaque) */
+typedef struct roj_evloop roj_evloop_t;
+
+/* Create an event loop, NULL on error */
+roj_evloop_t* evloop_new(void);
+
+/* Create a loop on a caller-driven clock (e.g. a simulator's virtual
+ * time). It watches no fds and never sleeps: evloop_run_once() only fires
+ * the timers that are due at clock(). NULL on error. */
+roj_evloop_t* evloop_new_manual(roj_clock_ms_fn clock);
+
+/* Free the loop, dropping all registrations */
+void evloop_free(roj_evloop_t* loop);
+
+/* A descriptor that becomes readable when the loop has work, for nesting
+ * it in another poller (epoll fd on Linux, -1 elsewhere) */
+int evloop_get_fd(const roj_evloop_t* loop);
+
+/* Watch fd for readability */
+int evloop_add_fd(roj_evloop_t* loop, int fd, roj_io_cb cb, void* ctx);
+
+/* Stop watching fd */
+void evloop_remove_fd(roj_evloop_t* loop, int fd);
+
+/* Schedule cb after delay_ms, then every period_ms if non-zero.
+ * Returns a timer id (> 0) or -1. */
+int evloop_add_timer(roj_evloop_t* loop, uint64_t delay_ms, uint64_t period_ms,
+                     roj_timer_cb cb, void* ctx);
+
+/* Cancel a pending timer (safe from inside its own callback) */
+void evloop_cancel_timer(roj_evloop_t* loop, int timer_id);
+
+/* Dispatch events until evloop_stop() (async-signal-safe) is called */
+int evloop_run(roj_evloop_t* loop);
+void evloop_stop(roj_evloop_t* loop);
+
+/* Wait up to timeout_ms (-1 = until something happens) and dispatch one
+ * round of ready fds and due timers */
+int evloop_run_once(roj_evloop_t* loop, int timeout_ms);
+
+/* Deadline of the earliest pending timer on the loop's clock, UINT64_MAX
+ * if none */
+uint64_t evloop_next_deadline(const roj_evloop_t* loop);
+
+/* Monotonic clock in milliseconds */
+uint64_t evloop_now_ms(void);
+
+/* Get loop counters */
+void evloop_get_stats(const roj_evloop_t* loop, roj_evloop_stats_t* stats);
+
+#endif /* ROJ_EVENT_LOOP_H */
@@ -0,0 +1,285 @@
+/*
+ * ROJ History - per-thread event buffers and JSON/EDN export
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "history.h"
+#include "metrics.h"
+#include "logger.h"
+#include "symtab.h"
+#include "roj.h"
+
+/* One micro-op; the first entry of an event also carries its header */
+typedef struct {
+    uint64_t time_ns;
+    int64_t value;
+    uint32_t key;               /* Elle key: nodes free the symbol table before a dump */
+    uint32_t process;
+    uint8_t type;
+    uint8_t ops;                /* entries in this event on its first, else 0 */
+} history_entry_t;
+
+typedef struct {
+    history_entry_t* entries;
+    _Atomic size_t count;       /* published with release after each event */
+    _Atomic uint64_t dropped;   /* events */
+} history_buf_t;
+
+static _Atomic(history_buf_t*) g_bufs[ROJ_HISTORY_MAX_THREADS];
+static _Atomic int g_buf_count = 0;
+static _Atomic uint64_t g_unbuffered = 0;  /* events from threads past the limit */
+
+static _Thread_local history_buf_t* t_buf = NULL;
+static _Thread_local bool t_no_buf = false;
+
+static history_buf_t* claim_buf(void) {
+    int i = atomic_fetch_add_explicit(&g_buf_count, 1, memory_order_acq_rel);
+    if (i >= ROJ_HISTORY_MAX_THREADS) {
+        return NULL;
+    }
+
+    history_buf_t* b = calloc(1, sizeof(*b));
+    if (!b) {
+        return NULL;
+    }
+    b->entries = malloc(ROJ_HISTORY_EVENTS * sizeof(*b->entries));
+    if (!b->entries) {
+        free(b);
+        return NULL;
+    }
+    /* Touch every page now rather than on the commit path */
+    memset(b->entries, 0, ROJ_HISTORY_EVENTS * sizeof(*b->entries));
+    atomic_init(&b->count, 0);
+    atomic_init(&b->dropped, 0);
+    atomic_store_explicit(&g_bufs[i], b, memory_order_release);
+    return b;
+}
+
+static history_buf_t* thread_buf(void) {
+    if (!t_buf && !t_no_buf) {
+        t_buf = claim_buf();
+        if (!t_buf) {
+            t_no_buf = true;
+            fprintf(stderr, "[WARN] History: no buffer for this thread, its events are lost\n");
+        }
+    }
+    return t_buf;
+}
+
+void history_thread_init(void) {
+    (void)thread_buf();
+}
+
+/* Elle keys */
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3) do {                                      \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);       \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                            \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                            \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);       \
+    } while (0)
+
+/* SipHash-1-3 with a zero key over the bytes of s followed by 0xFF: what
+ * Rust's DefaultHasher::new() computes for a str, since str's Hash impl
+ * appends that terminator */
+static uint64_t rust_str_hash(const char* s) {
+    uint64_t v0 = 0x736f6d6570736575ULL;
+    uint64_t v1 = 0x646f72616e646f6dULL;
+    uint64_t v2 = 0x6c7967656e657261ULL;
+    uint64_t v3 = 0x7465646279746573ULL;
+    size_t len = strlen(s) + 1;
+    uint64_t m = 0;
+    int fill = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = i < len - 1 ? (uint8_t)s[i] : 0xFF;
+        m |= (uint64_t)byte << (8 * fill);
+        if (++fill == 8) {
+            v3 ^= m;
+            SIP_ROUND(v0, v1, v2, v3);
+            v0 ^= m;
+            m = 0;
+            fill = 0;
+        }
+    }
+
+    m |= (uint64_t)(len & 0xFF) << 56;
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+    v2 ^= 0xFF;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Elle keys are numbers: 31 bits of the key's hash, the same mapping as
+ * roj-core-rs key_to_numeric so C and Rust histories agree. Rust does not
+ * promise DefaultHasher's algorithm; if it changes, both sides must move
+ * to an explicit hash together. */
+static uint32_t elle_key(roj_sym_t key) {
+    return (uint32_t)(rust_str_hash(symtab_str(key)) & 0x7FFFFFFF);
+}
+
+void history_record(roj_history_type_t type, uint32_t process, const roj_kv_t* ops, int count) {
+    uint64_t now = metrics_now_ns();
+    history_buf_t* b = thread_buf();
+    if (!b) {
+        atomic_fetch_add_explicit(&g_unbuffered, 1, memory_order_relaxed);
+        return;
+    }
+
+    /* Only this thread writes count */
+    size_t n = atomic_load_explicit(&b->count, memory_order_relaxed);
+    if (count < 1 || count > ROJ_MAX_BATCH || n + (size_t)count > ROJ_HISTORY_EVENTS) {
+        atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        history_entry_t* e = &b->entries[n + (size_t)i];
+        e->time_ns = now;
+        e->value = ops[i].value;
+        e->key = elle_key(ops[i].key);
+        e->process = process;
+        e->type = (uint8_t)type;
+        e->ops = i == 0 ? (uint8_t)count : 0;
+    }
+    atomic_store_explicit(&b->count, n + (size_t)count, memory_order_release);
+}
+
+/* Export */
+
+static const char* g_type_names[] = { "invoke", "ok", "fail" };
+
+static int compare_events(const void* a, const void* b) {
+    const history_entry_t* x = *(const history_entry_t* const*)a;
+    const history_entry_t* y = *(const history_entry_t* const*)b;
+    if (x->time_ns != y->time_ns) {
+        return x->time_ns < y->time_ns ? -1 : 1;
+    }
+    /* Same tick: keep each thread's own order */
+    uintptr_t xa = (uintptr_t)x, ya = (uintptr_t)y;
+    return xa < ya ? -1 : xa > ya;
+}
+
+static void write_json(FILE* f, const history_entry_t* const* events, size_t count,
+                       uint64_t base) {
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < count; i++) {
+        const history_entry_t* e = events[i];
+        fprintf(f, "  {\"index\": %llu, \"type\": \"%s\", \"f\": \"txn\", \"process\": %u, "
+                "\"time\": %llu, \"value\": [",
+                (unsigned long long)i, g_type_names[e->type], (unsigned)e->process,
+                (unsigned long long)(e->time_ns - base));
+        for (int op = 0; op < e->ops; op++) {
+            fprintf(f, "%s[\"append\", %lld, %lld]", op ? ", " : "",
+                    (long long)e[op].key, (long long)e[op].value);
+        }
+        fprintf(f, "]}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "]\n");
+}
+
+static void write_edn(FILE* f, const history_entry_t* const* events, size_t count,
+                      uint64_t base) {
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < count; i++) {
+        const history_entry_t* e = events[i];
+        fprintf(f, "  {:index %llu, :type :%s, :f :txn, :process %u, :time %llu, :value [",
+                (unsigned long long)i, g_type_names[e->type], (unsigned)e->process,
+                (unsigned long long)(e->time_ns - base));
+        for (int op = 0; op < e->ops; op++) {
+            fprintf(f, "%s[:append %lld %lld]", op ? " " : "",
+                    (long long)e[op].key, (long long)e[op].value);
+        }
+        fprintf(f, "]}\n");
+    }
+    fprintf(f, "]\n");
+}
+
+int roj_history_dump(const char* path) {
+    int threads = atomic_load_explicit(&g_buf_count, memory_order_acquire);
+    if (threads > ROJ_HISTORY_MAX_THREADS) threads = ROJ_HISTORY_MAX_THREADS;
+
+    /* Snapshot each buffer's published prefix; recording may go on meanwhile */
+    size_t counts[ROJ_HISTORY_MAX_THREADS] = { 0 };
+    history_buf_t* bufs[ROJ_HISTORY_MAX_THREADS] = { NULL };
+    size_t total = 0;
+    for (int t = 0; t < threads; t++) {
+        bufs[t] = atomic_load_explicit(&g_bufs[t], memory_order_acquire);
+        if (bufs[t]) {
+            counts[t] = atomic_load_explicit(&bufs[t]->count, memory_order_acquire);
+            total += counts[t];
+        }
+    }
+
+    const history_entry_t** events = malloc((total ? total : 1) * sizeof(*events));
+    if (!events) {
+        fprintf(stderr, "[ERROR] History: out of memory exporting %zu entries\n", total);
+        return -1;
+    }
+
+    size_t count = 0;
+    uint64_t base = UINT64_MAX;
+    for (int t = 0; t < threads; t++) {
+        for (size_t i = 0; i < counts[t]; i += bufs[t]->entries[i].ops) {
+            const history_entry_t* e = &bufs[t]->entries[i];
+            events[count++] = e;
+            if (e->time_ns < base) {
+                base = e->time_ns;
+            }
+        }
+    }
+    qsort(events, count, sizeof(*events), compare_events);
+
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "[ERROR] History: cannot write %s\n", path);
+        free(events);
+        return -1;
+    }
+
+    size_t len = strlen(path);
+    if (len > 4 && strcmp(path + len - 4, ".edn") == 0) {
+        write_edn(f, events, count, base);
+    } else {
+        write_json(f, events, count, base);
+    }
+    free(events);
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "[ERROR] History: failed writing %s\n", path);
+        return -1;
+    }
+
+    uint64_t dropped = roj_history_dropped();
+    ROJ_LOG(ROJ_LOG_INFO, "History: %zu events written to %s", count, path);
+    if (dropped > 0) {
+        printf(" (%llu dropped: buffers full)", (unsigned long long)dropped);
+    }
+    printf("\n");
+    return 0;
+}
+
+uint64_t roj_history_dropped(void) {
+    uint64_t dropped = atomic_load_explicit(&g_unbuffered, memory_order_relaxed);
+    int threads = atomic_load_explicit(&g_buf_count, memory_order_acquire);
+    if (threads > ROJ_HISTORY_MAX_THREADS) threads = ROJ_HISTORY_MAX_THREADS;
+    for (int t = 0; t < threads; t++) {
+        history_buf_t* b = atomic_load_explicit(&g_bufs[t], memory_order_acquire);
+        if (b) {
+            dropped += atomic_load_explicit(&b->dropped, memory_order_relaxed);
+        }
+    }
+    return dropped;
+}
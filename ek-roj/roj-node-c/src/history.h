@@ -0,0 +1,70 @@
+/*
+ * ROJ History - Elle history recorder for own proposals
+ *
+ * Consensus records an invoke when it opens a proposal, ok when the
+ * proposal reaches its vote threshold and fail when it expires. Each key
+ * update is one Elle list-append micro-op, so a batched proposal is a
+ * transaction of several appends, and the process is the node's origin
+ * index. The output matches roj-core-rs history.rs, which roj-elle check
+ * and scripts/run-elle-tests.sh --check consume.
+ *
+ * Recording is a clock read and a few stores into the calling thread's own
+ * preallocated buffer: no lock, no allocation, no shared cache line. Event
+ * indexes are assigned at dump time, after merging every thread's buffer
+ * in timestamp order. A full buffer drops events and counts them.
+ *
+ * Everything here is compiled out unless the tree is configured with
+ * -DROJ_HISTORY=ON; the ROJ_HISTORY_* macros then expand to nothing and
+ * do not evaluate their arguments.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_HISTORY_H
+#define ROJ_HISTORY_H
+
+#include <stdint.h>
+#include "types.h"
+
+#ifndef ROJ_HISTORY_EVENTS
+#define ROJ_HISTORY_EVENTS       (1 << 18)  /* micro-op entries per thread */
+#endif
+#define ROJ_HISTORY_MAX_THREADS  64
+
+typedef enum {
+    ROJ_HISTORY_INVOKE = 0,
+    ROJ_HISTORY_OK,
+    ROJ_HISTORY_FAIL
+} roj_history_type_t;
+
+#ifdef ROJ_HISTORY
+
+/* Allocate and pre-fault the calling thread's buffer, so the first record
+ * does not pay for it (recording allocates on first use otherwise) */
+void history_thread_init(void);
+
+/* Record one event of process with count key updates as its value */
+void history_record(roj_history_type_t type, uint32_t process, const roj_kv_t* ops, int count);
+
+/* Record the event for a key/value or batched proposal */
+static inline void history_record_proposal(roj_history_type_t type, uint32_t process,
+                                           const roj_proposal_t* p) {
+    if (p->batch) {
+        history_record(type, process, p->batch, p->batch_count);
+    } else {
+        roj_kv_t single = { p->key, p->value };
+        history_record(type, process, &single, 1);
+    }
+}
+
+#define ROJ_HISTORY_THREAD_INIT()              history_thread_init()
+#define ROJ_HISTORY_PROPOSAL(type, process, p) history_record_proposal((type), (process), (p))
+
+#else
+
+#define ROJ_HISTORY_THREAD_INIT()              ((void)0)
+#define ROJ_HISTORY_PROPOSAL(type, process, p) ((void)0)
+
+#endif /* ROJ_HISTORY */
+
+#endif /* ROJ_HISTORY_H */
@@ -0,0 +1,142 @@
+/*
+ * ROJ JSON Arena - per-thread bump allocator behind cJSON's hooks
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "json_arena.h"
+#include "cJSON.h"
+
+#ifdef ROJ_THREADS
+#include <pthread.h>
+#define ARENA_LOCAL _Thread_local
+#else
+#define ARENA_LOCAL     /* one thread: a plain static will do */
+#endif
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+typedef struct {
+    char* base;
+    size_t cap;
+    size_t used;
+    size_t overflow;            /* bytes this scope took from the heap */
+    int depth;
+    uint64_t allocs;            /* bumps this scope, published at its end */
+} json_arena_t;
+
+static ARENA_LOCAL json_arena_t t_arena;
+
+static _Atomic bool g_installed = false;
+static _Atomic uint64_t g_arena_allocs = 0;
+static _Atomic uint64_t g_heap_allocs = 0;
+static _Atomic uint64_t g_heap_bytes = 0;
+static _Atomic uint64_t g_arena_grows = 0;
+
+#ifdef ROJ_THREADS
+static pthread_key_t g_arena_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+
+/* Thread exit: t_arena is gone by now, the key kept its block */
+static void release_arena(void* base) {
+    free(base);
+}
+
+static void make_key(void) {
+    pthread_key_create(&g_arena_key, release_arena);
+}
+#endif
+
+static void* arena_malloc(size_t size) {
+    json_arena_t* a = &t_arena;
+    if (a->depth > 0) {
+        size_t offset = (a->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+        if (offset + size <= a->cap) {
+            a->used = offset + size;
+            a->allocs++;
+            return a->base + offset;
+        }
+        a->overflow += size + ARENA_ALIGN;
+    }
+    atomic_fetch_add_explicit(&g_heap_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_heap_bytes, size, memory_order_relaxed);
+    return malloc(size);
+}
+
+static void arena_free(void* ptr) {
+    json_arena_t* a = &t_arena;
+    char* p = ptr;
+    if (a->base && p >= a->base && p < a->base + a->cap) {
+        return;     /* reclaimed when the scope ends */
+    }
+    free(ptr);
+}
+
+void json_arena_install(void) {
+    if (!atomic_exchange_explicit(&g_installed, true, memory_order_acq_rel)) {
+        cJSON_Hooks hooks = { arena_malloc, arena_free };
+        cJSON_InitHooks(&hooks);
+    }
+}
+
+/* Replace the block with one of at least need bytes; nothing in it is live */
+static void grow(json_arena_t* a, size_t need) {
+    size_t cap = a->cap ? a->cap : ROJ_JSON_ARENA_INITIAL;
+    while (cap < need && cap < ROJ_JSON_ARENA_MAX) {
+        cap *= 2;
+    }
+    if (cap > ROJ_JSON_ARENA_MAX) {
+        cap = ROJ_JSON_ARENA_MAX;
+    }
+    if (cap <= a->cap) {
+        return;
+    }
+
+    char* base = malloc(cap);
+    if (!base) {
+        return;     /* keep the old block; overflow keeps going to the heap */
+    }
+    free(a->base);
+    a->base = base;
+    a->cap = cap;
+    atomic_fetch_add_explicit(&g_arena_grows, 1, memory_order_relaxed);
+#ifdef ROJ_THREADS
+    pthread_once(&g_key_once, make_key);
+    pthread_setspecific(g_arena_key, base);
+#endif
+}
+
+void json_arena_begin(void) {
+    json_arena_t* a = &t_arena;
+    if (a->depth++ == 0 && !a->base) {
+        grow(a, ROJ_JSON_ARENA_INITIAL);
+    }
+}
+
+void json_arena_end(void) {
+    json_arena_t* a = &t_arena;
+    if (a->depth == 0 || --a->depth > 0) {
+        return;
+    }
+
+    if (a->allocs > 0) {
+        atomic_fetch_add_explicit(&g_arena_allocs, a->allocs, memory_order_relaxed);
+    }
+    if (a->overflow > 0) {
+        grow(a, a->used + a->overflow);
+    }
+    a->used = 0;
+    a->overflow = 0;
+    a->allocs = 0;
+}
+
+void json_arena_get_stats(roj_json_arena_stats_t* stats) {
+    stats->arena_allocs = atomic_load_explicit(&g_arena_allocs, memory_order_relaxed);
+    stats->heap_allocs = atomic_load_explicit(&g_heap_allocs, memory_order_relaxed);
+    stats->heap_bytes = atomic_load_explicit(&g_heap_bytes, memory_order_relaxed);
+    stats->arena_grows = atomic_load_explicit(&g_arena_grows, memory_order_relaxed);
+}
@@ -0,0 +1,46 @@
+/*
+ * ROJ JSON Arena - per-thread bump allocator behind cJSON's hooks
+ *
+ * Between json_arena_begin() and json_arena_end() every cJSON allocation
+ * on the calling thread is a pointer bump in that thread's arena, and
+ * cJSON's frees of arena memory do nothing. The outermost end rewinds the
+ * arena, so a cJSON tree or printed string must not outlive its scope.
+ * Scopes nest; message_to_json and message_from_json each open one.
+ *
+ * A scope that does not fit falls back to malloc for the rest, and its end
+ * grows the arena to the size that scope needed (up to ROJ_JSON_ARENA_MAX),
+ * so once the arena has seen the largest message, parsing and printing
+ * touch the heap no more. Allocations outside a scope, or before
+ * json_arena_install(), go to malloc/free as before.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_JSON_ARENA_H
+#define ROJ_JSON_ARENA_H
+
+#include <stdint.h>
+
+#define ROJ_JSON_ARENA_INITIAL  (16 * 1024)    /* first arena on a thread */
+#define ROJ_JSON_ARENA_MAX      (1024 * 1024)  /* arena growth stops here */
+
+/* Process-wide cJSON allocation counters */
+typedef struct {
+    uint64_t arena_allocs;      /* served by a pointer bump */
+    uint64_t heap_allocs;       /* went to malloc: outside a scope or overflow */
+    uint64_t heap_bytes;
+    uint64_t arena_grows;       /* arena reallocations (first one included) */
+} roj_json_arena_stats_t;
+
+/* Install the arena hooks into cJSON. Call before starting threads that use
+ * cJSON: libroj does so when it creates a node. Repeat calls do nothing. */
+void json_arena_install(void);
+
+/* Open and close an allocation scope on the calling thread */
+void json_arena_begin(void);
+void json_arena_end(void);
+
+/* Counters since start, summed over all threads */
+void json_arena_get_stats(roj_json_arena_stats_t* stats);
+
+#endif /* ROJ_JSON_ARENA_H */
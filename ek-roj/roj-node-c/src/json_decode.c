@@ -0,0 +1,845 @@
+/*
+ * ROJ JSON Decode - single-pass, allocation-free message decoder
+ *
+ * The document is scanned once. String fields are recorded as slices into
+ * the input buffer and copied into the message once the "type" field has
+ * selected the union member, so field order on the wire does not matter.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "json_decode.h"
+#include "payload.h"
+#include "proposal_table.h"
+#include "symtab.h"
+
+#define JSON_MAX_DEPTH 32
+
+typedef struct {
+    const char* p;
+    const char* end;
+} jscan_t;
+
+/* Raw string contents between the quotes */
+typedef struct {
+    const char* start;
+    size_t len;
+    bool escaped;
+} jslice_t;
+
+typedef enum {
+    F_TYPE = 0,
+    F_NODE_ID,
+    F_LANG,
+    F_VERSION,
+    F_PROPOSAL_ID,
+    F_FROM,
+    F_KEY,
+    F_VOTE,
+    F_CANDIDATE_ID,
+    F_VOTER_ID,
+    F_LEADER_ID,
+    F_FOLLOWER_ID,
+    F_STRING_COUNT
+} json_field_t;
+
+/* Unsigned counters of the leader-mode messages */
+typedef enum {
+    N_TERM = 0,
+    N_LAST_LOG_INDEX,
+    N_LAST_LOG_TERM,
+    N_PREV_LOG_INDEX,
+    N_PREV_LOG_TERM,
+    N_LEADER_COMMIT,
+    N_MATCH_INDEX,
+    N_LOG_COUNT
+} json_log_field_t;
+
+typedef struct {
+    jslice_t str[F_STRING_COUNT];
+    bool has_str[F_STRING_COUNT];
+    int64_t value;
+    int64_t timestamp;
+    bool has_value;
+    bool has_timestamp;
+    uint32_t caps;
+    jslice_t voters[ROJ_MAX_VOTERS];
+    int voter_count;
+    jslice_t entry_keys[ROJ_MAX_BATCH];
+    int64_t entry_values[ROJ_MAX_BATCH];
+    int entry_count;
+    jslice_t ids[ROJ_MAX_AGG];
+    int id_count;
+    int64_t vote_bits;
+    jslice_t item_ids[ROJ_MAX_AGG];
+    jslice_t item_keys[ROJ_MAX_AGG];
+    int64_t item_values[ROJ_MAX_AGG];
+    int64_t item_bits[ROJ_MAX_AGG];
+    int item_count;
+    int64_t log[N_LOG_COUNT];
+    int64_t entry_terms[ROJ_MAX_BATCH];
+    jslice_t entry_ids[ROJ_MAX_BATCH];      /* log entries; len 0 = no id */
+    uint8_t entry_ops[ROJ_MAX_BATCH];
+    int64_t entry_expects[ROJ_MAX_BATCH];
+    bool vote_granted;
+    bool success;
+    roj_intern_t intern;        /* what the sender may add to the symbol table */
+    bool unresolved;            /* a string could not become a symbol */
+} json_fields_t;
+
+static const char* const g_string_fields[F_STRING_COUNT] = {
+    "type", "node_id", "lang", "version", "proposal_id", "from", "key", "vote",
+    "candidate_id", "voter_id", "leader_id", "follower_id"
+};
+
+static const char* const g_log_fields[N_LOG_COUNT] = {
+    "term", "last_log_index", "last_log_term", "prev_log_index", "prev_log_term",
+    "leader_commit", "match_index"
+};
+
+static void skip_ws(jscan_t* s) {
+    while (s->p < s->end &&
+           (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r')) {
+        s->p++;
+    }
+}
+
+static bool expect(jscan_t* s, char c) {
+    skip_ws(s);
+    if (s->p < s->end && *s->p == c) {
+        s->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool peek(jscan_t* s, char c) {
+    skip_ws(s);
+    return s->p < s->end && *s->p == c;
+}
+
+static bool scan_string(jscan_t* s, jslice_t* out) {
+    if (!expect(s, '"')) return false;
+
+    out->start = s->p;
+    out->escaped = false;
+    while (s->p < s->end && *s->p != '"') {
+        if (*s->p == '\\') {
+            out->escaped = true;
+            s->p++;
+        }
+        s->p++;
+    }
+    if (s->p >= s->end) return false;
+
+    out->len = (size_t)(s->p - out->start);
+    s->p++;  /* closing quote */
+    return true;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static size_t put_utf8(char* out, size_t room, uint32_t cp) {
+    char tmp[4];
+    size_t n;
+    if (cp < 0x80) {
+        tmp[0] = (char)cp; n = 1;
+    } else if (cp < 0x800) {
+        tmp[0] = (char)(0xC0 | (cp >> 6));
+        tmp[1] = (char)(0x80 | (cp & 0x3F)); n = 2;
+    } else if (cp < 0x10000) {
+        tmp[0] = (char)(0xE0 | (cp >> 12));
+        tmp[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        tmp[2] = (char)(0x80 | (cp & 0x3F)); n = 3;
+    } else {
+        tmp[0] = (char)(0xF0 | (cp >> 18));
+        tmp[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        tmp[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        tmp[3] = (char)(0x80 | (cp & 0x3F)); n = 4;
+    }
+    if (n > room) return 0;
+    memcpy(out, tmp, n);
+    return n;
+}
+
+static uint32_t read_u16_escape(const char* p, const char* end) {
+    if (end - p < 4) return 0xFFFFFFFFu;
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = hex_digit(p[i]);
+        if (d < 0) return 0xFFFFFFFFu;
+        v = (v << 4) | (uint32_t)d;
+    }
+    return v;
+}
+
+/* Copy a slice into a fixed field, unescaping and truncating like strncpy */
+static void copy_slice(const jslice_t* sl, char* out, size_t out_size) {
+    size_t room = out_size - 1;
+
+    if (!sl->escaped) {
+        size_t n = sl->len < room ? sl->len : room;
+        memcpy(out, sl->start, n);
+        out[n] = '\0';
+        return;
+    }
+
+    const char* p = sl->start;
+    const char* end = sl->start + sl->len;
+    size_t o = 0;
+    while (p < end && o < room) {
+        if (*p != '\\') {
+            out[o++] = *p++;
+            continue;
+        }
+        p++;
+        if (p >= end) break;
+        switch (*p) {
+            case 'b': out[o++] = '\b'; p++; break;
+            case 'f': out[o++] = '\f'; p++; break;
+            case 'n': out[o++] = '\n'; p++; break;
+            case 'r': out[o++] = '\r'; p++; break;
+            case 't': out[o++] = '\t'; p++; break;
+            case 'u': {
+                uint32_t cp = read_u16_escape(p + 1, end);
+                p += 5;
+                if (cp == 0xFFFFFFFFu) break;
+                if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 &&
+                    p[0] == '\\' && p[1] == 'u') {
+                    uint32_t lo = read_u16_escape(p + 2, end);
+                    if (lo >= 0xDC00 && lo < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        p += 6;
+                    }
+                }
+                size_t n = put_utf8(out + o, room - o, cp);
+                if (n == 0) {
+                    room = o;  /* no space for the full sequence */
+                }
+                o += n;
+                break;
+            }
+            default: out[o++] = *p++; break;
+        }
+    }
+    out[o] = '\0';
+}
+
+static bool slice_eq(const jslice_t* sl, const char* lit) {
+    if (sl->escaped) {
+        char tmp[32];
+        copy_slice(sl, tmp, sizeof(tmp));
+        return strcmp(tmp, lit) == 0;
+    }
+    size_t n = strlen(lit);
+    return sl->len == n && memcmp(sl->start, lit, n) == 0;
+}
+
+static bool scan_number(jscan_t* s, int64_t* out) {
+    skip_ws(s);
+    const char* start = s->p;
+    bool neg = false;
+    uint64_t acc = 0;
+    bool overflow = false;
+
+    if (s->p < s->end && *s->p == '-') {
+        neg = true;
+        s->p++;
+    }
+    if (s->p >= s->end || *s->p < '0' || *s->p > '9') return false;
+
+    while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+        uint64_t d = (uint64_t)(*s->p - '0');
+        if (acc > (UINT64_MAX - d) / 10) overflow = true;
+        acc = acc * 10 + d;
+        s->p++;
+    }
+
+    bool fractional = s->p < s->end &&
+                      (*s->p == '.' || *s->p == 'e' || *s->p == 'E');
+    if (!fractional && !overflow && acc <= (uint64_t)INT64_MAX + (neg ? 1u : 0u)) {
+        *out = neg ? (int64_t)(0 - acc) : (int64_t)acc;
+        return true;
+    }
+
+    /* Rare path: fractions, exponents and out-of-range integers */
+    while (s->p < s->end &&
+           ((*s->p >= '0' && *s->p <= '9') || *s->p == '.' || *s->p == 'e' ||
+            *s->p == 'E' || *s->p == '+' || *s->p == '-')) {
+        s->p++;
+    }
+    char tmp[64];
+    size_t n = (size_t)(s->p - start);
+    if (n >= sizeof(tmp)) n = sizeof(tmp) - 1;
+    memcpy(tmp, start, n);
+    tmp[n] = '\0';
+    double d = strtod(tmp, NULL);
+    if (d >= 9.2233720368547758e18) *out = INT64_MAX;
+    else if (d <= -9.2233720368547758e18) *out = INT64_MIN;
+    else *out = (int64_t)d;
+    return true;
+}
+
+static bool skip_value(jscan_t* s, int depth);
+
+static bool skip_container(jscan_t* s, char close, bool object, int depth) {
+    if (depth > JSON_MAX_DEPTH) return false;
+    if (expect(s, close)) return true;
+    do {
+        if (object) {
+            jslice_t name;
+            if (!scan_string(s, &name) || !expect(s, ':')) return false;
+        }
+        if (!skip_value(s, depth + 1)) return false;
+    } while (expect(s, ','));
+    return expect(s, close);
+}
+
+static bool skip_value(jscan_t* s, int depth) {
+    skip_ws(s);
+    if (s->p >= s->end) return false;
+
+    switch (*s->p) {
+        case '"': {
+            jslice_t ignored;
+            return scan_string(s, &ignored);
+        }
+        case '{':
+            s->p++;
+            return skip_container(s, '}', true, depth);
+        case '[':
+            s->p++;
+            return skip_container(s, ']', false, depth);
+        case 't':
+            if (s->end - s->p >= 4 && memcmp(s->p, "true", 4) == 0) { s->p += 4; return true; }
+            return false;
+        case 'f':
+            if (s->end - s->p >= 5 && memcmp(s->p, "false", 5) == 0) { s->p += 5; return true; }
+            return false;
+        case 'n':
+            if (s->end - s->p >= 4 && memcmp(s->p, "null", 4) == 0) { s->p += 4; return true; }
+            return false;
+        default: {
+            int64_t ignored;
+            return scan_number(s, &ignored);
+        }
+    }
+}
+
+/* Parse "capabilities" or "voters"; non-string elements are skipped */
+static bool scan_string_array(jscan_t* s, json_fields_t* f, bool voters) {
+    if (!expect(s, '[')) return skip_value(s, 1);
+    if (expect(s, ']')) return true;
+
+    do {
+        if (!peek(s, '"')) {
+            if (!skip_value(s, 2)) return false;
+            continue;
+        }
+        jslice_t item;
+        if (!scan_string(s, &item)) return false;
+        if (voters) {
+            if (f->voter_count < ROJ_MAX_VOTERS) {
+                f->voters[f->voter_count++] = item;
+            }
+        } else {
+            char name[32];
+            copy_slice(&item, name, sizeof(name));
+            f->caps |= str_to_cap(name);
+        }
+    } while (expect(s, ','));
+
+    return expect(s, ']');
+}
+
+/* Parse one {"key":"k","value":1} element of "entries" (log entries also
+ * carry "index", "term", "id", "op" and "expect"; the index is implied by
+ * position) */
+static bool scan_entry(jscan_t* s, json_fields_t* f) {
+    int i = f->entry_count;
+
+    f->entry_keys[i].start = "";
+    f->entry_keys[i].len = 0;
+    f->entry_keys[i].escaped = false;
+    f->entry_values[i] = 0;
+    f->entry_terms[i] = 0;
+    f->entry_ids[i].len = 0;
+    f->entry_ops[i] = ROJ_OP_SET;
+    f->entry_expects[i] = 0;
+
+    if (!expect(s, '{')) return false;
+    if (expect(s, '}')) return true;
+    do {
+        jslice_t name;
+        if (!scan_string(s, &name) || !expect(s, ':')) return false;
+
+        if (slice_eq(&name, "key") && peek(s, '"')) {
+            if (!scan_string(s, &f->entry_keys[i])) return false;
+            continue;
+        }
+        if (slice_eq(&name, "id") && peek(s, '"')) {
+            if (!scan_string(s, &f->entry_ids[i])) return false;
+            continue;
+        }
+        if (slice_eq(&name, "op") && peek(s, '"')) {
+            jslice_t op;
+            if (!scan_string(s, &op)) return false;
+            if (slice_eq(&op, "cas")) {
+                f->entry_ops[i] = ROJ_OP_CAS;
+            } else if (slice_eq(&op, "read")) {
+                f->entry_ops[i] = ROJ_OP_READ;
+            } else if (!slice_eq(&op, "set")) {
+                return false;
+            }
+            continue;
+        }
+        skip_ws(s);
+        if (s->p < s->end && (*s->p == '-' || (*s->p >= '0' && *s->p <= '9'))) {
+            if (slice_eq(&name, "value")) {
+                if (!scan_number(s, &f->entry_values[i])) return false;
+                continue;
+            }
+            if (slice_eq(&name, "term")) {
+                if (!scan_number(s, &f->entry_terms[i])) return false;
+                continue;
+            }
+            if (slice_eq(&name, "expect")) {
+                if (!scan_number(s, &f->entry_expects[i])) return false;
+                continue;
+            }
+        }
+        if (!skip_value(s, 3)) return false;
+    } while (expect(s, ','));
+    return expect(s, '}');
+}
+
+/* Parse "entries"; a batch is applied whole, so too many entries is an error */
+static bool scan_entries(jscan_t* s, json_fields_t* f) {
+    if (!expect(s, '[')) return skip_value(s, 1);
+    if (expect(s, ']')) return true;
+
+    do {
+        if (!peek(s, '{')) {
+            if (!skip_value(s, 2)) return false;
+            continue;
+        }
+        if (f->entry_count == ROJ_MAX_BATCH || !scan_entry(s, f)) return false;
+        f->entry_count++;
+    } while (expect(s, ','));
+
+    return expect(s, ']');
+}
+
+/* Parse "proposal_ids" of a VOTE_AGG; too many IDs is an error */
+static bool scan_ids(jscan_t* s, json_fields_t* f) {
+    if (!expect(s, '[')) return skip_value(s, 1);
+    if (expect(s, ']')) return true;
+
+    do {
+        if (!peek(s, '"')) {
+            if (!skip_value(s, 2)) return false;
+            continue;
+        }
+        if (f->id_count == ROJ_MAX_AGG || !scan_string(s, &f->ids[f->id_count])) {
+            return false;
+        }
+        f->id_count++;
+    } while (expect(s, ','));
+
+    return expect(s, ']');
+}
+
+/* Parse one {"proposal_id":"..","key":"k","value":1,"voter_bits":3} of "commits" */
+static bool scan_commit(jscan_t* s, json_fields_t* f) {
+    int i = f->item_count;
+    static const jslice_t empty = { "", 0, false };
+
+    f->item_ids[i] = empty;
+    f->item_keys[i] = empty;
+    f->item_values[i] = 0;
+    f->item_bits[i] = 0;
+
+    if (!expect(s, '{')) return false;
+    if (expect(s, '}')) return true;
+    do {
+        jslice_t name;
+        if (!scan_string(s, &name) || !expect(s, ':')) return false;
+
+        if (peek(s, '"')) {
+            if (slice_eq(&name, "proposal_id")) {
+                if (!scan_string(s, &f->item_ids[i])) return false;
+                continue;
+            }
+            if (slice_eq(&name, "key")) {
+                if (!scan_string(s, &f->item_keys[i])) return false;
+                continue;
+            }
+        }
+        skip_ws(s);
+        if (s->p < s->end && (*s->p == '-' || (*s->p >= '0' && *s->p <= '9'))) {
+            if (slice_eq(&name, "value")) {
+                if (!scan_number(s, &f->item_values[i])) return false;
+                continue;
+            }
+            if (slice_eq(&name, "voter_bits")) {
+                if (!scan_number(s, &f->item_bits[i])) return false;
+                continue;
+            }
+        }
+        if (!skip_value(s, 3)) return false;
+    } while (expect(s, ','));
+    return expect(s, '}');
+}
+
+/* Parse "commits" of a COMMIT_AGG; too many commits is an error */
+static bool scan_commits(jscan_t* s, json_fields_t* f) {
+    if (!expect(s, '[')) return skip_value(s, 1);
+    if (expect(s, ']')) return true;
+
+    do {
+        if (!peek(s, '{')) {
+            if (!skip_value(s, 2)) return false;
+            continue;
+        }
+        if (f->item_count == ROJ_MAX_AGG || !scan_commit(s, f)) return false;
+        f->item_count++;
+    } while (expect(s, ','));
+
+    return expect(s, ']');
+}
+
+static bool scan_object(jscan_t* s, json_fields_t* f) {
+    if (!expect(s, '{')) return false;
+    if (expect(s, '}')) return true;
+
+    do {
+        jslice_t name;
+        if (!scan_string(s, &name) || !expect(s, ':')) return false;
+
+        bool handled = false;
+        for (int i = 0; i < F_STRING_COUNT; i++) {
+            if (slice_eq(&name, g_string_fields[i])) {
+                if (peek(s, '"')) {
+                    if (!scan_string(s, &f->str[i])) return false;
+                    f->has_str[i] = true;
+                    handled = true;
+                }
+                break;
+            }
+        }
+        if (handled) continue;
+
+        for (int i = 0; i < N_LOG_COUNT; i++) {
+            if (slice_eq(&name, g_log_fields[i])) {
+                skip_ws(s);
+                if (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+                    if (!scan_number(s, &f->log[i])) return false;
+                    handled = true;
+                }
+                break;
+            }
+        }
+        if (handled) continue;
+
+        if (slice_eq(&name, "vote_granted") || slice_eq(&name, "success")) {
+            skip_ws(s);
+            bool flag = s->end - s->p >= 4 && memcmp(s->p, "true", 4) == 0;
+            if (!skip_value(s, 1)) return false;
+            if (slice_eq(&name, "success")) f->success = flag;
+            else f->vote_granted = flag;
+            continue;
+        }
+
+        if (slice_eq(&name, "value") || slice_eq(&name, "timestamp") ||
+            slice_eq(&name, "vote_bits")) {
+            skip_ws(s);
+            if (s->p < s->end && (*s->p == '-' || (*s->p >= '0' && *s->p <= '9'))) {
+                int64_t v;
+                if (!scan_number(s, &v)) return false;
+                if (slice_eq(&name, "value")) { f->value = v; f->has_value = true; }
+                else if (slice_eq(&name, "timestamp")) { f->timestamp = v; f->has_timestamp = true; }
+                else f->vote_bits = v;
+                continue;
+            }
+        }
+        else if (slice_eq(&name, "capabilities")) {
+            if (!scan_string_array(s, f, false)) return false;
+            continue;
+        }
+        else if (slice_eq(&name, "voters")) {
+            if (!scan_string_array(s, f, true)) return false;
+            continue;
+        }
+        else if (slice_eq(&name, "entries")) {
+            if (!scan_entries(s, f)) return false;
+            continue;
+        }
+        else if (slice_eq(&name, "proposal_ids")) {
+            if (!scan_ids(s, f)) return false;
+            continue;
+        }
+        else if (slice_eq(&name, "commits")) {
+            if (!scan_commits(s, f)) return false;
+            continue;
+        }
+
+        if (!skip_value(s, 1)) return false;
+    } while (expect(s, ','));
+
+    return expect(s, '}');
+}
+
+static void copy_field(const json_fields_t* f, json_field_t id,
+                       char* out, size_t out_size) {
+    if (f->has_str[id]) {
+        copy_slice(&f->str[id], out, out_size);
+    }
+}
+
+/* Intern a string slice as far as the sender may add symbols; only escaped
+ * strings need a decoded copy first. An unknown sender's ANNOUNCE
+ * (untrusted) may add its own ID. */
+static roj_sym_t intern_slice_as(json_fields_t* f, const jslice_t* sl, bool untrusted) {
+    const char* s = sl->start;
+    size_t len = sl->len;
+    char tmp[ROJ_SYM_MAX_LEN + 1];
+
+    if (len == 0) {
+        return ROJ_SYM_EMPTY;
+    }
+    if (sl->escaped) {
+        copy_slice(sl, tmp, sizeof(tmp));
+        s = tmp;
+        len = strlen(tmp);
+    }
+    roj_sym_t sym = untrusted && f->intern == ROJ_INTERN_KNOWN
+        ? symtab_intern_untrusted(s, len)
+        : symtab_resolve(f->intern, s, len);
+    if (sym == ROJ_SYM_EMPTY && len > 0) {
+        f->unresolved = true;
+    }
+    return sym;
+}
+
+static roj_sym_t intern_slice(json_fields_t* f, const jslice_t* sl) {
+    return intern_slice_as(f, sl, false);
+}
+
+static roj_sym_t intern_field(json_fields_t* f, json_field_t id) {
+    return f->has_str[id] ? intern_slice(f, &f->str[id]) : ROJ_SYM_EMPTY;
+}
+
+static void intern_entries(json_fields_t* f, roj_kv_t* entries) {
+    for (int i = 0; i < f->entry_count; i++) {
+        entries[i].key = intern_slice(f, &f->entry_keys[i]);
+        entries[i].value = f->entry_values[i];
+    }
+}
+
+static uint64_t slice_to_id(const jslice_t* sl) {
+    char tmp[ROJ_PROPOSAL_ID_LEN];
+    copy_slice(sl, tmp, sizeof(tmp));
+    return proposal_id_from_str(tmp);
+}
+
+static void intern_log_entries(json_fields_t* f, roj_log_entry_t* entries) {
+    for (int i = 0; i < f->entry_count; i++) {
+        roj_log_entry_t* e = &entries[i];
+        e->term = (uint64_t)f->entry_terms[i];
+        e->id = f->entry_ids[i].len > 0 ? slice_to_id(&f->entry_ids[i]) : 0;
+        e->key = intern_slice(f, &f->entry_keys[i]);
+        e->op = f->entry_ops[i];
+        e->value = f->entry_values[i];
+        e->expect = f->entry_expects[i];
+    }
+}
+
+int json_decode_message(const char* json, size_t len, roj_message_t* msg,
+                        roj_intern_t intern) {
+    jscan_t s = { json, json + len };
+    json_fields_t f;
+
+    /* Only the presence flags need clearing; slices are written before use */
+    memset(f.has_str, 0, sizeof(f.has_str));
+    f.has_value = f.has_timestamp = false;
+    f.caps = 0;
+    f.voter_count = 0;
+    f.entry_count = 0;
+    f.id_count = 0;
+    f.vote_bits = 0;
+    f.item_count = 0;
+    memset(f.log, 0, sizeof(f.log));
+    f.vote_granted = f.success = false;
+    f.intern = intern;
+    f.unresolved = false;
+
+    if (!scan_object(&s, &f) || !f.has_str[F_TYPE]) {
+        return -1;
+    }
+
+    memset(msg, 0, sizeof(*msg));
+    const jslice_t* type = &f.str[F_TYPE];
+
+    if (slice_eq(type, "ANNOUNCE")) {
+        msg->type = MSG_ANNOUNCE;
+        if (f.has_str[F_NODE_ID]) {
+            msg->data.announce.node_id = intern_slice_as(&f, &f.str[F_NODE_ID], true);
+        }
+        copy_field(&f, F_VERSION, msg->data.announce.version,
+                   sizeof(msg->data.announce.version));
+        if (f.has_str[F_LANG]) {
+            char lang[16];
+            copy_slice(&f.str[F_LANG], lang, sizeof(lang));
+            msg->data.announce.lang = str_to_lang(lang);
+        }
+        msg->data.announce.caps = f.caps;
+    }
+    else if (slice_eq(type, "PROPOSE")) {
+        msg->type = MSG_PROPOSE;
+        copy_field(&f, F_PROPOSAL_ID, msg->data.propose.proposal_id, ROJ_PROPOSAL_ID_LEN);
+        msg->data.propose.from = intern_field(&f, F_FROM);
+        msg->data.propose.key = intern_field(&f, F_KEY);
+        if (f.has_value) msg->data.propose.value = f.value;
+        if (f.has_timestamp) msg->data.propose.timestamp = f.timestamp;
+    }
+    else if (slice_eq(type, "VOTE")) {
+        msg->type = MSG_VOTE;
+        copy_field(&f, F_PROPOSAL_ID, msg->data.vote.proposal_id, ROJ_PROPOSAL_ID_LEN);
+        msg->data.vote.from = intern_field(&f, F_FROM);
+        if (f.has_str[F_VOTE] && slice_eq(&f.str[F_VOTE], "reject")) {
+            msg->data.vote.vote = VOTE_REJECT;
+        }
+    }
+    else if (slice_eq(type, "COMMIT")) {
+        msg->type = MSG_COMMIT;
+        copy_field(&f, F_PROPOSAL_ID, msg->data.commit.proposal_id, ROJ_PROPOSAL_ID_LEN);
+        msg->data.commit.key = intern_field(&f, F_KEY);
+        if (f.has_value) msg->data.commit.value = f.value;
+        msg->data.commit.voter_count = f.voter_count;
+        for (int i = 0; i < f.voter_count; i++) {
+            msg->data.commit.voters[i] = intern_slice(&f, &f.voters[i]);
+        }
+    }
+    else if (slice_eq(type, "PROPOSE_BATCH")) {
+        msg->type = MSG_PROPOSE_BATCH;
+        roj_payload_t* payload = payload_recv_slot();
+        if (!payload) {
+            return -1;
+        }
+        copy_field(&f, F_PROPOSAL_ID, msg->data.propose_batch.proposal_id,
+                   ROJ_PROPOSAL_ID_LEN);
+        msg->data.propose_batch.from = intern_field(&f, F_FROM);
+        if (f.has_timestamp) msg->data.propose_batch.timestamp = f.timestamp;
+        msg->data.propose_batch.entries = payload->kv;
+        intern_entries(&f, payload->kv);
+        msg->data.propose_batch.count = f.entry_count;
+    }
+    else if (slice_eq(type, "COMMIT_BATCH")) {
+        msg->type = MSG_COMMIT_BATCH;
+        roj_payload_t* payload = payload_recv_slot();
+        if (!payload) {
+            return -1;
+        }
+        copy_field(&f, F_PROPOSAL_ID, msg->data.commit_batch.proposal_id,
+                   ROJ_PROPOSAL_ID_LEN);
+        msg->data.commit_batch.entries = payload->kv;
+        intern_entries(&f, payload->kv);
+        msg->data.commit_batch.count = f.entry_count;
+        msg->data.commit_batch.voter_count = f.voter_count;
+        for (int i = 0; i < f.voter_count; i++) {
+            msg->data.commit_batch.voters[i] = intern_slice(&f, &f.voters[i]);
+        }
+    }
+    else if (slice_eq(type, "VOTE_AGG")) {
+        msg->type = MSG_VOTE_AGG;
+        roj_payload_t* payload = payload_recv_slot();
+        if (!payload) {
+            return -1;
+        }
+        msg->data.vote_agg.from = intern_field(&f, F_FROM);
+        msg->data.vote_agg.accept_bits = (uint32_t)f.vote_bits;
+        msg->data.vote_agg.count = f.id_count;
+        msg->data.vote_agg.ids = payload->ids;
+        for (int i = 0; i < f.id_count; i++) {
+            msg->data.vote_agg.ids[i] = slice_to_id(&f.ids[i]);
+        }
+    }
+    else if (slice_eq(type, "COMMIT_AGG")) {
+        msg->type = MSG_COMMIT_AGG;
+        roj_payload_t* payload = payload_recv_slot();
+        if (!payload) {
+            return -1;
+        }
+        msg->data.commit_agg.voter_count = f.voter_count;
+        for (int i = 0; i < f.voter_count; i++) {
+            msg->data.commit_agg.voters[i] = intern_slice(&f, &f.voters[i]);
+        }
+        msg->data.commit_agg.count = f.item_count;
+        msg->data.commit_agg.items = payload->items;
+        for (int i = 0; i < f.item_count; i++) {
+            roj_commit_item_t* item = &msg->data.commit_agg.items[i];
+            item->id = slice_to_id(&f.item_ids[i]);
+            item->key = intern_slice(&f, &f.item_keys[i]);
+            item->value = f.item_values[i];
+            item->voter_bits = (uint32_t)f.item_bits[i];
+        }
+    }
+    else if (slice_eq(type, "REQUEST_VOTE")) {
+        msg->type = MSG_REQUEST_VOTE;
+        msg->data.request_vote.term = (uint64_t)f.log[N_TERM];
+        msg->data.request_vote.candidate_id = intern_field(&f, F_CANDIDATE_ID);
+        msg->data.request_vote.last_log_index = (uint64_t)f.log[N_LAST_LOG_INDEX];
+        msg->data.request_vote.last_log_term = (uint64_t)f.log[N_LAST_LOG_TERM];
+    }
+    else if (slice_eq(type, "VOTE_RESPONSE")) {
+        msg->type = MSG_VOTE_RESPONSE;
+        msg->data.vote_response.term = (uint64_t)f.log[N_TERM];
+        msg->data.vote_response.voter_id = intern_field(&f, F_VOTER_ID);
+        msg->data.vote_response.vote_granted = f.vote_granted;
+    }
+    else if (slice_eq(type, "APPEND_ENTRIES")) {
+        msg->type = MSG_APPEND_ENTRIES;
+        roj_payload_t* payload = payload_recv_slot();
+        if (!payload) {
+            return -1;
+        }
+        msg->data.append_entries.term = (uint64_t)f.log[N_TERM];
+        msg->data.append_entries.leader_id = intern_field(&f, F_LEADER_ID);
+        msg->data.append_entries.prev_log_index = (uint64_t)f.log[N_PREV_LOG_INDEX];
+        msg->data.append_entries.prev_log_term = (uint64_t)f.log[N_PREV_LOG_TERM];
+        msg->data.append_entries.leader_commit = (uint64_t)f.log[N_LEADER_COMMIT];
+        msg->data.append_entries.count = f.entry_count;
+        msg->data.append_entries.entries = payload->log;
+        intern_log_entries(&f, payload->log);
+    }
+    else if (slice_eq(type, "APPEND_ENTRIES_RESPONSE")) {
+        msg->type = MSG_APPEND_ENTRIES_RESPONSE;
+        msg->data.append_response.term = (uint64_t)f.log[N_TERM];
+        msg->data.append_response.follower_id = intern_field(&f, F_FOLLOWER_ID);
+        msg->data.append_response.success = f.success;
+        msg->data.append_response.match_index = (uint64_t)f.log[N_MATCH_INDEX];
+    }
+    else if (slice_eq(type, "FORWARD")) {
+        msg->type = MSG_FORWARD;
+        roj_payload_t* payload = payload_recv_slot();
+        if (!payload) {
+            return -1;
+        }
+        msg->data.forward.from = intern_field(&f, F_FROM);
+        msg->data.forward.entries = payload->log;
+        intern_log_entries(&f, payload->log);
+        msg->data.forward.count = f.entry_count;
+    }
+    else {
+        msg->type = MSG_UNKNOWN;
+    }
+
+    return f.unresolved ? -1 : 0;
+}
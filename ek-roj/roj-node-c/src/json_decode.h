@@ -0,0 +1,23 @@
+/*
+ * ROJ JSON Decode - single-pass, allocation-free message decoder
+ *
+ * Tokenizes a datagram in place and copies known fields straight into
+ * roj_message_t. Accepts the same documents as message_from_json
+ * (proto/messages.json); unknown fields are skipped.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_JSON_DECODE_H
+#define ROJ_JSON_DECODE_H
+
+#include <stddef.h>
+#include "types.h"
+#include "symtab.h"
+
+/* Parse message from a JSON buffer of len bytes (NUL terminator optional),
+ * resolving its strings as intern allows */
+int json_decode_message(const char* json, size_t len, roj_message_t* msg,
+                        roj_intern_t intern);
+
+#endif /* ROJ_JSON_DECODE_H */
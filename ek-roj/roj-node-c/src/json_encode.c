@@ -0,0 +1,378 @@
+/*
+ * ROJ JSON Encode - direct-to-buffer message encoder implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <string.h>
+#include "json_encode.h"
+#include "symtab.h"
+
+
+typedef struct {
+    char* buf;
+    size_t size;
+    size_t pos;
+    bool overflow;
+    const roj_json_templates_t* t;  /* NULL = encode everything */
+} json_writer_t;
+
+static void put_raw(json_writer_t* w, const char* s, size_t len) {
+    if (w->pos + len >= w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->pos, s, len);
+    w->pos += len;
+}
+
+#define PUT_LIT(w, lit) put_raw((w), (lit), sizeof(lit) - 1)
+
+/* Escaped string contents, without the surrounding quotes */
+static void put_escaped(json_writer_t* w, const char* s) {
+    static const char hex[] = "0123456789abcdef";
+    const char* run = s;
+
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        put_raw(w, run, (size_t)(s - run));
+        run = s + 1;
+        switch (c) {
+            case '"':  PUT_LIT(w, "\\\""); break;
+            case '\\': PUT_LIT(w, "\\\\"); break;
+            case '\n': PUT_LIT(w, "\\n"); break;
+            case '\r': PUT_LIT(w, "\\r"); break;
+            case '\t': PUT_LIT(w, "\\t"); break;
+            default: {
+                char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+                put_raw(w, esc, sizeof(esc));
+                break;
+            }
+        }
+    }
+    put_raw(w, run, (size_t)(s - run));
+}
+
+static void put_i64(json_writer_t* w, int64_t v) {
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+
+    do {
+        *--p = (char)('0' + (u % 10));
+        u /= 10;
+    } while (u);
+    if (v < 0) *--p = '-';
+
+    put_raw(w, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+static void put_from(json_writer_t* w, roj_sym_t from) {
+    if (w->t && w->t->from_chunk_len > 0 && from == w->t->node_sym) {
+        put_raw(w, w->t->from_chunk, w->t->from_chunk_len);
+        return;
+    }
+    PUT_LIT(w, "\",\"from\":\"");
+    put_escaped(w, symtab_str(from));
+    PUT_LIT(w, "\"");
+}
+
+/* ,"entries":[{"key":"k","value":1},...] */
+static void put_entries(json_writer_t* w, const roj_kv_t* entries, int count) {
+    PUT_LIT(w, ",\"entries\":[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0) PUT_LIT(w, ",");
+        PUT_LIT(w, "{\"key\":\"");
+        put_escaped(w, symtab_str(entries[i].key));
+        PUT_LIT(w, "\",\"value\":");
+        put_i64(w, entries[i].value);
+        PUT_LIT(w, "}");
+    }
+    PUT_LIT(w, "]");
+}
+
+/* "<16 hex digits>" */
+static void put_id(json_writer_t* w, uint64_t id) {
+    static const char hex[] = "0123456789abcdef";
+    char tmp[18];
+
+    tmp[0] = tmp[17] = '"';
+    for (int i = 16; i >= 1; i--) {
+        tmp[i] = hex[id & 0xF];
+        id >>= 4;
+    }
+    put_raw(w, tmp, sizeof(tmp));
+}
+
+/* ,"entries":[{"index":1,"term":1,"id":"..","key":"k","value":1},...]; CAS
+ * and READ entries add "op" (and "expect"), FORWARD entries carry no index
+ * or term, the no-op no id */
+static void put_log_entries(json_writer_t* w, const roj_log_entry_t* entries, int count,
+                            uint64_t prev_index, bool log) {
+    PUT_LIT(w, ",\"entries\":[");
+    for (int i = 0; i < count; i++) {
+        const roj_log_entry_t* e = &entries[i];
+        if (i > 0) PUT_LIT(w, ",");
+        PUT_LIT(w, "{");
+        if (log) {
+            PUT_LIT(w, "\"index\":");
+            put_i64(w, (int64_t)(prev_index + 1 + (uint64_t)i));
+            PUT_LIT(w, ",\"term\":");
+            put_i64(w, (int64_t)e->term);
+            PUT_LIT(w, ",");
+        }
+        if (e->id != 0) {
+            PUT_LIT(w, "\"id\":");
+            put_id(w, e->id);
+            PUT_LIT(w, ",");
+        }
+        PUT_LIT(w, "\"key\":\"");
+        put_escaped(w, symtab_str(e->key));
+        if (e->op != ROJ_OP_SET) {
+            const char* op = op_to_str((roj_op_t)e->op);
+            PUT_LIT(w, "\",\"op\":\"");
+            put_raw(w, op, strlen(op));
+        }
+        PUT_LIT(w, "\",\"value\":");
+        put_i64(w, e->value);
+        if (e->op == ROJ_OP_CAS) {
+            PUT_LIT(w, ",\"expect\":");
+            put_i64(w, e->expect);
+        }
+        PUT_LIT(w, "}");
+    }
+    PUT_LIT(w, "]");
+}
+
+/* ,"voters":["a",...] */
+static void put_voters(json_writer_t* w, const roj_sym_t* voters, int count) {
+    PUT_LIT(w, ",\"voters\":[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0) PUT_LIT(w, ",");
+        PUT_LIT(w, "\"");
+        put_escaped(w, symtab_str(voters[i]));
+        PUT_LIT(w, "\"");
+    }
+    PUT_LIT(w, "]");
+}
+
+static int finish(json_writer_t* w) {
+    if (w->overflow) return -1;
+    w->buf[w->pos] = '\0';
+    return (int)w->pos;
+}
+
+static void encode_announce(json_writer_t* w, const roj_message_t* msg) {
+    PUT_LIT(w, "{\"type\":\"ANNOUNCE\",\"node_id\":\"");
+    put_escaped(w, symtab_str(msg->data.announce.node_id));
+    PUT_LIT(w, "\",\"lang\":\"");
+    put_escaped(w, lang_to_str(msg->data.announce.lang));
+    PUT_LIT(w, "\",\"capabilities\":[");
+    bool first = true;
+    for (int bit = 0; bit < 32; bit++) {
+        const char* name = cap_to_str(1u << bit);
+        if (name && (msg->data.announce.caps & (1u << bit))) {
+            if (!first) PUT_LIT(w, ",");
+            PUT_LIT(w, "\"");
+            put_escaped(w, name);
+            PUT_LIT(w, "\"");
+            first = false;
+        }
+    }
+    PUT_LIT(w, "],\"version\":\"");
+    put_escaped(w, msg->data.announce.version);
+    PUT_LIT(w, "\"}");
+}
+
+void json_encode_init(roj_json_templates_t* t, const char* node_id) {
+    json_writer_t w = { t->from_chunk, sizeof(t->from_chunk), 0, false, NULL };
+
+    memset(t, 0, sizeof(*t));
+    t->node_sym = symtab_intern_str(node_id);
+
+    PUT_LIT(&w, "\",\"from\":\"");
+    put_escaped(&w, symtab_str(t->node_sym));
+    PUT_LIT(&w, "\"");
+    t->from_chunk_len = w.overflow ? 0 : w.pos;
+}
+
+void json_encode_set_announce(roj_json_templates_t* t, const roj_message_t* announce) {
+    json_writer_t w = { t->announce_json, sizeof(t->announce_json), 0, false, NULL };
+
+    encode_announce(&w, announce);
+    t->announce_len = finish(&w);
+    t->announce_src = *announce;
+}
+
+int json_encode_message(const roj_json_templates_t* t, const roj_message_t* msg,
+                        char* buf, size_t buf_size) {
+    json_writer_t w = { buf, buf_size, 0, false, t };
+
+    switch (msg->type) {
+        case MSG_ANNOUNCE:
+            if (t && t->announce_len > 0 &&
+                memcmp(&msg->data.announce, &t->announce_src.data.announce,
+                       sizeof(msg->data.announce)) == 0) {
+                put_raw(&w, t->announce_json, (size_t)t->announce_len);
+                break;
+            }
+            encode_announce(&w, msg);
+            break;
+
+        case MSG_PROPOSE:
+            PUT_LIT(&w, "{\"type\":\"PROPOSE\",\"proposal_id\":\"");
+            put_escaped(&w, msg->data.propose.proposal_id);
+            put_from(&w, msg->data.propose.from);
+            PUT_LIT(&w, ",\"key\":\"");
+            put_escaped(&w, symtab_str(msg->data.propose.key));
+            PUT_LIT(&w, "\",\"value\":");
+            put_i64(&w, msg->data.propose.value);
+            PUT_LIT(&w, ",\"timestamp\":");
+            put_i64(&w, msg->data.propose.timestamp);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_VOTE:
+            PUT_LIT(&w, "{\"type\":\"VOTE\",\"proposal_id\":\"");
+            put_escaped(&w, msg->data.vote.proposal_id);
+            put_from(&w, msg->data.vote.from);
+            if (msg->data.vote.vote == VOTE_REJECT) {
+                PUT_LIT(&w, ",\"vote\":\"reject\"}");
+            } else {
+                PUT_LIT(&w, ",\"vote\":\"accept\"}");
+            }
+            break;
+
+        case MSG_COMMIT:
+            PUT_LIT(&w, "{\"type\":\"COMMIT\",\"proposal_id\":\"");
+            put_escaped(&w, msg->data.commit.proposal_id);
+            PUT_LIT(&w, "\",\"key\":\"");
+            put_escaped(&w, symtab_str(msg->data.commit.key));
+            PUT_LIT(&w, "\",\"value\":");
+            put_i64(&w, msg->data.commit.value);
+            put_voters(&w, msg->data.commit.voters, msg->data.commit.voter_count);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_PROPOSE_BATCH:
+            PUT_LIT(&w, "{\"type\":\"PROPOSE_BATCH\",\"proposal_id\":\"");
+            put_escaped(&w, msg->data.propose_batch.proposal_id);
+            put_from(&w, msg->data.propose_batch.from);
+            put_entries(&w, msg->data.propose_batch.entries, msg->data.propose_batch.count);
+            PUT_LIT(&w, ",\"timestamp\":");
+            put_i64(&w, msg->data.propose_batch.timestamp);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_COMMIT_BATCH:
+            PUT_LIT(&w, "{\"type\":\"COMMIT_BATCH\",\"proposal_id\":\"");
+            put_escaped(&w, msg->data.commit_batch.proposal_id);
+            PUT_LIT(&w, "\"");
+            put_entries(&w, msg->data.commit_batch.entries, msg->data.commit_batch.count);
+            put_voters(&w, msg->data.commit_batch.voters, msg->data.commit_batch.voter_count);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_VOTE_AGG:
+            PUT_LIT(&w, "{\"type\":\"VOTE_AGG");
+            put_from(&w, msg->data.vote_agg.from);
+            PUT_LIT(&w, ",\"proposal_ids\":[");
+            for (int i = 0; i < msg->data.vote_agg.count; i++) {
+                if (i > 0) PUT_LIT(&w, ",");
+                put_id(&w, msg->data.vote_agg.ids[i]);
+            }
+            PUT_LIT(&w, "],\"vote_bits\":");
+            put_i64(&w, (int64_t)msg->data.vote_agg.accept_bits);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_COMMIT_AGG:
+            PUT_LIT(&w, "{\"type\":\"COMMIT_AGG\"");
+            put_voters(&w, msg->data.commit_agg.voters, msg->data.commit_agg.voter_count);
+            PUT_LIT(&w, ",\"commits\":[");
+            for (int i = 0; i < msg->data.commit_agg.count; i++) {
+                const roj_commit_item_t* item = &msg->data.commit_agg.items[i];
+                if (i > 0) PUT_LIT(&w, ",");
+                PUT_LIT(&w, "{\"proposal_id\":");
+                put_id(&w, item->id);
+                PUT_LIT(&w, ",\"key\":\"");
+                put_escaped(&w, symtab_str(item->key));
+                PUT_LIT(&w, "\",\"value\":");
+                put_i64(&w, item->value);
+                PUT_LIT(&w, ",\"voter_bits\":");
+                put_i64(&w, (int64_t)item->voter_bits);
+                PUT_LIT(&w, "}");
+            }
+            PUT_LIT(&w, "]}");
+            break;
+
+        case MSG_REQUEST_VOTE:
+            PUT_LIT(&w, "{\"type\":\"REQUEST_VOTE\",\"term\":");
+            put_i64(&w, (int64_t)msg->data.request_vote.term);
+            PUT_LIT(&w, ",\"candidate_id\":\"");
+            put_escaped(&w, symtab_str(msg->data.request_vote.candidate_id));
+            PUT_LIT(&w, "\",\"last_log_index\":");
+            put_i64(&w, (int64_t)msg->data.request_vote.last_log_index);
+            PUT_LIT(&w, ",\"last_log_term\":");
+            put_i64(&w, (int64_t)msg->data.request_vote.last_log_term);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_VOTE_RESPONSE:
+            PUT_LIT(&w, "{\"type\":\"VOTE_RESPONSE\",\"term\":");
+            put_i64(&w, (int64_t)msg->data.vote_response.term);
+            PUT_LIT(&w, ",\"voter_id\":\"");
+            put_escaped(&w, symtab_str(msg->data.vote_response.voter_id));
+            if (msg->data.vote_response.vote_granted) {
+                PUT_LIT(&w, "\",\"vote_granted\":true}");
+            } else {
+                PUT_LIT(&w, "\",\"vote_granted\":false}");
+            }
+            break;
+
+        case MSG_APPEND_ENTRIES:
+            PUT_LIT(&w, "{\"type\":\"APPEND_ENTRIES\",\"term\":");
+            put_i64(&w, (int64_t)msg->data.append_entries.term);
+            PUT_LIT(&w, ",\"leader_id\":\"");
+            put_escaped(&w, symtab_str(msg->data.append_entries.leader_id));
+            PUT_LIT(&w, "\",\"prev_log_index\":");
+            put_i64(&w, (int64_t)msg->data.append_entries.prev_log_index);
+            PUT_LIT(&w, ",\"prev_log_term\":");
+            put_i64(&w, (int64_t)msg->data.append_entries.prev_log_term);
+            put_log_entries(&w, msg->data.append_entries.entries, msg->data.append_entries.count,
+                            msg->data.append_entries.prev_log_index, true);
+            PUT_LIT(&w, ",\"leader_commit\":");
+            put_i64(&w, (int64_t)msg->data.append_entries.leader_commit);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_APPEND_ENTRIES_RESPONSE:
+            PUT_LIT(&w, "{\"type\":\"APPEND_ENTRIES_RESPONSE\",\"term\":");
+            put_i64(&w, (int64_t)msg->data.append_response.term);
+            PUT_LIT(&w, ",\"follower_id\":\"");
+            put_escaped(&w, symtab_str(msg->data.append_response.follower_id));
+            if (msg->data.append_response.success) {
+                PUT_LIT(&w, "\",\"success\":true,\"match_index\":");
+            } else {
+                PUT_LIT(&w, "\",\"success\":false,\"match_index\":");
+            }
+            put_i64(&w, (int64_t)msg->data.append_response.match_index);
+            PUT_LIT(&w, "}");
+            break;
+
+        case MSG_FORWARD:
+            PUT_LIT(&w, "{\"type\":\"FORWARD");
+            put_from(&w, msg->data.forward.from);
+            put_log_entries(&w, msg->data.forward.entries, msg->data.forward.count, 0, false);
+            PUT_LIT(&w, "}");
+            break;
+
+        default:
+            return -1;
+    }
+
+    return finish(&w);
+}
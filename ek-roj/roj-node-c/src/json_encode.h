@@ -0,0 +1,47 @@
+/*
+ * ROJ JSON Encode - direct-to-buffer message encoder
+ *
+ * Writes the same documents as message_to_json straight into the caller's
+ * buffer. Two per-node pieces are precomputed: the escaped
+ * ","from":"<node_id>" chunk, copied in whole wherever this node's own
+ * messages (VOTE, PROPOSE, batches) name their sender, and the complete
+ * ANNOUNCE document, sent as is while the announce is unchanged. Every
+ * other field is written per message.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_JSON_ENCODE_H
+#define ROJ_JSON_ENCODE_H
+
+#include <stddef.h>
+#include "types.h"
+
+#define JSON_TEMPLATE_MAX (ROJ_NODE_ID_MAX * 6 + 32)
+#define JSON_ANNOUNCE_MAX 512
+
+/* Per-node templates */
+typedef struct {
+    /* Node-specific chunk: ","from":"<node_id>" */
+    roj_sym_t node_sym;
+    char from_chunk[JSON_TEMPLATE_MAX];
+    size_t from_chunk_len;
+
+    /* Full ANNOUNCE document, valid while the message matches announce_src */
+    roj_message_t announce_src;
+    char announce_json[JSON_ANNOUNCE_MAX];
+    int announce_len;
+} roj_json_templates_t;
+
+/* Precompute templates for messages originating from node_id */
+void json_encode_init(roj_json_templates_t* t, const char* node_id);
+
+/* Precompute this node's ANNOUNCE (call again when capabilities change) */
+void json_encode_set_announce(roj_json_templates_t* t, const roj_message_t* announce);
+
+/* Serialize message to JSON using t's templates (NULL = none), returns
+ * length (excluding NUL) or -1 */
+int json_encode_message(const roj_json_templates_t* t, const roj_message_t* msg,
+                        char* buf, size_t buf_size);
+
+#endif /* ROJ_JSON_ENCODE_H */
@@ -0,0 +1,594 @@
+/*
+ * ROJ Logger - leveled logger with an asynchronous per-thread ring
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "logger.h"
+
+#ifdef ROJ_THREADS
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "spsc_ring.h"
+#endif
+
+#define SPEC_MAX_PREFIX 16      /* '%', flags, width and precision */
+
+_Atomic int g_log_level = ROJ_LOG_INFO;
+
+static const char* g_level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+static const char* g_level_args[] = { "error", "warn", "info", "debug" };
+
+void roj_log_set_level(roj_log_level_t level) {
+    atomic_store_explicit(&g_log_level, (int)level, memory_order_relaxed);
+}
+
+roj_log_level_t roj_log_get_level(void) {
+    return (roj_log_level_t)atomic_load_explicit(&g_log_level, memory_order_relaxed);
+}
+
+int roj_log_parse_level(const char* name, roj_log_level_t* level) {
+    for (int i = ROJ_LOG_ERROR; i <= ROJ_LOG_DEBUG; i++) {
+        if (strcmp(name, g_level_args[i]) == 0) {
+            *level = (roj_log_level_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static FILE* level_stream(int level) {
+    return level <= ROJ_LOG_WARN ? stderr : stdout;
+}
+
+/* Format and write on the calling thread, as one line */
+static void write_now(roj_log_level_t level, const char* fmt, va_list ap) {
+    char line[1024];
+    int n = snprintf(line, sizeof(line), "[%s] ", g_level_names[level]);
+    int len = vsnprintf(line + n, sizeof(line) - (size_t)n, fmt, ap);
+    size_t end = len < 0 ? (size_t)n : (size_t)n + (size_t)len;
+
+    if (end > sizeof(line) - 2) {
+        end = sizeof(line) - 2;
+    }
+    line[end++] = '\n';
+    fwrite(line, 1, end, level_stream(level));
+}
+
+#ifndef ROJ_THREADS
+
+void roj_log_write(roj_log_level_t level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    write_now(level, fmt, ap);
+    va_end(ap);
+}
+
+int roj_log_start(void) {
+    fprintf(stderr, "[WARN] Log: built without ROJ_THREADS, logging stays synchronous\n");
+    return -1;
+}
+
+void roj_log_stop(void) {
+}
+
+uint64_t roj_log_dropped(void) {
+    return 0;
+}
+
+#else
+
+/* Conversions */
+
+typedef enum {
+    LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_Z, LEN_J, LEN_T, LEN_BIG_L
+} spec_len_t;
+
+typedef struct {
+    size_t prefix;          /* '%', flags, width and precision */
+    spec_len_t len;
+    char conv;
+    size_t size;            /* the whole conversion */
+} spec_t;
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/* Parse the conversion at p (a '%' not followed by another); -1 if it is
+ * not one a record can carry */
+static int parse_spec(const char* p, spec_t* s) {
+    const char* q = p + 1;
+
+    while (*q != '\0' && strchr("-+ #0", *q)) q++;
+    while (is_digit(*q)) q++;
+    if (*q == '.') {
+        q++;
+        while (is_digit(*q)) q++;
+    }
+    s->prefix = (size_t)(q - p);
+
+    s->len = LEN_NONE;
+    if (q[0] == 'h' && q[1] == 'h')      { s->len = LEN_HH; q += 2; }
+    else if (q[0] == 'l' && q[1] == 'l') { s->len = LEN_LL; q += 2; }
+    else if (*q == 'h')                  { s->len = LEN_H; q++; }
+    else if (*q == 'l')                  { s->len = LEN_L; q++; }
+    else if (*q == 'z')                  { s->len = LEN_Z; q++; }
+    else if (*q == 'j')                  { s->len = LEN_J; q++; }
+    else if (*q == 't')                  { s->len = LEN_T; q++; }
+    else if (*q == 'L')                  { s->len = LEN_BIG_L; q++; }
+
+    s->conv = *q;
+    s->size = (size_t)(q + 1 - p);
+    if (*q == '\0' || s->prefix > SPEC_MAX_PREFIX) {
+        return -1;
+    }
+    if (strchr("diouxX", *q)) {
+        return s->len == LEN_BIG_L ? -1 : 0;
+    }
+    if (strchr("fFeEgGaA", *q)) {
+        return s->len == LEN_NONE || s->len == LEN_L || s->len == LEN_BIG_L ? 0 : -1;
+    }
+    if (strchr("csp", *q)) {
+        return s->len == LEN_NONE ? 0 : -1;
+    }
+    return -1;
+}
+
+/* Records */
+
+typedef union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void* p;
+} log_arg_t;
+
+#define RECORD_TEXT_SIZE \
+    (ROJ_LOGGER_RECORD_SIZE - ROJ_LOGGER_MAX_ARGS * sizeof(log_arg_t) - sizeof(const char*) - 2)
+
+typedef struct {
+    log_arg_t args[ROJ_LOGGER_MAX_ARGS];
+    const char* fmt;        /* NULL: text holds the formatted line */
+    uint8_t level;
+    uint8_t nargs;
+    char text[RECORD_TEXT_SIZE];    /* %s arguments, NUL-terminated */
+} log_record_t;
+
+_Static_assert(sizeof(log_record_t) == ROJ_LOGGER_RECORD_SIZE, "log record size");
+
+static int64_t signed_arg(spec_len_t len, va_list* ap) {
+    switch (len) {
+    case LEN_HH: return (signed char)va_arg(*ap, int);
+    case LEN_H:  return (short)va_arg(*ap, int);
+    case LEN_L:  return va_arg(*ap, long);
+    case LEN_LL: return va_arg(*ap, long long);
+    case LEN_Z:  return (int64_t)va_arg(*ap, size_t);
+    case LEN_J:  return va_arg(*ap, intmax_t);
+    case LEN_T:  return va_arg(*ap, ptrdiff_t);
+    default:     return va_arg(*ap, int);
+    }
+}
+
+static uint64_t unsigned_arg(spec_len_t len, va_list* ap) {
+    switch (len) {
+    case LEN_HH: return (unsigned char)va_arg(*ap, unsigned int);
+    case LEN_H:  return (unsigned short)va_arg(*ap, unsigned int);
+    case LEN_L:  return va_arg(*ap, unsigned long);
+    case LEN_LL: return va_arg(*ap, unsigned long long);
+    case LEN_Z:  return va_arg(*ap, size_t);
+    case LEN_J:  return va_arg(*ap, uintmax_t);
+    case LEN_T:  return (uint64_t)va_arg(*ap, ptrdiff_t);
+    default:     return va_arg(*ap, unsigned int);
+    }
+}
+
+/* Copy the arguments fmt names into rec; -1 if it needs formatting now */
+static int capture(log_record_t* rec, const char* fmt, va_list* ap) {
+    size_t used = 0;
+    int n = 0;
+
+    for (const char* p = fmt; (p = strchr(p, '%')) != NULL; ) {
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+
+        spec_t s;
+        if (parse_spec(p, &s) != 0 || n == ROJ_LOGGER_MAX_ARGS) {
+            return -1;
+        }
+        log_arg_t* a = &rec->args[n++];
+
+        switch (s.conv) {
+        case 'd': case 'i':
+            a->i = signed_arg(s.len, ap);
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            a->u = unsigned_arg(s.len, ap);
+            break;
+        case 'c':
+            a->i = va_arg(*ap, int);
+            break;
+        case 'p':
+            a->p = va_arg(*ap, void*);
+            break;
+        case 's': {
+            /* Strings are copied: the caller's buffer may be gone by the
+             * time the record is written. Long ones are cut short. */
+            const char* str = va_arg(*ap, const char*);
+            size_t len = strlen(str ? str : "(null)");
+            size_t room = used < sizeof(rec->text) ? sizeof(rec->text) - used - 1 : 0;
+            if (room == 0) {
+                return -1;
+            }
+            if (len > room) len = room;
+            memcpy(rec->text + used, str ? str : "(null)", len);
+            rec->text[used + len] = '\0';
+            a->u = used;
+            used += len + 1;
+            break;
+        }
+        default:
+            a->d = s.len == LEN_BIG_L ? (double)va_arg(*ap, long double)
+                                      : va_arg(*ap, double);
+            break;
+        }
+        p += s.size;
+    }
+
+    rec->fmt = fmt;
+    rec->nargs = (uint8_t)n;
+    return 0;
+}
+
+static void write_record(const log_record_t* rec) {
+    FILE* f = level_stream(rec->level);
+
+    fprintf(f, "[%s] ", g_level_names[rec->level]);
+    if (!rec->fmt) {
+        fputs(rec->text, f);
+        fputc('\n', f);
+        return;
+    }
+
+    int n = 0;
+    const char* p = rec->fmt;
+    for (const char* pct; (pct = strchr(p, '%')) != NULL; ) {
+        fwrite(p, 1, (size_t)(pct - p), f);
+        if (pct[1] == '%') {
+            fputc('%', f);
+            p = pct + 2;
+            continue;
+        }
+
+        /* capture() accepted this format, so every conversion parses */
+        spec_t s;
+        parse_spec(pct, &s);
+        const log_arg_t* a = &rec->args[n++];
+
+        /* Integers were widened: print them through "ll" */
+        char spec[SPEC_MAX_PREFIX + 4];
+        memcpy(spec, pct, s.prefix);
+        char* e = spec + s.prefix;
+        if (strchr("diouxX", s.conv)) {
+            *e++ = 'l';
+            *e++ = 'l';
+        }
+        *e++ = s.conv;
+        *e = '\0';
+
+        switch (s.conv) {
+        case 'd': case 'i':
+            fprintf(f, spec, (long long)a->i);
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            fprintf(f, spec, (unsigned long long)a->u);
+            break;
+        case 'c':
+            fprintf(f, spec, (int)a->i);
+            break;
+        case 'p':
+            fprintf(f, spec, a->p);
+            break;
+        case 's':
+            fprintf(f, spec, rec->text + a->u);
+            break;
+        default:
+            fprintf(f, spec, a->d);
+            break;
+        }
+        p = pct + s.size;
+    }
+    fputs(p, f);
+    fputc('\n', f);
+}
+
+/* Rings */
+
+enum { RING_FREE, RING_OWNED, RING_RETIRED };
+
+typedef struct {
+    roj_spsc_ring_t ring;
+    _Atomic int state;          /* RING_RETIRED once the owning thread exits */
+    _Atomic bool writing;       /* owner is between its g_async check and commit */
+    _Atomic uint64_t dropped;   /* bumped by the owner, read by the drain */
+    uint64_t dropped_seen;      /* drain only */
+} log_ring_t;
+
+static _Atomic(log_ring_t*) g_rings[ROJ_LOGGER_MAX_THREADS];
+static _Atomic int g_ring_count = 0;
+static _Atomic bool g_async = false;
+static _Atomic bool g_draining = false;
+static _Atomic bool g_drain_idle = false;   /* drain waits on g_wake */
+static pthread_mutex_t g_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t g_drain;
+static pthread_key_t g_ring_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local log_ring_t* t_ring = NULL;
+static _Thread_local bool t_no_ring = false;
+
+static void wake_drain(void);
+
+/* Thread exit: the drain hands the ring out again once it is empty */
+static void retire_ring(void* ptr) {
+    log_ring_t* r = ptr;
+    atomic_store_explicit(&r->state, RING_RETIRED, memory_order_release);
+    wake_drain();
+}
+
+static void make_key(void) {
+    pthread_key_create(&g_ring_key, retire_ring);
+}
+
+static log_ring_t* claim_ring(void) {
+    pthread_once(&g_key_once, make_key);
+
+    int count = atomic_load_explicit(&g_ring_count, memory_order_acquire);
+    if (count > ROJ_LOGGER_MAX_THREADS) count = ROJ_LOGGER_MAX_THREADS;
+
+    log_ring_t* r = NULL;
+    for (int i = 0; i < count && !r; i++) {
+        log_ring_t* candidate = atomic_load_explicit(&g_rings[i], memory_order_acquire);
+        int expected = RING_FREE;
+        if (candidate &&
+            atomic_compare_exchange_strong_explicit(&candidate->state, &expected, RING_OWNED,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed)) {
+            r = candidate;
+        }
+    }
+
+    if (!r) {
+        int i = atomic_fetch_add(&g_ring_count, 1);
+        if (i >= ROJ_LOGGER_MAX_THREADS) {
+            return NULL;
+        }
+        r = calloc(1, sizeof(*r));
+        if (!r) {
+            return NULL;
+        }
+        if (spsc_ring_init(&r->ring, ROJ_LOGGER_RING_SLOTS, sizeof(log_record_t)) != 0) {
+            free(r);
+            return NULL;
+        }
+        atomic_init(&r->state, RING_OWNED);
+        atomic_init(&r->writing, false);
+        atomic_init(&r->dropped, 0);
+        atomic_store(&g_rings[i], r);
+    }
+
+    pthread_setspecific(g_ring_key, r);
+    return r;
+}
+
+/* Wake the drain if it went to sleep. The fence pairs with the one in
+ * drain_main: either the drain sees the record published before it, or
+ * this sees g_drain_idle set. */
+static void wake_drain(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&g_drain_idle, memory_order_relaxed)) {
+        pthread_mutex_lock(&g_wake_lock);
+        atomic_store_explicit(&g_drain_idle, false, memory_order_relaxed);
+        pthread_cond_signal(&g_wake);
+        pthread_mutex_unlock(&g_wake_lock);
+    }
+}
+
+/* 0 if the record was queued or dropped, -1 to write it synchronously */
+static int enqueue(roj_log_level_t level, const char* fmt, va_list* ap) {
+    log_ring_t* r = t_ring;
+    if (!r) {
+        if (t_no_ring) {
+            return -1;
+        }
+        r = t_ring = claim_ring();
+        if (!r) {
+            t_no_ring = true;
+            return -1;
+        }
+    }
+
+    /* Pairs with roj_log_stop: either it waits for this record, or this
+     * sees logging has gone synchronous */
+    atomic_store(&r->writing, true);
+    if (!atomic_load(&g_async)) {
+        atomic_store_explicit(&r->writing, false, memory_order_release);
+        return -1;
+    }
+
+    log_record_t* rec = spsc_ring_reserve(&r->ring);
+    if (!rec) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        wake_drain();
+        atomic_store_explicit(&r->writing, false, memory_order_release);
+        return 0;
+    }
+
+    va_list copy;
+    va_copy(copy, *ap);
+    rec->level = (uint8_t)level;
+    if (capture(rec, fmt, ap) != 0) {
+        rec->fmt = NULL;
+        vsnprintf(rec->text, sizeof(rec->text), fmt, copy);
+    }
+    va_end(copy);
+
+    spsc_ring_commit(&r->ring);
+    wake_drain();
+    atomic_store_explicit(&r->writing, false, memory_order_release);
+    return 0;
+}
+
+void roj_log_write(roj_log_level_t level, const char* fmt, ...) {
+    va_list ap;
+
+    if (atomic_load_explicit(&g_async, memory_order_acquire)) {
+        va_start(ap, fmt);
+        int queued = enqueue(level, fmt, &ap);
+        va_end(ap);
+        if (queued == 0) {
+            return;
+        }
+    }
+
+    va_start(ap, fmt);
+    write_now(level, fmt, ap);
+    va_end(ap);
+}
+
+/* Drain */
+
+static size_t drain_ring(log_ring_t* r) {
+    /* Read first: a retired owner has published its last record */
+    int state = atomic_load_explicit(&r->state, memory_order_acquire);
+    size_t n = 0;
+    log_record_t* rec;
+
+    while ((rec = spsc_ring_peek(&r->ring)) != NULL) {
+        write_record(rec);
+        spsc_ring_pop(&r->ring);
+        n++;
+    }
+
+    uint64_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    if (dropped != r->dropped_seen) {
+        fprintf(stderr, "[WARN] Log: dropped %llu records, ring full\n",
+                (unsigned long long)(dropped - r->dropped_seen));
+        r->dropped_seen = dropped;
+        n++;
+    }
+
+    if (state == RING_RETIRED) {
+        atomic_store_explicit(&r->state, RING_FREE, memory_order_release);
+    }
+    return n;
+}
+
+static size_t drain_all(void) {
+    int count = atomic_load_explicit(&g_ring_count, memory_order_acquire);
+    if (count > ROJ_LOGGER_MAX_THREADS) count = ROJ_LOGGER_MAX_THREADS;
+
+    size_t n = 0;
+    for (int i = 0; i < count; i++) {
+        log_ring_t* r = atomic_load_explicit(&g_rings[i], memory_order_acquire);
+        if (r) {
+            n += drain_ring(r);
+        }
+    }
+    if (n > 0) {
+        fflush(stdout);
+    }
+    return n;
+}
+
+static void* drain_main(void* arg) {
+    (void)arg;
+
+    while (atomic_load_explicit(&g_draining, memory_order_acquire)) {
+        if (drain_all() > 0) {
+            continue;
+        }
+
+        /* Announce the sleep, then look once more: a record committed
+         * before the fence is drained here, any later one wakes us */
+        atomic_store_explicit(&g_drain_idle, true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (drain_all() > 0) {
+            atomic_store_explicit(&g_drain_idle, false, memory_order_relaxed);
+            continue;
+        }
+
+        pthread_mutex_lock(&g_wake_lock);
+        while (atomic_load_explicit(&g_drain_idle, memory_order_relaxed) &&
+               atomic_load_explicit(&g_draining, memory_order_acquire)) {
+            pthread_cond_wait(&g_wake, &g_wake_lock);
+        }
+        pthread_mutex_unlock(&g_wake_lock);
+    }
+    return NULL;
+}
+
+int roj_log_start(void) {
+    if (atomic_load_explicit(&g_draining, memory_order_acquire)) {
+        return 0;
+    }
+
+    atomic_store_explicit(&g_draining, true, memory_order_release);
+    if (pthread_create(&g_drain, NULL, drain_main, NULL) != 0) {
+        atomic_store_explicit(&g_draining, false, memory_order_release);
+        fprintf(stderr, "[ERROR] Log: failed to start the drain thread\n");
+        return -1;
+    }
+    atomic_store_explicit(&g_async, true, memory_order_release);
+    return 0;
+}
+
+void roj_log_stop(void) {
+    if (!atomic_load_explicit(&g_draining, memory_order_acquire)) {
+        return;
+    }
+
+    /* New records go straight out. Wait for any record a producer is still
+     * queueing, then for the drain to stop, and write what is left. */
+    atomic_store(&g_async, false);
+    int count = atomic_load(&g_ring_count);
+    if (count > ROJ_LOGGER_MAX_THREADS) count = ROJ_LOGGER_MAX_THREADS;
+    for (int i = 0; i < count; i++) {
+        log_ring_t* r = atomic_load(&g_rings[i]);
+        while (r && atomic_load(&r->writing)) {
+            sched_yield();
+        }
+    }
+
+    pthread_mutex_lock(&g_wake_lock);
+    atomic_store_explicit(&g_draining, false, memory_order_release);
+    pthread_cond_signal(&g_wake);
+    pthread_mutex_unlock(&g_wake_lock);
+    pthread_join(g_drain, NULL);
+    drain_all();
+}
+
+uint64_t roj_log_dropped(void) {
+    int count = atomic_load_explicit(&g_ring_count, memory_order_acquire);
+    if (count > ROJ_LOGGER_MAX_THREADS) count = ROJ_LOGGER_MAX_THREADS;
+
+    uint64_t dropped = 0;
+    for (int i = 0; i < count; i++) {
+        log_ring_t* r = atomic_load_explicit(&g_rings[i], memory_order_acquire);
+        if (r) {
+            dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        }
+    }
+    return dropped;
+}
+
+#endif /* ROJ_THREADS */
@@ -0,0 +1,54 @@
+/*
+ * ROJ Logger - leveled logger with an asynchronous per-thread ring
+ *
+ * ROJ_LOG() checks the level first, so a disabled record costs one relaxed
+ * load. Until roj_log_start(), enabled records are formatted and written
+ * on the calling thread. After it, the caller only copies the format
+ * pointer and its arguments (strings by value) into a record in its own
+ * thread's SPSC ring, and a background thread formats and writes them.
+ * A full ring drops the record and counts it; logging never blocks. The
+ * drain thread sleeps on a condition variable once every ring is empty and
+ * the first record after that wakes it, so an idle node has no wakeups.
+ *
+ * Formats must be string literals. Conversions are the usual printf ones
+ * without '*' widths; a record with more than ROJ_LOGGER_MAX_ARGS arguments
+ * or an unsupported conversion is formatted on the spot instead.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_LOGGER_H
+#define ROJ_LOGGER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "roj.h"
+
+#define ROJ_LOGGER_MAX_ARGS      8
+#define ROJ_LOGGER_RECORD_SIZE   256     /* bytes per ring slot */
+#define ROJ_LOGGER_RING_SLOTS    4096    /* records per thread */
+#define ROJ_LOGGER_MAX_THREADS   64
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ROJ_LOGGER_PRINTF(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define ROJ_LOGGER_PRINTF(fmt, args)
+#endif
+
+extern _Atomic int g_log_level;
+
+static inline bool roj_log_enabled(roj_log_level_t level) {
+    return (int)level <= atomic_load_explicit(&g_log_level, memory_order_relaxed);
+}
+
+/* Log one line (no trailing newline) at level, prefixed "[LEVEL] " */
+void roj_log_write(roj_log_level_t level, const char* fmt, ...) ROJ_LOGGER_PRINTF(2, 3);
+
+#define ROJ_LOG(level, ...)                     \
+    do {                                        \
+        if (roj_log_enabled(level)) {           \
+            roj_log_write((level), __VA_ARGS__); \
+        }                                       \
+    } while (0)
+
+#endif /* ROJ_LOGGER_H */
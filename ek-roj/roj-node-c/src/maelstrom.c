@@ -0,0 +1,573 @@
+/*
+ * ROJ Maelstrom - lin-kv node speaking Maelstrom's stdin/stdout protocol
+ *
+ * Maelstrom starts every node as a process and relays JSON messages, one
+ * per line, between their stdin and stdout. In this mode the node has no
+ * sockets: ROJ messages travel through Maelstrom as internal bodies
+ * (roj_announce, roj_propose, roj_vote, roj_commit, ...) holding the usual
+ * JSON encoding, so Maelstrom's latency and faults apply to consensus.
+ *
+ * In leader mode (--mode leader) every lin-kv operation is an entry in the
+ * replicated log, answered once it is applied on the node the client
+ * asked:
+ *   write k v      a SET entry; write_ok
+ *   cas k from to  a CAS entry, checked against the state at its index;
+ *                  cas_ok, or error 22 (precondition failed) / 20 (no key)
+ *   read k         a READ entry; read_ok with the value at its index
+ * so the history is linearizable. The cluster size is taken from init, so
+ * a minority never elects or commits. An operation not applied within
+ * MAELSTROM_OP_TIMEOUT_MS gets error 0 (timeout): it may still take effect.
+ *
+ * The default threshold mode maps lin-kv onto K-threshold consensus
+ * instead: write and cas propose k = v (cas once the local value is from),
+ * read returns the locally committed value. An own proposal that expires
+ * never commits anywhere, so its client gets a definite error 11
+ * (temporarily unavailable). Reads are local and CAS checks before it
+ * proposes, so concurrent clients can see stale values: that mode is for
+ * comparing throughput and latency with the Go and Rust nodes, and Knossos
+ * will flag it under contention.
+ *
+ * Node logs go to stderr; stdout carries protocol messages only.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "cJSON.h"
+#include "json_arena.h"
+#include "maelstrom.h"
+#include "node.h"
+#include "transport.h"
+#include "event_loop.h"
+#include "logger.h"
+
+#define MAELSTROM_MAX_NODES   (ROJ_MAX_PEERS + 1)
+#define MAELSTROM_MAX_PENDING 4096
+#define MAELSTROM_LINE_MAX    65536
+#define MAELSTROM_NET         0x0A4D0000u     /* 10.77.0.0: one made-up address per node */
+#define MAELSTROM_OP_TIMEOUT_MS 5000            /* leader mode: wait for an entry to apply */
+
+/* Maelstrom error codes */
+#define ERR_TIMEOUT           0
+#define ERR_NOT_SUPPORTED     10
+#define ERR_UNAVAILABLE       11
+#define ERR_MALFORMED         12
+#define ERR_NO_KEY            20
+#define ERR_PRECONDITION      22
+
+typedef struct {
+    uint64_t id;                        /* own proposal or log entry that answers it */
+    char client[ROJ_NODE_ID_MAX];
+    int64_t msg_id;
+    const char* reply;                  /* "write_ok", "cas_ok" or "read_ok" */
+    uint64_t deadline;                  /* leader mode: give up then */
+} pending_t;
+
+typedef struct {
+    roj_node_config_t config;
+    roj_node_t* node;                   /* NULL until init */
+    FILE* out;                          /* the original stdout */
+
+    char names[MAELSTROM_MAX_NODES][ROJ_NODE_ID_MAX];
+    struct sockaddr_in addrs[MAELSTROM_MAX_NODES];
+    int count;
+    int self;
+
+    pending_t pending[MAELSTROM_MAX_PENDING];
+    int pending_count;
+} maelstrom_t;
+
+static maelstrom_t g_mael;
+
+/* Output */
+
+static void send_body(maelstrom_t* m, const char* dest, const char* body) {
+    fprintf(m->out, "{\"src\":\"%s\",\"dest\":\"%s\",\"body\":%s}\n",
+            m->names[m->self], dest, body);
+}
+
+static void reply(maelstrom_t* m, const char* dest, int64_t msg_id, const char* type,
+                  const char* fields) {
+    fprintf(m->out, "{\"src\":\"%s\",\"dest\":\"%s\",\"body\":{\"type\":\"%s\","
+            "\"in_reply_to\":%lld%s}}\n",
+            m->names[m->self], dest, type, (long long)msg_id, fields);
+}
+
+static void reply_error(maelstrom_t* m, const char* dest, int64_t msg_id, int code,
+                        const char* text) {
+    char fields[160];
+    snprintf(fields, sizeof(fields), ",\"code\":%d,\"text\":\"%s\"", code, text);
+    reply(m, dest, msg_id, "error", fields);
+}
+
+/* ROJ messages as internal Maelstrom messages */
+
+static int node_for_addr(const maelstrom_t* m, const struct sockaddr_in* addr) {
+    uint32_t host = ntohl(addr->sin_addr.s_addr);
+    if (host <= MAELSTROM_NET || host > MAELSTROM_NET + (uint32_t)m->count) {
+        return -1;
+    }
+    return (int)(host - MAELSTROM_NET - 1);
+}
+
+static int node_for_name(const maelstrom_t* m, const char* name) {
+    for (int i = 0; i < m->count; i++) {
+        if (strcmp(m->names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Node send hook: re-tag the JSON encoding as roj_<type> for each target */
+static void send_roj(const roj_message_t* msg, const struct sockaddr_in* addrs, int count,
+                     void* ctx) {
+    maelstrom_t* m = ctx;
+    char json[ROJ_MSG_MAX_SIZE];
+    char body[ROJ_MSG_MAX_SIZE + 32];
+    char type[32];
+
+    if (message_to_json(msg, json, sizeof(json)) < 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Maelstrom: cannot encode %s", msg_type_to_str(msg->type));
+        return;
+    }
+
+    /* The encoding always opens with the type: {"type":"PROPOSE",... */
+    const char* name = msg_type_to_str(msg->type);
+    size_t prefix = strlen("{\"type\":\"") + strlen(name) + 1;
+    size_t i;
+    for (i = 0; name[i] != '\0' && i < sizeof(type) - 1; i++) {
+        type[i] = (char)(name[i] >= 'A' && name[i] <= 'Z' ? name[i] - 'A' + 'a' : name[i]);
+    }
+    type[i] = '\0';
+    snprintf(body, sizeof(body), "{\"type\":\"roj_%s\"%s", type, json + prefix);
+
+    for (int a = 0; a < count; a++) {
+        if (addrs[a].sin_addr.s_addr == htonl(INADDR_BROADCAST)) {
+            for (int n = 0; n < m->count; n++) {
+                if (n != m->self) {
+                    send_body(m, m->names[n], body);
+                }
+            }
+            continue;
+        }
+        int n = node_for_addr(m, &addrs[a]);
+        if (n >= 0 && n != m->self) {
+            send_body(m, m->names[n], body);
+        }
+    }
+}
+
+/* type is the body's own "type" string past "roj_" */
+static void handle_roj(maelstrom_t* m, const char* src, cJSON* body, char* type) {
+    roj_message_t msg;
+
+    int from = node_for_name(m, src);
+    if (from < 0 || !m->node) {
+        return;
+    }
+
+    /* Back to the plain encoding: "roj_propose" becomes "PROPOSE" in place */
+    char* t = type - 4;
+    for (size_t i = 0; ; i++) {
+        char c = type[i];
+        t[i] = (char)(c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c);
+        if (c == '\0') {
+            break;
+        }
+    }
+
+    char* json = cJSON_PrintUnformatted(body);
+    if (json && message_from_json(json, &msg) == 0) {
+        roj_node_deliver(m->node, &msg, &m->addrs[from]);
+    } else {
+        ROJ_LOG(ROJ_LOG_WARN, "Maelstrom: cannot decode %s from %s", t, src);
+    }
+    cJSON_free(json);
+}
+
+/* lin-kv */
+
+static void on_outcome(roj_node_t* node, uint64_t id, bool committed, void* ctx) {
+    maelstrom_t* m = ctx;
+    (void)node;
+
+    for (int i = 0; i < m->pending_count; i++) {
+        pending_t* p = &m->pending[i];
+        if (p->id != id) {
+            continue;
+        }
+        if (committed) {
+            reply(m, p->client, p->msg_id, p->reply, "");
+        } else {
+            reply_error(m, p->client, p->msg_id, ERR_UNAVAILABLE, "proposal expired");
+        }
+        *p = m->pending[--m->pending_count];
+        return;
+    }
+}
+
+/* Leader mode: one of our log entries was applied */
+static void on_applied(roj_node_t* node, uint64_t id, roj_op_result_t result, int64_t value,
+                       void* ctx) {
+    maelstrom_t* m = ctx;
+    char fields[64] = "";
+    (void)node;
+
+    for (int i = 0; i < m->pending_count; i++) {
+        pending_t* p = &m->pending[i];
+        if (p->id != id) {
+            continue;
+        }
+        if (result == ROJ_OP_NO_KEY) {
+            reply_error(m, p->client, p->msg_id, ERR_NO_KEY, "no such key");
+        } else if (result == ROJ_OP_DIFFERS) {
+            reply_error(m, p->client, p->msg_id, ERR_PRECONDITION, "value differs");
+        } else {
+            if (strcmp(p->reply, "read_ok") == 0) {
+                snprintf(fields, sizeof(fields), ",\"value\":%lld", (long long)value);
+            }
+            reply(m, p->client, p->msg_id, p->reply, fields);
+        }
+        *p = m->pending[--m->pending_count];
+        return;
+    }
+}
+
+/* Leader mode: answer operations whose entry never applied */
+static void expire_pending(maelstrom_t* m) {
+    uint64_t now = evloop_now_ms();
+
+    for (int i = 0; i < m->pending_count; ) {
+        pending_t* p = &m->pending[i];
+        if (p->deadline > now) {
+            i++;
+            continue;
+        }
+        reply_error(m, p->client, p->msg_id, ERR_TIMEOUT, "not applied in time");
+        *p = m->pending[--m->pending_count];
+    }
+}
+
+/* Maelstrom keys are usually integers; ROJ keys are strings */
+static int key_of(const cJSON* body, char* key, size_t size) {
+    const cJSON* k = cJSON_GetObjectItem(body, "key");
+    if (cJSON_IsNumber(k)) {
+        snprintf(key, size, "%lld", (long long)k->valuedouble);
+        return 0;
+    }
+    if (cJSON_IsString(k) && strlen(k->valuestring) < size) {
+        strcpy(key, k->valuestring);
+        return 0;
+    }
+    return -1;
+}
+
+static int int_of(const cJSON* body, const char* name, int64_t* value) {
+    const cJSON* v = cJSON_GetObjectItem(body, name);
+    if (!cJSON_IsNumber(v)) {
+        return -1;
+    }
+    *value = (int64_t)v->valuedouble;
+    return 0;
+}
+
+static void propose(maelstrom_t* m, const char* src, int64_t msg_id, const char* key,
+                    int64_t value, const char* ok) {
+    uint64_t id;
+
+    if (m->pending_count == MAELSTROM_MAX_PENDING ||
+        roj_node_propose_id(m->node, key, value, &id) != 0) {
+        reply_error(m, src, msg_id, ERR_UNAVAILABLE, "cannot propose");
+        return;
+    }
+
+    pending_t* p = &m->pending[m->pending_count++];
+    p->id = id;
+    snprintf(p->client, sizeof(p->client), "%s", src);
+    p->msg_id = msg_id;
+    p->reply = ok;
+    p->deadline = 0;
+}
+
+/* Leader mode: put the operation in the log, answer when it is applied */
+static void submit(maelstrom_t* m, const char* src, int64_t msg_id, roj_op_t op,
+                   const char* key, int64_t value, int64_t expect, const char* ok) {
+    uint64_t id;
+
+    if (m->pending_count == MAELSTROM_MAX_PENDING ||
+        roj_node_submit(m->node, op, key, value, expect, &id) != 0) {
+        reply_error(m, src, msg_id, ERR_UNAVAILABLE, "cannot submit");
+        return;
+    }
+
+    pending_t* p = &m->pending[m->pending_count++];
+    p->id = id;
+    snprintf(p->client, sizeof(p->client), "%s", src);
+    p->msg_id = msg_id;
+    p->reply = ok;
+    p->deadline = evloop_now_ms() + MAELSTROM_OP_TIMEOUT_MS;
+}
+
+static void handle_kv(maelstrom_t* m, const char* src, int64_t msg_id, const cJSON* body,
+                      const char* type) {
+    char key[ROJ_KEY_MAX];
+    char fields[64];
+    int64_t value, from, to;
+
+    if (key_of(body, key, sizeof(key)) != 0) {
+        reply_error(m, src, msg_id, ERR_MALFORMED, "bad key");
+        return;
+    }
+
+    if (m->config.leader_mode) {
+        if (strcmp(type, "read") == 0) {
+            submit(m, src, msg_id, ROJ_OP_READ, key, 0, 0, "read_ok");
+        } else if (strcmp(type, "write") == 0) {
+            if (int_of(body, "value", &value) != 0) {
+                reply_error(m, src, msg_id, ERR_MALFORMED, "bad value");
+                return;
+            }
+            submit(m, src, msg_id, ROJ_OP_SET, key, value, 0, "write_ok");
+        } else {
+            if (int_of(body, "from", &from) != 0 || int_of(body, "to", &to) != 0) {
+                reply_error(m, src, msg_id, ERR_MALFORMED, "bad from/to");
+                return;
+            }
+            submit(m, src, msg_id, ROJ_OP_CAS, key, to, from, "cas_ok");
+        }
+        return;
+    }
+
+    if (strcmp(type, "read") == 0) {
+        if (roj_node_get(m->node, key, &value) != 0) {
+            reply_error(m, src, msg_id, ERR_NO_KEY, "no such key");
+            return;
+        }
+        snprintf(fields, sizeof(fields), ",\"value\":%lld", (long long)value);
+        reply(m, src, msg_id, "read_ok", fields);
+    }
+    else if (strcmp(type, "write") == 0) {
+        if (int_of(body, "value", &value) != 0) {
+            reply_error(m, src, msg_id, ERR_MALFORMED, "bad value");
+            return;
+        }
+        propose(m, src, msg_id, key, value, "write_ok");
+    }
+    else {
+        if (int_of(body, "from", &from) != 0 || int_of(body, "to", &to) != 0) {
+            reply_error(m, src, msg_id, ERR_MALFORMED, "bad from/to");
+            return;
+        }
+        if (roj_node_get(m->node, key, &value) != 0) {
+            reply_error(m, src, msg_id, ERR_NO_KEY, "no such key");
+            return;
+        }
+        if (value != from) {
+            reply_error(m, src, msg_id, ERR_PRECONDITION, "value differs");
+            return;
+        }
+        propose(m, src, msg_id, key, to, "cas_ok");
+    }
+}
+
+/* Setup */
+
+static uint64_t seed_for(const char* name) {
+    /* FNV-1a of the node ID, mixed with the clock so restarts differ */
+    uint64_t h = 1469598103934665603ULL;
+    for (const char* c = name; *c; c++) {
+        h = (h ^ (uint8_t)*c) * 1099511628211ULL;
+    }
+    return h ^ evloop_now_ms();
+}
+
+static void handle_init(maelstrom_t* m, const char* src, int64_t msg_id, const cJSON* body) {
+    const cJSON* id = cJSON_GetObjectItem(body, "node_id");
+    const cJSON* ids = cJSON_GetObjectItem(body, "node_ids");
+
+    if (m->node || !cJSON_IsString(id) || !cJSON_IsArray(ids) ||
+        cJSON_GetArraySize(ids) > MAELSTROM_MAX_NODES) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Maelstrom: unusable init");
+        return;
+    }
+
+    m->count = 0;
+    m->self = -1;
+    for (int i = 0; i < cJSON_GetArraySize(ids); i++) {
+        const cJSON* item = cJSON_GetArrayItem(ids, i);
+        if (!cJSON_IsString(item) || strlen(item->valuestring) >= ROJ_NODE_ID_MAX) {
+            ROJ_LOG(ROJ_LOG_ERROR, "Maelstrom: unusable node ID in init");
+            return;
+        }
+        strcpy(m->names[m->count], item->valuestring);
+        m->addrs[m->count].sin_family = AF_INET;
+        m->addrs[m->count].sin_addr.s_addr = htonl(MAELSTROM_NET + (uint32_t)m->count + 1);
+        m->addrs[m->count].sin_port = htons((uint16_t)m->config.port);
+        if (strcmp(item->valuestring, id->valuestring) == 0) {
+            m->self = m->count;
+        }
+        m->count++;
+    }
+    if (m->self < 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Maelstrom: %s is not among node_ids", id->valuestring);
+        return;
+    }
+
+    /* Origins by rank in the sorted member list: unique, and the same
+     * numbering on every node whatever order init lists them in */
+    int rank = 0;
+    for (int i = 0; i < m->count; i++) {
+        if (strcmp(m->names[i], m->names[m->self]) < 0) {
+            rank++;
+        }
+    }
+
+    roj_node_env_t env = {
+        .send = send_roj,
+        .send_ctx = m,
+        .clock = evloop_now_ms,
+        .seed = seed_for(id->valuestring),
+        .origin = (uint16_t)(rank + 1),
+    };
+    m->config.node_id = m->names[m->self];
+    if (m->config.cluster_size == 0) {
+        m->config.cluster_size = m->count;
+    }
+    m->node = roj_node_create_env(&m->config, &env);
+    if (!m->node) {
+        return;
+    }
+    if (m->config.leader_mode) {
+        roj_node_on_applied(m->node, on_applied, m);
+    } else {
+        roj_node_on_outcome(m->node, on_outcome, m);
+    }
+
+    ROJ_LOG(ROJ_LOG_INFO, "Maelstrom: %s initialized with %d nodes", m->names[m->self],
+            m->count);
+    reply(m, src, msg_id, "init_ok", "");
+}
+
+static void handle_line(maelstrom_t* m, const char* line) {
+    cJSON* root = cJSON_Parse(line);
+    const cJSON* src = cJSON_GetObjectItem(root, "src");
+    cJSON* body = cJSON_GetObjectItem(root, "body");
+    cJSON* type = cJSON_GetObjectItem(body, "type");
+
+    if (!cJSON_IsString(src) || !cJSON_IsObject(body) || !cJSON_IsString(type)) {
+        ROJ_LOG(ROJ_LOG_WARN, "Maelstrom: ignoring malformed message");
+        cJSON_Delete(root);
+        return;
+    }
+
+    int64_t msg_id = 0;
+    int_of(body, "msg_id", &msg_id);
+
+    char* t = type->valuestring;
+    if (strncmp(t, "roj_", 4) == 0) {
+        handle_roj(m, src->valuestring, body, t + 4);
+    } else if (strcmp(t, "init") == 0) {
+        handle_init(m, src->valuestring, msg_id, body);
+    } else if (!m->node) {
+        ROJ_LOG(ROJ_LOG_WARN, "Maelstrom: %s before init", t);
+    } else if (strcmp(t, "read") == 0 || strcmp(t, "write") == 0 || strcmp(t, "cas") == 0) {
+        handle_kv(m, src->valuestring, msg_id, body, t);
+    } else {
+        reply_error(m, src->valuestring, msg_id, ERR_NOT_SUPPORTED, "not supported");
+    }
+    cJSON_Delete(root);
+}
+
+/* Time until the node's next timer, for poll() */
+static int poll_timeout(const maelstrom_t* m) {
+    if (!m->node) {
+        return -1;
+    }
+    uint64_t next = roj_node_next_deadline(m->node);
+    uint64_t now = evloop_now_ms();
+    if (next == UINT64_MAX) {
+        return -1;
+    }
+    return next <= now ? 0 : next - now > INT_MAX ? INT_MAX : (int)(next - now);
+}
+
+int maelstrom_run(const roj_node_config_t* config) {
+    maelstrom_t* m = &g_mael;
+    static char buf[MAELSTROM_LINE_MAX];
+    size_t len = 0;
+
+    memset(m, 0, sizeof(*m));
+    m->config = *config;
+    json_arena_install();
+    if (!m->config.leader_mode && m->config.batch_max > 1) {
+        fprintf(stderr, "[WARN] Maelstrom: lin-kv runs threshold mode without batching\n");
+        m->config.batch_max = 1;
+    }
+
+    /* Keep the protocol stream to ourselves; every log goes to stderr */
+    int out = dup(STDOUT_FILENO);
+    if (out < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 || !(m->out = fdopen(out, "w"))) {
+        fprintf(stderr, "[ERROR] Maelstrom: cannot set up stdout\n");
+        return 1;
+    }
+
+#ifdef ROJ_THREADS
+    roj_log_start();
+#endif
+
+    for (;;) {
+        struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+        int rc = poll(&pfd, 1, poll_timeout(m));
+        if (rc < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (rc > 0) {
+            ssize_t n = read(STDIN_FILENO, buf + len, sizeof(buf) - 1 - len);
+            if (n <= 0) {
+                break;
+            }
+            len += (size_t)n;
+            buf[len] = '\0';
+
+            char* start = buf;
+            char* nl;
+            while ((nl = strchr(start, '\n')) != NULL) {
+                *nl = '\0';
+                /* The envelope and everything the node sends in reply share one scope */
+                json_arena_begin();
+                handle_line(m, start);
+                json_arena_end();
+                start = nl + 1;
+            }
+            len -= (size_t)(start - buf);
+            if (len == sizeof(buf) - 1) {
+                ROJ_LOG(ROJ_LOG_WARN, "Maelstrom: dropping an overlong line");
+                len = 0;
+            } else {
+                memmove(buf, start, len);
+            }
+        }
+
+        if (m->node) {
+            roj_node_poll(m->node, 0);
+            if (m->config.leader_mode && m->pending_count > 0) {
+                expire_pending(m);
+            }
+        }
+        fflush(m->out);
+    }
+
+    roj_node_destroy(m->node);
+    fclose(m->out);
+    roj_log_stop();
+    return 0;
+}
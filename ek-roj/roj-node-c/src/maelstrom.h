@@ -0,0 +1,17 @@
+/*
+ * ROJ Maelstrom - lin-kv node speaking Maelstrom's stdin/stdout protocol
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_MAELSTROM_H
+#define ROJ_MAELSTROM_H
+
+#include "roj.h"
+
+/* Serve Maelstrom on stdin/stdout until stdin closes. The node ID and its
+ * peers come from Maelstrom's init message; the rest of config applies.
+ * Returns the process exit status. */
+int maelstrom_run(const roj_node_config_t* config);
+
+#endif /* ROJ_MAELSTROM_H */
@@ -1,7 +1,8 @@
 /*
  * ROJ Node - C Implementation
  *
- * Distributed consensus node for the ROJ protocol.
+ * Distributed consensus node for the ROJ protocol: the command line front
+ * end of libroj.
  *
  * SPDX-License-Identifier: AGPL-3.0
  */
@@ -14,23 +15,22 @@
 #ifdef _WIN32
 #include <winsock2.h>
 #include <windows.h>
-#define usleep(x) Sleep((x)/1000)
 #else
 #include <unistd.h>
-#include <sys/select.h>
 #endif
 
-#include "types.h"
-#include "discovery.h"
-#include "transport.h"
-#include "consensus.h"
+#include "roj.h"
+#ifndef _WIN32
+#include "maelstrom.h"
+#endif
 
-static volatile int g_running = 1;
-static char g_node_id[ROJ_NODE_ID_MAX];
+static roj_node_t* g_node = NULL;
 
 static void signal_handler(int sig) {
     (void)sig;
-    g_running = 0;
+    if (g_node) {
+        roj_node_stop(g_node);
+    }
 }
 
 static void print_help(void) {
@@ -38,203 +38,294 @@ static void print_help(void) {
     printf("  propose <key> <value>  - Propose a consensus value\n");
     printf("  state                  - Show committed state\n");
     printf("  peers                  - Show discovered peers\n");
+    printf("  iostats                - Show datagrams moved per syscall\n");
+    printf("  stats                  - Show message counters and commit latencies\n");
+    printf("  snapshot               - Write a state snapshot (with --data-dir)\n");
+    printf("  loglevel <level>       - Log error, warn, info or debug records\n");
+    if (roj_node_is_leader_mode(g_node)) {
+        printf("  leader                 - Show role, term and log position\n");
+    }
     printf("  quit                   - Exit\n\n");
 }
 
-static void handle_stdin(void) {
-    char line[256];
-    if (fgets(line, sizeof(line), stdin) == NULL) {
-        return;
-    }
-
+static void handle_command(char* line) {
     /* Remove newline */
     line[strcspn(line, "\r\n")] = '\0';
 
-    char cmd[64], key[64];
+    char key[64];
     int64_t value;
+    char level_name[16];
+    roj_log_level_t level;
 
     if (sscanf(line, "propose %63s %lld", key, (long long*)&value) == 2) {
-        roj_message_t msg;
-        if (consensus_create_proposal(key, value, &msg) == 0) {
-            struct sockaddr_in addrs[ROJ_MAX_PEERS];
-            int count = discovery_get_peer_addrs(addrs, ROJ_MAX_PEERS);
-
-            if (count == 0) {
-                printf("[INFO] No peers discovered yet\n");
-            } else {
-                transport_broadcast(&msg, addrs, count);
-            }
-        }
+        roj_node_propose(g_node, key, value);
     }
     else if (strncmp(line, "state", 5) == 0) {
-        consensus_print_state();
+        roj_node_print_state(g_node);
     }
     else if (strncmp(line, "peers", 5) == 0) {
-        roj_peer_list_t* peers = discovery_get_peers();
-        printf("Discovered peers:\n");
-        if (peers->count == 0) {
-            printf("  (none)\n");
+        roj_node_print_peers(g_node);
+    }
+    else if (strncmp(line, "iostats", 7) == 0) {
+        roj_node_print_stats(g_node);
+    }
+    else if (strncmp(line, "stats", 5) == 0) {
+        roj_node_print_metrics(g_node);
+    }
+    else if (strncmp(line, "snapshot", 8) == 0) {
+        if (roj_node_snapshot(g_node) < 0) {
+            printf("No snapshot started (needs --data-dir, errors are logged)\n");
+        }
+    }
+    else if (sscanf(line, "loglevel %15s", level_name) == 1) {
+        if (roj_log_parse_level(level_name, &level) == 0) {
+            roj_log_set_level(level);
         } else {
-            for (int i = 0; i < peers->count; i++) {
-                if (peers->peers[i].active) {
-                    char addr_str[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &peers->peers[i].addr.sin_addr,
-                              addr_str, sizeof(addr_str));
-                    printf("  %s (%s) at %s:%d\n",
-                           peers->peers[i].node_id,
-                           lang_to_str(peers->peers[i].lang),
-                           addr_str,
-                           ntohs(peers->peers[i].addr.sin_port));
-                }
-            }
+            printf("Unknown level. Try: error, warn, info or debug\n");
         }
     }
+    else if (roj_node_is_leader_mode(g_node) && strncmp(line, "leader", 6) == 0) {
+        roj_node_print_status(g_node);
+    }
     else if (strncmp(line, "quit", 4) == 0 || strncmp(line, "exit", 4) == 0) {
-        g_running = 0;
+        roj_node_stop(g_node);
     }
     else if (strlen(line) > 0) {
         printf("Unknown command. Try: propose <key> <value>\n");
     }
 }
 
-static void handle_message(const roj_message_t* msg, const struct sockaddr_in* from) {
-    switch (msg->type) {
-        case MSG_ANNOUNCE:
-            /* Update peer list */
-            discovery_update_peer(msg->data.announce.node_id,
-                                  msg->data.announce.lang,
-                                  from,
-                                  msg->data.announce.version);
-            break;
-
-        case MSG_PROPOSE:
-            if (strcmp(msg->data.propose.from, g_node_id) != 0) {
-                roj_message_t vote;
-                if (consensus_handle_propose(msg, &vote) == 0) {
-                    transport_send(&vote, from);
-                }
-            }
-            break;
-
-        case MSG_VOTE:
-            if (strcmp(msg->data.vote.from, g_node_id) != 0) {
-                roj_message_t commit;
-                int peer_count = discovery_peer_count();
-                if (consensus_handle_vote(msg, &commit, peer_count) == 0) {
-                    /* Broadcast commit */
-                    struct sockaddr_in addrs[ROJ_MAX_PEERS];
-                    int count = discovery_get_peer_addrs(addrs, ROJ_MAX_PEERS);
-                    transport_broadcast(&commit, addrs, count);
-                }
-            }
-            break;
-
-        case MSG_COMMIT:
-            consensus_handle_commit(msg);
-            break;
+static void on_stdin(roj_node_t* node, int fd, void* ctx) {
+    (void)ctx;
+#ifdef _WIN32
+    char line[256];
+    (void)node;
+    (void)fd;
+    if (fgets(line, sizeof(line), stdin) != NULL) {
+        handle_command(line);
+    }
+#else
+    /* Read the fd directly: stdio buffering would hide queued lines from epoll */
+    static char buf[1024];
+    static size_t len = 0;
+
+    ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+    if (n <= 0) {
+        /* EOF: keep serving the network, stop watching stdin */
+        roj_node_unwatch_fd(node, fd);
+        return;
+    }
+    len += (size_t)n;
+    buf[len] = '\0';
+
+    char* start = buf;
+    char* nl;
+    while ((nl = strchr(start, '\n')) != NULL) {
+        *nl = '\0';
+        handle_command(start);
+        start = nl + 1;
+    }
 
-        default:
-            break;
+    len -= (size_t)(start - buf);
+    if (len == sizeof(buf) - 1) {
+        /* Overlong line without newline: handle what we have */
+        handle_command(buf);
+        len = 0;
+    } else {
+        memmove(buf, start, len);
     }
+#endif
+}
+
+static void print_usage(const char* prog) {
+#ifdef ROJ_THREADS
+    printf("Usage: %s --name <node_id> [--port <port>] [--mode threshold|leader] "
+           "[--cluster-size <n>] [--wire json|binary] "
+           "[--batch <n>] [--batch-delay <ms>] [--agg-delay <ms>] [--shards <k>] "
+           "[--data-dir <dir>] [--wal-sync <ms>] [--snapshot-every <n>] "
+           "[--metrics-file <path>] [--metrics-interval <ms>] "
+           "[--log-level <level>] [--io-threads <n>]\n", prog);
+#else
+    printf("Usage: %s --name <node_id> [--port <port>] [--mode threshold|leader] "
+           "[--cluster-size <n>] [--wire json|binary] "
+           "[--batch <n>] [--batch-delay <ms>] [--agg-delay <ms>] [--shards <k>] "
+           "[--data-dir <dir>] [--wal-sync <ms>] [--snapshot-every <n>] "
+           "[--metrics-file <path>] [--metrics-interval <ms>] "
+           "[--log-level <level>]\n", prog);
+#endif
+#ifndef _WIN32
+    printf("       %s --maelstrom [options]   (Maelstrom lin-kv node on stdin/stdout)\n",
+           prog);
+#endif
+    printf("       --cluster-size <n> required in leader mode: never elect or commit with "
+           "fewer than\n"
+           "                          a majority of n nodes, even before they are all "
+           "discovered\n");
+    printf("       --wal-sync <ms>    group fsync window: commits are acknowledged once "
+           "the window's\n"
+           "                          fsync returns, so a burst shares one (0: fsync each "
+           "commit)\n");
+#ifdef ROJ_HISTORY
+    printf("       --history <path>   also write an Elle history of own proposals "
+           "on exit (EDN if *.edn, else JSON)\n");
+#endif
 }
 
 int main(int argc, char* argv[]) {
-    int port = ROJ_UDP_PORT;
+    roj_node_config_t config;
+    bool maelstrom = false;
+#ifdef ROJ_HISTORY
+    const char* history_file = NULL;
+#endif
+    roj_node_config_defaults(&config);
 
     /* Parse arguments */
     for (int i = 1; i < argc; i++) {
         if ((strcmp(argv[i], "--name") == 0 || strcmp(argv[i], "-n") == 0) && i + 1 < argc) {
-            strncpy(g_node_id, argv[++i], ROJ_NODE_ID_MAX - 1);
+            config.node_id = argv[++i];
         }
         else if ((strcmp(argv[i], "--port") == 0 || strcmp(argv[i], "-p") == 0) && i + 1 < argc) {
-            port = atoi(argv[++i]);
+            config.port = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "leader") == 0) {
+                config.leader_mode = true;
+            } else if (strcmp(mode, "threshold") != 0) {
+                fprintf(stderr, "Error: unknown mode \"%s\"\n", mode);
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cluster-size") == 0 && i + 1 < argc) {
+            config.cluster_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--wire") == 0 && i + 1 < argc) {
+            /* "json" stops advertising the binary encoding to peers */
+            config.json_only = strcmp(argv[++i], "json") == 0;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            config.batch_max = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--batch-delay") == 0 && i + 1 < argc) {
+            config.batch_delay_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--agg-delay") == 0 && i + 1 < argc) {
+            config.agg_delay_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--data-dir") == 0 && i + 1 < argc) {
+            config.data_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--wal-sync") == 0 && i + 1 < argc) {
+            /* 0: fsync every commit; otherwise group commits for up to N ms */
+            config.wal_sync_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--snapshot-every") == 0 && i + 1 < argc) {
+            config.snapshot_every = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+            config.metrics_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+            config.metrics_interval_ms = atoi(argv[++i]);
         }
+        else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            roj_log_level_t level;
+            if (roj_log_parse_level(argv[++i], &level) != 0) {
+                fprintf(stderr, "Error: unknown log level \"%s\"\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            roj_log_set_level(level);
+        }
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            config.shards = atoi(argv[++i]);
+        }
+#ifndef _WIN32
+        else if (strcmp(argv[i], "--maelstrom") == 0) {
+            maelstrom = true;
+        }
+#endif
+#ifdef ROJ_HISTORY
+        else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            history_file = argv[++i];
+        }
+#endif
+#ifdef ROJ_THREADS
+        else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            config.io_threads = atoi(argv[++i]);
+        }
+#endif
         else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
-            printf("Usage: %s --name <node_id> [--port <port>]\n", argv[0]);
+            print_usage(argv[0]);
             return 0;
         }
     }
 
-    if (strlen(g_node_id) == 0) {
-        fprintf(stderr, "Error: --name is required\n");
-        fprintf(stderr, "Usage: %s --name <node_id> [--port <port>]\n", argv[0]);
-        return 1;
-    }
-
-    /* Setup signal handlers */
-    signal(SIGINT, signal_handler);
 #ifndef _WIN32
-    signal(SIGTERM, signal_handler);
+    if (maelstrom) {
+        /* The node ID and its peers arrive in Maelstrom's init message */
+        int status = maelstrom_run(&config);
+#ifdef ROJ_HISTORY
+        if (history_file && roj_history_dump(history_file) != 0) {
+            status = 1;
+        }
+#endif
+        return status;
+    }
 #endif
 
-    printf("[INFO] ROJ node \"%s\" starting (c)\n", g_node_id);
-
-    /* Initialize subsystems */
-    if (discovery_init(g_node_id, LANG_C) != 0) {
-        fprintf(stderr, "[ERROR] Failed to initialize discovery\n");
+    if (!config.node_id || strlen(config.node_id) == 0) {
+        fprintf(stderr, "Error: --name is required\n");
+        print_usage(argv[0]);
         return 1;
     }
-
-    if (transport_init(port) != 0) {
-        fprintf(stderr, "[ERROR] Failed to initialize transport\n");
+    if (config.leader_mode && config.cluster_size <= 0) {
+        fprintf(stderr, "Error: --mode leader needs --cluster-size\n");
+        print_usage(argv[0]);
         return 1;
     }
 
-    if (consensus_init(g_node_id) != 0) {
-        fprintf(stderr, "[ERROR] Failed to initialize consensus\n");
+    printf("[INFO] ROJ node \"%s\" starting (c)\n", config.node_id);
+
+    g_node = roj_node_create(&config);
+    if (!g_node) {
         return 1;
     }
 
-    print_help();
-
-    int sock = transport_get_socket();
-    fd_set readfds;
-    struct timeval tv;
+#ifdef ROJ_THREADS
+    /* Keep formatting and stdout writes off the message path */
+    roj_log_start();
+#endif
 
-    /* Main event loop */
-    while (g_running) {
-        FD_ZERO(&readfds);
-        FD_SET(sock, &readfds);
+    /* Setup signal handlers */
+    signal(SIGINT, signal_handler);
 #ifndef _WIN32
-        FD_SET(STDIN_FILENO, &readfds);
-        int maxfd = sock > STDIN_FILENO ? sock : STDIN_FILENO;
-#else
-        int maxfd = sock;
-        /* On Windows, check stdin separately */
-        if (_kbhit()) {
-            handle_stdin();
-        }
+    signal(SIGTERM, signal_handler);
 #endif
 
-        tv.tv_sec = 0;
-        tv.tv_usec = 100000;  /* 100ms timeout */
-
-        int ret = select(maxfd + 1, &readfds, NULL, NULL, &tv);
-        if (ret < 0) {
-            break;
-        }
+#ifdef _WIN32
+    roj_node_watch_fd(g_node, 0, on_stdin, NULL);
+#else
+    roj_node_watch_fd(g_node, STDIN_FILENO, on_stdin, NULL);
+#endif
 
-        if (ret > 0) {
-            if (FD_ISSET(sock, &readfds)) {
-                roj_message_t msg;
-                struct sockaddr_in from;
-                if (transport_recv(&msg, &from) == 0) {
-                    handle_message(&msg, &from);
-                }
-            }
+    print_help();
 
-#ifndef _WIN32
-            if (FD_ISSET(STDIN_FILENO, &readfds)) {
-                handle_stdin();
-            }
-#endif
-        }
-    }
+    /* Main event loop: sleeps until a datagram, a command or a timer */
+    roj_node_run(g_node);
 
     printf("\n[INFO] Shutting down...\n");
 
-    transport_shutdown();
-    discovery_shutdown();
+    roj_node_t* node = g_node;
+    g_node = NULL;
+    roj_node_destroy(node);
+    roj_log_stop();
 
+#ifdef ROJ_HISTORY
+    if (history_file && roj_history_dump(history_file) != 0) {
+        return 1;
+    }
+#endif
     return 0;
 }
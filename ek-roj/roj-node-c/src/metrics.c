@@ -0,0 +1,304 @@
+/*
+ * ROJ Metrics - counters, HDR-style histograms and Prometheus text output
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+#include "json_arena.h"
+#include "roj.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/* Prometheus buckets: powers of two from ~1 us to ~69 s */
+#define PROM_FIRST_SHIFT  10
+#define PROM_LAST_SHIFT   36
+
+#define HIST_SUB          (1u << ROJ_HIST_SUB_BITS)
+
+static const char* g_dir_names[ROJ_METRIC_DIRECTIONS] = { "rx", "tx" };
+
+void metrics_init(roj_metrics_t* m) {
+    memset(m, 0, sizeof(*m));
+}
+
+uint64_t metrics_now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static int highest_bit(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(x);
+#else
+    int n = 0;
+    while (x >>= 1) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Histograms */
+
+static int bucket_index(uint64_t ns) {
+    if (ns < 2 * HIST_SUB) {
+        return (int)ns;
+    }
+    int shift = highest_bit(ns) - ROJ_HIST_SUB_BITS;
+    if (shift > ROJ_HIST_MAX_SHIFT) {
+        return ROJ_HIST_BUCKETS - 1;
+    }
+    return (shift << ROJ_HIST_SUB_BITS) + (int)(ns >> shift);
+}
+
+/* Largest value that falls into bucket index */
+static uint64_t bucket_upper(int index) {
+    if (index < (int)(2 * HIST_SUB)) {
+        return (uint64_t)index;
+    }
+    int shift = (index >> ROJ_HIST_SUB_BITS) - 1;
+    uint64_t mantissa = (uint64_t)(index - (shift << ROJ_HIST_SUB_BITS));
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void histogram_record(roj_histogram_t* h, uint64_t ns) {
+    metrics_inc(&h->buckets[bucket_index(ns)], 1);
+    metrics_inc(&h->count, 1);
+    metrics_inc(&h->sum, ns);
+
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (ns > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &max, ns,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+static uint64_t load(const _Atomic uint64_t* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+uint64_t histogram_quantile(const roj_histogram_t* h, double q) {
+    uint64_t count = load(&h->count);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(q * (double)count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+
+    uint64_t seen = 0;
+    uint64_t max = load(&h->max);
+    for (int i = 0; i < ROJ_HIST_BUCKETS; i++) {
+        seen += load(&h->buckets[i]);
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+/* Human-readable output */
+
+static void print_duration(uint64_t ns) {
+    if (ns < 10000) {
+        printf("%lluns", (unsigned long long)ns);
+    } else if (ns < 10000000) {
+        printf("%.1fus", (double)ns / 1e3);
+    } else {
+        printf("%.1fms", (double)ns / 1e6);
+    }
+}
+
+static void print_histogram(const char* name, const roj_histogram_t* h) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char* labels[] = { "p50", "p90", "p99", "p99.9" };
+    uint64_t count = load(&h->count);
+
+    printf("  %s: %llu samples", name, (unsigned long long)count);
+    if (count == 0) {
+        printf("\n");
+        return;
+    }
+    printf(", mean ");
+    print_duration(load(&h->sum) / count);
+    for (int i = 0; i < 4; i++) {
+        printf(", %s ", labels[i]);
+        print_duration(histogram_quantile(h, quantiles[i]));
+    }
+    printf(", max ");
+    print_duration(load(&h->max));
+    printf("\n");
+}
+
+void metrics_print(const roj_metrics_t* m, const roj_transport_stats_t* io) {
+    printf("Metrics:\n");
+    for (int dir = 0; dir < ROJ_METRIC_DIRECTIONS; dir++) {
+        bool any = false;
+        printf("  %s:", g_dir_names[dir]);
+        for (int type = 0; type <= MSG_UNKNOWN; type++) {
+            uint64_t n = load(&m->messages[dir][type]);
+            if (n > 0) {
+                printf(" %s=%llu", msg_type_to_str((roj_msg_type_t)type),
+                       (unsigned long long)n);
+                any = true;
+            }
+        }
+        printf("%s\n", any ? "" : " (none)");
+    }
+    if (io) {
+        printf("  decode errors: %llu\n", (unsigned long long)io->decode_errors);
+    }
+    printf("  proposals: %llu created, %llu committed, %llu expired "
+           "(%llu received ones expired)\n",
+           (unsigned long long)load(&m->proposals_created),
+           (unsigned long long)load(&m->proposals_committed),
+           (unsigned long long)load(&m->proposals_expired),
+           (unsigned long long)load(&m->peer_proposals_expired));
+    printf("  commits applied: %llu\n", (unsigned long long)load(&m->commits_applied));
+    printf("  log records dropped: %llu\n", (unsigned long long)roj_log_dropped());
+
+    roj_json_arena_stats_t arena;
+    json_arena_get_stats(&arena);
+    printf("  cJSON allocations: %llu from the arena, %llu from the heap (%llu bytes), "
+           "%llu arena grows\n",
+           (unsigned long long)arena.arena_allocs, (unsigned long long)arena.heap_allocs,
+           (unsigned long long)arena.heap_bytes, (unsigned long long)arena.arena_grows);
+    print_histogram("propose->commit", &m->commit_latency);
+    print_histogram("vote round-trip", &m->vote_rtt);
+}
+
+/* Prometheus text format */
+
+static void write_counter(FILE* f, const char* name, const char* help, const char* node,
+                          uint64_t value) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    fprintf(f, "%s{node=\"%s\"} %llu\n", name, node, (unsigned long long)value);
+}
+
+static void write_histogram(FILE* f, const char* name, const char* help, const char* node,
+                            const roj_histogram_t* h) {
+    uint64_t seen = 0;
+    int bucket = 0;
+
+    fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (int shift = PROM_FIRST_SHIFT; shift <= PROM_LAST_SHIFT; shift++) {
+        uint64_t le = 1ULL << shift;
+        /* Buckets never straddle a power of two */
+        while (bucket < ROJ_HIST_BUCKETS && bucket_upper(bucket) < le) {
+            seen += load(&h->buckets[bucket++]);
+        }
+        fprintf(f, "%s_bucket{node=\"%s\",le=\"%.9g\"} %llu\n",
+                name, node, (double)le / 1e9, (unsigned long long)seen);
+    }
+    fprintf(f, "%s_bucket{node=\"%s\",le=\"+Inf\"} %llu\n",
+            name, node, (unsigned long long)load(&h->count));
+    fprintf(f, "%s_sum{node=\"%s\"} %.9f\n", name, node, (double)load(&h->sum) / 1e9);
+    fprintf(f, "%s_count{node=\"%s\"} %llu\n", name, node, (unsigned long long)load(&h->count));
+}
+
+void metrics_write_prometheus(const roj_metrics_t* m, const roj_transport_stats_t* io,
+                              const char* node, FILE* f) {
+    fprintf(f, "# HELP roj_messages_total Datagrams handled, by direction and message type\n");
+    fprintf(f, "# TYPE roj_messages_total counter\n");
+    for (int dir = 0; dir < ROJ_METRIC_DIRECTIONS; dir++) {
+        for (int type = 0; type <= MSG_UNKNOWN; type++) {
+            fprintf(f, "roj_messages_total{node=\"%s\",direction=\"%s\",type=\"%s\"} %llu\n",
+                    node, g_dir_names[dir], msg_type_to_str((roj_msg_type_t)type),
+                    (unsigned long long)load(&m->messages[dir][type]));
+        }
+    }
+
+    if (io) {
+        write_counter(f, "roj_decode_errors_total", "Datagrams that failed to decode",
+                      node, io->decode_errors);
+        write_counter(f, "roj_recv_datagrams_total", "Datagrams received", node,
+                      io->recv_datagrams);
+        write_counter(f, "roj_send_datagrams_total", "Datagrams sent", node,
+                      io->send_datagrams);
+        write_counter(f, "roj_recv_dropped_total", "Datagrams dropped by the kernel", node,
+                      io->recv_dropped);
+        write_counter(f, "roj_recv_truncated_total",
+                      "Datagrams dropped for not fitting a receive slot", node,
+                      io->recv_truncated);
+    }
+
+    write_counter(f, "roj_proposals_created_total", "Proposals this node created", node,
+                  load(&m->proposals_created));
+    write_counter(f, "roj_proposals_committed_total",
+                  "Proposals this node created that reached the threshold", node,
+                  load(&m->proposals_committed));
+    write_counter(f, "roj_proposals_expired_total",
+                  "Proposals this node created that timed out collecting votes", node,
+                  load(&m->proposals_expired));
+    write_counter(f, "roj_peer_proposals_expired_total",
+                  "Received proposals that timed out awaiting their COMMIT", node,
+                  load(&m->peer_proposals_expired));
+    write_counter(f, "roj_commits_applied_total", "Key updates applied to committed state",
+                  node, load(&m->commits_applied));
+    write_counter(f, "roj_log_dropped_total", "Log records dropped on a full ring (process-wide)",
+                  node, roj_log_dropped());
+
+    roj_json_arena_stats_t arena;
+    json_arena_get_stats(&arena);
+    write_counter(f, "roj_json_arena_allocs_total",
+                  "cJSON allocations served by the per-thread arena (process-wide)", node,
+                  arena.arena_allocs);
+    write_counter(f, "roj_json_heap_allocs_total",
+                  "cJSON allocations that went to malloc (process-wide)", node,
+                  arena.heap_allocs);
+    write_counter(f, "roj_json_arena_grows_total",
+                  "Per-thread JSON arena allocations and regrowths (process-wide)", node,
+                  arena.arena_grows);
+
+    write_histogram(f, "roj_commit_latency_seconds",
+                    "Time from creating a proposal to reaching its vote threshold", node,
+                    &m->commit_latency);
+    write_histogram(f, "roj_vote_rtt_seconds",
+                    "Time from creating a proposal to each peer's VOTE", node, &m->vote_rtt);
+}
+
+int metrics_dump_file(const roj_metrics_t* m, const roj_transport_stats_t* io,
+                      const char* node, const char* path) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE* f = fopen(tmp, "w");
+    if (!f) {
+        fprintf(stderr, "[ERROR] Metrics: cannot write %s\n", tmp);
+        return -1;
+    }
+    metrics_write_prometheus(m, io, node, f);
+    if (fclose(f) != 0) {
+        fprintf(stderr, "[ERROR] Metrics: failed writing %s\n", tmp);
+        remove(tmp);
+        return -1;
+    }
+#ifdef _WIN32
+    /* rename() does not replace an existing file on Windows */
+    remove(path);
+#endif
+    if (rename(tmp, path) != 0) {
+        fprintf(stderr, "[ERROR] Metrics: cannot rename %s to %s\n", tmp, path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
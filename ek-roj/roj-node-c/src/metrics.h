@@ -0,0 +1,91 @@
+/*
+ * ROJ Metrics - counters and latency histograms
+ *
+ * Every field is a relaxed C11 atomic, so any thread may record without a
+ * lock and readers get a consistent-enough view for monitoring. Recording
+ * is one uncontended fetch_add; nothing allocates after init.
+ *
+ * Histograms are HDR-style log-linear: values below 32 ns have a bucket
+ * each, above that every power of two is split into 16 buckets, so any
+ * recorded value is known to within 1/16 (~6%). They cover up to 2^45 ns
+ * (about 9.7 hours); longer values land in the last bucket.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_METRICS_H
+#define ROJ_METRICS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include "types.h"
+#include "transport.h"
+
+#define ROJ_HIST_SUB_BITS     4
+#define ROJ_HIST_MAX_SHIFT    40
+#define ROJ_HIST_BUCKETS      ((ROJ_HIST_MAX_SHIFT + 2) << ROJ_HIST_SUB_BITS)
+#define ROJ_METRICS_INTERVAL_MS 10000   /* default Prometheus file refresh */
+
+typedef enum {
+    ROJ_METRIC_RX = 0,
+    ROJ_METRIC_TX,
+    ROJ_METRIC_DIRECTIONS
+} roj_metric_dir_t;
+
+typedef struct {
+    _Atomic uint64_t buckets[ROJ_HIST_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} roj_histogram_t;
+
+typedef struct {
+    /* Datagrams by direction and message type (tx counts each destination) */
+    _Atomic uint64_t messages[ROJ_METRIC_DIRECTIONS][MSG_UNKNOWN + 1];
+
+    /* Own proposals, and received ones that never saw their COMMIT */
+    _Atomic uint64_t proposals_created;
+    _Atomic uint64_t proposals_committed;
+    _Atomic uint64_t proposals_expired;
+    _Atomic uint64_t peer_proposals_expired;
+    _Atomic uint64_t commits_applied;   /* key updates applied to state */
+
+    roj_histogram_t commit_latency;     /* own proposal: created -> committed */
+    roj_histogram_t vote_rtt;           /* own proposal: created -> each peer VOTE */
+} roj_metrics_t;
+
+/* Zero all counters and histograms */
+void metrics_init(roj_metrics_t* m);
+
+/* Monotonic clock in nanoseconds, for latency samples */
+uint64_t metrics_now_ns(void);
+
+static inline void metrics_inc(_Atomic uint64_t* counter, uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline void metrics_count_message(roj_metrics_t* m, roj_metric_dir_t dir,
+                                         roj_msg_type_t type, uint64_t n) {
+    metrics_inc(&m->messages[dir][type <= MSG_UNKNOWN ? type : MSG_UNKNOWN], n);
+}
+
+/* Record one latency sample in nanoseconds */
+void histogram_record(roj_histogram_t* h, uint64_t ns);
+
+/* Value at quantile q (0..1), as the upper bound of its bucket; 0 if empty */
+uint64_t histogram_quantile(const roj_histogram_t* h, double q);
+
+/* Print counters and latency quantiles (io may be NULL) */
+void metrics_print(const roj_metrics_t* m, const roj_transport_stats_t* io);
+
+/* Write everything in the Prometheus text exposition format, labelled
+ * with node (io may be NULL) */
+void metrics_write_prometheus(const roj_metrics_t* m, const roj_transport_stats_t* io,
+                              const char* node, FILE* f);
+
+/* Write the Prometheus text to path through a temporary file and rename,
+ * so a scraper never reads half a file */
+int metrics_dump_file(const roj_metrics_t* m, const roj_transport_stats_t* io,
+                      const char* node, const char* path);
+
+#endif /* ROJ_METRICS_H */
@@ -0,0 +1,1190 @@
+/*
+ * ROJ Node - node context implementation
+ *
+ * Wires the modules of one node together: routes decoded messages to
+ * discovery, consensus or the replicated log, sends their replies, and
+ * runs the batching, aggregation, storage and announce timers.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "node.h"
+#include "types.h"
+#include "discovery.h"
+#include "transport.h"
+#include "consensus.h"
+#include "json_encode.h"
+#include "json_arena.h"
+#include "event_loop.h"
+#include "timer_wheel.h"
+#include "symtab.h"
+#include "coalesce.h"
+#include "wal.h"
+#include "payload.h"
+#include "snapshot.h"
+#include "replog.h"
+#include "metrics.h"
+#include "logger.h"
+#ifdef ROJ_THREADS
+#include "pipeline.h"
+#endif
+
+#define ROJ_NODE_MAX_WATCH  8
+#define ROJ_NODE_MAX_SEEDS  ROJ_MAX_PEERS
+
+typedef struct {
+    int fd;
+    roj_node_fd_cb cb;
+    void* ctx;
+} node_watch_t;
+
+/* A report of a commit, held until the WAL group that logged it is synced */
+typedef enum {
+    HELD_COMMIT,                /* COMMIT or COMMIT_BATCH to broadcast */
+    HELD_APPLY,                 /* commit_cb */
+    HELD_OUTCOME,               /* outcome_cb, committed */
+    HELD_APPLIED                /* applied_cb */
+} held_kind_t;
+
+typedef struct {
+    held_kind_t kind;
+    roj_sym_t key;
+    uint64_t id;
+    int64_t value;
+    roj_op_result_t result;
+    roj_message_t msg;          /* HELD_COMMIT, its array in payload */
+    roj_payload_t* payload;
+} held_t;
+
+struct roj_node {
+    roj_node_config_t config;
+    char node_id[ROJ_NODE_ID_MAX];
+    char data_dir[512];
+    char metrics_file[512];
+    roj_sym_t node_sym;
+    bool symtab_ref;
+    roj_node_env_t env;         /* send == NULL: UDP sockets and the system clock */
+    roj_clock_ms_fn clock;
+
+    roj_evloop_t* loop;
+    roj_transport_t* tp;
+    roj_recv_ctx_t* shard_ctx[ROJ_MAX_SHARDS];
+#ifdef ROJ_THREADS
+    roj_pipeline_t* pipeline;   /* NULL: receive and send on the loop thread */
+#endif
+    roj_json_templates_t templates;
+
+    roj_timer_wheel_t wheel;
+    int wheel_tick;
+    roj_discovery_t discovery;
+    roj_consensus_t consensus;
+    roj_coalesce_t coalesce;
+    roj_wal_t wal;
+    roj_snapshot_t snapshot;
+    roj_replog_t replog;
+    roj_metrics_t metrics;
+
+    int batch_timer;
+    int agg_timer;
+    int wal_timer;
+    int replog_timer;
+    uint64_t replog_due;        /* when replog_timer fires */
+    int snapshot_timer;
+
+    struct sockaddr_in seeds[ROJ_NODE_MAX_SEEDS];
+    int seed_count;
+
+    node_watch_t watch[ROJ_NODE_MAX_WATCH];
+    int dispatching;            /* inside a callback that syncs when it returns */
+    roj_node_commit_cb commit_cb;
+    void* commit_ctx;
+    roj_node_outcome_fn outcome_cb;
+    void* outcome_ctx;
+    roj_node_applied_fn applied_cb;
+    void* applied_ctx;
+
+    held_t* held;               /* oldest first, see must_hold */
+    int held_count;
+    int held_cap;
+
+    roj_message_t msgs[ROJ_RECV_BATCH];
+};
+
+/* Send msg to count peers, through the sender thread when pipelined */
+static void broadcast_message(roj_node_t* node, const roj_message_t* msg,
+                              const struct sockaddr_in* addrs,
+                              const roj_wire_t* wires, int count) {
+    metrics_count_message(&node->metrics, ROJ_METRIC_TX, msg->type, (uint64_t)count);
+    if (node->env.send) {
+        node->env.send(msg, addrs, count, node->env.send_ctx);
+        return;
+    }
+#ifdef ROJ_THREADS
+    if (node->pipeline) {
+        pipeline_send(node->pipeline, msg, addrs, wires, count);
+        return;
+    }
+#endif
+    transport_broadcast_wire(node->tp, msg, addrs, wires, count);
+}
+
+/* Coalescer and replicated log sender; ctx is the node */
+static void send_message(const roj_message_t* msg, const struct sockaddr_in* to,
+                         roj_wire_t wire, void* ctx) {
+    broadcast_message(ctx, msg, to, &wire, 1);
+}
+
+/* Send everything waiting in the aggregation window */
+static void flush_coalesced(roj_node_t* node) {
+    if (node->agg_timer >= 0) {
+        evloop_cancel_timer(node->loop, node->agg_timer);
+        node->agg_timer = -1;
+    }
+    coalesce_flush(&node->coalesce);
+}
+
+static void on_agg_timer(void* ctx) {
+    flush_coalesced(ctx);
+}
+
+/* True if messages to this peer may wait for an aggregate */
+static bool can_coalesce(const roj_node_t* node, const struct sockaddr_in* to) {
+    return node->config.agg_delay_ms > 0 &&
+           (discovery_caps_for_addr(&node->discovery, to) & ROJ_CAP_AGG);
+}
+
+static void arm_agg_timer(roj_node_t* node) {
+    if (node->agg_timer < 0 && coalesce_pending(&node->coalesce) > 0) {
+        node->agg_timer = evloop_add_timer(node->loop, (uint64_t)node->config.agg_delay_ms, 0,
+                                           on_agg_timer, node);
+    }
+}
+
+static void send_vote(roj_node_t* node, const roj_message_t* vote,
+                      const struct sockaddr_in* to) {
+    roj_wire_t wire = discovery_wire_for_addr(&node->discovery, to);
+
+    if (vote->type == MSG_VOTE && can_coalesce(node, to)) {
+        coalesce_vote(&node->coalesce, vote, to, wire);
+        arm_agg_timer(node);
+    } else {
+        send_message(vote, to, wire, node);
+    }
+}
+
+/* Commits go out right away, except to peers that take COMMIT_AGG */
+static void send_commit(roj_node_t* node, const roj_message_t* commit) {
+    struct sockaddr_in addrs[ROJ_MAX_PEERS];
+    roj_wire_t wires[ROJ_MAX_PEERS];
+    int count = discovery_get_peer_targets(&node->discovery, addrs, wires, ROJ_MAX_PEERS);
+    int direct = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (commit->type == MSG_COMMIT && can_coalesce(node, &addrs[i])) {
+            coalesce_commit(&node->coalesce, commit, &addrs[i], wires[i]);
+        } else {
+            addrs[direct] = addrs[i];
+            wires[direct] = wires[i];
+            direct++;
+        }
+    }
+    if (direct > 0) {
+        broadcast_message(node, commit, addrs, wires, direct);
+    }
+    arm_agg_timer(node);
+}
+
+/* Nothing reports a commit before its WAL group's fdatasync returns. True
+ * if a report must wait: an earlier one is waiting, or commits are logged
+ * but not synced. *h is its slot then, NULL if there was no memory for it,
+ * and it is dropped like a report whose fsync failed. */
+static bool must_hold(roj_node_t* node, held_kind_t kind, held_t** h) {
+    if (node->held_count == 0 &&
+        (wal_pending(&node->wal) == 0 || wal_failed(&node->wal))) {
+        return false;
+    }
+
+    *h = NULL;
+    if (node->held_count == node->held_cap) {
+        int cap = node->held_cap ? node->held_cap * 2 : 64;
+        held_t* held = realloc(node->held, (size_t)cap * sizeof(*held));
+        if (!held) {
+            ROJ_LOG(ROJ_LOG_ERROR, "Out of memory holding a commit for the WAL, "
+                    "not reporting it");
+            return true;
+        }
+        node->held = held;
+        node->held_cap = cap;
+    }
+    *h = &node->held[node->held_count++];
+    memset(*h, 0, sizeof(**h));
+    (*h)->kind = kind;
+    return true;
+}
+
+static void broadcast_commit(const roj_message_t* commit, void* ctx) {
+    roj_node_t* node = ctx;
+    held_t* h;
+
+    if (!must_hold(node, HELD_COMMIT, &h)) {
+        send_commit(node, commit);
+        return;
+    }
+    if (!h) {
+        return;
+    }
+    if (message_payload_size(commit) > 0 && !(h->payload = malloc(sizeof(*h->payload)))) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Out of memory holding a commit for the WAL, not reporting it");
+        node->held_count--;
+        return;
+    }
+    message_copy(&h->msg, h->payload, commit);
+}
+
+/* Send and report, in order, what the last WAL group made durable */
+static void release_held(roj_node_t* node) {
+    int count = node->held_count;
+
+    /* Callbacks may submit more; that is synced when this sync_node goes on */
+    node->dispatching++;
+    for (int i = 0; i < count; i++) {
+        held_t h = node->held[i];     /* holding more may move the array */
+        switch (h.kind) {
+            case HELD_COMMIT:
+                send_commit(node, &h.msg);
+                free(h.payload);
+                break;
+            case HELD_APPLY:
+                if (node->commit_cb) {
+                    node->commit_cb(node, symtab_str(h.key), h.value, node->commit_ctx);
+                }
+                break;
+            case HELD_OUTCOME:
+                if (node->outcome_cb) {
+                    node->outcome_cb(node, h.id, true, node->outcome_ctx);
+                }
+                break;
+            case HELD_APPLIED:
+                if (node->applied_cb) {
+                    node->applied_cb(node, h.id, h.result, h.value, node->applied_ctx);
+                }
+                break;
+        }
+    }
+    node->dispatching--;
+
+    node->held_count -= count;
+    memmove(node->held, node->held + count, (size_t)node->held_count * sizeof(*node->held));
+}
+
+/* The WAL failed before these were durable: nobody hears about them */
+static void drop_held(roj_node_t* node) {
+    ROJ_LOG(ROJ_LOG_ERROR, "WAL: dropping %d reports of commits that did not become durable",
+            node->held_count);
+    for (int i = 0; i < node->held_count; i++) {
+        free(node->held[i].payload);
+    }
+    node->held_count = 0;
+}
+
+static void settle_held(roj_node_t* node) {
+    if (node->held_count == 0) {
+        return;
+    }
+    if (wal_failed(&node->wal)) {
+        drop_held(node);
+    } else if (wal_pending(&node->wal) == 0) {
+        release_held(node);
+    }
+}
+
+static void broadcast_to_peers(roj_node_t* node, const roj_message_t* msg) {
+    struct sockaddr_in addrs[ROJ_MAX_PEERS];
+    roj_wire_t wires[ROJ_MAX_PEERS];
+    int count = discovery_get_peer_targets(&node->discovery, addrs, wires, ROJ_MAX_PEERS);
+
+    if (count == 0) {
+        ROJ_LOG(ROJ_LOG_DEBUG, "No peers discovered yet");
+    } else {
+        broadcast_message(node, msg, addrs, wires, count);
+    }
+}
+
+/* Propose everything queued in the batching window */
+static void flush_proposals(roj_node_t* node) {
+    roj_message_t msg;
+    int rc;
+
+    if (node->batch_timer >= 0) {
+        evloop_cancel_timer(node->loop, node->batch_timer);
+        node->batch_timer = -1;
+    }
+
+    /* Peers without batch support get one PROPOSE per update */
+    bool batch = discovery_peers_support(&node->discovery, ROJ_CAP_BATCH);
+    while ((rc = consensus_flush_proposals(&node->consensus, &msg, batch)) >= 0) {
+        if (rc == 0) {
+            broadcast_to_peers(node, &msg);
+        }
+    }
+}
+
+static void on_batch_timer(void* ctx) {
+    flush_proposals(ctx);
+}
+
+static void sync_node(roj_node_t* node);
+
+static void on_wal_timer(void* ctx) {
+    roj_node_t* node = ctx;
+    node->wal_timer = -1;
+    wal_sync(&node->wal);
+    sync_node(node);
+}
+
+static void on_snapshot_timer(void* ctx) {
+    roj_node_t* node = ctx;
+    int rc = snapshot_poll(&node->snapshot);
+    if (rc == 0) {
+        return;
+    }
+    evloop_cancel_timer(node->loop, node->snapshot_timer);
+    node->snapshot_timer = -1;
+    if (rc > 0) {
+        /* The rotated log is covered now */
+        wal_drop_rotated(&node->wal);
+    }
+}
+
+static int start_snapshot(roj_node_t* node) {
+    if (!wal_is_open(&node->wal)) {
+        return -1;
+    }
+    if (snapshot_in_progress(&node->snapshot)) {
+        return 1;
+    }
+    if (wal_rotate(&node->wal) != 0) {
+        fprintf(stderr, "[ERROR] Snapshot: cannot rotate the WAL in %s, no snapshot taken\n",
+                node->data_dir);
+        return -1;
+    }
+    if (consensus_snapshot(&node->consensus, &node->snapshot, node->data_dir) != 0) {
+        return -1;
+    }
+    node->snapshot_timer = evloop_add_timer(node->loop, ROJ_SNAPSHOT_POLL_MS,
+                                            ROJ_SNAPSHOT_POLL_MS, on_snapshot_timer, node);
+    return 0;
+}
+
+/* Bound how long logged commits wait for their group fsync (and the
+ * reports held for it), and snapshot once the log has grown enough */
+static void sync_storage(roj_node_t* node) {
+    if (node->wal_timer < 0 && !wal_failed(&node->wal) &&
+        (wal_pending(&node->wal) > 0 || node->held_count > 0)) {
+        /* Nothing pending: a full group or a rotation synced it already */
+        uint64_t delay = wal_pending(&node->wal) > 0 ? (uint64_t)node->config.wal_sync_ms : 0;
+        node->wal_timer = evloop_add_timer(node->loop, delay, 0, on_wal_timer, node);
+    }
+    if (node->config.snapshot_every > 0 &&
+        wal_records_since_rotate(&node->wal) >= (uint64_t)node->config.snapshot_every) {
+        start_snapshot(node);
+    }
+}
+
+static void on_replog_timer(void* ctx);
+
+/* Wake the replicated log when its next timeout is due. A deadline that
+ * moved later is left to the armed timer, which finds nothing to do and
+ * re-arms. */
+static void arm_replog_timer(roj_node_t* node) {
+    uint64_t due = replog_next_deadline(&node->replog);
+    uint64_t now = node->clock();
+
+    if (node->replog_timer >= 0) {
+        if (due >= node->replog_due) {
+            return;
+        }
+        evloop_cancel_timer(node->loop, node->replog_timer);
+    }
+    node->replog_due = due;
+    node->replog_timer = evloop_add_timer(node->loop, due > now ? due - now : 0, 0,
+                                          on_replog_timer, node);
+}
+
+static void on_replog_timer(void* ctx) {
+    roj_node_t* node = ctx;
+    node->replog_timer = -1;
+    replog_tick(&node->replog);
+    arm_replog_timer(node);
+    sync_storage(node);
+}
+
+static void on_wheel_tick(void* ctx) {
+    roj_node_t* node = ctx;
+    timer_wheel_advance(&node->wheel);
+
+    /* Nothing left to expire: stop ticking until the next deadline is set */
+    if (timer_wheel_pending(&node->wheel) == 0) {
+        evloop_cancel_timer(node->loop, node->wheel_tick);
+        node->wheel_tick = -1;
+    }
+}
+
+/* After a batch of events: report commits whose WAL group is synced,
+ * replicate what the batch appended and re-arm the log's timeouts (leader
+ * mode), run the wheel's tick timer only while it holds deadlines, and
+ * schedule storage work */
+static void sync_node(roj_node_t* node) {
+    settle_held(node);
+    if (node->config.leader_mode) {
+        replog_flush(&node->replog);
+        arm_replog_timer(node);
+    }
+    if (node->wheel_tick < 0 && timer_wheel_pending(&node->wheel) > 0) {
+        node->wheel_tick = evloop_add_timer(node->loop, ROJ_WHEEL_TICK_MS, ROJ_WHEEL_TICK_MS,
+                                            on_wheel_tick, node);
+    }
+    sync_storage(node);
+}
+
+static bool is_log_message(roj_msg_type_t type) {
+    return type >= MSG_REQUEST_VOTE && type <= MSG_FORWARD;
+}
+
+/* A discovered peer's datagrams may add symbols from now on */
+static void admit_peer(roj_node_t* node, roj_sym_t node_id) {
+    const roj_peer_list_t* peers = discovery_get_peers(&node->discovery);
+
+    if (!node->tp) {
+        return;     /* harness delivery: every sender is trusted */
+    }
+    for (int i = 0; i < peers->count; i++) {
+        if (peers->peers[i].node_id == node_id) {
+            transport_admit(node->tp, i, &peers->peers[i].addr);
+            return;
+        }
+    }
+}
+
+/* Origins folded from node IDs can clash; two nodes sharing one would mint
+ * the same proposal IDs. Such a peer is never admitted, and of two nodes
+ * that clash with each other the one whose ID sorts last stops, so the
+ * pair never runs side by side whichever hears the other first. */
+static bool refuse_peer(roj_node_t* node, roj_sym_t node_id) {
+    if (node->env.origin != 0) {
+        return false;   /* the harness numbered the members */
+    }
+
+    roj_sym_t clash = discovery_origin_clash(&node->discovery, node_id);
+    if (clash == ROJ_SYM_EMPTY) {
+        return false;
+    }
+    ROJ_LOG(ROJ_LOG_ERROR, "Node IDs \"%s\" and \"%s\" share proposal origin %u; "
+            "rename one of them", symtab_str(node_id), symtab_str(clash),
+            (unsigned)proposal_origin_of(symtab_str(node_id)));
+    if (clash == node->node_sym && strcmp(node->node_id, symtab_str(node_id)) > 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Stopping: this node cannot join the cluster");
+        roj_node_stop(node);
+    }
+    return true;
+}
+
+static void handle_message(const roj_message_t* msg, const struct sockaddr_in* from,
+                           void* ctx) {
+    roj_node_t* node = ctx;
+
+    metrics_count_message(&node->metrics, ROJ_METRIC_RX, msg->type, 1);
+
+    /* The modes do not mix: each ignores the other's traffic */
+    if (msg->type != MSG_ANNOUNCE && is_log_message(msg->type) != node->config.leader_mode) {
+        return;
+    }
+
+    switch (msg->type) {
+        case MSG_ANNOUNCE:
+            if (refuse_peer(node, msg->data.announce.node_id)) {
+                break;
+            }
+            /* Update peer list, answer new peers so they learn our capabilities */
+            if (discovery_update_peer(&node->discovery,
+                                      msg->data.announce.node_id,
+                                      msg->data.announce.lang,
+                                      from,
+                                      msg->data.announce.version,
+                                      msg->data.announce.caps)) {
+                roj_message_t announce;
+                discovery_build_announce(&node->discovery, &announce);
+                send_message(&announce, from, WIRE_JSON, node);
+            }
+            admit_peer(node, msg->data.announce.node_id);
+            break;
+
+        case MSG_PROPOSE:
+        case MSG_PROPOSE_BATCH:
+            if ((msg->type == MSG_PROPOSE ? msg->data.propose.from
+                                          : msg->data.propose_batch.from) != node->node_sym) {
+                roj_message_t vote;
+                if (consensus_handle_propose(&node->consensus, msg, &vote) == 0) {
+                    send_vote(node, &vote, from);
+                }
+            }
+            break;
+
+        case MSG_VOTE:
+            if (msg->data.vote.from != node->node_sym) {
+                roj_message_t commit;
+                int peer_count = discovery_peer_count(&node->discovery);
+                if (consensus_handle_vote(&node->consensus, msg, &commit, peer_count) == 0) {
+                    broadcast_commit(&commit, node);
+                }
+            }
+            break;
+
+        case MSG_VOTE_AGG:
+            if (msg->data.vote_agg.from != node->node_sym) {
+                consensus_handle_vote_agg(&node->consensus, msg,
+                                          discovery_peer_count(&node->discovery),
+                                          broadcast_commit, node);
+            }
+            break;
+
+        case MSG_COMMIT:
+        case MSG_COMMIT_BATCH:
+        case MSG_COMMIT_AGG:
+            consensus_handle_commit(&node->consensus, msg);
+            break;
+
+        case MSG_REQUEST_VOTE:
+        case MSG_VOTE_RESPONSE:
+        case MSG_APPEND_ENTRIES:
+        case MSG_APPEND_ENTRIES_RESPONSE:
+        case MSG_FORWARD:
+            replog_handle_message(&node->replog, msg, from);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void on_socket(int fd, void* ctx) {
+    roj_node_t* node = ctx;
+    struct sockaddr_in froms[ROJ_RECV_BATCH];
+    int count = -1;
+
+    /* Shard 0 reads through the transport's own context */
+    for (int i = 0; i < transport_shard_count(node->tp); i++) {
+        if (transport_get_shard_socket(node->tp, i) == fd) {
+            count = i == 0
+                ? transport_recv_batch(node->tp, node->msgs, froms, ROJ_RECV_BATCH)
+                : transport_recv_batch_ctx(node->tp, node->shard_ctx[i], node->msgs, froms,
+                                           ROJ_RECV_BATCH);
+            break;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        handle_message(&node->msgs[i], &froms[i], node);
+    }
+    sync_node(node);
+}
+
+#ifdef ROJ_THREADS
+static void on_pipeline(int fd, void* ctx) {
+    roj_node_t* node = ctx;
+    (void)fd;
+
+    pipeline_drain(node->pipeline, handle_message, node);
+    sync_node(node);
+}
+#endif
+
+static void announce_self(roj_node_t* node) {
+    roj_message_t announce;
+    struct sockaddr_in addr;
+
+    discovery_build_announce(&node->discovery, &announce);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    addr.sin_port = htons(node->config.port);
+
+    /* ANNOUNCE is always JSON: peers learn our encodings from it */
+    send_message(&announce, &addr, WIRE_JSON, node);
+    if (node->seed_count > 0) {
+        broadcast_message(node, &announce, node->seeds, NULL, node->seed_count);
+    }
+}
+
+static void on_announce_timer(void* ctx) {
+    announce_self(ctx);
+}
+
+static void on_metrics_timer(void* ctx) {
+    roj_node_t* node = ctx;
+    roj_transport_stats_t io;
+
+    if (node->tp) {
+        transport_get_stats(node->tp, &io);
+    }
+    metrics_dump_file(&node->metrics, node->tp ? &io : NULL, node->node_id,
+                      node->metrics_file);
+}
+
+/* Without I/O threads the event loop drains every shard itself */
+static int add_shard_fds(roj_node_t* node) {
+    if (evloop_add_fd(node->loop, transport_get_socket(node->tp), on_socket, node) != 0) {
+        return -1;
+    }
+    for (int i = 1; i < transport_shard_count(node->tp); i++) {
+        node->shard_ctx[i] = transport_recv_ctx_new(node->tp, i);
+        if (!node->shard_ctx[i] ||
+            evloop_add_fd(node->loop, transport_get_shard_socket(node->tp, i),
+                          on_socket, node) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void on_watched(int fd, void* ctx) {
+    roj_node_t* node = ctx;
+
+    for (int i = 0; i < ROJ_NODE_MAX_WATCH; i++) {
+        if (node->watch[i].cb && node->watch[i].fd == fd) {
+            node->dispatching++;
+            node->watch[i].cb(node, fd, node->watch[i].ctx);
+            node->dispatching--;
+            break;
+        }
+    }
+    sync_node(node);
+}
+
+void roj_node_config_defaults(roj_node_config_t* config) {
+    memset(config, 0, sizeof(*config));
+    config->port = ROJ_UDP_PORT;
+    config->batch_max = 1;
+    config->batch_delay_ms = ROJ_BATCH_DELAY_MS;
+    config->shards = 1;
+    config->wal_sync_ms = ROJ_WAL_SYNC_MS;
+    config->snapshot_every = ROJ_SNAPSHOT_EVERY;
+    config->metrics_interval_ms = ROJ_METRICS_INTERVAL_MS;
+}
+
+/* Rebuild committed state before serving peers: map the snapshot, then
+ * replay the log written since it was taken */
+static int open_storage(roj_node_t* node) {
+    if (consensus_load_snapshot(&node->consensus, &node->snapshot, node->data_dir) < 0) {
+        fprintf(stderr, "[ERROR] Unusable snapshot in %s; move it aside to start "
+                "from the log alone\n", node->data_dir);
+        return -1;
+    }
+    if (wal_open(&node->wal, node->data_dir, node->config.wal_sync_ms,
+                 consensus_restore, &node->consensus) != 0) {
+        fprintf(stderr, "[ERROR] Failed to open write-ahead log\n");
+        return -1;
+    }
+    consensus_set_wal(&node->consensus, &node->wal);
+    return 0;
+}
+
+static int start_node(roj_node_t* node) {
+    const roj_node_config_t* cfg = &node->config;
+    uint32_t caps = ROJ_CAP_CONSENSUS | ROJ_CAP_WIRE_BIN | ROJ_CAP_BATCH | ROJ_CAP_AGG;
+
+    /* Node IDs and keys are interned from here on */
+    if (symtab_init() != 0) {
+        fprintf(stderr, "[ERROR] Failed to initialize symbol table\n");
+        return -1;
+    }
+    node->symtab_ref = true;
+    node->node_sym = symtab_intern_str(node->node_id);
+
+    if (discovery_init(&node->discovery, node->node_id, LANG_C) != 0) {
+        fprintf(stderr, "[ERROR] Failed to initialize discovery\n");
+        return -1;
+    }
+    if (cfg->json_only) {
+        /* Stop advertising the binary encoding to peers */
+        caps &= ~ROJ_CAP_WIRE_BIN;
+    }
+    if (cfg->leader_mode) {
+        caps |= ROJ_CAP_LOG;
+    }
+    discovery_set_capabilities(&node->discovery, caps);
+
+    if (!node->env.send) {
+        node->tp = transport_new(cfg->port, cfg->shards);
+        if (!node->tp) {
+            fprintf(stderr, "[ERROR] Failed to initialize transport\n");
+            return -1;
+        }
+    }
+
+    if (consensus_init(&node->consensus, node->node_id) != 0) {
+        fprintf(stderr, "[ERROR] Failed to initialize consensus\n");
+        return -1;
+    }
+    if (node->env.send) {
+        consensus_seed(&node->consensus, node->env.seed);
+    }
+    if (node->env.origin != 0) {
+        consensus_set_origin(&node->consensus, node->env.origin);
+    }
+    consensus_set_batching(&node->consensus, cfg->batch_max);
+    consensus_set_metrics(&node->consensus, &node->metrics);
+    coalesce_init(&node->coalesce, send_message, node);
+
+    if (node->data_dir[0] != '\0' && open_storage(node) != 0) {
+        return -1;
+    }
+
+    /* Precompute our JSON "from" chunk and ANNOUNCE document */
+    roj_message_t announce;
+    discovery_build_announce(&node->discovery, &announce);
+    json_encode_init(&node->templates, node->node_id);
+    json_encode_set_announce(&node->templates, &announce);
+    if (node->tp) {
+        transport_set_templates(node->tp, &node->templates);
+    }
+
+    node->loop = node->env.send ? evloop_new_manual(node->clock) : evloop_new();
+    if (!node->loop) {
+        fprintf(stderr, "[ERROR] Failed to initialize event loop\n");
+        return -1;
+    }
+
+    /* Proposal and peer deadlines share one timing wheel on the loop clock */
+    if (timer_wheel_init(&node->wheel, ROJ_WHEEL_TICK_MS, node->clock) != 0) {
+        fprintf(stderr, "[ERROR] Failed to initialize timer wheel\n");
+        return -1;
+    }
+    consensus_set_timer_wheel(&node->consensus, &node->wheel);
+    discovery_set_timer_wheel(&node->discovery, &node->wheel);
+
+    if (cfg->leader_mode) {
+        /* Without it, nodes that have not discovered each other yet would
+         * each count a majority of themselves */
+        if (cfg->cluster_size <= 0) {
+            ROJ_LOG(ROJ_LOG_ERROR, "Leader mode needs a cluster size");
+            return -1;
+        }
+        if (replog_init(&node->replog, node->node_id, &node->consensus, &node->discovery,
+                        node->clock, send_message, node) != 0) {
+            return -1;
+        }
+        if (node->env.send) {
+            replog_seed(&node->replog, node->env.seed);
+        }
+        replog_set_cluster_size(&node->replog, cfg->cluster_size);
+        arm_replog_timer(node);
+        ROJ_LOG(ROJ_LOG_INFO, "Leader mode: updates go through an elected leader's log");
+    }
+
+    if (node->env.send) {
+        /* The harness delivers messages itself */
+        return 0;
+    }
+#ifdef ROJ_THREADS
+    if (cfg->io_threads > 0) {
+        /* I/O threads own the socket; this thread only sees decoded messages */
+        node->pipeline = pipeline_start(node->tp, cfg->io_threads);
+        if (!node->pipeline) {
+            fprintf(stderr, "[ERROR] Failed to start pipeline\n");
+            return -1;
+        }
+        return evloop_add_fd(node->loop, pipeline_get_fd(node->pipeline), on_pipeline, node);
+    }
+#endif
+    return add_shard_fds(node);
+}
+
+static roj_node_t* create_node(const roj_node_config_t* config, const roj_node_env_t* env) {
+    if (!config->node_id || config->node_id[0] == '\0') {
+        fprintf(stderr, "[ERROR] A node needs an ID\n");
+        return NULL;
+    }
+
+    roj_node_t* node = calloc(1, sizeof(*node));
+    if (!node) {
+        fprintf(stderr, "[ERROR] Failed to allocate node\n");
+        return NULL;
+    }
+    /* Before this node starts any threads that could parse with cJSON */
+    json_arena_install();
+    node->config = *config;
+    strncpy(node->node_id, config->node_id, sizeof(node->node_id) - 1);
+    node->config.node_id = node->node_id;
+    if (config->data_dir) {
+        strncpy(node->data_dir, config->data_dir, sizeof(node->data_dir) - 1);
+        node->config.data_dir = node->data_dir;
+    }
+    if (config->metrics_file) {
+        strncpy(node->metrics_file, config->metrics_file, sizeof(node->metrics_file) - 1);
+        node->config.metrics_file = node->metrics_file;
+    }
+    if (node->config.metrics_interval_ms < 1) {
+        node->config.metrics_interval_ms = ROJ_METRICS_INTERVAL_MS;
+    }
+    if (node->config.batch_delay_ms < 0) node->config.batch_delay_ms = 0;
+    if (node->config.agg_delay_ms < 0) node->config.agg_delay_ms = 0;
+    if (node->config.wal_sync_ms < 0) node->config.wal_sync_ms = 0;
+    if (node->config.snapshot_every < 0) node->config.snapshot_every = 0;
+    if (node->config.io_threads < 0) node->config.io_threads = 0;
+    if (env) {
+        node->env = *env;
+        node->clock = env->clock;
+    } else {
+        node->clock = evloop_now_ms;
+    }
+
+    node->wheel_tick = -1;
+    node->batch_timer = -1;
+    node->agg_timer = -1;
+    node->wal_timer = -1;
+    node->replog_timer = -1;
+    node->snapshot_timer = -1;
+    wal_init(&node->wal);
+    metrics_init(&node->metrics);
+
+    if (start_node(node) != 0) {
+        roj_node_destroy(node);
+        return NULL;
+    }
+
+    evloop_add_timer(node->loop, 0, ROJ_ANNOUNCE_INTERVAL_MS, on_announce_timer, node);
+    if (node->metrics_file[0] != '\0') {
+        uint64_t interval = (uint64_t)node->config.metrics_interval_ms;
+        evloop_add_timer(node->loop, interval, interval, on_metrics_timer, node);
+    }
+    return node;
+}
+
+roj_node_t* roj_node_create(const roj_node_config_t* config) {
+    return create_node(config, NULL);
+}
+
+roj_node_t* roj_node_create_env(const roj_node_config_t* config, const roj_node_env_t* env) {
+    return create_node(config, env);
+}
+
+void roj_node_destroy(roj_node_t* node) {
+    if (!node) {
+        return;
+    }
+
+    if (node->tp && node->loop) {
+        /* Updates still waiting in the batching window go out first */
+        flush_proposals(node);
+        if (node->config.leader_mode && node->replog.log) {
+            replog_flush(&node->replog);
+        }
+    }
+    consensus_set_timer_wheel(&node->consensus, NULL);
+    discovery_set_timer_wheel(&node->discovery, NULL);
+    timer_wheel_free(&node->wheel);
+    /* Held commits go out with the last group, or not at all */
+    wal_sync(&node->wal);
+    settle_held(node);
+    free(node->held);
+    if (node->tp) {
+        coalesce_flush(&node->coalesce);
+    }
+    if (snapshot_wait(&node->snapshot) > 0) {
+        wal_drop_rotated(&node->wal);
+    }
+    wal_close(&node->wal);
+    replog_free(&node->replog);
+#ifdef ROJ_THREADS
+    pipeline_stop(node->pipeline);
+#endif
+    if (node->tp) {
+        for (int i = 1; i < transport_shard_count(node->tp); i++) {
+            transport_recv_ctx_free(node->tp, node->shard_ctx[i]);
+        }
+    }
+    evloop_free(node->loop);
+    transport_free(node->tp);
+    /* The store reads the mapped snapshot until it is freed */
+    consensus_free(&node->consensus);
+    snapshot_release(&node->snapshot);
+    discovery_shutdown(&node->discovery);
+    if (node->symtab_ref) {
+        symtab_free();
+    }
+    free(node);
+}
+
+int roj_node_run(roj_node_t* node) {
+    return evloop_run(node->loop);
+}
+
+void roj_node_stop(roj_node_t* node) {
+    evloop_stop(node->loop);
+}
+
+int roj_node_poll(roj_node_t* node, int timeout_ms) {
+    return evloop_run_once(node->loop, timeout_ms);
+}
+
+int roj_node_fd(const roj_node_t* node) {
+    return evloop_get_fd(node->loop);
+}
+
+uint64_t roj_node_next_deadline(const roj_node_t* node) {
+    return evloop_next_deadline(node->loop);
+}
+
+void roj_node_deliver(roj_node_t* node, const roj_message_t* msg,
+                      const struct sockaddr_in* from) {
+    handle_message(msg, from, node);
+    sync_node(node);
+}
+
+int roj_node_watch_fd(roj_node_t* node, int fd, roj_node_fd_cb cb, void* ctx) {
+    for (int i = 0; i < ROJ_NODE_MAX_WATCH; i++) {
+        if (!node->watch[i].cb) {
+            if (evloop_add_fd(node->loop, fd, on_watched, node) != 0) {
+                return -1;
+            }
+            node->watch[i].fd = fd;
+            node->watch[i].cb = cb;
+            node->watch[i].ctx = ctx;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void roj_node_unwatch_fd(roj_node_t* node, int fd) {
+    for (int i = 0; i < ROJ_NODE_MAX_WATCH; i++) {
+        if (node->watch[i].cb && node->watch[i].fd == fd) {
+            evloop_remove_fd(node->loop, fd);
+            node->watch[i].cb = NULL;
+            return;
+        }
+    }
+}
+
+int roj_node_add_seed(roj_node_t* node, const char* host, int port) {
+    if (node->seed_count == ROJ_NODE_MAX_SEEDS) {
+        return -1;
+    }
+
+    struct sockaddr_in* addr = &node->seeds[node->seed_count];
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr->sin_addr) != 1) {
+        fprintf(stderr, "[ERROR] Bad seed address %s\n", host);
+        return -1;
+    }
+    node->seed_count++;
+    return 0;
+}
+
+int roj_node_propose(roj_node_t* node, const char* key, int64_t value) {
+    int rc = 0;
+
+    if (node->config.leader_mode) {
+        /* Appended or forwarded to the leader when the event batch ends */
+        rc = replog_submit(&node->replog, ROJ_OP_SET, key, value, 0, NULL);
+    } else {
+        roj_message_t msg;
+        int created = consensus_create_proposal(&node->consensus, key, value, &msg);
+        if (created == 0) {
+            broadcast_to_peers(node, &msg);
+        } else if (created > 0) {
+            /* Queued: send once the batch fills or the window closes */
+            if (consensus_batch_full(&node->consensus)) {
+                flush_proposals(node);
+            } else if (node->batch_timer < 0) {
+                node->batch_timer = evloop_add_timer(node->loop,
+                                                     (uint64_t)node->config.batch_delay_ms, 0,
+                                                     on_batch_timer, node);
+            }
+        } else {
+            rc = -1;
+        }
+    }
+
+    if (!node->dispatching) {
+        sync_node(node);
+    }
+    return rc;
+}
+
+int roj_node_propose_id(roj_node_t* node, const char* key, int64_t value, uint64_t* id) {
+    roj_message_t msg;
+
+    if (node->config.leader_mode || node->config.batch_max > 1 ||
+        consensus_create_proposal(&node->consensus, key, value, &msg) != 0) {
+        return -1;
+    }
+    *id = proposal_id_from_str(msg.data.propose.proposal_id);
+    broadcast_to_peers(node, &msg);
+
+    if (!node->dispatching) {
+        sync_node(node);
+    }
+    return 0;
+}
+
+static void on_outcome(uint64_t id, bool committed, void* ctx) {
+    roj_node_t* node = ctx;
+    held_t* h;
+
+    /* An expiry is news at once; only a commit waits for its fsync */
+    if (committed && must_hold(node, HELD_OUTCOME, &h)) {
+        if (h) {
+            h->id = id;
+        }
+        return;
+    }
+    node->outcome_cb(node, id, committed, node->outcome_ctx);
+}
+
+void roj_node_on_outcome(roj_node_t* node, roj_node_outcome_fn cb, void* ctx) {
+    node->outcome_cb = cb;
+    node->outcome_ctx = ctx;
+    consensus_set_outcome_hook(&node->consensus, cb ? on_outcome : NULL, node);
+}
+
+int roj_node_submit(roj_node_t* node, roj_op_t op, const char* key, int64_t value,
+                    int64_t expect, uint64_t* id) {
+    if (!node->config.leader_mode ||
+        replog_submit(&node->replog, op, key, value, expect, id) != 0) {
+        return -1;
+    }
+
+    if (!node->dispatching) {
+        sync_node(node);
+    }
+    return 0;
+}
+
+static void on_applied(uint64_t id, roj_op_result_t result, int64_t value, void* ctx) {
+    roj_node_t* node = ctx;
+    held_t* h;
+
+    if (must_hold(node, HELD_APPLIED, &h)) {
+        if (h) {
+            h->id = id;
+            h->result = result;
+            h->value = value;
+        }
+        return;
+    }
+    node->applied_cb(node, id, result, value, node->applied_ctx);
+}
+
+void roj_node_on_applied(roj_node_t* node, roj_node_applied_fn cb, void* ctx) {
+    node->applied_cb = cb;
+    node->applied_ctx = ctx;
+    if (node->config.leader_mode) {
+        replog_set_applied_hook(&node->replog, cb ? on_applied : NULL, node);
+    }
+}
+
+static void on_apply(roj_sym_t key, int64_t value, void* ctx) {
+    roj_node_t* node = ctx;
+    held_t* h;
+
+    if (must_hold(node, HELD_APPLY, &h)) {
+        if (h) {
+            h->key = key;
+            h->value = value;
+        }
+        return;
+    }
+    node->commit_cb(node, symtab_str(key), value, node->commit_ctx);
+}
+
+void roj_node_on_commit(roj_node_t* node, roj_node_commit_cb cb, void* ctx) {
+    node->commit_cb = cb;
+    node->commit_ctx = ctx;
+    consensus_set_apply_hook(&node->consensus, cb ? on_apply : NULL, node);
+}
+
+int roj_node_get(const roj_node_t* node, const char* key, int64_t* value) {
+    return consensus_get_state(&node->consensus, key, value);
+}
+
+int roj_node_snapshot(roj_node_t* node) {
+    return start_snapshot(node);
+}
+
+const char* roj_node_id(const roj_node_t* node) {
+    return node->node_id;
+}
+
+bool roj_node_is_leader_mode(const roj_node_t* node) {
+    return node->config.leader_mode;
+}
+
+void roj_node_print_state(const roj_node_t* node) {
+    consensus_print_state(&node->consensus);
+}
+
+void roj_node_print_peers(roj_node_t* node) {
+    roj_peer_list_t* peers = discovery_get_peers(&node->discovery);
+    printf("Discovered peers:\n");
+    if (peers->count == 0) {
+        printf("  (none)\n");
+        return;
+    }
+    for (int i = 0; i < peers->count; i++) {
+        if (peers->peers[i].active) {
+            char addr_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &peers->peers[i].addr.sin_addr,
+                      addr_str, sizeof(addr_str));
+            printf("  %s (%s) at %s:%d\n",
+                   symtab_str(peers->peers[i].node_id),
+                   lang_to_str(peers->peers[i].lang),
+                   addr_str,
+                   ntohs(peers->peers[i].addr.sin_port));
+        }
+    }
+}
+
+void roj_node_print_stats(const roj_node_t* node) {
+    roj_evloop_stats_t loop;
+    evloop_get_stats(node->loop, &loop);
+    if (node->tp) {
+        transport_print_stats(node->tp);
+    }
+#ifdef ROJ_THREADS
+    if (node->pipeline) {
+        pipeline_print_stats(node->pipeline);
+    }
+#endif
+    if (node->config.agg_delay_ms > 0) {
+        coalesce_print_stats(&node->coalesce);
+    }
+    if (wal_is_open(&node->wal)) {
+        wal_print_stats(&node->wal);
+    }
+    printf("  loop: %llu wakeups, %llu io events, %llu timer fires\n",
+           (unsigned long long)loop.wakeups,
+           (unsigned long long)loop.io_events,
+           (unsigned long long)loop.timer_fires);
+}
+
+void roj_node_print_metrics(const roj_node_t* node) {
+    roj_transport_stats_t io;
+
+    if (node->tp) {
+        transport_get_stats(node->tp, &io);
+    }
+    metrics_print(&node->metrics, node->tp ? &io : NULL);
+}
+
+void roj_node_print_status(const roj_node_t* node) {
+    if (node->config.leader_mode) {
+        replog_print_status(&node->replog);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * ROJ Node - hooks for in-process harnesses
+ *
+ * A node created with an environment sends through env->send instead of
+ * UDP, receives whatever the harness hands to roj_node_deliver(), and runs
+ * all of its timers on env->clock. That lets a harness such as roj-sim
+ * run a whole cluster on one thread in virtual time.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_NODE_H
+#define ROJ_NODE_H
+
+#include "roj.h"
+#include "types.h"
+#include "timer_wheel.h"
+
+/* Carry msg to count addresses; INADDR_BROADCAST means every node on the
+ * port, as on a LAN */
+typedef void (*roj_node_send_fn)(const roj_message_t* msg, const struct sockaddr_in* addrs,
+                                 int count, void* ctx);
+
+typedef struct {
+    roj_node_send_fn send;
+    void* send_ctx;
+    roj_clock_ms_fn clock;      /* drives every timer of the node */
+    uint64_t seed;              /* proposal IDs and election jitter */
+    uint16_t origin;            /* proposal origin, unique among the members
+                                 * (e.g. index + 1); 0 = fold the node ID */
+} roj_node_env_t;
+
+/* Create a node without sockets in env. roj_node_poll() then only fires
+ * the timers due at env->clock() and never waits. */
+roj_node_t* roj_node_create_env(const roj_node_config_t* config, const roj_node_env_t* env);
+
+/* Hand the node a message that arrived from `from` */
+void roj_node_deliver(roj_node_t* node, const roj_message_t* msg,
+                      const struct sockaddr_in* from);
+
+/* When the node's next timer is due, UINT64_MAX if none */
+uint64_t roj_node_next_deadline(const roj_node_t* node);
+
+/* Called once for each of the node's own proposals: committed when it
+ * reached its vote threshold, or not when it expired (threshold mode) */
+typedef void (*roj_node_outcome_fn)(roj_node_t* node, uint64_t id, bool committed,
+                                    void* ctx);
+
+void roj_node_on_outcome(roj_node_t* node, roj_node_outcome_fn cb, void* ctx);
+
+/* Propose key = value as a proposal of its own and name it in *id.
+ * Threshold mode without batching only; -1 otherwise or if it failed. */
+int roj_node_propose_id(roj_node_t* node, const char* key, int64_t value, uint64_t* id);
+
+/* Called once an operation from roj_node_submit is applied on this node,
+ * with how it went and the key's value after it (leader mode). An
+ * operation lost with a deposed leader's term is never reported. */
+typedef void (*roj_node_applied_fn)(roj_node_t* node, uint64_t id, roj_op_result_t result,
+                                    int64_t value, void* ctx);
+
+void roj_node_on_applied(roj_node_t* node, roj_node_applied_fn cb, void* ctx);
+
+/* Put op on key in the replicated log and name it in *id; expect is the
+ * value a ROJ_OP_CAS requires. Leader mode only; -1 otherwise or if it
+ * was dropped. */
+int roj_node_submit(roj_node_t* node, roj_op_t op, const char* key, int64_t value,
+                    int64_t expect, uint64_t* id);
+
+#endif /* ROJ_NODE_H */
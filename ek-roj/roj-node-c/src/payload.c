@@ -0,0 +1,114 @@
+/*
+ * ROJ Payload - out-of-line arrays of batch, aggregate and log messages
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "payload.h"
+#include "transport.h"
+
+#ifdef ROJ_THREADS
+#include <pthread.h>
+#define PAYLOAD_LOCAL _Thread_local
+#else
+#define PAYLOAD_LOCAL   /* one thread: a plain static will do */
+#endif
+
+_Static_assert(ROJ_PAYLOAD_RECV_SLOTS >= ROJ_RECV_BATCH,
+               "a receive batch must not reuse its own slots");
+
+typedef struct {
+    roj_payload_t* slots;
+    unsigned next;
+} payload_ring_t;
+
+static PAYLOAD_LOCAL payload_ring_t t_recv;
+
+#ifdef ROJ_THREADS
+static pthread_key_t g_recv_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+
+/* Thread exit: t_recv is gone by now, the key kept its slots */
+static void release_slots(void* slots) {
+    free(slots);
+}
+
+static void make_key(void) {
+    pthread_key_create(&g_recv_key, release_slots);
+}
+#endif
+
+roj_payload_t* payload_recv_slot(void) {
+    payload_ring_t* r = &t_recv;
+    if (!r->slots) {
+        r->slots = malloc(ROJ_PAYLOAD_RECV_SLOTS * sizeof(*r->slots));
+        if (!r->slots) {
+            return NULL;
+        }
+#ifdef ROJ_THREADS
+        pthread_once(&g_key_once, make_key);
+        pthread_setspecific(g_recv_key, r->slots);
+#endif
+    }
+    roj_payload_t* slot = &r->slots[r->next];
+    r->next = (r->next + 1) % ROJ_PAYLOAD_RECV_SLOTS;
+    return slot;
+}
+
+/* The array msg points at, with its size */
+static void* payload_of(const roj_message_t* msg, size_t* size) {
+    switch (msg->type) {
+        case MSG_PROPOSE_BATCH:
+            *size = (size_t)msg->data.propose_batch.count * sizeof(roj_kv_t);
+            return msg->data.propose_batch.entries;
+        case MSG_COMMIT_BATCH:
+            *size = (size_t)msg->data.commit_batch.count * sizeof(roj_kv_t);
+            return msg->data.commit_batch.entries;
+        case MSG_VOTE_AGG:
+            *size = (size_t)msg->data.vote_agg.count * sizeof(uint64_t);
+            return msg->data.vote_agg.ids;
+        case MSG_COMMIT_AGG:
+            *size = (size_t)msg->data.commit_agg.count * sizeof(roj_commit_item_t);
+            return msg->data.commit_agg.items;
+        case MSG_APPEND_ENTRIES:
+            *size = (size_t)msg->data.append_entries.count * sizeof(roj_log_entry_t);
+            return msg->data.append_entries.entries;
+        case MSG_FORWARD:
+            *size = (size_t)msg->data.forward.count * sizeof(roj_log_entry_t);
+            return msg->data.forward.entries;
+        default:
+            *size = 0;
+            return NULL;
+    }
+}
+
+size_t message_payload_size(const roj_message_t* msg) {
+    size_t size;
+    payload_of(msg, &size);
+    return size;
+}
+
+void message_set_payload(roj_message_t* msg, roj_payload_t* payload) {
+    switch (msg->type) {
+        case MSG_PROPOSE_BATCH:  msg->data.propose_batch.entries = payload->kv; break;
+        case MSG_COMMIT_BATCH:   msg->data.commit_batch.entries = payload->kv; break;
+        case MSG_VOTE_AGG:       msg->data.vote_agg.ids = payload->ids; break;
+        case MSG_COMMIT_AGG:     msg->data.commit_agg.items = payload->items; break;
+        case MSG_APPEND_ENTRIES: msg->data.append_entries.entries = payload->log; break;
+        case MSG_FORWARD:        msg->data.forward.entries = payload->log; break;
+        default: break;
+    }
+}
+
+void message_copy(roj_message_t* dst, roj_payload_t* payload, const roj_message_t* src) {
+    size_t size;
+    const void* array = payload_of(src, &size);
+
+    *dst = *src;
+    if (size > 0) {
+        memcpy(payload, array, size);
+        message_set_payload(dst, payload);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * ROJ Payload - out-of-line arrays of batch, aggregate and log messages
+ *
+ * PROPOSE_BATCH, COMMIT_BATCH, VOTE_AGG, COMMIT_AGG, APPEND_ENTRIES and
+ * FORWARD point at their array instead of carrying it, which keeps
+ * roj_message_t small for everything that is copied into rings and queues.
+ *
+ * Whoever builds a message owns the array until the message is sent or
+ * handled: builders point it at storage of their own, and decoders at a
+ * receive slot of the decoding thread. A decoded array stays valid until
+ * ROJ_PAYLOAD_RECV_SLOTS more messages are decoded on that thread, one
+ * receive batch, so it must be handled before the next batch is read.
+ * Anything that keeps a message longer copies it with message_copy().
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_PAYLOAD_H
+#define ROJ_PAYLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+#define ROJ_PAYLOAD_RECV_SLOTS 32     /* ROJ_RECV_BATCH */
+
+/* Room for the largest array any message points at */
+typedef union {
+    roj_kv_t kv[ROJ_MAX_BATCH];
+    roj_log_entry_t log[ROJ_MAX_BATCH];
+    uint64_t ids[ROJ_MAX_AGG];
+    roj_commit_item_t items[ROJ_MAX_AGG];
+} roj_payload_t;
+
+/* True for the message types that point at an array */
+static inline bool message_type_has_payload(int type) {
+    return type == MSG_PROPOSE_BATCH || type == MSG_COMMIT_BATCH || type == MSG_VOTE_AGG ||
+           type == MSG_COMMIT_AGG || type == MSG_APPEND_ENTRIES || type == MSG_FORWARD;
+}
+
+/* Next receive slot of the calling thread for a decoder to fill, NULL if
+ * out of memory */
+roj_payload_t* payload_recv_slot(void);
+
+/* Bytes of msg's out-of-line array, 0 for none */
+size_t message_payload_size(const roj_message_t* msg);
+
+/* Point msg's array (if its type has one) at payload */
+void message_set_payload(roj_message_t* msg, roj_payload_t* payload);
+
+/* Copy src to dst with its array in payload; payload may be NULL only if
+ * message_payload_size(src) is 0 */
+void message_copy(roj_message_t* dst, roj_payload_t* payload, const roj_message_t* src);
+
+#endif /* ROJ_PAYLOAD_H */
@@ -0,0 +1,63 @@
+/*
+ * ROJ Pipeline - threaded receive/decode and send stages
+ *
+ * I/O threads read the UDP socket, or one SO_REUSEPORT shard each
+ * (round-robin when there are more threads than shards; a peer's messages
+ * stay in order only while each shard has one reader). Each thread drains
+ * datagrams with recvmmsg, decodes them into roj_message_t and pushes them
+ * onto its own SPSC ring.
+ * The event loop thread is woken through one descriptor, drains every
+ * ring and stays the only thread touching consensus, discovery and timer
+ * state. Outbound messages travel back through another SPSC ring to a
+ * sender thread that encodes them and fans them out with sendmmsg.
+ * Messages with an out-of-line array (payload.h) take a second slot from
+ * a smaller ring alongside each of those rings for their array.
+ *
+ * Built with ROJ_THREADS (POSIX only).
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_PIPELINE_H
+#define ROJ_PIPELINE_H
+
+#include "types.h"
+#include "transport.h"
+
+#define ROJ_PIPELINE_MAX_THREADS  16
+#define ROJ_PIPELINE_IN_SLOTS     4096   /* per I/O thread */
+#define ROJ_PIPELINE_OUT_SLOTS    512
+#define ROJ_PIPELINE_IN_PAYLOADS  1024   /* batch/agg/log arrays, per I/O thread */
+#define ROJ_PIPELINE_OUT_PAYLOADS 256
+#define ROJ_PIPELINE_DRAIN_BUDGET 1024   /* messages per ring per wakeup */
+
+typedef void (*roj_pipeline_handler)(const roj_message_t* msg,
+                                     const struct sockaddr_in* from, void* ctx);
+
+/* Threads and queues of one pipeline (opaque) */
+typedef struct roj_pipeline roj_pipeline_t;
+
+/* Start io_threads receive threads and the sender thread on tp's sockets,
+ * NULL on error */
+roj_pipeline_t* pipeline_start(roj_transport_t* tp, int io_threads);
+
+/* Stop and join all threads (queued outbound messages are sent first),
+ * then free the pipeline */
+void pipeline_stop(roj_pipeline_t* pl);
+
+/* Descriptor that becomes readable when decoded messages are queued */
+int pipeline_get_fd(const roj_pipeline_t* pl);
+
+/* Event loop thread: hand queued messages to handler with ctx, returns
+ * the count */
+int pipeline_drain(roj_pipeline_t* pl, roj_pipeline_handler handler, void* ctx);
+
+/* Event loop thread: queue msg for addrs[i] with encoding wires[i]
+ * (wires may be NULL for all-JSON) */
+int pipeline_send(roj_pipeline_t* pl, const roj_message_t* msg, const struct sockaddr_in* addrs,
+                  const roj_wire_t* wires, int count);
+
+/* Print per-thread counters */
+void pipeline_print_stats(const roj_pipeline_t* pl);
+
+#endif /* ROJ_PIPELINE_H */
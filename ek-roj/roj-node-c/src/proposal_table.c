@@ -0,0 +1,197 @@
+/*
+ * ROJ Proposal Table - in-flight proposal tracker implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proposal_table.h"
+
+#define ROJ_PROPOSAL_MIN_CAP 16
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t proposal_id_from_str(const char* s) {
+    uint64_t v = 0;
+    int n = 0;
+
+    for (; s[n]; n++) {
+        char c = s[n];
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else break;
+        v = (v << 4) | (uint64_t)d;
+    }
+    if (n == 16 && s[n] == '\0') {
+        return v;
+    }
+
+    /* Foreign ID format: FNV-1a of the string */
+    uint64_t h = 1469598103934665603ULL;
+    for (const char* p = s; *p; p++) {
+        h ^= (uint8_t)*p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint16_t proposal_origin_of(const char* node_id) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char* p = node_id; *p; p++) {
+        h ^= (uint8_t)*p;
+        h *= 1099511628211ULL;
+    }
+    return (uint16_t)(h ^ (h >> 16) ^ (h >> 32) ^ (h >> 48));
+}
+
+void proposal_id_to_str(uint64_t id, char* buf) {
+    snprintf(buf, ROJ_PROPOSAL_ID_LEN, "%016llx", (unsigned long long)id);
+}
+
+static void index_put(uint32_t* index, uint32_t cap, uint64_t id, uint32_t slot) {
+    uint32_t mask = cap - 1;
+    uint32_t i = (uint32_t)mix64(id) & mask;
+    while (index[i] != ROJ_PROPOSAL_NONE) {
+        i = (i + 1) & mask;
+    }
+    index[i] = slot;
+}
+
+static int index_grow(roj_proposal_table_t* t, uint32_t cap) {
+    uint32_t* index = malloc((size_t)cap * sizeof(*index));
+    if (!index) return -1;
+    memset(index, 0xFF, (size_t)cap * sizeof(*index));
+
+    for (uint32_t i = 0; i < t->index_cap; i++) {
+        uint32_t slot = t->index[i];
+        if (slot != ROJ_PROPOSAL_NONE) {
+            index_put(index, cap, t->hot[slot].id, slot);
+        }
+    }
+
+    free(t->index);
+    t->index = index;
+    t->index_cap = cap;
+    return 0;
+}
+
+static int slots_grow(roj_proposal_table_t* t) {
+    uint32_t cap = t->cap ? t->cap * 2 : ROJ_PROPOSAL_MIN_CAP;
+
+    roj_proposal_hot_t* hot = realloc(t->hot, (size_t)cap * sizeof(*hot));
+    if (!hot) return -1;
+    t->hot = hot;
+
+    roj_proposal_votes_t* votes = realloc(t->votes, (size_t)cap * sizeof(*votes));
+    if (!votes) return -1;
+    t->votes = votes;
+
+    roj_proposal_t* cold = realloc(t->cold, (size_t)cap * sizeof(*cold));
+    if (!cold) return -1;
+    t->cold = cold;
+
+    uint32_t* free_list = realloc(t->free_list, (size_t)cap * sizeof(*free_list));
+    if (!free_list) return -1;
+    t->free_list = free_list;
+
+    t->cap = cap;
+    return 0;
+}
+
+int proposal_table_init(roj_proposal_table_t* t, uint32_t initial_cap) {
+    memset(t, 0, sizeof(*t));
+    while (t->cap < initial_cap || t->cap == 0) {
+        if (slots_grow(t) != 0) return -1;
+    }
+    return index_grow(t, t->cap * 2);
+}
+
+void proposal_table_free(roj_proposal_table_t* t) {
+    free(t->hot);
+    free(t->votes);
+    free(t->cold);
+    free(t->free_list);
+    free(t->index);
+    memset(t, 0, sizeof(*t));
+}
+
+uint32_t proposal_table_find(const roj_proposal_table_t* t, uint64_t id) {
+    uint32_t mask = t->index_cap - 1;
+    uint32_t i = (uint32_t)mix64(id) & mask;
+
+    for (;;) {
+        uint32_t slot = t->index[i];
+        if (slot == ROJ_PROPOSAL_NONE) return ROJ_PROPOSAL_NONE;
+        if (t->hot[slot].id == id) return slot;
+        i = (i + 1) & mask;
+    }
+}
+
+uint32_t proposal_table_insert(roj_proposal_table_t* t, uint64_t id) {
+    if (proposal_table_find(t, id) != ROJ_PROPOSAL_NONE) {
+        return ROJ_PROPOSAL_NONE;
+    }
+
+    uint32_t slot;
+    if (t->free_count > 0) {
+        slot = t->free_list[--t->free_count];
+    } else {
+        if (t->used == t->cap && slots_grow(t) != 0) {
+            return ROJ_PROPOSAL_NONE;
+        }
+        slot = t->used++;
+    }
+
+    if ((t->count + 1) * 2 > t->index_cap && index_grow(t, t->index_cap * 2) != 0) {
+        t->free_list[t->free_count++] = slot;
+        return ROJ_PROPOSAL_NONE;
+    }
+
+    memset(&t->hot[slot], 0, sizeof(t->hot[slot]));
+    memset(&t->votes[slot], 0, sizeof(t->votes[slot]));
+    memset(&t->cold[slot], 0, sizeof(t->cold[slot]));
+    t->hot[slot].id = id;
+    t->hot[slot].in_use = 1;
+
+    index_put(t->index, t->index_cap, id, slot);
+    t->count++;
+    return slot;
+}
+
+void proposal_table_remove(roj_proposal_table_t* t, uint32_t slot) {
+    if (slot >= t->used || !t->hot[slot].in_use) return;
+
+    uint32_t mask = t->index_cap - 1;
+    uint32_t i = (uint32_t)mix64(t->hot[slot].id) & mask;
+    while (t->index[i] != slot) {
+        i = (i + 1) & mask;
+    }
+
+    /* Backward-shift deletion keeps linear probe chains unbroken */
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        uint32_t moving = t->index[j];
+        if (moving == ROJ_PROPOSAL_NONE) break;
+        uint32_t home = (uint32_t)mix64(t->hot[moving].id) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            t->index[i] = moving;
+            i = j;
+        }
+    }
+    t->index[i] = ROJ_PROPOSAL_NONE;
+
+    t->hot[slot].in_use = 0;
+    t->free_list[t->free_count++] = slot;
+    t->count--;
+}
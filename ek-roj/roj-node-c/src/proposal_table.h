@@ -0,0 +1,112 @@
+/*
+ * ROJ Proposal Table - in-flight proposal tracker
+ *
+ * Proposals are identified by a 64-bit ID: the proposer's 16-bit origin
+ * index in the top bits and a 48-bit sequence number below. Origins must
+ * be unique in a cluster. A harness that knows every member numbers them;
+ * otherwise the origin is folded from the node ID and discovery refuses
+ * a node whose origin clashes with one it already knows. On the JSON
+ * wire the ID travels as 16 lowercase hex digits; IDs minted by other
+ * implementations (e.g. 8-char UUID prefixes) are hashed into the same
+ * 64-bit space and their original string is kept for replies.
+ *
+ * Per-proposal state is split into two hot arrays touched on every VOTE
+ * (ID and vote counters; who voted and how) and a cold array (key, value,
+ * deadline). Lookups go
+ * through an open-addressing index keyed by ID. Everything grows on demand,
+ * so the number of proposals in flight is unbounded.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_PROPOSAL_TABLE_H
+#define ROJ_PROPOSAL_TABLE_H
+
+#include <stddef.h>
+#include "types.h"
+
+#define ROJ_PROPOSAL_SEQ_BITS 48
+#define ROJ_PROPOSAL_NONE     UINT32_MAX
+
+/* Hot per-proposal state, 16 bytes */
+typedef struct {
+    uint64_t id;
+    uint16_t accepts;
+    uint16_t rejects;
+    uint16_t vote_count;
+    uint16_t in_use;
+} roj_proposal_hot_t;
+
+/* Voter bitsets, 64 bytes for 256 voter slots */
+typedef struct {
+    uint64_t voted[ROJ_VOTER_WORDS];     /* bit per interned voter slot */
+    uint64_t accepted[ROJ_VOTER_WORDS];  /* subset of voted */
+} roj_proposal_votes_t;
+
+typedef struct {
+    roj_proposal_hot_t* hot;
+    roj_proposal_votes_t* votes;
+    roj_proposal_t* cold;
+    uint32_t* free_list;
+    uint32_t free_count;
+    uint32_t cap;           /* slots in hot/votes/cold */
+    uint32_t used;          /* slots ever handed out (high-water mark) */
+    uint32_t count;         /* proposals in flight */
+
+    uint32_t* index;        /* ID hash -> slot, ROJ_PROPOSAL_NONE = empty */
+    uint32_t index_cap;     /* power of two, kept at most half full */
+} roj_proposal_table_t;
+
+/* Initialize an empty table */
+int proposal_table_init(roj_proposal_table_t* t, uint32_t initial_cap);
+
+/* Free all memory held by the table */
+void proposal_table_free(roj_proposal_table_t* t);
+
+/* Add a proposal with the given ID; its votes and cold entry are zeroed.
+ * Returns the slot, or ROJ_PROPOSAL_NONE if the ID exists or memory ran out */
+uint32_t proposal_table_insert(roj_proposal_table_t* t, uint64_t id);
+
+/* Find a proposal by ID, returns the slot or ROJ_PROPOSAL_NONE */
+uint32_t proposal_table_find(const roj_proposal_table_t* t, uint64_t id);
+
+/* Remove the proposal in slot */
+void proposal_table_remove(roj_proposal_table_t* t, uint32_t slot);
+
+static inline roj_proposal_hot_t* proposal_hot(roj_proposal_table_t* t, uint32_t slot) {
+    return &t->hot[slot];
+}
+
+static inline roj_proposal_votes_t* proposal_votes(roj_proposal_table_t* t, uint32_t slot) {
+    return &t->votes[slot];
+}
+
+static inline roj_proposal_t* proposal_cold(roj_proposal_table_t* t, uint32_t slot) {
+    return &t->cold[slot];
+}
+
+/* Origin index folded from a node ID (FNV-1a, 64 to 16 bits) */
+uint16_t proposal_origin_of(const char* node_id);
+
+/* Compose a proposal ID from origin index and sequence number */
+static inline uint64_t proposal_id_make(uint16_t origin, uint64_t seq) {
+    return ((uint64_t)origin << ROJ_PROPOSAL_SEQ_BITS) |
+           (seq & ((1ULL << ROJ_PROPOSAL_SEQ_BITS) - 1));
+}
+
+/* Origin index and sequence number of an ID */
+static inline uint16_t proposal_id_origin(uint64_t id) {
+    return (uint16_t)(id >> ROJ_PROPOSAL_SEQ_BITS);
+}
+
+static inline uint64_t proposal_id_seq(uint64_t id) {
+    return id & ((1ULL << ROJ_PROPOSAL_SEQ_BITS) - 1);
+}
+
+/* Map a wire proposal_id string to its 64-bit ID */
+uint64_t proposal_id_from_str(const char* s);
+
+/* Format a 64-bit ID as 16 hex digits (buf >= ROJ_PROPOSAL_ID_LEN) */
+void proposal_id_to_str(uint64_t id, char* buf);
+
+#endif /* ROJ_PROPOSAL_TABLE_H */
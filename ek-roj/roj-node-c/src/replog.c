@@ -0,0 +1,859 @@
+/*
+ * ROJ Replicated Log - leader election and log replication implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "replog.h"
+#include "consensus.h"
+#include "discovery.h"
+#include "state_store.h"
+#include "symtab.h"
+#include "logger.h"
+
+#define LOG_INITIAL_CAP 1024
+
+static const char* const g_role_names[] = { "follower", "candidate", "leader" };
+
+/* Log */
+
+static uint64_t last_index(const roj_replog_t* rl) {
+    return rl->base + rl->log_len;
+}
+
+static uint64_t last_term(const roj_replog_t* rl) {
+    return rl->log_len > 0 ? rl->log[rl->log_len - 1].term : rl->base_term;
+}
+
+static roj_log_entry_t* entry_at(roj_replog_t* rl, uint64_t index) {
+    return &rl->log[index - rl->base - 1];
+}
+
+/* Term of the entry at index; false if it was compacted or is not there */
+static bool term_at(roj_replog_t* rl, uint64_t index, uint64_t* term) {
+    if (index == rl->base) {
+        *term = rl->base_term;
+        return true;
+    }
+    if (index < rl->base || index > last_index(rl)) {
+        return false;
+    }
+    *term = entry_at(rl, index)->term;
+    return true;
+}
+
+/* Append a copy of src in term */
+static int append_entry(roj_replog_t* rl, uint64_t term, const roj_log_entry_t* src) {
+    if (rl->log_len == rl->log_cap) {
+        size_t cap = rl->log_cap * 2;
+        roj_log_entry_t* log = realloc(rl->log, cap * sizeof(*log));
+        if (!log) {
+            ROJ_LOG(ROJ_LOG_ERROR, "Log: out of memory at index %llu",
+                    (unsigned long long)last_index(rl));
+            return -1;
+        }
+        rl->log = log;
+        rl->log_cap = cap;
+    }
+
+    roj_log_entry_t* e = &rl->log[rl->log_len++];
+    *e = *src;
+    e->term = term;
+    return 0;
+}
+
+/* Drop the entry at index and everything after it. Only uncommitted
+ * entries can be dropped: a leader elected by a real majority holds every
+ * committed one, so a leader that disagrees with one means the cluster has
+ * split (nodes started with different cluster sizes), and the updates it
+ * acknowledged cannot be kept. That is fatal. */
+static void truncate_from(roj_replog_t* rl, uint64_t index, roj_sym_t leader) {
+    if (index <= rl->commit) {
+        roj_log_stop();     /* write out what is queued before going down */
+        ROJ_LOG(ROJ_LOG_ERROR, "Log: leader %s disagrees with committed entry %llu "
+                "(commit %llu); the cluster has split, aborting",
+                symtab_str(leader), (unsigned long long)index,
+                (unsigned long long)rl->commit);
+        abort();
+    }
+    rl->log_len = (size_t)(index - rl->base - 1);
+}
+
+/* Forget applied entries that every follower has, keeping ROJ_LOG_RETAIN
+ * for laggards. Waits until a whole ROJ_LOG_RETAIN can go so the memmove
+ * stays amortized. */
+static void compact(roj_replog_t* rl) {
+    if (rl->applied < rl->base + 2 * (uint64_t)ROJ_LOG_RETAIN) {
+        return;
+    }
+
+    uint64_t upto = rl->applied - ROJ_LOG_RETAIN;
+    if (rl->role == ROLE_LEADER) {
+        /* A member that is gone does not hold the log back */
+        for (int i = 0; i < rl->member_count; i++) {
+            if (rl->members[i].active && rl->members[i].match_index < upto) {
+                upto = rl->members[i].match_index;
+            }
+        }
+    }
+    if (upto < rl->base + ROJ_LOG_RETAIN) {
+        return;
+    }
+
+    size_t drop = (size_t)(upto - rl->base);
+    rl->base_term = entry_at(rl, upto)->term;
+    memmove(rl->log, rl->log + drop, (rl->log_len - drop) * sizeof(*rl->log));
+    rl->log_len -= drop;
+    rl->base = upto;
+}
+
+/* True if an entry with this ID was applied before, or is too old to tell:
+ * a forward resent across a late acknowledgement lands in the log twice.
+ * Every node applies the same log, so they all skip the same copies. */
+static bool applied_before(roj_replog_t* rl, uint64_t id) {
+    uint16_t origin = proposal_id_origin(id);
+    uint64_t seq = proposal_id_seq(id);
+    roj_log_origin_t* o = NULL;
+
+    for (int i = 0; i < rl->origin_count; i++) {
+        if (rl->origins[i].origin == origin) {
+            o = &rl->origins[i];
+            break;
+        }
+    }
+    if (!o) {
+        if (rl->origin_count == ROJ_MAX_PEERS + 1) {
+            return false;   /* more origins than nodes: cannot tell */
+        }
+        o = &rl->origins[rl->origin_count++];
+        memset(o, 0, sizeof(*o));
+        o->origin = origin;
+        o->high = seq;
+    } else if (seq > o->high) {
+        /* Slide the window up, forgetting the numbers that fall out */
+        if (seq - o->high >= ROJ_APPLIED_WINDOW) {
+            memset(o->seen, 0, sizeof(o->seen));
+        } else {
+            for (uint64_t q = o->high + 1; q < seq; q++) {
+                o->seen[(q % ROJ_APPLIED_WINDOW) / 64] &= ~(1ULL << (q % 64));
+            }
+        }
+        o->high = seq;
+    } else if (o->high - seq >= ROJ_APPLIED_WINDOW) {
+        return true;
+    } else if (o->seen[(seq % ROJ_APPLIED_WINDOW) / 64] & (1ULL << (seq % 64))) {
+        return true;
+    }
+
+    o->seen[(seq % ROJ_APPLIED_WINDOW) / 64] |= 1ULL << (seq % 64);
+    return false;
+}
+
+static void apply_entry(roj_replog_t* rl, const roj_log_entry_t* e) {
+    roj_op_result_t result = ROJ_OP_OK;
+    int64_t value = e->value;
+
+    if (e->op != ROJ_OP_SET &&
+        consensus_get_state(rl->consensus, symtab_str(e->key), &value) != 0) {
+        result = ROJ_OP_NO_KEY;
+    } else if (e->op == ROJ_OP_CAS && value != e->expect) {
+        result = ROJ_OP_DIFFERS;
+    } else if (e->op != ROJ_OP_READ) {
+        value = e->value;
+        if (consensus_apply(rl->consensus, e->key, value) != 0) {
+            return;     /* not applied here, so not reported either */
+        }
+        ROJ_LOG(ROJ_LOG_INFO, "Log: Applied %s=%lld (index %llu)", symtab_str(e->key),
+                (long long)value, (unsigned long long)rl->applied);
+    }
+
+    if (rl->on_applied && proposal_id_origin(e->id) == rl->consensus->origin) {
+        rl->on_applied(e->id, result, value, rl->on_applied_ctx);
+    }
+}
+
+static void apply_committed(roj_replog_t* rl) {
+    while (rl->applied < rl->commit) {
+        const roj_log_entry_t* e = entry_at(rl, ++rl->applied);
+        if (e->id == 0) {
+            continue;   /* a new leader's no-op */
+        }
+        if (applied_before(rl, e->id)) {
+            ROJ_LOG(ROJ_LOG_DEBUG, "Log: Skipping %s again (index %llu)", symtab_str(e->key),
+                    (unsigned long long)rl->applied);
+            continue;
+        }
+        apply_entry(rl, e);
+    }
+    compact(rl);
+}
+
+/* Members */
+
+static roj_log_member_t* find_member(roj_replog_t* rl, roj_sym_t node_id) {
+    for (int i = 0; i < rl->member_count; i++) {
+        if (rl->members[i].node_id == node_id) {
+            return &rl->members[i];
+        }
+    }
+    return NULL;
+}
+
+/* Follow discovery: every peer ever seen speaking "log/1" is a member and
+ * keeps its vote. Peers that time out are only marked inactive, so the
+ * majority never shrinks and a partitioned minority cannot elect itself. */
+static void sync_members(roj_replog_t* rl) {
+    roj_peer_list_t* peers = discovery_get_peers(rl->discovery);
+
+    for (int i = 0; i < rl->member_count; i++) {
+        rl->members[i].active = false;
+    }
+    for (int i = 0; i < peers->count; i++) {
+        const roj_peer_t* p = &peers->peers[i];
+        if (!(p->caps & ROJ_CAP_LOG) || p->node_id == rl->self) {
+            continue;
+        }
+
+        roj_log_member_t* m = find_member(rl, p->node_id);
+        if (!m) {
+            if (rl->member_count == ROJ_MAX_PEERS) {
+                continue;
+            }
+            m = &rl->members[rl->member_count++];
+            memset(m, 0, sizeof(*m));
+            m->node_id = p->node_id;
+            m->next_index = last_index(rl) + 1;
+            m->progress = true;
+        }
+        m->active = p->active;
+        m->addr = p->addr;
+        m->wire = discovery_wire_for_addr(rl->discovery, &p->addr);
+    }
+}
+
+/* Voting members, ourselves included: every member seen, and at least the
+ * configured cluster size */
+static int voters(const roj_replog_t* rl) {
+    return rl->member_count + 1 > rl->cluster_size ? rl->member_count + 1 : rl->cluster_size;
+}
+
+/* Votes or replicas needed, ourselves included */
+static int majority(const roj_replog_t* rl) {
+    return voters(rl) / 2 + 1;
+}
+
+/* Election */
+
+static uint64_t next_random(roj_replog_t* rl) {
+    rl->rng ^= rl->rng << 13;
+    rl->rng ^= rl->rng >> 7;
+    rl->rng ^= rl->rng << 17;
+    return rl->rng;
+}
+
+static void reset_election_timer(roj_replog_t* rl) {
+    uint64_t span = ROJ_ELECTION_TIMEOUT_MAX_MS - ROJ_ELECTION_TIMEOUT_MIN_MS + 1;
+    rl->election_deadline = rl->now() + ROJ_ELECTION_TIMEOUT_MIN_MS + next_random(rl) % span;
+}
+
+/* Any message from a later term makes us a follower in that term */
+static void observe_term(roj_replog_t* rl, uint64_t term) {
+    if (term <= rl->term) {
+        return;
+    }
+    if (rl->role != ROLE_FOLLOWER) {
+        ROJ_LOG(ROJ_LOG_INFO, "Election: term %llu seen, stepping down", (unsigned long long)term);
+        rl->role = ROLE_FOLLOWER;
+        reset_election_timer(rl);
+    }
+    rl->term = term;
+    rl->voted_for = ROJ_SYM_EMPTY;
+    rl->leader = ROJ_SYM_EMPTY;
+}
+
+/* Highest index a majority holds becomes committed, but only through an
+ * entry of our own term (log.rs try_advance_commit) */
+static void advance_commit(roj_replog_t* rl) {
+    uint64_t match[ROJ_MAX_PEERS + 1];
+    int n = 0;
+
+    match[n++] = last_index(rl);
+    for (int i = 0; i < rl->member_count; i++) {
+        uint64_t v = rl->members[i].match_index;
+        int j = n++;
+        /* Insertion sort, descending */
+        while (j > 0 && match[j - 1] < v) {
+            match[j] = match[j - 1];
+            j--;
+        }
+        match[j] = v;
+    }
+
+    /* Members not discovered yet hold nothing */
+    int need = majority(rl);
+    if (need > n) {
+        return;
+    }
+    uint64_t index = match[need - 1];
+    if (index > rl->commit && entry_at(rl, index)->term == rl->term) {
+        rl->commit = index;
+        apply_committed(rl);
+    }
+}
+
+/* One APPEND_ENTRIES from m->next_index; -1 if it would need compacted entries */
+static int send_append(roj_replog_t* rl, roj_log_member_t* m) {
+    roj_message_t msg;
+    uint64_t prev = m->next_index - 1;
+    uint64_t prev_term;
+
+    if (!term_at(rl, prev, &prev_term)) {
+        if (!m->stalled) {
+            ROJ_LOG(ROJ_LOG_WARN, "Log: %s needs entries before %llu, which are compacted",
+                    symtab_str(m->node_id), (unsigned long long)(rl->base + 1));
+            m->stalled = true;
+        }
+        return -1;
+    }
+
+    uint64_t avail = last_index(rl) - prev;
+    int count = avail < ROJ_MAX_BATCH ? (int)avail : ROJ_MAX_BATCH;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_APPEND_ENTRIES;
+    msg.data.append_entries.term = rl->term;
+    msg.data.append_entries.leader_id = rl->self;
+    msg.data.append_entries.prev_log_index = prev;
+    msg.data.append_entries.prev_log_term = prev_term;
+    msg.data.append_entries.leader_commit = rl->commit;
+    msg.data.append_entries.count = count;
+    if (count > 0) {
+        /* A slice of the log: sending copies or encodes it right away */
+        msg.data.append_entries.entries = entry_at(rl, prev + 1);
+    }
+
+    rl->send(&msg, &m->addr, m->wire, rl->send_ctx);
+    m->next_index += (uint64_t)count;
+    return 0;
+}
+
+/* Keep up to ROJ_LOG_WINDOW unacknowledged entries in flight; a heartbeat
+ * sends one message even when there is nothing new */
+static void replicate(roj_replog_t* rl, roj_log_member_t* m, bool heartbeat) {
+    bool sent = false;
+
+    while ((heartbeat && !sent) ||
+           (m->next_index <= last_index(rl) &&
+            m->next_index - m->match_index <= ROJ_LOG_WINDOW)) {
+        if (send_append(rl, m) != 0) {
+            return;
+        }
+        sent = true;
+    }
+}
+
+static void heartbeat(roj_replog_t* rl) {
+    advance_commit(rl);
+    for (int i = 0; i < rl->member_count; i++) {
+        roj_log_member_t* m = &rl->members[i];
+        if (!m->active) {
+            continue;
+        }
+        if (!m->progress) {
+            /* Nothing acknowledged for a whole interval: resend what was lost */
+            m->next_index = m->match_index + 1;
+        }
+        m->progress = false;
+        replicate(rl, m, true);
+    }
+    rl->next_heartbeat = rl->now() + ROJ_HEARTBEAT_INTERVAL_MS;
+}
+
+static void become_leader(roj_replog_t* rl) {
+    rl->role = ROLE_LEADER;
+    rl->leader = rl->self;
+    ROJ_LOG(ROJ_LOG_INFO, "Election: Leader for term %llu (%d/%d votes)",
+            (unsigned long long)rl->term, rl->vote_count, voters(rl));
+
+    for (int i = 0; i < rl->member_count; i++) {
+        rl->members[i].next_index = last_index(rl) + 1;
+        rl->members[i].match_index = 0;
+        rl->members[i].progress = true;
+        rl->members[i].stalled = false;
+    }
+
+    /* A no-op of our own term lets entries of earlier terms commit;
+     * operations that were waiting for a leader become ours */
+    static const roj_log_entry_t noop = { 0 };
+    append_entry(rl, rl->term, &noop);
+    for (int i = 0; i < rl->forward_count; i++) {
+        append_entry(rl, rl->term, &rl->forward[i].entry);
+    }
+    rl->forward_count = 0;
+
+    heartbeat(rl);
+}
+
+static void start_election(roj_replog_t* rl) {
+    roj_message_t msg;
+
+    if (rl->cluster_size == 0) {
+        /* A majority of the members seen so far is no majority */
+        reset_election_timer(rl);
+        return;
+    }
+
+    rl->term++;
+    rl->role = ROLE_CANDIDATE;
+    rl->voted_for = rl->self;
+    rl->leader = ROJ_SYM_EMPTY;
+    rl->votes[0] = rl->self;
+    rl->vote_count = 1;
+    reset_election_timer(rl);
+
+    ROJ_LOG(ROJ_LOG_INFO, "Election: Starting election for term %llu",
+            (unsigned long long)rl->term);
+
+    if (rl->vote_count >= majority(rl)) {
+        become_leader(rl);
+        return;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_REQUEST_VOTE;
+    msg.data.request_vote.term = rl->term;
+    msg.data.request_vote.candidate_id = rl->self;
+    msg.data.request_vote.last_log_index = last_index(rl);
+    msg.data.request_vote.last_log_term = last_term(rl);
+    for (int i = 0; i < rl->member_count; i++) {
+        if (rl->members[i].active) {
+            rl->send(&msg, &rl->members[i].addr, rl->members[i].wire, rl->send_ctx);
+        }
+    }
+}
+
+/* Message handlers */
+
+static void handle_request_vote(roj_replog_t* rl, const roj_message_t* msg,
+                                const struct sockaddr_in* from) {
+    roj_sym_t candidate = msg->data.request_vote.candidate_id;
+    bool granted = false;
+    roj_message_t reply;
+
+    if (msg->data.request_vote.term == rl->term) {
+        bool can_vote = rl->voted_for == ROJ_SYM_EMPTY || rl->voted_for == candidate;
+        /* The candidate's log must be at least as up to date as ours */
+        bool log_ok = msg->data.request_vote.last_log_term > last_term(rl) ||
+                      (msg->data.request_vote.last_log_term == last_term(rl) &&
+                       msg->data.request_vote.last_log_index >= last_index(rl));
+        granted = can_vote && log_ok;
+    }
+
+    if (granted) {
+        rl->voted_for = candidate;
+        reset_election_timer(rl);
+        ROJ_LOG(ROJ_LOG_INFO, "Election: Granting vote to %s for term %llu",
+                symtab_str(candidate), (unsigned long long)rl->term);
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    reply.type = MSG_VOTE_RESPONSE;
+    reply.data.vote_response.term = rl->term;
+    reply.data.vote_response.voter_id = rl->self;
+    reply.data.vote_response.vote_granted = granted;
+    rl->send(&reply, from, discovery_wire_for_addr(rl->discovery, from), rl->send_ctx);
+}
+
+static void handle_vote_response(roj_replog_t* rl, const roj_message_t* msg) {
+    roj_sym_t voter = msg->data.vote_response.voter_id;
+
+    if (rl->role != ROLE_CANDIDATE || msg->data.vote_response.term != rl->term ||
+        !msg->data.vote_response.vote_granted) {
+        return;
+    }
+    for (int i = 0; i < rl->vote_count; i++) {
+        if (rl->votes[i] == voter) {
+            return;
+        }
+    }
+    if (rl->vote_count == ROJ_MAX_PEERS + 1) {
+        return;
+    }
+
+    rl->votes[rl->vote_count++] = voter;
+    ROJ_LOG(ROJ_LOG_INFO, "Election: Vote from %s (%d/%d)",
+            symtab_str(voter), rl->vote_count, voters(rl));
+    if (rl->vote_count >= majority(rl)) {
+        become_leader(rl);
+    }
+}
+
+/* Forwards */
+
+/* An entry reached our log: if we forwarded it, it needs no resend */
+static void forward_seen(roj_replog_t* rl, uint64_t id) {
+    for (int i = 0; i < rl->forward_count; i++) {
+        if (rl->forward[i].entry.id == id) {
+            rl->forward_count--;
+            memmove(&rl->forward[i], &rl->forward[i + 1],
+                    (size_t)(rl->forward_count - i) * sizeof(*rl->forward));
+            return;
+        }
+    }
+}
+
+/* Send the operations that are new or due for a retry to the leader, in order,
+ * ROJ_MAX_BATCH per FORWARD */
+static void flush_forward(roj_replog_t* rl) {
+    roj_message_t msg;
+    roj_log_entry_t entries[ROJ_MAX_BATCH];
+    uint64_t now;
+
+    if (rl->forward_count == 0 || rl->role == ROLE_LEADER || rl->leader == ROJ_SYM_EMPTY) {
+        return;
+    }
+
+    now = rl->now();
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_FORWARD;
+    msg.data.forward.from = rl->self;
+    msg.data.forward.entries = entries;
+    for (int i = 0; i < rl->forward_count; i++) {
+        roj_forward_t* f = &rl->forward[i];
+        if (f->resend_at > now) {
+            continue;
+        }
+        if (f->resend_at != 0) {
+            ROJ_LOG(ROJ_LOG_DEBUG, "Log: Resending %s %s to %s", op_to_str((roj_op_t)f->entry.op),
+                    symtab_str(f->entry.key), symtab_str(rl->leader));
+        }
+        f->resend_at = now + ROJ_FORWARD_RETRY_MS;
+        entries[msg.data.forward.count++] = f->entry;
+        if (msg.data.forward.count == ROJ_MAX_BATCH) {
+            rl->send(&msg, &rl->leader_addr,
+                     discovery_wire_for_addr(rl->discovery, &rl->leader_addr), rl->send_ctx);
+            msg.data.forward.count = 0;
+        }
+    }
+    if (msg.data.forward.count > 0) {
+        rl->send(&msg, &rl->leader_addr,
+                 discovery_wire_for_addr(rl->discovery, &rl->leader_addr), rl->send_ctx);
+    }
+}
+
+/* Follower side; returns the reply's match index through *match */
+static bool accept_entries(roj_replog_t* rl, const roj_message_t* msg, uint64_t* match) {
+    uint64_t prev = msg->data.append_entries.prev_log_index;
+    uint64_t term;
+
+    if (prev > last_index(rl)) {
+        *match = last_index(rl);
+        return false;
+    }
+    if (prev >= rl->base && term_at(rl, prev, &term) &&
+        term != msg->data.append_entries.prev_log_term) {
+        /* Diverged at prev: drop it and everything after */
+        truncate_from(rl, prev, msg->data.append_entries.leader_id);
+        *match = prev - 1;
+        return false;
+    }
+
+    for (int i = 0; i < msg->data.append_entries.count; i++) {
+        const roj_log_entry_t* e = &msg->data.append_entries.entries[i];
+        uint64_t index = prev + 1 + (uint64_t)i;
+
+        if (index <= rl->base) {
+            continue;   /* compacted here, so already committed */
+        }
+        if (index <= last_index(rl)) {
+            if (entry_at(rl, index)->term == e->term) {
+                continue;
+            }
+            truncate_from(rl, index, msg->data.append_entries.leader_id);
+        }
+        if (append_entry(rl, e->term, e) != 0) {
+            *match = last_index(rl);
+            return false;
+        }
+        forward_seen(rl, e->id);
+    }
+
+    *match = prev + (uint64_t)msg->data.append_entries.count;
+    if (msg->data.append_entries.leader_commit > rl->commit) {
+        uint64_t commit = msg->data.append_entries.leader_commit;
+        if (commit > *match) commit = *match;
+        if (commit > rl->commit) {
+            rl->commit = commit;
+            apply_committed(rl);
+        }
+    }
+    return true;
+}
+
+static void handle_append_entries(roj_replog_t* rl, const roj_message_t* msg,
+                                  const struct sockaddr_in* from) {
+    roj_wire_t wire = discovery_wire_for_addr(rl->discovery, from);
+    roj_message_t reply;
+    uint64_t match = last_index(rl);
+    bool success = false;
+
+    if (msg->data.append_entries.term == rl->term) {
+        /* The term's leader: a candidate gives up, everyone restarts the timeout */
+        if (rl->role != ROLE_FOLLOWER) {
+            ROJ_LOG(ROJ_LOG_INFO, "Election: Stepping down in term %llu",
+                    (unsigned long long)rl->term);
+            rl->role = ROLE_FOLLOWER;
+        }
+        if (rl->leader != msg->data.append_entries.leader_id) {
+            rl->leader = msg->data.append_entries.leader_id;
+            ROJ_LOG(ROJ_LOG_INFO, "Election: Recognized %s as leader for term %llu",
+                    symtab_str(rl->leader), (unsigned long long)rl->term);
+            /* What the last leader did not append goes to the new one now */
+            for (int i = 0; i < rl->forward_count; i++) {
+                rl->forward[i].resend_at = 0;
+            }
+        }
+        rl->leader_addr = *from;
+        reset_election_timer(rl);
+
+        success = accept_entries(rl, msg, &match);
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    reply.type = MSG_APPEND_ENTRIES_RESPONSE;
+    reply.data.append_response.term = rl->term;
+    reply.data.append_response.follower_id = rl->self;
+    reply.data.append_response.success = success;
+    reply.data.append_response.match_index = match;
+    rl->send(&reply, from, wire, rl->send_ctx);
+}
+
+static void handle_append_response(roj_replog_t* rl, const roj_message_t* msg) {
+    roj_log_member_t* m = find_member(rl, msg->data.append_response.follower_id);
+
+    if (rl->role != ROLE_LEADER || msg->data.append_response.term != rl->term || !m) {
+        return;
+    }
+
+    uint64_t match = msg->data.append_response.match_index;
+    if (match > last_index(rl)) match = last_index(rl);
+    m->progress = true;
+
+    if (msg->data.append_response.success) {
+        if (match > m->match_index) {
+            m->match_index = match;
+            advance_commit(rl);
+        }
+        if (m->next_index <= m->match_index) {
+            m->next_index = m->match_index + 1;
+        }
+        return;
+    }
+
+    /* The follower's log ends or diverges earlier (or it restarted empty):
+     * back up to its hint and retry at once */
+    if (match < m->match_index) {
+        m->match_index = match;
+    }
+    m->next_index = match + 1;
+    replicate(rl, m, true);
+}
+
+static void handle_forward(roj_replog_t* rl, const roj_message_t* msg) {
+    if (rl->role != ROLE_LEADER) {
+        ROJ_LOG(ROJ_LOG_WARN, "Log: Not the leader, dropping %d operations from %s "
+                "(resent later)", msg->data.forward.count, symtab_str(msg->data.forward.from));
+        return;
+    }
+    for (int i = 0; i < msg->data.forward.count; i++) {
+        if (append_entry(rl, rl->term, &msg->data.forward.entries[i]) != 0) {
+            return;
+        }
+    }
+}
+
+static uint64_t seed_rng(const char* node_id, uint64_t seed) {
+    return (state_key_hash(node_id) ^ (seed * 0x9E3779B97F4A7C15ULL)) | 1;
+}
+
+/* API */
+
+int replog_init(roj_replog_t* rl, const char* node_id, roj_consensus_t* consensus,
+                roj_discovery_t* discovery, roj_clock_ms_fn now,
+                roj_replog_send send, void* ctx) {
+    memset(rl, 0, sizeof(*rl));
+    rl->self = symtab_intern_str(node_id);
+    rl->consensus = consensus;
+    rl->discovery = discovery;
+    rl->now = now;
+    rl->send = send;
+    rl->send_ctx = ctx;
+    rl->rng = seed_rng(node_id, (uint64_t)time(NULL));
+
+    rl->log = malloc(LOG_INITIAL_CAP * sizeof(*rl->log));
+    if (!rl->log) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Failed to allocate replicated log");
+        return -1;
+    }
+    rl->log_cap = LOG_INITIAL_CAP;
+    rl->role = ROLE_FOLLOWER;
+    rl->voted_for = rl->leader = ROJ_SYM_EMPTY;
+
+    /* Give discovery one announce round before the first election */
+    reset_election_timer(rl);
+    rl->election_deadline += ROJ_ANNOUNCE_INTERVAL_MS;
+    return 0;
+}
+
+void replog_seed(roj_replog_t* rl, uint64_t seed) {
+    rl->rng = seed_rng(symtab_str(rl->self), seed);
+    reset_election_timer(rl);
+    rl->election_deadline += ROJ_ANNOUNCE_INTERVAL_MS;
+}
+
+void replog_set_cluster_size(roj_replog_t* rl, int voters) {
+    rl->cluster_size = voters > ROJ_MAX_PEERS + 1 ? ROJ_MAX_PEERS + 1 : voters;
+}
+
+void replog_set_applied_hook(roj_replog_t* rl, roj_replog_applied_fn fn, void* ctx) {
+    rl->on_applied = fn;
+    rl->on_applied_ctx = ctx;
+}
+
+void replog_free(roj_replog_t* rl) {
+    free(rl->log);
+    rl->log = NULL;
+    rl->log_len = rl->log_cap = 0;
+}
+
+int replog_submit(roj_replog_t* rl, roj_op_t op, const char* key, int64_t value,
+                  int64_t expect, uint64_t* id) {
+    roj_log_entry_t e = { 0 };
+
+    if (rl->role != ROLE_LEADER && rl->forward_count == ROJ_FORWARD_MAX) {
+        ROJ_LOG(ROJ_LOG_WARN, "Log: %d operations waiting for a leader, dropping %s",
+                rl->forward_count, key);
+        return -1;
+    }
+
+    e.id = consensus_next_id(rl->consensus);
+    e.key = symtab_intern_str(key);
+    e.op = (uint8_t)op;
+    e.value = value;
+    e.expect = op == ROJ_OP_CAS ? expect : 0;
+    if (id) {
+        *id = e.id;
+    }
+
+    if (rl->role == ROLE_LEADER) {
+        return append_entry(rl, rl->term, &e);
+    }
+    rl->forward[rl->forward_count].entry = e;
+    rl->forward[rl->forward_count].resend_at = 0;
+    rl->forward_count++;
+    return 0;
+}
+
+void replog_handle_message(roj_replog_t* rl, const roj_message_t* msg,
+                           const struct sockaddr_in* from) {
+    switch (msg->type) {
+        case MSG_REQUEST_VOTE:
+            observe_term(rl, msg->data.request_vote.term);
+            handle_request_vote(rl, msg, from);
+            break;
+
+        case MSG_VOTE_RESPONSE:
+            observe_term(rl, msg->data.vote_response.term);
+            handle_vote_response(rl, msg);
+            break;
+
+        case MSG_APPEND_ENTRIES:
+            observe_term(rl, msg->data.append_entries.term);
+            handle_append_entries(rl, msg, from);
+            break;
+
+        case MSG_APPEND_ENTRIES_RESPONSE:
+            observe_term(rl, msg->data.append_response.term);
+            handle_append_response(rl, msg);
+            break;
+
+        case MSG_FORWARD:
+            handle_forward(rl, msg);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void replog_tick(roj_replog_t* rl) {
+    uint64_t now = rl->now();
+
+    sync_members(rl);
+    if (rl->role == ROLE_LEADER) {
+        if (now >= rl->next_heartbeat) {
+            heartbeat(rl);
+        }
+    } else if (now >= rl->election_deadline) {
+        start_election(rl);
+    } else {
+        flush_forward(rl);
+    }
+}
+
+uint64_t replog_next_deadline(const roj_replog_t* rl) {
+    if (rl->role == ROLE_LEADER) {
+        return rl->next_heartbeat;
+    }
+
+    uint64_t due = rl->election_deadline;
+    if (rl->leader != ROJ_SYM_EMPTY) {
+        for (int i = 0; i < rl->forward_count; i++) {
+            if (rl->forward[i].resend_at < due) {
+                due = rl->forward[i].resend_at;
+            }
+        }
+    }
+    return due;
+}
+
+void replog_flush(roj_replog_t* rl) {
+    if (rl->role != ROLE_LEADER) {
+        flush_forward(rl);
+        return;
+    }
+
+    /* Alone, appending is committing */
+    advance_commit(rl);
+    for (int i = 0; i < rl->member_count; i++) {
+        if (rl->members[i].active && rl->members[i].next_index <= last_index(rl)) {
+            replicate(rl, &rl->members[i], false);
+        }
+    }
+}
+
+bool replog_is_leader(const roj_replog_t* rl) {
+    return rl->role == ROLE_LEADER;
+}
+
+void replog_print_status(const roj_replog_t* rl) {
+    printf("Leader mode: %s, term %llu, leader %s\n", g_role_names[rl->role],
+           (unsigned long long)rl->term,
+           rl->leader != ROJ_SYM_EMPTY ? symtab_str(rl->leader) : "(unknown)");
+    printf("  log: last %llu (term %llu), commit %llu, applied %llu, first kept %llu\n",
+           (unsigned long long)last_index(rl), (unsigned long long)last_term(rl),
+           (unsigned long long)rl->commit, (unsigned long long)rl->applied,
+           (unsigned long long)(rl->base + 1));
+    if (rl->role == ROLE_LEADER) {
+        for (int i = 0; i < rl->member_count; i++) {
+            printf("  %s: match %llu, next %llu%s\n", symtab_str(rl->members[i].node_id),
+                   (unsigned long long)rl->members[i].match_index,
+                   (unsigned long long)rl->members[i].next_index,
+                   rl->members[i].active ? "" : " (gone)");
+        }
+    }
+}
@@ -0,0 +1,205 @@
+/*
+ * ROJ Replicated Log - leader election and log replication (leader mode)
+ *
+ * The C counterpart of roj-core-rs election.rs and log.rs. Nodes elect a
+ * leader per term (REQUEST_VOTE / VOTE_RESPONSE, randomized 150-300 ms
+ * election timeout). Followers hand their operations to the leader in
+ * FORWARD messages; the leader appends them to its log and replicates
+ * batches of up to ROJ_MAX_BATCH entries with APPEND_ENTRIES, which doubles
+ * as the 50 ms heartbeat. An entry commits once a majority's match index
+ * covers it and is applied through consensus_apply(), so it reaches the
+ * state store and the WAL like a K-threshold commit.
+ *
+ * An entry sets a key, sets it only if it holds an expected value (CAS), or
+ * reads it. Every node settles CAS and READ against its own state when it
+ * applies the entry, so they all reach the same result at the same index;
+ * the node that submitted the operation reports it through the applied
+ * hook. Entries carry the origin's proposal ID, and one that was applied
+ * before (or is older than the last ROJ_APPLIED_WINDOW from its origin) is
+ * skipped, so a resent forward takes effect once.
+ *
+ * Replication is sent from replog_flush(rl), which the caller runs once per
+ * batch of events: every update that arrived in one wakeup shares one
+ * APPEND_ENTRIES (or FORWARD) per peer. A window of unacknowledged entries
+ * is kept in flight per follower; a follower that makes no progress
+ * between heartbeats is re-sent from its match index.
+ *
+ * A follower keeps each operation it forwarded until the entry reaches its
+ * log, and sends it again every ROJ_FORWARD_RETRY_MS (to whichever node
+ * leads by then), so a lost FORWARD, or one that reached a node no longer
+ * leading, is not lost for good. An operation the old leader appended but
+ * never committed can still vanish with its term; its origin then never
+ * hears about it.
+ *
+ * Membership is taken from discovery: every peer ever seen advertising
+ * "log/1" votes and counts toward the majority, and the majority is never
+ * smaller than that of the configured cluster size, which must be set
+ * before this node campaigns. A member that times out keeps its vote (it
+ * is only no longer sent to), so a partitioned minority cannot elect a
+ * leader or commit; removing a node for good takes a restart of the
+ * others. A follower only ever drops uncommitted entries: a leader that
+ * disagrees with a committed one aborts the node.
+ *
+ * Terms, votes and the log live in memory only, as in the Rust modules,
+ * and applied entries beyond the last ROJ_LOG_RETAIN are dropped; a
+ * follower that falls further behind than that cannot be caught up (there
+ * is no snapshot transfer).
+ *
+ * Event loop thread only.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_REPLOG_H
+#define ROJ_REPLOG_H
+
+#include "types.h"
+#include "timer_wheel.h"
+#include "consensus.h"
+#include "discovery.h"
+
+#define ROJ_ELECTION_TIMEOUT_MIN_MS  150
+#define ROJ_ELECTION_TIMEOUT_MAX_MS  300
+#define ROJ_HEARTBEAT_INTERVAL_MS    50
+#define ROJ_LOG_WINDOW      (8 * ROJ_MAX_BATCH)  /* unacknowledged entries per follower */
+#define ROJ_LOG_RETAIN      65536               /* applied entries kept for laggards */
+#define ROJ_FORWARD_MAX     ROJ_LOG_WINDOW      /* updates a follower holds for the leader */
+#define ROJ_FORWARD_RETRY_MS (4 * ROJ_HEARTBEAT_INTERVAL_MS)  /* resend unseen forwards */
+#define ROJ_APPLIED_WINDOW  ROJ_FORWARD_MAX     /* recent IDs remembered per origin */
+
+typedef void (*roj_replog_send)(const roj_message_t* msg,
+                                const struct sockaddr_in* to, roj_wire_t wire, void* ctx);
+
+/* An operation this node submitted was applied: how it went, and the key's
+ * value after it (unless result is ROJ_OP_NO_KEY) */
+typedef void (*roj_replog_applied_fn)(uint64_t id, roj_op_result_t result, int64_t value,
+                                      void* ctx);
+
+typedef enum {
+    ROLE_FOLLOWER = 0,
+    ROLE_CANDIDATE,
+    ROLE_LEADER
+} roj_role_t;
+
+/* A peer in the cluster; next/match only matter while we lead */
+typedef struct {
+    roj_sym_t node_id;
+    struct sockaddr_in addr;
+    roj_wire_t wire;
+    uint64_t next_index;    /* next entry to send */
+    uint64_t match_index;   /* highest entry known to be replicated there */
+    bool active;            /* discovery hears from it; gone members still vote */
+    bool progress;          /* acknowledged something since the last heartbeat */
+    bool stalled;           /* needs compacted entries (warned once) */
+} roj_log_member_t;
+
+/* An operation handed to the leader and not yet seen in our log */
+typedef struct {
+    roj_log_entry_t entry;
+    uint64_t resend_at;     /* next FORWARD of it; 0 = not sent yet */
+} roj_forward_t;
+
+/* Entry IDs applied from one origin: the highest sequence number and a bit
+ * per number in the window below it (indexed by seq % ROJ_APPLIED_WINDOW) */
+typedef struct {
+    uint16_t origin;
+    uint64_t high;
+    uint64_t seen[ROJ_APPLIED_WINDOW / 64];
+} roj_log_origin_t;
+
+typedef struct {
+    roj_sym_t self;
+    roj_consensus_t* consensus;     /* committed entries are applied here */
+    roj_discovery_t* discovery;     /* membership and wire formats */
+    roj_clock_ms_fn now;
+    roj_replog_send send;
+    void* send_ctx;
+    roj_replog_applied_fn on_applied;   /* NULL = none */
+    void* on_applied_ctx;
+    uint64_t rng;
+
+    /* Election state (election.rs) */
+    roj_role_t role;
+    uint64_t term;
+    roj_sym_t voted_for;
+    roj_sym_t leader;
+    struct sockaddr_in leader_addr;
+    roj_sym_t votes[ROJ_MAX_PEERS + 1];     /* granted this term, ours included */
+    int vote_count;
+    uint64_t election_deadline;
+    uint64_t next_heartbeat;
+
+    /* Log (log.rs): holds entries base + 1 .. base + log_len */
+    roj_log_entry_t* log;
+    size_t log_len;
+    size_t log_cap;
+    uint64_t base;
+    uint64_t base_term;
+    uint64_t commit;
+    uint64_t applied;
+    roj_log_origin_t origins[ROJ_MAX_PEERS + 1];
+    int origin_count;
+
+    roj_log_member_t members[ROJ_MAX_PEERS];   /* only ever grows */
+    int member_count;
+    int cluster_size;               /* voters expected, ourselves included; 0 = never elect */
+
+    /* Operations for the leader, oldest first, until they show up in the log */
+    roj_forward_t forward[ROJ_FORWARD_MAX];
+    int forward_count;
+} roj_replog_t;
+
+/* Start as a follower. The first election waits for one announce round so
+ * peers are known before anyone campaigns. Committed entries are applied to
+ * consensus; send is called with ctx for every outgoing message. */
+int replog_init(roj_replog_t* rl, const char* node_id, roj_consensus_t* consensus,
+                roj_discovery_t* discovery, roj_clock_ms_fn now,
+                roj_replog_send send, void* ctx);
+
+/* Draw election timeouts from seed instead of the wall clock, for
+ * reproducible runs; call right after replog_init */
+void replog_seed(roj_replog_t* rl, uint64_t seed);
+
+/* Count at least `voters` votes (ourselves included) when working out a
+ * majority, even before that many members are discovered. Until it is set
+ * the node never campaigns. */
+void replog_set_cluster_size(roj_replog_t* rl, int voters);
+
+/* Call fn for every operation this node submitted, once it is applied */
+void replog_set_applied_hook(roj_replog_t* rl, roj_replog_applied_fn fn, void* ctx);
+
+/* Free the log */
+void replog_free(roj_replog_t* rl);
+
+/* Append an operation (leader) or queue it for the leader (follower) and
+ * name it in *id (NULL: not needed); expect only matters for ROJ_OP_CAS.
+ * Returns 0, or -1 if it was dropped: ROJ_FORWARD_MAX operations are
+ * already waiting for a leader to take them. */
+int replog_submit(roj_replog_t* rl, roj_op_t op, const char* key, int64_t value,
+                  int64_t expect, uint64_t* id);
+
+/* Handle REQUEST_VOTE, VOTE_RESPONSE, APPEND_ENTRIES(_RESPONSE) or FORWARD */
+void replog_handle_message(roj_replog_t* rl, const roj_message_t* msg,
+                           const struct sockaddr_in* from);
+
+/* Election and heartbeat timeouts and forward retries; call once
+ * replog_next_deadline() is reached */
+void replog_tick(roj_replog_t* rl);
+
+/* When replog_tick() next has work, on rl's clock: the next heartbeat
+ * (leader), else the election timeout or the earliest forward to resend.
+ * It only moves earlier through replog_handle_message(), replog_submit()
+ * and replog_flush(), so the caller re-reads it after those. */
+uint64_t replog_next_deadline(const roj_replog_t* rl);
+
+/* Send what the last batch of events produced: new entries to followers,
+ * queued updates to the leader */
+void replog_flush(roj_replog_t* rl);
+
+/* True while this node leads its term */
+bool replog_is_leader(const roj_replog_t* rl);
+
+/* Print role, term, leader and log indices */
+void replog_print_status(const roj_replog_t* rl);
+
+#endif /* ROJ_REPLOG_H */
@@ -0,0 +1,156 @@
+/*
+ * ROJ - embeddable consensus node (libroj)
+ *
+ * Everything a node owns - sockets, event loop, timers, consensus and log
+ * state, WAL and snapshots - hangs off one roj_node_t, so a process can
+ * embed a node next to its own work or run several nodes side by side.
+ * The process-wide state is the symbol table of interned node IDs and
+ * keys, which all nodes share, the logger, and cJSON's allocator hooks:
+ * the first roj_node_create() points them at libroj's per-thread JSON
+ * arena (json_arena.h), so a host that uses cJSON itself gets arena-aware
+ * allocation too (plain malloc/free outside an arena scope) and must not
+ * install hooks of its own while a node exists.
+ *
+ * A node is driven by one thread at a time: either roj_node_run() until
+ * roj_node_stop(), or roj_node_poll() from the host's own loop (wait on
+ * roj_node_fd() where it is available). With io_threads > 0 the node
+ * also runs its own receive and send threads (ROJ_THREADS builds).
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_H
+#define ROJ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct roj_node roj_node_t;
+
+typedef struct {
+    const char* node_id;        /* required */
+    int port;                   /* UDP port; announces are broadcast to it */
+    bool leader_mode;           /* replicated log instead of K-threshold votes */
+    int cluster_size;           /* leader mode: nodes that vote (required) */
+    bool json_only;             /* do not advertise the binary encoding */
+    int batch_max;              /* updates per proposal, 1 = no batching */
+    int batch_delay_ms;
+    int agg_delay_ms;           /* VOTE/COMMIT aggregation window, 0 = off */
+    int shards;                 /* SO_REUSEPORT receive sockets */
+    int io_threads;             /* 0: receive and send on the polling thread */
+    const char* data_dir;       /* WAL and snapshots, NULL = memory only */
+    int wal_sync_ms;            /* group fsync window; commits are acked once it
+                                 * closes and is synced, 0 = fsync each commit */
+    int snapshot_every;         /* logged commits, 0 = manual only */
+    const char* metrics_file;   /* Prometheus text rewritten here, NULL = none */
+    int metrics_interval_ms;
+} roj_node_config_t;
+
+/* Called when a watched descriptor is readable */
+typedef void (*roj_node_fd_cb)(roj_node_t* node, int fd, void* ctx);
+
+/* Called for each key update committed to the node's state */
+typedef void (*roj_node_commit_cb)(roj_node_t* node, const char* key, int64_t value,
+                                   void* ctx);
+
+/* Fill config with the defaults of the roj-node-c command line */
+void roj_node_config_defaults(roj_node_config_t* config);
+
+/* Create a node: bind its sockets, recover state from data_dir and start
+ * announcing. Returns NULL on error. */
+roj_node_t* roj_node_create(const roj_node_config_t* config);
+
+/* Flush pending output, close storage and free the node */
+void roj_node_destroy(roj_node_t* node);
+
+/* Serve until roj_node_stop(); returns 0, or -1 if polling failed */
+int roj_node_run(roj_node_t* node);
+
+/* Make roj_node_run() return (async-signal-safe) */
+void roj_node_stop(roj_node_t* node);
+
+/* Wait up to timeout_ms (-1 = until something happens) and handle one
+ * round of datagrams and timers */
+int roj_node_poll(roj_node_t* node, int timeout_ms);
+
+/* Descriptor that is readable when roj_node_poll() has work (-1 if the
+ * platform has none; poll with a short timeout instead) */
+int roj_node_fd(const roj_node_t* node);
+
+/* Have the node's loop call cb when fd is readable (e.g. a command pipe).
+ * Updates proposed from cb go out together when it returns. */
+int roj_node_watch_fd(roj_node_t* node, int fd, roj_node_fd_cb cb, void* ctx);
+void roj_node_unwatch_fd(roj_node_t* node, int fd);
+
+/* Also announce to host:port, for peers outside the broadcast domain or
+ * nodes on other ports of this host */
+int roj_node_add_seed(roj_node_t* node, const char* host, int port);
+
+/* Propose key = value. Returns 0 once it is proposed, queued for the next
+ * batch or handed to the leader; -1 if it was dropped. */
+int roj_node_propose(roj_node_t* node, const char* key, int64_t value);
+
+/* Have cb see every commit applied from here on (NULL stops it). It runs
+ * inside message handling, so it must not call back into the node. */
+void roj_node_on_commit(roj_node_t* node, roj_node_commit_cb cb, void* ctx);
+
+/* Committed value of key (0 if found, -1 if not) */
+int roj_node_get(const roj_node_t* node, const char* key, int64_t* value);
+
+/* Start a background snapshot (0 started, 1 already running, -1 without
+ * data_dir or on error) */
+int roj_node_snapshot(roj_node_t* node);
+
+/* Node ID and mode */
+const char* roj_node_id(const roj_node_t* node);
+bool roj_node_is_leader_mode(const roj_node_t* node);
+
+/* Print committed state, discovered peers, I/O counters, message and
+ * proposal counters with latency quantiles, or (leader mode) role, term
+ * and log position */
+void roj_node_print_state(const roj_node_t* node);
+void roj_node_print_peers(roj_node_t* node);
+void roj_node_print_stats(const roj_node_t* node);
+void roj_node_print_metrics(const roj_node_t* node);
+void roj_node_print_status(const roj_node_t* node);
+
+/* Process-wide logging */
+
+typedef enum {
+    ROJ_LOG_ERROR = 0,
+    ROJ_LOG_WARN,
+    ROJ_LOG_INFO,
+    ROJ_LOG_DEBUG
+} roj_log_level_t;
+
+/* Records above level are skipped (default ROJ_LOG_INFO); safe to change
+ * at any time from any thread */
+void roj_log_set_level(roj_log_level_t level);
+roj_log_level_t roj_log_get_level(void);
+
+/* Level from "error", "warn", "info" or "debug" (0), or -1 if unknown */
+int roj_log_parse_level(const char* name, roj_log_level_t* level);
+
+/* Format and write log records on a background thread from now on
+ * (ROJ_THREADS builds; -1 elsewhere or on error) */
+int roj_log_start(void);
+
+/* Write out what is queued and go back to logging on the caller's thread.
+ * Call it once nodes logging in the background have been destroyed. */
+void roj_log_stop(void);
+
+/* Records dropped because a thread's ring was full */
+uint64_t roj_log_dropped(void);
+
+#ifdef ROJ_HISTORY
+/* Process-wide Elle history (ROJ_HISTORY builds) */
+
+/* Write every event recorded so far, from all threads, as an Elle history:
+ * EDN if path ends in ".edn", JSON otherwise. Safe while nodes run. */
+int roj_history_dump(const char* path);
+
+/* Events dropped because a thread's buffer was full */
+uint64_t roj_history_dropped(void);
+#endif
+
+#endif /* ROJ_H */
@@ -0,0 +1,687 @@
+/*
+ * ROJ Simulator - deterministic in-process cluster benchmark
+ *
+ * Runs N nodes in one process over an in-memory network with seeded
+ * latency, loss and reordering. Every node's timers run on one virtual
+ * clock that jumps straight to the next delivery or deadline, so a run
+ * takes as long as the protocol code needs and no longer.
+ *
+ * Each cluster size gets the same closed-loop workload: every node keeps
+ * --inflight proposals outstanding until --ops have been resolved. The
+ * report gives commits per virtual second (up to the last commit, so
+ * proposals that only expire do not count toward the run) and per
+ * wall-clock second, how many proposals failed or expired,
+ * propose->commit latency percentiles in virtual time, and a digest of
+ * the order in which proposers saw their commits. Identical options give
+ * identical virtual figures and digests, so a regression can be bisected
+ * on the digest alone and the wall-clock columns show what it costs.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "node.h"
+#include "payload.h"
+#include "replog.h"
+
+#define SIM_MAX_NODES    ROJ_MAX_PEERS
+#define SIM_MAX_SIZES    16
+#define SIM_EPOCH_MS     1000000     /* virtual time of cluster start */
+#define SIM_NET_PREFIX   0x0A000000u /* node i lives at 10.0.0.0 + i + 1 */
+
+typedef struct {
+    int sizes[SIM_MAX_SIZES];
+    int size_count;
+    uint64_t seed;
+    int ops;                /* proposals per cluster size */
+    int inflight;           /* outstanding proposals per node */
+    int latency_ms;
+    int jitter_ms;
+    double loss;            /* probability a datagram is dropped */
+    double reorder;         /* probability a datagram is held back */
+    uint64_t limit_ms;      /* virtual time cap per cluster size */
+    bool leader_mode;
+    int batch_max;
+    int batch_delay_ms;
+    int agg_delay_ms;
+    bool verbose;
+    const char* history_file;
+} sim_options_t;
+
+/* One sent datagram, shared by every delivery of a broadcast */
+typedef struct {
+    int refs;
+    roj_message_t msg;
+    roj_payload_t payload;      /* msg's array: the sender's goes away */
+} sim_packet_t;
+
+typedef enum {
+    EV_DELIVER,
+    EV_PROPOSE,
+    EV_TIMEOUT
+} sim_event_kind_t;
+
+typedef struct {
+    uint64_t at;
+    uint64_t seq;           /* ties go to the event scheduled first */
+    sim_event_kind_t kind;
+    int node;               /* receiver, proposer or owner of the op */
+    int from;
+    int op;
+    sim_packet_t* packet;
+} sim_event_t;
+
+typedef struct sim_cluster sim_cluster_t;
+
+typedef struct {
+    sim_cluster_t* cluster;
+    roj_node_t* node;
+    int index;
+    struct sockaddr_in addr;
+    int outstanding;
+} sim_node_t;
+
+struct sim_cluster {
+    const sim_options_t* opt;
+    sim_node_t nodes[SIM_MAX_NODES];
+    int count;
+    uint64_t rng;
+
+    sim_event_t* heap;
+    int heap_size;
+    int heap_cap;
+    uint64_t next_seq;
+
+    /* Per op: who proposed it, when, and whether it is resolved */
+    int* op_node;
+    uint64_t* op_start;
+    uint8_t* op_done;
+    uint32_t* latencies;
+    int issued;
+    int committed;
+    int failed;             /* refused at propose time */
+    int expired;            /* no commit within ROJ_VOTE_TIMEOUT_MS */
+    uint64_t first_issue;
+    uint64_t last_commit;
+    uint64_t digest;
+
+    uint64_t datagrams;
+    uint64_t dropped;
+};
+
+/* Virtual clock shared by every node of the running cluster */
+static uint64_t g_now;
+
+static uint64_t sim_clock(void) {
+    return g_now;
+}
+
+static uint64_t wall_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/* xorshift64*: the only source of randomness in a run */
+static uint64_t next_random(sim_cluster_t* c) {
+    c->rng ^= c->rng >> 12;
+    c->rng ^= c->rng << 25;
+    c->rng ^= c->rng >> 27;
+    return c->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static double next_unit(sim_cluster_t* c) {
+    return (double)(next_random(c) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void digest_add(sim_cluster_t* c, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        c->digest ^= (v >> (i * 8)) & 0xFF;
+        c->digest *= 0x100000001B3ULL;
+    }
+}
+
+/* Event queue: binary heap ordered by (at, seq) */
+
+static bool event_before(const sim_event_t* a, const sim_event_t* b) {
+    return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+static int push_event(sim_cluster_t* c, sim_event_t ev) {
+    if (c->heap_size == c->heap_cap) {
+        int cap = c->heap_cap ? c->heap_cap * 2 : 1024;
+        sim_event_t* heap = realloc(c->heap, (size_t)cap * sizeof(*heap));
+        if (!heap) {
+            fprintf(stderr, "[ERROR] Out of memory for simulator events\n");
+            return -1;
+        }
+        c->heap = heap;
+        c->heap_cap = cap;
+    }
+
+    ev.seq = c->next_seq++;
+    int pos = c->heap_size++;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (!event_before(&ev, &c->heap[parent])) break;
+        c->heap[pos] = c->heap[parent];
+        pos = parent;
+    }
+    c->heap[pos] = ev;
+    return 0;
+}
+
+static sim_event_t pop_event(sim_cluster_t* c) {
+    sim_event_t top = c->heap[0];
+    sim_event_t last = c->heap[--c->heap_size];
+    int pos = 0;
+
+    if (c->heap_size == 0) {
+        return top;
+    }
+    for (;;) {
+        int child = pos * 2 + 1;
+        if (child >= c->heap_size) break;
+        if (child + 1 < c->heap_size && event_before(&c->heap[child + 1], &c->heap[child])) {
+            child++;
+        }
+        if (!event_before(&c->heap[child], &last)) break;
+        c->heap[pos] = c->heap[child];
+        pos = child;
+    }
+    c->heap[pos] = last;
+    return top;
+}
+
+static void release_packet(sim_packet_t* packet) {
+    if (--packet->refs == 0) {
+        free(packet);
+    }
+}
+
+/* Network */
+
+static int node_for_addr(const sim_cluster_t* c, const struct sockaddr_in* addr) {
+    uint32_t host = ntohl(addr->sin_addr.s_addr);
+    if (host <= SIM_NET_PREFIX || host > SIM_NET_PREFIX + (uint32_t)c->count) {
+        return -1;
+    }
+    return (int)(host - SIM_NET_PREFIX - 1);
+}
+
+/* Queue one copy of packet for node to, unless the network loses it */
+static void route(sim_cluster_t* c, sim_packet_t* packet, int from, int to) {
+    const sim_options_t* opt = c->opt;
+
+    c->datagrams++;
+    if (opt->loss > 0 && next_unit(c) < opt->loss) {
+        c->dropped++;
+        return;
+    }
+
+    int64_t delay = opt->latency_ms;
+    if (opt->jitter_ms > 0) {
+        delay += (int64_t)(next_random(c) % (uint64_t)(2 * opt->jitter_ms + 1)) - opt->jitter_ms;
+    }
+    if (opt->reorder > 0 && next_unit(c) < opt->reorder) {
+        /* Held back long enough for later datagrams to overtake it */
+        delay += 1 + (int64_t)(next_random(c) % (uint64_t)(4 * opt->latency_ms + 1));
+    }
+    if (delay < 0) delay = 0;
+
+    sim_event_t ev = { .at = g_now + (uint64_t)delay, .kind = EV_DELIVER,
+                       .node = to, .from = from, .packet = packet };
+    if (push_event(c, ev) == 0) {
+        packet->refs++;
+    }
+}
+
+static void sim_send(const roj_message_t* msg, const struct sockaddr_in* addrs, int count,
+                     void* ctx) {
+    sim_node_t* sender = ctx;
+    sim_cluster_t* c = sender->cluster;
+
+    sim_packet_t* packet = malloc(sizeof(*packet));
+    if (!packet) {
+        fprintf(stderr, "[ERROR] Out of memory for simulated datagram\n");
+        return;
+    }
+    packet->refs = 1;       /* held until every copy is queued */
+    message_copy(&packet->msg, &packet->payload, msg);
+
+    for (int i = 0; i < count; i++) {
+        if (addrs[i].sin_addr.s_addr == htonl(INADDR_BROADCAST)) {
+            for (int j = 0; j < c->count; j++) {
+                if (j != sender->index) {
+                    route(c, packet, sender->index, j);
+                }
+            }
+        } else {
+            int to = node_for_addr(c, &addrs[i]);
+            if (to >= 0) {
+                route(c, packet, sender->index, to);
+            }
+        }
+    }
+    release_packet(packet);
+}
+
+/* Workload */
+
+static void schedule_proposal(sim_cluster_t* c, int node) {
+    sim_event_t ev = { .at = g_now, .kind = EV_PROPOSE, .node = node };
+    push_event(c, ev);
+}
+
+typedef enum {
+    OP_COMMITTED,
+    OP_FAILED,
+    OP_EXPIRED
+} op_outcome_t;
+
+static void resolve_op(sim_cluster_t* c, int op, op_outcome_t outcome) {
+    sim_node_t* sn = &c->nodes[c->op_node[op]];
+
+    c->op_done[op] = 1;
+    if (outcome == OP_COMMITTED) {
+        c->latencies[c->committed++] = (uint32_t)(g_now - c->op_start[op]);
+        c->last_commit = g_now;
+        digest_add(c, (uint64_t)op << 8 | (uint64_t)sn->index);
+        digest_add(c, g_now);
+    } else if (outcome == OP_EXPIRED) {
+        c->expired++;
+    } else {
+        c->failed++;
+    }
+    sn->outstanding--;
+    if (c->issued < c->opt->ops) {
+        schedule_proposal(c, sn->index);
+    }
+}
+
+/* Only the proposer's own commit counts: that is when its client hears back */
+static void on_commit(roj_node_t* node, const char* key, int64_t value, void* ctx) {
+    sim_node_t* sn = ctx;
+    sim_cluster_t* c = sn->cluster;
+    (void)node;
+    (void)key;
+
+    if (value >= 0 && value < c->issued && c->op_node[value] == sn->index &&
+        !c->op_done[value]) {
+        resolve_op(c, (int)value, OP_COMMITTED);
+    }
+}
+
+static void issue_proposal(sim_cluster_t* c, int node) {
+    sim_node_t* sn = &c->nodes[node];
+    char key[32];
+
+    if (c->issued == c->opt->ops || sn->outstanding >= c->opt->inflight) {
+        return;
+    }
+
+    int op = c->issued++;
+    if (op == 0) {
+        c->first_issue = g_now;
+    }
+    c->op_node[op] = node;
+    c->op_start[op] = g_now;
+    sn->outstanding++;
+
+    /* One key per op: concurrent writers never merge in a batch */
+    snprintf(key, sizeof(key), "s%d", op);
+    if (roj_node_propose(sn->node, key, op) != 0) {
+        resolve_op(c, op, OP_FAILED);
+        return;
+    }
+    if (!c->op_done[op]) {
+        sim_event_t ev = { .at = g_now + ROJ_VOTE_TIMEOUT_MS, .kind = EV_TIMEOUT,
+                           .node = node, .op = op };
+        push_event(c, ev);
+    }
+}
+
+static void handle_event(sim_cluster_t* c, const sim_event_t* ev) {
+    switch (ev->kind) {
+        case EV_DELIVER:
+            roj_node_deliver(c->nodes[ev->node].node, &ev->packet->msg,
+                             &c->nodes[ev->from].addr);
+            release_packet(ev->packet);
+            break;
+        case EV_PROPOSE:
+            issue_proposal(c, ev->node);
+            break;
+        case EV_TIMEOUT:
+            if (!c->op_done[ev->op]) {
+                resolve_op(c, ev->op, OP_EXPIRED);
+            }
+            break;
+    }
+}
+
+/* Advance virtual time until `until`, or until every op is resolved when
+ * ops_done is set. Deliveries due at a moment run before timers due then. */
+static void run_until(sim_cluster_t* c, uint64_t until, bool ops_done) {
+    while (!ops_done || c->committed + c->failed + c->expired < c->opt->ops) {
+        uint64_t next_event = c->heap_size > 0 ? c->heap[0].at : UINT64_MAX;
+        uint64_t next_timer = UINT64_MAX;
+        for (int i = 0; i < c->count; i++) {
+            uint64_t d = roj_node_next_deadline(c->nodes[i].node);
+            if (d < next_timer) next_timer = d;
+        }
+
+        uint64_t next = next_event <= next_timer ? next_event : next_timer;
+        if (next > until) {
+            break;
+        }
+        if (next > g_now) {
+            g_now = next;
+        }
+
+        if (next_event <= g_now) {
+            sim_event_t ev = pop_event(c);
+            handle_event(c, &ev);
+        } else {
+            for (int i = 0; i < c->count; i++) {
+                if (roj_node_next_deadline(c->nodes[i].node) <= g_now) {
+                    roj_node_poll(c->nodes[i].node, 0);
+                }
+            }
+        }
+    }
+    if (!ops_done && g_now < until) {
+        g_now = until;
+    }
+}
+
+static int create_cluster(sim_cluster_t* c, const sim_options_t* opt, int count) {
+    memset(c, 0, sizeof(*c));
+    c->opt = opt;
+    c->count = count;
+    c->rng = (opt->seed ^ ((uint64_t)count * 0x9E3779B97F4A7C15ULL)) | 1;
+    c->digest = 0xCBF29CE484222325ULL;
+
+    c->op_node = calloc((size_t)opt->ops, sizeof(*c->op_node));
+    c->op_start = calloc((size_t)opt->ops, sizeof(*c->op_start));
+    c->op_done = calloc((size_t)opt->ops, sizeof(*c->op_done));
+    c->latencies = calloc((size_t)opt->ops, sizeof(*c->latencies));
+    if (!c->op_node || !c->op_start || !c->op_done || !c->latencies) {
+        fprintf(stderr, "[ERROR] Out of memory for %d ops\n", opt->ops);
+        return -1;
+    }
+
+    g_now = SIM_EPOCH_MS;
+    for (int i = 0; i < count; i++) {
+        sim_node_t* sn = &c->nodes[i];
+        char node_id[16];
+        roj_node_config_t config;
+        roj_node_env_t env;
+
+        sn->cluster = c;
+        sn->index = i;
+        sn->addr.sin_family = AF_INET;
+        sn->addr.sin_addr.s_addr = htonl(SIM_NET_PREFIX + (uint32_t)i + 1);
+        sn->addr.sin_port = htons(ROJ_UDP_PORT);
+
+        snprintf(node_id, sizeof(node_id), "n%d", i);
+        roj_node_config_defaults(&config);
+        config.node_id = node_id;
+        config.leader_mode = opt->leader_mode;
+        config.cluster_size = count;
+        config.batch_max = opt->batch_max;
+        config.batch_delay_ms = opt->batch_delay_ms;
+        config.agg_delay_ms = opt->agg_delay_ms;
+
+        memset(&env, 0, sizeof(env));
+        env.send = sim_send;
+        env.send_ctx = sn;
+        env.clock = sim_clock;
+        env.seed = opt->seed * SIM_MAX_NODES + (uint64_t)i;
+        env.origin = (uint16_t)(i + 1);
+
+        sn->node = roj_node_create_env(&config, &env);
+        if (!sn->node) {
+            return -1;
+        }
+        roj_node_on_commit(sn->node, on_commit, sn);
+    }
+    return 0;
+}
+
+static void destroy_cluster(sim_cluster_t* c) {
+    for (int i = 0; i < c->count; i++) {
+        roj_node_destroy(c->nodes[i].node);
+    }
+    while (c->heap_size > 0) {
+        sim_event_t ev = pop_event(c);
+        if (ev.kind == EV_DELIVER) {
+            release_packet(ev.packet);
+        }
+    }
+    free(c->heap);
+    free(c->op_node);
+    free(c->op_start);
+    free(c->op_done);
+    free(c->latencies);
+}
+
+/* Node logs go to /dev/null during a run unless --verbose */
+static int quiet_begin(void) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (saved < 0 || null < 0) {
+        if (saved >= 0) close(saved);
+        if (null >= 0) close(null);
+        return -1;
+    }
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    return saved;
+}
+
+static void quiet_end(int saved) {
+    if (saved < 0) return;
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t* sorted, int count, double p) {
+    if (count == 0) return 0;
+    return sorted[(int)((count - 1) * p + 0.5)];
+}
+
+static int run_size(const sim_options_t* opt, int count) {
+    sim_cluster_t c;
+    int quiet = opt->verbose ? -1 : quiet_begin();
+
+    if (create_cluster(&c, opt, count) != 0) {
+        quiet_end(quiet);
+        destroy_cluster(&c);
+        return -1;
+    }
+
+    /* Let discovery (and in leader mode an election) settle first */
+    uint64_t warmup = 2 * ROJ_ANNOUNCE_INTERVAL_MS;
+    if (opt->leader_mode) {
+        warmup += ROJ_ELECTION_TIMEOUT_MAX_MS;
+    }
+    run_until(&c, g_now + warmup, false);
+
+    uint64_t start = wall_us();
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < opt->inflight; k++) {
+            schedule_proposal(&c, i);
+        }
+    }
+    run_until(&c, g_now + opt->limit_ms, true);
+    uint64_t wall = wall_us() - start;
+
+    quiet_end(quiet);
+
+    qsort(c.latencies, (size_t)c.committed, sizeof(*c.latencies), compare_u32);
+    /* Throughput runs to the last commit: an expiry resolves ROJ_VOTE_TIMEOUT_MS
+     * after its proposal and would stretch the run with no work done */
+    double virt_s = c.committed > 0 ? (double)(c.last_commit - c.first_issue) / 1000.0 : 0.0;
+    int unresolved = opt->ops - c.committed - c.failed - c.expired;
+    double wall_s = (double)wall / 1e6;
+
+    printf("%5d %9d %6d %7d %9.3f %11.1f %6u %6u %6u %6u %9.1f %12.1f %10llu %8llu  %016llx\n",
+           count, c.committed, c.failed + unresolved, c.expired,
+           virt_s, virt_s > 0 ? c.committed / virt_s : 0.0,
+           percentile(c.latencies, c.committed, 0.50),
+           percentile(c.latencies, c.committed, 0.90),
+           percentile(c.latencies, c.committed, 0.99),
+           c.committed > 0 ? c.latencies[c.committed - 1] : 0,
+           wall_s * 1000.0, wall_s > 0 ? c.committed / wall_s : 0.0,
+           (unsigned long long)c.datagrams, (unsigned long long)c.dropped,
+           (unsigned long long)c.digest);
+    fflush(stdout);
+
+    destroy_cluster(&c);
+    return 0;
+}
+
+static int parse_sizes(sim_options_t* opt, const char* list) {
+    char buf[128];
+    strncpy(buf, list, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    opt->size_count = 0;
+    for (char* tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        int n = atoi(tok);
+        if (n < 1 || n > SIM_MAX_NODES || opt->size_count == SIM_MAX_SIZES) {
+            fprintf(stderr, "Error: cluster sizes are 1..%d, at most %d of them\n",
+                    SIM_MAX_NODES, SIM_MAX_SIZES);
+            return -1;
+        }
+        opt->sizes[opt->size_count++] = n;
+    }
+    return opt->size_count > 0 ? 0 : -1;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [--nodes 3,5,8,16,32] [--seed <n>] [--ops <n>] [--inflight <n>] "
+           "[--latency <ms>] [--jitter <ms>] [--loss <pct>] [--reorder <pct>] "
+           "[--limit <ms>] [--mode threshold|leader] [--batch <n>] [--batch-delay <ms>] "
+           "[--agg-delay <ms>] [--verbose]\n", prog);
+#ifdef ROJ_HISTORY
+    printf("       --history <path>   write an Elle history of every run (EDN if *.edn, "
+           "else JSON)\n");
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    sim_options_t opt;
+
+    memset(&opt, 0, sizeof(opt));
+    parse_sizes(&opt, "3,5,8,16,32");
+    opt.seed = 1;
+    opt.ops = 5000;
+    opt.inflight = 4;
+    opt.latency_ms = 2;
+    opt.jitter_ms = 1;
+    opt.limit_ms = 600000;
+    opt.batch_max = 1;
+    opt.batch_delay_ms = ROJ_BATCH_DELAY_MS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+            if (parse_sizes(&opt, argv[++i]) != 0) {
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opt.seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            opt.ops = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--inflight") == 0 && i + 1 < argc) {
+            opt.inflight = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            opt.latency_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+            opt.jitter_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+            opt.loss = atof(argv[++i]) / 100.0;
+        }
+        else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            opt.reorder = atof(argv[++i]) / 100.0;
+        }
+        else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) {
+            opt.limit_ms = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            opt.leader_mode = strcmp(argv[++i], "leader") == 0;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            opt.batch_max = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--batch-delay") == 0 && i + 1 < argc) {
+            opt.batch_delay_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--agg-delay") == 0 && i + 1 < argc) {
+            opt.agg_delay_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--verbose") == 0) {
+            opt.verbose = true;
+        }
+#ifdef ROJ_HISTORY
+        else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            opt.history_file = argv[++i];
+        }
+#endif
+        else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0 ? 0 : 1;
+        }
+    }
+
+    if (opt.ops < 1 || opt.inflight < 1 || opt.latency_ms < 0 || opt.jitter_ms < 0) {
+        fprintf(stderr, "Error: --ops and --inflight must be positive, delays not negative\n");
+        return 1;
+    }
+
+    /* Expiry warnings are expected under loss; skipping them saves formatting too */
+    if (!opt.verbose) {
+        roj_log_set_level(ROJ_LOG_ERROR);
+    }
+
+    printf("# roj-sim seed=%llu ops=%d inflight=%d latency=%dms jitter=%dms loss=%.2f%% "
+           "reorder=%.2f%% mode=%s batch=%d batch-delay=%dms agg-delay=%dms\n",
+           (unsigned long long)opt.seed, opt.ops, opt.inflight, opt.latency_ms,
+           opt.jitter_ms, opt.loss * 100.0, opt.reorder * 100.0,
+           opt.leader_mode ? "leader" : "threshold", opt.batch_max, opt.batch_delay_ms,
+           opt.agg_delay_ms);
+    printf("# latencies in virtual ms; wall columns depend on the host\n");
+    printf("%5s %9s %6s %7s %9s %11s %6s %6s %6s %6s %9s %12s %10s %8s  %-16s\n",
+           "nodes", "committed", "failed", "expired", "virt_s", "commits/s", "p50", "p90", "p99",
+           "max", "wall_ms", "wall_cmt/s", "datagrams", "dropped", "digest");
+
+    for (int i = 0; i < opt.size_count; i++) {
+        if (run_size(&opt, opt.sizes[i]) != 0) {
+            return 1;
+        }
+    }
+#ifdef ROJ_HISTORY
+    if (opt.history_file && roj_history_dump(opt.history_file) != 0) {
+        return 1;
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * ROJ Snapshot - memory-mapped images of the committed state table
+ * implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "snapshot.h"
+#include "logger.h"
+
+#ifdef _WIN32
+
+int snapshot_load(roj_snapshot_t* snap, const char* dir, roj_state_store_t* store) {
+    (void)snap;
+    (void)dir;
+    (void)store;
+    return 1;
+}
+
+int snapshot_start(roj_snapshot_t* snap, const char* dir, const roj_state_store_t* store) {
+    (void)snap;
+    (void)dir;
+    (void)store;
+    ROJ_LOG(ROJ_LOG_WARN, "Snapshot: not supported on this platform");
+    return -1;
+}
+
+int snapshot_poll(roj_snapshot_t* snap) {
+    (void)snap;
+    return 0;
+}
+
+bool snapshot_in_progress(const roj_snapshot_t* snap) {
+    (void)snap;
+    return false;
+}
+
+int snapshot_wait(roj_snapshot_t* snap) {
+    (void)snap;
+    return 0;
+}
+
+void snapshot_release(roj_snapshot_t* snap) {
+    (void)snap;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "crc32c.h"
+
+#define SNAPSHOT_MAGIC  "ROJSNAP1"
+#define SNAPSHOT_ENDIAN 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t endian;        /* SNAPSHOT_ENDIAN in the writer's byte order */
+    uint32_t slot_size;     /* sizeof(roj_state_slot_t) of the writer */
+    uint64_t cap;
+    uint64_t count;
+    int64_t created;        /* unix time */
+    uint32_t slots_crc;
+    uint32_t header_crc;    /* over every field above */
+    uint8_t reserved[16];
+} snapshot_header_t;
+
+_Static_assert(sizeof(snapshot_header_t) == 64, "snapshot header must stay 64 bytes");
+
+
+static void snapshot_paths(const char* dir, char* path, char* tmp, size_t size) {
+    snprintf(path, size, "%s/%s", dir, ROJ_SNAPSHOT_FILE);
+    snprintf(tmp, size, "%s/%s.tmp", dir, ROJ_SNAPSHOT_FILE);
+}
+
+static uint32_t header_crc(const snapshot_header_t* h) {
+    return crc32c(h, offsetof(snapshot_header_t, header_crc));
+}
+
+static const char* check_image(const uint8_t* map, size_t len) {
+    const snapshot_header_t* h = (const snapshot_header_t*)map;
+
+    if (len < sizeof(*h) || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0) {
+        return "not a ROJ snapshot";
+    }
+    if (h->header_crc != header_crc(h)) {
+        return "header checksum mismatch";
+    }
+    if (h->endian != SNAPSHOT_ENDIAN || h->slot_size != sizeof(roj_state_slot_t)) {
+        return "written by a build with a different slot layout";
+    }
+    if (h->cap == 0 || (h->cap & (h->cap - 1)) != 0 || h->count >= h->cap ||
+        (len - sizeof(*h)) / sizeof(roj_state_slot_t) != h->cap) {
+        return "size does not match its header";
+    }
+    if (crc32c(map + sizeof(*h), (size_t)h->cap * sizeof(roj_state_slot_t)) != h->slots_crc) {
+        return "slot checksum mismatch";
+    }
+    return NULL;
+}
+
+int snapshot_load(roj_snapshot_t* snap, const char* dir, roj_state_store_t* store) {
+    char path[600], tmp[600];
+    struct stat st;
+
+    snapshot_paths(dir, path, tmp, sizeof(path));
+    unlink(tmp);    /* a writer that never finished */
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 1 : -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* Private read-only mapping: pages come straight from the page cache */
+    snap->map_len = (size_t)st.st_size;
+    snap->map = mmap(NULL, snap->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap->map == MAP_FAILED) {
+        snap->map = NULL;
+        ROJ_LOG(ROJ_LOG_ERROR, "Snapshot: cannot map %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    const char* problem = check_image(snap->map, snap->map_len);
+    if (problem) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Snapshot: %s: %s", path, problem);
+        munmap(snap->map, snap->map_len);
+        snap->map = NULL;
+        return -1;
+    }
+
+    const snapshot_header_t* h = snap->map;
+    state_store_attach_base(store,
+                            (const roj_state_slot_t*)((const uint8_t*)snap->map + sizeof(*h)),
+                            (size_t)h->cap, (size_t)h->count);
+    ROJ_LOG(ROJ_LOG_INFO, "Snapshot: mapped %llu keys from %s", (unsigned long long)h->count, path);
+    return 0;
+}
+
+/* Runs in the forked child: no stdio, no malloc */
+static int write_image(const char* path, const char* tmp, const char* dir,
+                       const roj_state_store_t* store) {
+    size_t cap = state_store_image_cap(store);
+    size_t len = sizeof(snapshot_header_t) + cap * sizeof(roj_state_slot_t);
+
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    /* The file starts zeroed, which is an empty table */
+    if (ftruncate(fd, (off_t)len) != 0) {
+        close(fd);
+        return -1;
+    }
+    uint8_t* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    snapshot_header_t* h = (snapshot_header_t*)map;
+    roj_state_slot_t* slots = (roj_state_slot_t*)(map + sizeof(*h));
+    memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+    h->endian = SNAPSHOT_ENDIAN;
+    h->slot_size = sizeof(roj_state_slot_t);
+    h->cap = cap;
+    h->count = state_store_write_image(store, slots, cap);
+    h->created = (int64_t)time(NULL);
+    h->slots_crc = crc32c(slots, cap * sizeof(roj_state_slot_t));
+    h->header_crc = header_crc(h);
+
+    int rc = msync(map, len, MS_SYNC);
+    munmap(map, len);
+    if (rc != 0 || fsync(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp, path) != 0) {
+        return -1;
+    }
+    int dfd = open(dir, O_RDONLY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+    return 0;
+}
+
+int snapshot_start(roj_snapshot_t* snap, const char* dir, const roj_state_store_t* store) {
+    char path[600], tmp[600];
+
+    if (snap->writer > 0) {
+        return 1;
+    }
+    snapshot_paths(dir, path, tmp, sizeof(path));
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Snapshot: fork failed: %s", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        _exit(write_image(path, tmp, dir, store) == 0 ? 0 : 1);
+    }
+
+    snap->writer = pid;
+    snap->writer_keys = state_store_count(store);
+    ROJ_LOG(ROJ_LOG_INFO, "Snapshot: writing %zu keys (pid %d)", snap->writer_keys, (int)pid);
+    return 0;
+}
+
+static int reap(roj_snapshot_t* snap, int options) {
+    int status;
+
+    if (snap->writer <= 0) {
+        return 0;
+    }
+    pid_t pid = waitpid(snap->writer, &status, options);
+    if (pid == 0) {
+        return 0;
+    }
+    snap->writer = -1;
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "Snapshot: writer failed");
+        return -1;
+    }
+    ROJ_LOG(ROJ_LOG_INFO, "Snapshot: %zu keys durable", snap->writer_keys);
+    return 1;
+}
+
+int snapshot_poll(roj_snapshot_t* snap) {
+    return reap(snap, WNOHANG);
+}
+
+bool snapshot_in_progress(const roj_snapshot_t* snap) {
+    return snap->writer > 0;
+}
+
+int snapshot_wait(roj_snapshot_t* snap) {
+    return reap(snap, 0);
+}
+
+void snapshot_release(roj_snapshot_t* snap) {
+    if (snap->map) {
+        munmap(snap->map, snap->map_len);
+        snap->map = NULL;
+        snap->map_len = 0;
+    }
+}
+
+#endif /* _WIN32 */
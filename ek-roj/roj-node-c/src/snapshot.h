@@ -0,0 +1,57 @@
+/*
+ * ROJ Snapshot - memory-mapped images of the committed state table
+ *
+ * A snapshot is the state store's hash table written out flat: a 64-byte
+ * header (magic, layout check, capacity, key count, checksums) followed by
+ * the slot array in the in-memory layout, so loading it is an mmap plus a
+ * checksum pass. The mapped table becomes the store's read-only base and
+ * answers lookups at once; only the WAL tail is replayed on top.
+ *
+ * Images are written by a forked child from its copy-on-write view of the
+ * table, into a temporary file that is synced and renamed over the old
+ * snapshot, so the event loop only pays for fork() and a crash never
+ * leaves a partial snapshot behind. POSIX only.
+ *
+ * A zeroed roj_snapshot_t has nothing mapped and no writer running.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_SNAPSHOT_H
+#define ROJ_SNAPSHOT_H
+
+#include "state_store.h"
+
+#define ROJ_SNAPSHOT_FILE       "snapshot.bin"
+#define ROJ_SNAPSHOT_EVERY      10000   /* default logged commits between snapshots */
+#define ROJ_SNAPSHOT_POLL_MS    50      /* how often the writer is checked on */
+
+typedef struct {
+    void* map;              /* loaded image, mapped while the store reads it */
+    size_t map_len;
+    int writer;             /* pid of the running writer, <= 0 = none */
+    size_t writer_keys;
+} roj_snapshot_t;
+
+/* Map <dir>/snapshot.bin as the store's base. Returns 0 if mapped, 1 if
+ * there is no snapshot, -1 if the file is damaged or from another build. */
+int snapshot_load(roj_snapshot_t* snap, const char* dir, roj_state_store_t* store);
+
+/* Fork a writer for the store's current contents. Returns 0 when started,
+ * 1 if a writer is already running, -1 on error. */
+int snapshot_start(roj_snapshot_t* snap, const char* dir, const roj_state_store_t* store);
+
+/* Reap the writer: 1 once its snapshot is durable, -1 if it failed,
+ * 0 while it runs or when there is none */
+int snapshot_poll(roj_snapshot_t* snap);
+
+/* True while a writer is running */
+bool snapshot_in_progress(const roj_snapshot_t* snap);
+
+/* Block until a running writer exits, same result as snapshot_poll */
+int snapshot_wait(roj_snapshot_t* snap);
+
+/* Unmap the loaded image; call after the store that used it is freed */
+void snapshot_release(roj_snapshot_t* snap);
+
+#endif /* ROJ_SNAPSHOT_H */
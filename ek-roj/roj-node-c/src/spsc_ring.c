@@ -0,0 +1,32 @@
+/*
+ * ROJ SPSC Ring - bounded lock-free single-producer/single-consumer queue
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "spsc_ring.h"
+
+int spsc_ring_init(roj_spsc_ring_t* r, size_t capacity, size_t slot_size) {
+    size_t cap = 2;
+    while (cap < capacity) cap <<= 1;
+
+    /* Round slots up to whole cache lines so neighbours never share one */
+    slot_size = (slot_size + ROJ_CACHE_LINE - 1) & ~(size_t)(ROJ_CACHE_LINE - 1);
+
+    memset(r, 0, sizeof(*r));
+    r->slots = malloc(cap * slot_size);
+    if (!r->slots) return -1;
+
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->mask = cap - 1;
+    r->slot_size = slot_size;
+    return 0;
+}
+
+void spsc_ring_free(roj_spsc_ring_t* r) {
+    free(r->slots);
+    r->slots = NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ * ROJ SPSC Ring - bounded lock-free single-producer/single-consumer queue
+ *
+ * Fixed-size slots in a power-of-two array. The producer owns head and the
+ * consumer owns tail; each side reads the other's index with acquire and
+ * publishes its own with release, so a slot's contents are visible before
+ * its index is. Producers write straight into the reserved slot and
+ * consumers read it in place. Each side caches the other's index and only
+ * re-reads it when the ring looks full or empty, so steady-state traffic
+ * does not bounce the shared cache line.
+ *
+ * Several rings drained by one consumer make up an MPSC fan-in.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_SPSC_RING_H
+#define ROJ_SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define ROJ_CACHE_LINE 64
+
+typedef struct {
+    /* Producer side */
+    _Alignas(ROJ_CACHE_LINE) _Atomic size_t head;
+    size_t cached_tail;
+
+    /* Consumer side */
+    _Alignas(ROJ_CACHE_LINE) _Atomic size_t tail;
+    size_t cached_head;
+
+    /* Read-only after init */
+    _Alignas(ROJ_CACHE_LINE) uint8_t* slots;
+    size_t mask;
+    size_t slot_size;
+} roj_spsc_ring_t;
+
+/* Allocate a ring of capacity (rounded up to a power of two) slots */
+int spsc_ring_init(roj_spsc_ring_t* r, size_t capacity, size_t slot_size);
+
+/* Free the slot array */
+void spsc_ring_free(roj_spsc_ring_t* r);
+
+/* Producer: slot to fill, or NULL if the ring is full */
+static inline void* spsc_ring_reserve(roj_spsc_ring_t* r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - r->cached_tail > r->mask) {
+        r->cached_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head - r->cached_tail > r->mask) {
+            return NULL;
+        }
+    }
+    return r->slots + (head & r->mask) * r->slot_size;
+}
+
+/* Producer: publish the slot returned by spsc_ring_reserve */
+static inline void spsc_ring_commit(roj_spsc_ring_t* r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* Consumer: oldest slot, or NULL if the ring is empty */
+static inline void* spsc_ring_peek(roj_spsc_ring_t* r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (tail == r->cached_head) {
+        r->cached_head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail == r->cached_head) {
+            return NULL;
+        }
+    }
+    return r->slots + (tail & r->mask) * r->slot_size;
+}
+
+/* Consumer: release the slot returned by spsc_ring_peek */
+static inline void spsc_ring_pop(roj_spsc_ring_t* r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+#endif /* ROJ_SPSC_RING_H */
@@ -0,0 +1,264 @@
+/*
+ * ROJ State Store - hash-indexed committed state implementation
+ *
+ * Resize protocol: the full table becomes "old" and a table of twice the
+ * capacity becomes "cur". Every put migrates ROJ_STATE_MIGRATE_STEP slots
+ * from old to cur. Migrated slots are flagged rather than cleared so that
+ * probe chains in old stay intact. A key lives in exactly one table: puts
+ * update a not-yet-migrated entry in place in old instead of inserting a
+ * duplicate into cur.
+ *
+ * The base table is never written. A key put while it still has a base
+ * entry is counted in base_shadowed so the total stays exact; enumeration
+ * skips base entries that the live tables shadow.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "state_store.h"
+
+#define ROJ_STATE_MIN_CAP       64
+#define ROJ_STATE_MIGRATE_STEP  16
+
+uint64_t state_key_hash(const char* key) {
+    uint64_t h = 1469598103934665603ULL;
+    while (*key) {
+        h ^= (uint8_t)*key++;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static int table_alloc(roj_state_table_t* t, size_t cap) {
+    t->slots = calloc(cap, sizeof(*t->slots));
+    if (!t->slots) return -1;
+    t->cap = cap;
+    t->count = 0;
+    return 0;
+}
+
+static void table_free(roj_state_table_t* t) {
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Returns the slot holding key, or the empty slot where it would go */
+static roj_state_slot_t* table_probe(const roj_state_table_t* t,
+                                     const char* key, uint64_t hash) {
+    size_t mask = t->cap - 1;
+    size_t i = (size_t)hash & mask;
+
+    for (;;) {
+        roj_state_slot_t* slot = &t->slots[i];
+        if (slot->hash == 0) {
+            return slot;
+        }
+        if (slot->hash == hash && strcmp(slot->key, key) == 0) {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static void table_insert_new(roj_state_table_t* t, const char* key,
+                             uint64_t hash, int64_t value) {
+    roj_state_slot_t* slot = table_probe(t, key, hash);
+    slot->hash = hash;
+    slot->value = value;
+    slot->moved = false;
+    size_t len = strnlen(key, ROJ_KEY_MAX - 1);
+    memcpy(slot->key, key, len);
+    slot->key[len] = '\0';
+    t->count++;
+}
+
+static void migrate_step(roj_state_store_t* store, size_t steps) {
+    roj_state_table_t* old = &store->old;
+    if (!old->slots) return;
+
+    while (steps-- > 0 && store->migrate_pos < old->cap) {
+        roj_state_slot_t* slot = &old->slots[store->migrate_pos++];
+        if (slot->hash != 0 && !slot->moved) {
+            table_insert_new(&store->cur, slot->key, slot->hash, slot->value);
+            slot->moved = true;
+            old->count--;
+        }
+    }
+
+    if (store->migrate_pos >= old->cap) {
+        table_free(old);
+        store->migrate_pos = 0;
+    }
+}
+
+static int start_resize(roj_state_store_t* store) {
+    /* A previous resize must finish before the next one starts */
+    if (store->old.slots) {
+        migrate_step(store, store->old.cap);
+    }
+
+    roj_state_table_t bigger;
+    if (table_alloc(&bigger, store->cur.cap * 2) != 0) {
+        return -1;
+    }
+    store->old = store->cur;
+    store->cur = bigger;
+    store->migrate_pos = 0;
+    return 0;
+}
+
+int state_store_init(roj_state_store_t* store, size_t initial_cap) {
+    size_t cap = ROJ_STATE_MIN_CAP;
+    while (cap < initial_cap) cap <<= 1;
+
+    memset(store, 0, sizeof(*store));
+    return table_alloc(&store->cur, cap);
+}
+
+void state_store_free(roj_state_store_t* store) {
+    table_free(&store->cur);
+    table_free(&store->old);
+    store->migrate_pos = 0;
+    memset(&store->base, 0, sizeof(store->base));
+    store->base_shadowed = 0;
+}
+
+/* Live slot for key in cur or old, NULL if none */
+static const roj_state_slot_t* live_find(const roj_state_store_t* store,
+                                         const char* key, uint64_t hash) {
+    const roj_state_slot_t* slot = table_probe(&store->cur, key, hash);
+    if (slot->hash != 0) {
+        return slot;
+    }
+    if (store->old.slots) {
+        slot = table_probe(&store->old, key, hash);
+        if (slot->hash != 0 && !slot->moved) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static const roj_state_slot_t* base_find(const roj_state_store_t* store,
+                                         const char* key, uint64_t hash) {
+    if (store->base.cap == 0) {
+        return NULL;
+    }
+    const roj_state_slot_t* slot = table_probe(&store->base, key, hash);
+    return slot->hash != 0 ? slot : NULL;
+}
+
+int state_store_put(roj_state_store_t* store, const char* key, int64_t value) {
+    uint64_t hash = state_key_hash(key);
+
+    migrate_step(store, ROJ_STATE_MIGRATE_STEP);
+
+    roj_state_slot_t* slot = table_probe(&store->cur, key, hash);
+    if (slot->hash != 0) {
+        slot->value = value;
+        return 0;
+    }
+
+    if (store->old.slots) {
+        roj_state_slot_t* old_slot = table_probe(&store->old, key, hash);
+        if (old_slot->hash != 0 && !old_slot->moved) {
+            old_slot->value = value;
+            return 0;
+        }
+    }
+
+    /* New key: grow first if this insert would pass 3/4 load */
+    if ((store->cur.count + 1) * 4 > store->cur.cap * 3) {
+        if (start_resize(store) != 0) {
+            return -1;
+        }
+    }
+
+    if (base_find(store, key, hash)) {
+        store->base_shadowed++;
+    }
+    table_insert_new(&store->cur, key, hash, value);
+    return 0;
+}
+
+int state_store_get(const roj_state_store_t* store, const char* key, int64_t* value) {
+    uint64_t hash = state_key_hash(key);
+
+    const roj_state_slot_t* slot = live_find(store, key, hash);
+    if (!slot) {
+        slot = base_find(store, key, hash);
+    }
+    if (slot) {
+        *value = slot->value;
+        return 0;
+    }
+    return -1;
+}
+
+size_t state_store_count(const roj_state_store_t* store) {
+    return store->cur.count + store->old.count + store->base.count - store->base_shadowed;
+}
+
+void state_store_foreach(const roj_state_store_t* store,
+                         roj_state_visit_fn fn, void* ctx) {
+    for (size_t i = 0; i < store->cur.cap; i++) {
+        const roj_state_slot_t* slot = &store->cur.slots[i];
+        if (slot->hash != 0) {
+            fn(slot->key, slot->value, ctx);
+        }
+    }
+    for (size_t i = 0; i < store->old.cap; i++) {
+        const roj_state_slot_t* slot = &store->old.slots[i];
+        if (slot->hash != 0 && !slot->moved) {
+            fn(slot->key, slot->value, ctx);
+        }
+    }
+    for (size_t i = 0; i < store->base.cap; i++) {
+        const roj_state_slot_t* slot = &store->base.slots[i];
+        if (slot->hash != 0 && !live_find(store, slot->key, slot->hash)) {
+            fn(slot->key, slot->value, ctx);
+        }
+    }
+}
+
+void state_store_attach_base(roj_state_store_t* store,
+                             const roj_state_slot_t* slots, size_t cap, size_t count) {
+    /* Only ever probed, never written through */
+    store->base.slots = (roj_state_slot_t*)slots;
+    store->base.cap = cap;
+    store->base.count = count;
+    store->base_shadowed = 0;
+}
+
+size_t state_store_image_cap(const roj_state_store_t* store) {
+    size_t count = state_store_count(store);
+    size_t cap = ROJ_STATE_MIN_CAP;
+    while (count * 4 > cap * 3) cap <<= 1;
+    return cap;
+}
+
+static void image_add(roj_state_table_t* image, const roj_state_slot_t* slot) {
+    roj_state_slot_t* dst = table_probe(image, slot->key, slot->hash);
+    if (dst->hash == 0) {
+        table_insert_new(image, slot->key, slot->hash, slot->value);
+    }
+}
+
+size_t state_store_write_image(const roj_state_store_t* store,
+                             roj_state_slot_t* slots, size_t cap) {
+    roj_state_table_t image = { slots, cap, 0 };
+    const roj_state_table_t* layers[3] = { &store->cur, &store->old, &store->base };
+
+    /* Live tables first: their values win over the base they shadow */
+    for (int l = 0; l < 3; l++) {
+        for (size_t i = 0; i < layers[l]->cap; i++) {
+            const roj_state_slot_t* slot = &layers[l]->slots[i];
+            if (slot->hash != 0 && !slot->moved) {
+                image_add(&image, slot);
+            }
+        }
+    }
+    return image.count;
+}
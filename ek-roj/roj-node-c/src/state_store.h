@@ -0,0 +1,82 @@
+/*
+ * ROJ State Store - hash-indexed committed state
+ *
+ * Open addressing with linear probing. Each slot caches the key hash so
+ * probes compare 64-bit hashes before touching key bytes. When the load
+ * factor passes 3/4 the table doubles and the old table is drained a few
+ * slots per operation (incremental resize), so no single commit pays for
+ * rehashing the whole key space. There is no fixed capacity.
+ *
+ * A store can sit on top of a read-only base table with the same slot
+ * layout, such as a memory-mapped snapshot image. Lookups fall through to
+ * the base; puts always land in the live tables and shadow base entries.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_STATE_STORE_H
+#define ROJ_STATE_STORE_H
+
+#include <stddef.h>
+#include "types.h"
+
+typedef struct {
+    uint64_t hash;          /* 0 = empty */
+    int64_t value;
+    bool moved;             /* migrated out of a draining table */
+    char key[ROJ_KEY_MAX];
+} roj_state_slot_t;
+
+typedef struct {
+    roj_state_slot_t* slots;
+    size_t cap;             /* power of two */
+    size_t count;
+} roj_state_table_t;
+
+typedef struct {
+    roj_state_table_t cur;
+    roj_state_table_t old;  /* non-empty only while a resize is in progress */
+    size_t migrate_pos;
+    roj_state_table_t base; /* read-only, not owned (cap 0 = none) */
+    size_t base_shadowed;   /* base keys that also live in cur/old */
+} roj_state_store_t;
+
+typedef void (*roj_state_visit_fn)(const char* key, int64_t value, void* ctx);
+
+/* Initialize an empty store */
+int state_store_init(roj_state_store_t* store, size_t initial_cap);
+
+/* Free all memory held by the store */
+void state_store_free(roj_state_store_t* store);
+
+/* Insert or update key (returns 0 on success, -1 on allocation failure) */
+int state_store_put(roj_state_store_t* store, const char* key, int64_t value);
+
+/* Look up key (returns 0 if found, -1 if not) */
+int state_store_get(const roj_state_store_t* store, const char* key, int64_t* value);
+
+/* Number of keys */
+size_t state_store_count(const roj_state_store_t* store);
+
+/* Visit every key/value pair (unordered) */
+void state_store_foreach(const roj_state_store_t* store,
+                         roj_state_visit_fn fn, void* ctx);
+
+/* Serve lookups from a read-only table of cap (power of two) slots that
+ * holds count keys; slots must outlive the store */
+void state_store_attach_base(roj_state_store_t* store,
+                             const roj_state_slot_t* slots, size_t cap, size_t count);
+
+/* Capacity of a flat table holding every key at most 3/4 full */
+size_t state_store_image_cap(const roj_state_store_t* store);
+
+/* Fill a zeroed array of cap slots with every key (for snapshots), returns
+ * the key count. Touches no allocator, so it is safe in a child forked from
+ * a threaded process. */
+size_t state_store_write_image(const roj_state_store_t* store,
+                             roj_state_slot_t* slots, size_t cap);
+
+/* FNV-1a hash used for keys (never returns 0) */
+uint64_t state_key_hash(const char* key);
+
+#endif /* ROJ_STATE_STORE_H */
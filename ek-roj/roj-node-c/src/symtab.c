@@ -0,0 +1,314 @@
+/*
+ * ROJ Symbol Table - interned node IDs and keys implementation
+ *
+ * Entries live in fixed pages that are never reallocated, so a handle can
+ * be resolved without locking while another thread interns. With
+ * ROJ_THREADS, interning takes a mutex; each thread first checks a small
+ * direct-mapped cache so repeated IDs and keys rarely reach the lock.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symtab.h"
+
+#define SYMTAB_MIN_CAP    64
+#define SYMTAB_BLOCK_SIZE 4096
+#define SYMTAB_PAGE_BITS  10
+#define SYMTAB_PAGE_SIZE  (1u << SYMTAB_PAGE_BITS)
+#define SYMTAB_MAX_PAGES  4096      /* 4M symbols */
+
+typedef struct {
+    const char* str;
+    uint32_t hash;
+    uint32_t len;
+} sym_entry_t;
+
+/* Strings are packed into fixed blocks that are never reallocated */
+typedef struct sym_block {
+    struct sym_block* next;
+    size_t used;
+    char data[SYMTAB_BLOCK_SIZE];
+} sym_block_t;
+
+#ifdef ROJ_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define SYMTAB_CACHE_SIZE 256
+
+typedef struct {
+    uint32_t hash;
+    roj_sym_t sym;
+} sym_cache_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint32_t g_count = 0;
+static _Thread_local sym_cache_t t_cache[SYMTAB_CACHE_SIZE];
+static _Thread_local uint32_t t_cache_epoch = 0;
+static _Atomic uint32_t g_epoch = 1;     /* bumped by symtab_free */
+
+#define SYM_LOCK()      pthread_mutex_lock(&g_lock)
+#define SYM_UNLOCK()    pthread_mutex_unlock(&g_lock)
+#define COUNT_LOAD()    atomic_load_explicit(&g_count, memory_order_acquire)
+#define COUNT_STORE(v)  atomic_store_explicit(&g_count, (v), memory_order_release)
+#else
+static uint32_t g_count = 0;
+
+#define SYM_LOCK()      ((void)0)
+#define SYM_UNLOCK()    ((void)0)
+#define COUNT_LOAD()    (g_count)
+#define COUNT_STORE(v)  (g_count = (v))
+#endif
+
+static sym_entry_t* g_pages[SYMTAB_MAX_PAGES];  /* handle -> entry, [0][0] = "" */
+static uint32_t* g_index = NULL;        /* hash -> handle, 0 = empty */
+static uint32_t g_index_cap = 0;        /* power of two, at most half full */
+static sym_block_t* g_blocks = NULL;
+static int g_users = 0;                 /* symtab_init calls not yet freed */
+static uint32_t g_untrusted = 0;        /* added by symtab_intern_untrusted */
+
+static sym_entry_t* entry(roj_sym_t sym) {
+    return &g_pages[sym >> SYMTAB_PAGE_BITS][sym & (SYMTAB_PAGE_SIZE - 1)];
+}
+
+static uint32_t sym_hash(const char* s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void index_put(uint32_t* index, uint32_t cap, uint32_t hash, uint32_t sym) {
+    uint32_t mask = cap - 1;
+    uint32_t i = hash & mask;
+    while (index[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    index[i] = sym;
+}
+
+static int index_grow(uint32_t cap) {
+    uint32_t* index = calloc(cap, sizeof(*index));
+    if (!index) return -1;
+
+    uint32_t count = COUNT_LOAD();
+    for (uint32_t sym = 1; sym < count; sym++) {
+        index_put(index, cap, entry(sym)->hash, sym);
+    }
+
+    free(g_index);
+    g_index = index;
+    g_index_cap = cap;
+    return 0;
+}
+
+static const char* store_string(const char* s, size_t len) {
+    if (!g_blocks || g_blocks->used + len + 1 > SYMTAB_BLOCK_SIZE) {
+        sym_block_t* block = malloc(sizeof(*block));
+        if (!block) return NULL;
+        block->next = g_blocks;
+        block->used = 0;
+        g_blocks = block;
+    }
+
+    char* out = g_blocks->data + g_blocks->used;
+    memcpy(out, s, len);
+    out[len] = '\0';
+    g_blocks->used += len + 1;
+    return out;
+}
+
+static void free_locked(void) {
+    while (g_blocks) {
+        sym_block_t* next = g_blocks->next;
+        free(g_blocks);
+        g_blocks = next;
+    }
+    for (uint32_t p = 0; p < SYMTAB_MAX_PAGES && g_pages[p]; p++) {
+        free(g_pages[p]);
+        g_pages[p] = NULL;
+    }
+    free(g_index);
+    g_index = NULL;
+    g_index_cap = 0;
+    g_untrusted = 0;
+    COUNT_STORE(0);
+#ifdef ROJ_THREADS
+    atomic_fetch_add(&g_epoch, 1);
+#endif
+}
+
+static int init_locked(void) {
+    free_locked();
+
+    g_pages[0] = malloc(SYMTAB_PAGE_SIZE * sizeof(sym_entry_t));
+    if (!g_pages[0]) return -1;
+    g_pages[0][0].str = "";
+    g_pages[0][0].hash = 0;
+    g_pages[0][0].len = 0;
+    COUNT_STORE(1);
+
+    if (index_grow(SYMTAB_MIN_CAP * 2) != 0) {
+        free_locked();
+        return -1;
+    }
+    return 0;
+}
+
+int symtab_init(void) {
+    int rc = 0;
+
+    SYM_LOCK();
+    if (g_users == 0) {
+        rc = init_locked();
+    }
+    if (rc == 0) {
+        g_users++;
+    }
+    SYM_UNLOCK();
+    return rc;
+}
+
+void symtab_free(void) {
+    SYM_LOCK();
+    if (g_users == 0 || --g_users == 0) {
+        free_locked();
+    }
+    SYM_UNLOCK();
+}
+
+static roj_sym_t insert_symbol(const char* s, size_t len, uint32_t hash) {
+    uint32_t count = COUNT_LOAD();
+    uint32_t page = count >> SYMTAB_PAGE_BITS;
+
+    if ((count + 1) * 2 > g_index_cap && index_grow(g_index_cap * 2) != 0) {
+        return ROJ_SYM_EMPTY;
+    }
+    if (page >= SYMTAB_MAX_PAGES) {
+        return ROJ_SYM_EMPTY;
+    }
+    if (!g_pages[page]) {
+        g_pages[page] = malloc(SYMTAB_PAGE_SIZE * sizeof(sym_entry_t));
+        if (!g_pages[page]) return ROJ_SYM_EMPTY;
+    }
+    const char* str = store_string(s, len);
+    if (!str) return ROJ_SYM_EMPTY;
+
+    roj_sym_t sym = count;
+    entry(sym)->str = str;
+    entry(sym)->hash = hash;
+    entry(sym)->len = (uint32_t)len;
+    index_put(g_index, g_index_cap, hash, sym);
+    COUNT_STORE(count + 1);     /* publish the entry */
+    return sym;
+}
+
+static roj_sym_t find_locked(const char* s, size_t len, uint32_t hash) {
+    if (!g_index) {
+        return ROJ_SYM_EMPTY;
+    }
+
+    uint32_t mask = g_index_cap - 1;
+    for (uint32_t i = hash & mask; g_index[i] != 0; i = (i + 1) & mask) {
+        const sym_entry_t* e = entry(g_index[i]);
+        if (e->hash == hash && e->len == len && memcmp(e->str, s, len) == 0) {
+            return g_index[i];
+        }
+    }
+    return ROJ_SYM_EMPTY;
+}
+
+static roj_sym_t intern_locked(const char* s, size_t len, uint32_t hash, bool untrusted) {
+    if (!g_index && init_locked() != 0) {
+        fprintf(stderr, "[ERROR] Failed to allocate symbol table\n");
+        return ROJ_SYM_EMPTY;
+    }
+
+    roj_sym_t sym = find_locked(s, len, hash);
+    if (sym != ROJ_SYM_EMPTY) {
+        return sym;
+    }
+    if (untrusted) {
+        if (g_untrusted == ROJ_SYM_UNTRUSTED_MAX) {
+            return ROJ_SYM_EMPTY;
+        }
+        g_untrusted++;
+    }
+
+    sym = insert_symbol(s, len, hash);
+    if (sym == ROJ_SYM_EMPTY) {
+        fprintf(stderr, "[ERROR] Out of memory interning symbol\n");
+    }
+    return sym;
+}
+
+typedef enum {
+    SYM_FIND,
+    SYM_INTERN,
+    SYM_INTERN_UNTRUSTED
+} sym_op_t;
+
+static roj_sym_t resolve(const char* s, size_t len, sym_op_t op) {
+    if (len > ROJ_SYM_MAX_LEN) len = ROJ_SYM_MAX_LEN;
+    if (len == 0) return ROJ_SYM_EMPTY;
+
+    uint32_t hash = sym_hash(s, len);
+
+#ifdef ROJ_THREADS
+    uint32_t epoch = atomic_load_explicit(&g_epoch, memory_order_relaxed);
+    if (t_cache_epoch != epoch) {
+        memset(t_cache, 0, sizeof(t_cache));
+        t_cache_epoch = epoch;
+    }
+    sym_cache_t* c = &t_cache[hash & (SYMTAB_CACHE_SIZE - 1)];
+    if (c->sym != ROJ_SYM_EMPTY && c->hash == hash) {
+        const sym_entry_t* e = entry(c->sym);
+        if (e->len == len && memcmp(e->str, s, len) == 0) {
+            return c->sym;
+        }
+    }
+#endif
+
+    SYM_LOCK();
+    roj_sym_t sym = op == SYM_FIND ? find_locked(s, len, hash)
+                                   : intern_locked(s, len, hash, op == SYM_INTERN_UNTRUSTED);
+    SYM_UNLOCK();
+
+#ifdef ROJ_THREADS
+    if (sym != ROJ_SYM_EMPTY) {
+        c->hash = hash;
+        c->sym = sym;
+    }
+#endif
+    return sym;
+}
+
+roj_sym_t symtab_intern(const char* s, size_t len) {
+    return resolve(s, len, SYM_INTERN);
+}
+
+roj_sym_t symtab_lookup(const char* s, size_t len) {
+    return resolve(s, len, SYM_FIND);
+}
+
+roj_sym_t symtab_intern_untrusted(const char* s, size_t len) {
+    return resolve(s, len, SYM_INTERN_UNTRUSTED);
+}
+
+const char* symtab_str(roj_sym_t sym) {
+    return sym < COUNT_LOAD() ? entry(sym)->str : "";
+}
+
+size_t symtab_len(roj_sym_t sym) {
+    return sym < COUNT_LOAD() ? entry(sym)->len : 0;
+}
+
+uint32_t symtab_count(void) {
+    uint32_t count = COUNT_LOAD();
+    return count > 0 ? count - 1 : 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * ROJ Symbol Table - interned node IDs and keys
+ *
+ * Node IDs and state keys are interned once at the codec boundary and
+ * carried through the node as 32-bit handles (roj_sym_t), so comparing two
+ * IDs is an integer compare and messages stay small. Handles are dense
+ * indexes starting at 1; handle 0 is the empty string, which makes a zeroed
+ * message field read back as "".
+ *
+ * The table is shared by every node in the process. Interned strings are
+ * never freed and never move: pointers returned by symtab_str() stay valid
+ * until the last symtab_free(). When built with ROJ_THREADS any thread may
+ * intern; resolving a handle never takes a lock.
+ *
+ * Because nothing is ever freed, strings from senders that are not known
+ * peers must not grow the table: decoders resolve them with
+ * ROJ_INTERN_KNOWN, which only finds existing symbols, and an unknown
+ * node's ANNOUNCE may add its ID only within ROJ_SYM_UNTRUSTED_MAX.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_SYMTAB_H
+#define ROJ_SYMTAB_H
+
+#include <stddef.h>
+#include "types.h"
+
+#define ROJ_SYM_EMPTY   0
+#define ROJ_SYM_MAX_LEN (ROJ_NODE_ID_MAX - 1)   /* longer strings are truncated */
+#define ROJ_SYM_UNTRUSTED_MAX 4096              /* symbols unknown senders may add */
+
+/* How a decoder may turn a datagram's strings into symbols */
+typedef enum {
+    ROJ_INTERN_ALL = 0,     /* sender is a known peer: intern anything */
+    ROJ_INTERN_KNOWN        /* unknown sender: existing symbols only */
+} roj_intern_t;
+
+/* Start using the table; the first user initializes it (interning also
+ * initializes on first use) */
+int symtab_init(void);
+
+/* Stop using the table. Once every symtab_init has been matched, all
+ * interned strings are freed and every handle becomes invalid. */
+void symtab_free(void);
+
+/* Intern len bytes of s, returns its handle (ROJ_SYM_EMPTY if out of memory) */
+roj_sym_t symtab_intern(const char* s, size_t len);
+
+/* Intern a NUL-terminated string */
+static inline roj_sym_t symtab_intern_str(const char* s) {
+    return symtab_intern(s, strlen(s));
+}
+
+/* Handle of an already interned string, ROJ_SYM_EMPTY if there is none */
+roj_sym_t symtab_lookup(const char* s, size_t len);
+
+/* symtab_intern for an unknown sender's own ID: a new symbol counts
+ * against ROJ_SYM_UNTRUSTED_MAX, and past it ROJ_SYM_EMPTY is returned */
+roj_sym_t symtab_intern_untrusted(const char* s, size_t len);
+
+/* Intern (ROJ_INTERN_ALL) or look up (ROJ_INTERN_KNOWN) */
+static inline roj_sym_t symtab_resolve(roj_intern_t mode, const char* s, size_t len) {
+    return mode == ROJ_INTERN_ALL ? symtab_intern(s, len) : symtab_lookup(s, len);
+}
+
+/* String for a handle ("" for unknown handles) */
+const char* symtab_str(roj_sym_t sym);
+
+/* Length of the string for a handle */
+size_t symtab_len(roj_sym_t sym);
+
+/* Number of interned strings */
+uint32_t symtab_count(void);
+
+#endif /* ROJ_SYMTAB_H */
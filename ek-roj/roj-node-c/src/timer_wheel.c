@@ -0,0 +1,198 @@
+/*
+ * ROJ Timer Wheel - hierarchical timing wheel implementation
+ *
+ * A timer at level l sits in slot (expires >> 6l) & 63. That slot is
+ * cascaded (its timers re-placed one level down) when the lower bits of the
+ * current tick wrap to it, which is never later than the expiry tick.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "timer_wheel.h"
+
+#define NIL UINT32_MAX
+#define WHEEL_MIN_NODES 64
+#define WHEEL_SLOT_MASK (ROJ_WHEEL_SLOTS - 1)
+#define WHEEL_MAX_DELTA ((1ULL << (ROJ_WHEEL_SLOT_BITS * ROJ_WHEEL_LEVELS)) - 1)
+
+static int grow_pool(roj_timer_wheel_t* w) {
+    uint32_t cap = w->node_cap ? w->node_cap * 2 : WHEEL_MIN_NODES;
+    roj_wheel_node_t* nodes = realloc(w->nodes, (size_t)cap * sizeof(*nodes));
+    if (!nodes) return -1;
+
+    for (uint32_t i = w->node_cap; i < cap; i++) {
+        memset(&nodes[i], 0, sizeof(nodes[i]));
+        nodes[i].generation = 1;
+        nodes[i].next = i + 1 < cap ? i + 1 : w->free_head;
+    }
+    w->free_head = w->node_cap;
+    w->nodes = nodes;
+    w->node_cap = cap;
+    return 0;
+}
+
+static void link_node(roj_timer_wheel_t* w, uint32_t idx) {
+    roj_wheel_node_t* n = &w->nodes[idx];
+    uint64_t delta = n->expires > w->now ? n->expires - w->now : 0;
+    uint64_t expires = n->expires;
+    int level = 0;
+
+    if (delta > WHEEL_MAX_DELTA) {
+        /* Beyond the wheel's range: park in the farthest slot, re-placed on cascade */
+        expires = w->now + WHEEL_MAX_DELTA;
+        delta = WHEEL_MAX_DELTA;
+    }
+    while (level < ROJ_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << (ROJ_WHEEL_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    uint32_t slot = (uint32_t)(expires >> (ROJ_WHEEL_SLOT_BITS * level)) & WHEEL_SLOT_MASK;
+    uint16_t bucket = (uint16_t)(level * ROJ_WHEEL_SLOTS + slot);
+
+    n->bucket = bucket;
+    n->prev = NIL;
+    n->next = w->heads[bucket];
+    if (n->next != NIL) {
+        w->nodes[n->next].prev = idx;
+    }
+    w->heads[bucket] = idx;
+}
+
+static void unlink_node(roj_timer_wheel_t* w, uint32_t idx) {
+    roj_wheel_node_t* n = &w->nodes[idx];
+    if (n->prev != NIL) {
+        w->nodes[n->prev].next = n->next;
+    } else {
+        w->heads[n->bucket] = n->next;
+    }
+    if (n->next != NIL) {
+        w->nodes[n->next].prev = n->prev;
+    }
+}
+
+static void release_node(roj_timer_wheel_t* w, uint32_t idx) {
+    roj_wheel_node_t* n = &w->nodes[idx];
+    n->pending = 0;
+    n->generation++;
+    if (n->generation == 0) n->generation = 1;
+    n->next = w->free_head;
+    w->free_head = idx;
+    w->pending--;
+}
+
+static void cascade(roj_timer_wheel_t* w, int level) {
+    uint32_t slot = (uint32_t)(w->now >> (ROJ_WHEEL_SLOT_BITS * level)) & WHEEL_SLOT_MASK;
+    uint32_t bucket = (uint32_t)level * ROJ_WHEEL_SLOTS + slot;
+    uint32_t idx = w->heads[bucket];
+
+    w->heads[bucket] = NIL;
+    while (idx != NIL) {
+        uint32_t next = w->nodes[idx].next;
+        link_node(w, idx);
+        idx = next;
+    }
+}
+
+static size_t tick(roj_timer_wheel_t* w) {
+    size_t fired = 0;
+
+    w->now++;
+
+    /* Cascade each level whose lower levels just wrapped */
+    for (int level = 1; level < ROJ_WHEEL_LEVELS; level++) {
+        if ((w->now & ((1ULL << (ROJ_WHEEL_SLOT_BITS * level)) - 1)) != 0) break;
+        cascade(w, level);
+    }
+
+    uint32_t bucket = (uint32_t)(w->now & WHEEL_SLOT_MASK);
+    uint32_t idx;
+    while ((idx = w->heads[bucket]) != NIL) {
+        roj_wheel_node_t* n = &w->nodes[idx];
+        roj_wheel_cb cb = n->cb;
+        void* ctx = n->ctx;
+        uint64_t arg = n->arg;
+
+        unlink_node(w, idx);
+        release_node(w, idx);
+        cb(ctx, arg);
+        fired++;
+    }
+    return fired;
+}
+
+int timer_wheel_init(roj_timer_wheel_t* w, uint64_t tick_ms, roj_clock_ms_fn clock) {
+    memset(w, 0, sizeof(*w));
+    for (size_t i = 0; i < ROJ_WHEEL_LEVELS * ROJ_WHEEL_SLOTS; i++) {
+        w->heads[i] = NIL;
+    }
+    w->free_head = NIL;
+    w->tick_ms = tick_ms ? tick_ms : ROJ_WHEEL_TICK_MS;
+    w->clock = clock;
+    w->now = clock() / w->tick_ms;
+    return grow_pool(w);
+}
+
+void timer_wheel_free(roj_timer_wheel_t* w) {
+    free(w->nodes);
+    w->nodes = NULL;
+    w->node_cap = 0;
+    w->pending = 0;
+}
+
+roj_timer_id_t timer_wheel_add(roj_timer_wheel_t* w, uint64_t delay_ms,
+                               roj_wheel_cb cb, void* ctx, uint64_t arg) {
+    if (w->pending == 0 && !w->advancing) {
+        /* Idle wheel was not advanced; catch up without walking the ticks */
+        uint64_t now = w->clock() / w->tick_ms;
+        if (now > w->now) w->now = now;
+    }
+    if (w->free_head == NIL && grow_pool(w) != 0) {
+        return 0;
+    }
+
+    uint32_t idx = w->free_head;
+    roj_wheel_node_t* n = &w->nodes[idx];
+    w->free_head = n->next;
+
+    uint64_t ticks = (delay_ms + w->tick_ms - 1) / w->tick_ms;
+    n->expires = w->now + (ticks ? ticks : 1);
+    n->cb = cb;
+    n->ctx = ctx;
+    n->arg = arg;
+    n->pending = 1;
+    link_node(w, idx);
+    w->pending++;
+
+    return ((roj_timer_id_t)n->generation << 32) | idx;
+}
+
+void timer_wheel_cancel(roj_timer_wheel_t* w, roj_timer_id_t id) {
+    uint32_t idx = (uint32_t)id;
+    uint32_t generation = (uint32_t)(id >> 32);
+
+    if (id == 0 || idx >= w->node_cap) return;
+    roj_wheel_node_t* n = &w->nodes[idx];
+    if (!n->pending || n->generation != generation) return;
+
+    unlink_node(w, idx);
+    release_node(w, idx);
+}
+
+size_t timer_wheel_advance(roj_timer_wheel_t* w) {
+    uint64_t target = w->clock() / w->tick_ms;
+    size_t fired = 0;
+
+    w->advancing = 1;
+    while (w->now < target) {
+        if (w->pending == 0) {
+            w->now = target;
+            break;
+        }
+        fired += tick(w);
+    }
+    w->advancing = 0;
+    return fired;
+}
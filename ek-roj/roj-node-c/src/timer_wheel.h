@@ -0,0 +1,78 @@
+/*
+ * ROJ Timer Wheel - hierarchical timing wheel
+ *
+ * Four levels of 64 slots each; level n covers 64^(n+1) ticks. Insert and
+ * cancel are O(1) list operations, and each tick only visits one level-0
+ * slot (plus an occasional cascade of one higher slot), so the cost per
+ * tick does not depend on how many timers are pending.
+ *
+ * Timer nodes live in a pool owned by the wheel and are linked by index,
+ * and callbacks receive a 64-bit argument (e.g. a proposal ID) rather than
+ * a pointer, so owners can keep timer handles in storage that moves.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_TIMER_WHEEL_H
+#define ROJ_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROJ_WHEEL_LEVELS     4
+#define ROJ_WHEEL_SLOT_BITS  6
+#define ROJ_WHEEL_SLOTS      (1u << ROJ_WHEEL_SLOT_BITS)
+#define ROJ_WHEEL_TICK_MS    100     /* node deadlines are seconds-scale */
+
+/* Handle: pool index in the low 32 bits, generation above; 0 = no timer */
+typedef uint64_t roj_timer_id_t;
+
+typedef void (*roj_wheel_cb)(void* ctx, uint64_t arg);
+typedef uint64_t (*roj_clock_ms_fn)(void);
+
+typedef struct {
+    uint64_t expires;       /* absolute tick */
+    roj_wheel_cb cb;
+    void* ctx;
+    uint64_t arg;
+    uint32_t next;
+    uint32_t prev;
+    uint32_t generation;
+    uint16_t bucket;        /* level * SLOTS + slot */
+    uint16_t pending;
+} roj_wheel_node_t;
+
+typedef struct {
+    roj_wheel_node_t* nodes;
+    uint32_t node_cap;
+    uint32_t free_head;
+    uint32_t heads[ROJ_WHEEL_LEVELS * ROJ_WHEEL_SLOTS];
+    uint64_t now;           /* current tick */
+    uint64_t tick_ms;
+    roj_clock_ms_fn clock;
+    size_t pending;
+    int advancing;          /* inside timer_wheel_advance */
+} roj_timer_wheel_t;
+
+/* Initialize wheel driven by a monotonic millisecond clock */
+int timer_wheel_init(roj_timer_wheel_t* w, uint64_t tick_ms, roj_clock_ms_fn clock);
+
+/* Free the node pool */
+void timer_wheel_free(roj_timer_wheel_t* w);
+
+/* Schedule cb(ctx, arg) after delay_ms (rounded up to whole ticks) */
+roj_timer_id_t timer_wheel_add(roj_timer_wheel_t* w, uint64_t delay_ms,
+                               roj_wheel_cb cb, void* ctx, uint64_t arg);
+
+/* Cancel a pending timer; stale or zero handles are ignored */
+void timer_wheel_cancel(roj_timer_wheel_t* w, roj_timer_id_t id);
+
+/* Run all timers due by the current clock, returns the number fired */
+size_t timer_wheel_advance(roj_timer_wheel_t* w);
+
+/* Number of pending timers */
+static inline size_t timer_wheel_pending(const roj_timer_wheel_t* w) {
+    return w->pending;
+}
+
+#endif /* ROJ_TIMER_WHEEL_H */
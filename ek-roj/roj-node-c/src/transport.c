@@ -4,145 +4,755 @@
  * SPDX-License-Identifier: AGPL-3.0
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  /* recvmmsg/sendmmsg */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "transport.h"
+#include "wire.h"
+#include "json_decode.h"
+#include "json_encode.h"
+#include "payload.h"
+#include "proposal_table.h"
+#include "symtab.h"
+#include "json_arena.h"
 #include "cJSON.h"
 
 #ifdef _WIN32
 #pragma comment(lib, "ws2_32.lib")
-static SOCKET g_socket = INVALID_SOCKET;
 #define SOCKET_TYPE SOCKET
 #define SOCKET_INVALID INVALID_SOCKET
 #define CLOSE_SOCKET closesocket
 #else
 #include <unistd.h>
-static int g_socket = -1;
 #define SOCKET_TYPE int
 #define SOCKET_INVALID -1
 #define CLOSE_SOCKET close
 #endif
 
-static char g_recv_buf[ROJ_MSG_MAX_SIZE];
+/* Batch receive buffers; one per receiving thread */
+struct roj_recv_ctx {
+    char ring[ROJ_RECV_BATCH][ROJ_RECV_SLOT_SIZE];
+    roj_transport_stats_t stats;
+    int shard;
+    struct roj_recv_ctx* next;      /* extra contexts, summed by transport_get_stats */
+};
 
-int transport_init(int port) {
-#ifdef _WIN32
-    WSADATA wsa;
-    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
-        fprintf(stderr, "[ERROR] WSAStartup failed\n");
-        return -1;
-    }
+struct roj_transport {
+    /* Receive shards: sockets bound to the same port with SO_REUSEPORT.
+     * Shard 0 also sends. */
+    SOCKET_TYPE shards[ROJ_MAX_SHARDS];
+    uint64_t shard_drops[ROJ_MAX_SHARDS];   /* kernel queue overflows */
+    int shard_count;
+
+    /* Context used by transport_recv_batch on the event loop thread; heads
+     * the list of every context reading from this transport */
+    roj_recv_ctx_t* recv_ctx;
+
+    roj_transport_stats_t stats;
+    const roj_json_templates_t* templates;  /* for JSON sends, may be NULL */
+
+    /* Known peers' addresses, by peer index (0 = none). Written on the event
+     * loop thread, read by every receiving thread. */
+    uint64_t admitted[ROJ_MAX_PEERS];
+    char recv_buf[ROJ_MSG_MAX_SIZE];
+
+    /* Broadcast encodings, each produced at most once per message */
+    char json_buf[ROJ_MSG_MAX_SIZE];
+    char bin_buf[ROJ_MSG_MAX_SIZE];
+};
+
+#ifdef ROJ_THREADS
+/* Each counter has a single writer, but snapshots come from another thread */
+#define STAT_LOAD(v)     __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define STAT_STORE(v, x) __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+#else
+#define STAT_LOAD(v)     (v)
+#define STAT_STORE(v, x) ((v) = (x))
 #endif
+#define STAT_ADD(v, n)   STAT_STORE(v, STAT_LOAD(v) + (n))
+#define STAT_MAX(v, n)   do { if ((n) > STAT_LOAD(v)) STAT_STORE(v, (n)); } while (0)
+
+static void count_recv(roj_transport_stats_t* stats, int datagrams) {
+    STAT_ADD(stats->recv_calls, 1);
+    STAT_ADD(stats->recv_datagrams, (uint64_t)datagrams);
+    STAT_MAX(stats->recv_max_batch, (uint64_t)datagrams);
+}
+
+static void count_send(roj_transport_t* tp, int datagrams) {
+    STAT_ADD(tp->stats.send_calls, 1);
+    STAT_ADD(tp->stats.send_datagrams, (uint64_t)datagrams);
+    STAT_MAX(tp->stats.send_max_batch, (uint64_t)datagrams);
+}
 
-    g_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (g_socket == SOCKET_INVALID) {
+static void merge_stats(roj_transport_stats_t* dst, const roj_transport_stats_t* src) {
+    dst->recv_calls += STAT_LOAD(src->recv_calls);
+    dst->recv_datagrams += STAT_LOAD(src->recv_datagrams);
+    if (STAT_LOAD(src->recv_max_batch) > dst->recv_max_batch) {
+        dst->recv_max_batch = STAT_LOAD(src->recv_max_batch);
+    }
+    dst->recv_truncated += STAT_LOAD(src->recv_truncated);
+    dst->recv_dropped += STAT_LOAD(src->recv_dropped);
+    dst->decode_errors += STAT_LOAD(src->decode_errors);
+    dst->send_calls += STAT_LOAD(src->send_calls);
+    dst->send_datagrams += STAT_LOAD(src->send_datagrams);
+    if (STAT_LOAD(src->send_max_batch) > dst->send_max_batch) {
+        dst->send_max_batch = STAT_LOAD(src->send_max_batch);
+    }
+}
+
+static SOCKET_TYPE open_socket(int port, int reuseport) {
+    SOCKET_TYPE sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == SOCKET_INVALID) {
         fprintf(stderr, "[ERROR] Failed to create socket\n");
-        return -1;
+        return SOCKET_INVALID;
     }
 
     /* Enable broadcast */
     int broadcast = 1;
-    setsockopt(g_socket, SOL_SOCKET, SO_BROADCAST,
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST,
                (const char*)&broadcast, sizeof(broadcast));
 
     /* Enable address reuse */
     int reuse = 1;
-    setsockopt(g_socket, SOL_SOCKET, SO_REUSEADDR,
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
                (const char*)&reuse, sizeof(reuse));
 
+#ifdef __linux__
+    /* The kernel hashes each sender's address and port onto one socket of
+     * the group, so a peer's datagrams stay in order on a single shard */
+    if (reuseport) {
+        setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    }
+    /* Report the socket's receive queue drop count with each datagram */
+    setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &reuse, sizeof(reuse));
+#else
+    (void)reuseport;
+#endif
+
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
     addr.sin_port = htons(port);
 
-    if (bind(g_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         fprintf(stderr, "[ERROR] Failed to bind to port %d\n", port);
-        CLOSE_SOCKET(g_socket);
-        return -1;
+        CLOSE_SOCKET(sock);
+        return SOCKET_INVALID;
     }
+    return sock;
+}
 
-    printf("[INFO] Listening on port %d\n", port);
-    return 0;
+roj_transport_t* transport_new(int port, int shards) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "[ERROR] WSAStartup failed\n");
+        return NULL;
+    }
+#endif
+
+    roj_transport_t* tp = calloc(1, sizeof(*tp));
+    if (tp) {
+        tp->recv_ctx = calloc(1, sizeof(roj_recv_ctx_t));
+    }
+    if (!tp || !tp->recv_ctx) {
+        fprintf(stderr, "[ERROR] Failed to allocate transport\n");
+        transport_free(tp);
+        return NULL;
+    }
+
+    if (shards < 1) shards = 1;
+    if (shards > ROJ_MAX_SHARDS) shards = ROJ_MAX_SHARDS;
+#ifndef __linux__
+    if (shards > 1) {
+        printf("[WARN] SO_REUSEPORT load balancing needs Linux, using 1 socket\n");
+        shards = 1;
+    }
+#endif
+
+    for (int i = 0; i < shards; i++) {
+        tp->shards[i] = open_socket(port, shards > 1);
+        if (tp->shards[i] == SOCKET_INVALID) {
+            transport_free(tp);
+            return NULL;
+        }
+        tp->shard_count++;
+    }
+
+    if (shards > 1) {
+        printf("[INFO] Listening on port %d (%d SO_REUSEPORT shards)\n", port, shards);
+    } else {
+        printf("[INFO] Listening on port %d\n", port);
+    }
+    return tp;
 }
 
-void transport_shutdown(void) {
-    if (g_socket != SOCKET_INVALID) {
-        CLOSE_SOCKET(g_socket);
-        g_socket = SOCKET_INVALID;
+void transport_free(roj_transport_t* tp) {
+    if (tp) {
+        for (int i = 0; i < tp->shard_count; i++) {
+            CLOSE_SOCKET(tp->shards[i]);
+        }
+        free(tp->recv_ctx);
+        free(tp);
     }
 #ifdef _WIN32
     WSACleanup();
 #endif
 }
 
-int transport_get_socket(void) {
-    return (int)g_socket;
+void transport_set_templates(roj_transport_t* tp, const roj_json_templates_t* templates) {
+    tp->templates = templates;
+}
+
+int transport_get_socket(const roj_transport_t* tp) {
+    return (int)tp->shards[0];
+}
+
+int transport_shard_count(const roj_transport_t* tp) {
+    return tp->shard_count;
+}
+
+int transport_get_shard_socket(const roj_transport_t* tp, int shard) {
+    if (shard < 0 || shard >= tp->shard_count) return -1;
+    return (int)tp->shards[shard];
 }
 
-int transport_recv(roj_message_t* msg, struct sockaddr_in* from) {
+static uint64_t addr_key(const struct sockaddr_in* addr) {
+    /* Never 0, so an empty slot matches no address */
+    return 1ULL << 48 | (uint64_t)ntohl(addr->sin_addr.s_addr) << 16 | ntohs(addr->sin_port);
+}
+
+void transport_admit(roj_transport_t* tp, int index, const struct sockaddr_in* addr) {
+    if (index >= 0 && index < ROJ_MAX_PEERS) {
+        STAT_STORE(tp->admitted[index], addr_key(addr));
+    }
+}
+
+/* Strings from a known peer may be interned, others only looked up */
+static roj_intern_t sender_intern(const roj_transport_t* tp, const struct sockaddr_in* from) {
+    uint64_t key = addr_key(from);
+    for (int i = 0; i < ROJ_MAX_PEERS; i++) {
+        if (STAT_LOAD(tp->admitted[i]) == key) {
+            return ROJ_INTERN_ALL;
+        }
+    }
+    return ROJ_INTERN_KNOWN;
+}
+
+int transport_recv(roj_transport_t* tp, roj_message_t* msg, struct sockaddr_in* from) {
     socklen_t from_len = sizeof(*from);
 
-    int n = recvfrom(g_socket, g_recv_buf, sizeof(g_recv_buf) - 1, 0,
+    int n = recvfrom(tp->shards[0], tp->recv_buf, sizeof(tp->recv_buf) - 1, 0,
                      (struct sockaddr*)from, &from_len);
     if (n <= 0) {
         return -1;
     }
+    count_recv(&tp->stats, 1);
 
-    g_recv_buf[n] = '\0';
-    return message_from_json(g_recv_buf, msg);
+    tp->recv_buf[n] = '\0';
+    if (message_from_wire((const uint8_t*)tp->recv_buf, (size_t)n, msg,
+                          sender_intern(tp, from)) != 0) {
+        STAT_ADD(tp->stats.decode_errors, 1);
+        return -1;
+    }
+    return 0;
 }
 
-int transport_send(const roj_message_t* msg, const struct sockaddr_in* to) {
-    char buf[ROJ_MSG_MAX_SIZE];
-    int len = message_to_json(msg, buf, sizeof(buf));
-    if (len < 0) {
+roj_recv_ctx_t* transport_recv_ctx_new(roj_transport_t* tp, int shard) {
+    if (shard < 0 || shard >= tp->shard_count) return NULL;
+
+    roj_recv_ctx_t* ctx = calloc(1, sizeof(roj_recv_ctx_t));
+    if (ctx) {
+        ctx->shard = shard;
+        ctx->next = tp->recv_ctx->next;
+        tp->recv_ctx->next = ctx;
+    }
+    return ctx;
+}
+
+void transport_recv_ctx_free(roj_transport_t* tp, roj_recv_ctx_t* ctx) {
+    roj_recv_ctx_t** link = &tp->recv_ctx->next;
+
+    if (!ctx) return;
+    while (*link && *link != ctx) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = ctx->next;
+    }
+    free(ctx);
+}
+
+int transport_recv_batch(roj_transport_t* tp, roj_message_t* msgs, struct sockaddr_in* froms,
+                         int max) {
+    return transport_recv_batch_ctx(tp, tp->recv_ctx, msgs, froms, max);
+}
+
+int transport_recv_batch_ctx(roj_transport_t* tp, roj_recv_ctx_t* ctx,
+                             roj_message_t* msgs, struct sockaddr_in* froms, int max) {
+    SOCKET_TYPE sock = tp->shards[ctx->shard];
+    int lens[ROJ_RECV_BATCH];
+    int received = 0;
+
+    if (max > ROJ_RECV_BATCH) max = ROJ_RECV_BATCH;
+    if (max <= 0) return 0;
+
+#ifdef __linux__
+    struct mmsghdr hdrs[ROJ_RECV_BATCH];
+    struct iovec iovs[ROJ_RECV_BATCH];
+    struct {
+        _Alignas(struct cmsghdr) char buf[CMSG_SPACE(sizeof(uint32_t))];
+    } ctrl[ROJ_RECV_BATCH];
+
+    for (int i = 0; i < max; i++) {
+        iovs[i].iov_base = ctx->ring[i];
+        iovs[i].iov_len = ROJ_RECV_SLOT_SIZE;
+        memset(&hdrs[i].msg_hdr, 0, sizeof(hdrs[i].msg_hdr));
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = &froms[i];
+        hdrs[i].msg_hdr.msg_namelen = sizeof(froms[i]);
+        hdrs[i].msg_hdr.msg_control = ctrl[i].buf;
+        hdrs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+    }
+
+    received = recvmmsg(sock, hdrs, (unsigned int)max, MSG_DONTWAIT, NULL);
+    if (received <= 0) {
+        return received < 0 ? -1 : 0;
+    }
+    for (int i = 0; i < received; i++) {
+        lens[i] = (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) ? -1 : (int)hdrs[i].msg_len;
+    }
+    count_recv(&ctx->stats, received);
+
+    /* The overflow count is cumulative per socket: the newest one wins */
+    struct msghdr* last = &hdrs[received - 1].msg_hdr;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(last); c; c = CMSG_NXTHDR(last, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+            STAT_STORE(tp->shard_drops[ctx->shard], (uint64_t)drops);
+        }
+    }
+#else
+    /* Portable fallback: one recvfrom per datagram until the queue is empty */
+    while (received < max) {
+        fd_set readfds;
+        struct timeval tv = { 0, 0 };
+        FD_ZERO(&readfds);
+        FD_SET(sock, &readfds);
+        if (received > 0 && select((int)sock + 1, &readfds, NULL, NULL, &tv) <= 0) {
+            break;
+        }
+
+        socklen_t from_len = sizeof(froms[received]);
+        int n = recvfrom(sock, ctx->ring[received], ROJ_RECV_SLOT_SIZE, 0,
+                         (struct sockaddr*)&froms[received], &from_len);
+        if (n <= 0) {
+            break;
+        }
+        count_recv(&ctx->stats, 1);
+        lens[received++] = n;
+    }
+    if (received == 0) {
         return -1;
     }
+#endif
 
-    int sent = sendto(g_socket, buf, len, 0,
-                      (const struct sockaddr*)to, sizeof(*to));
-    return sent > 0 ? 0 : -1;
+    /* Decode in place, compacting out datagrams that fail to parse */
+    int count = 0;
+    for (int i = 0; i < received; i++) {
+        if (lens[i] < 0) {
+            STAT_ADD(ctx->stats.recv_truncated, 1);
+            continue;
+        }
+        if (message_from_wire((const uint8_t*)ctx->ring[i], (size_t)lens[i], &msgs[count],
+                              sender_intern(tp, &froms[i])) != 0) {
+            STAT_ADD(ctx->stats.decode_errors, 1);
+            continue;
+        }
+        if (count != i) {
+            froms[count] = froms[i];
+        }
+        count++;
+    }
+    return count;
 }
 
-int transport_broadcast(const roj_message_t* msg,
-                       const struct sockaddr_in* addrs, int addr_count) {
+int transport_send(roj_transport_t* tp, const roj_message_t* msg, const struct sockaddr_in* to) {
+    return transport_send_wire(tp, msg, to, WIRE_JSON);
+}
+
+int transport_send_wire(roj_transport_t* tp, const roj_message_t* msg, const struct sockaddr_in* to,
+                        roj_wire_t wire) {
     char buf[ROJ_MSG_MAX_SIZE];
-    int len = message_to_json(msg, buf, sizeof(buf));
+    int len = message_to_wire(tp->templates, msg, wire, buf, sizeof(buf));
     if (len < 0) {
         return -1;
     }
 
+    int sent = sendto(tp->shards[0], buf, len, 0,
+                      (const struct sockaddr*)to, sizeof(*to));
+    if (sent > 0) {
+        count_send(tp, 1);
+    }
+    return sent > 0 ? 0 : -1;
+}
+
+int transport_broadcast(roj_transport_t* tp, const roj_message_t* msg,
+                        const struct sockaddr_in* addrs, int addr_count) {
+    return transport_broadcast_wire(tp, msg, addrs, NULL, addr_count);
+}
+
+/* Send bufs[i] to addrs[i], skipping entries that failed to encode */
+static int send_fanout(roj_transport_t* tp, const char* const* bufs, const int* lens,
+                       const struct sockaddr_in* addrs, int count) {
     int success = 0;
-    for (int i = 0; i < addr_count; i++) {
-        if (sendto(g_socket, buf, len, 0,
+
+#ifdef __linux__
+    struct mmsghdr hdrs[ROJ_MAX_PEERS];
+    struct iovec iovs[ROJ_MAX_PEERS];
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (lens[i] < 0) continue;
+        iovs[n].iov_base = (void*)bufs[i];
+        iovs[n].iov_len = (size_t)lens[i];
+        memset(&hdrs[n], 0, sizeof(hdrs[n]));
+        hdrs[n].msg_hdr.msg_iov = &iovs[n];
+        hdrs[n].msg_hdr.msg_iovlen = 1;
+        hdrs[n].msg_hdr.msg_name = (void*)&addrs[i];
+        hdrs[n].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        n++;
+    }
+
+    /* sendmmsg may stop early; resume after the first unsent datagram */
+    int done = 0;
+    while (done < n) {
+        int sent = sendmmsg(tp->shards[0], &hdrs[done], (unsigned int)(n - done), 0);
+        if (sent <= 0) {
+            done++;  /* skip the failing destination */
+            continue;
+        }
+        count_send(tp, sent);
+        success += sent;
+        done += sent;
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        if (lens[i] < 0) continue;
+        if (sendto(tp->shards[0], bufs[i], lens[i], 0,
                    (const struct sockaddr*)&addrs[i], sizeof(addrs[i])) > 0) {
+            count_send(tp, 1);
             success++;
         }
     }
+#endif
+
     return success;
 }
 
-int message_to_json(const roj_message_t* msg, char* buf, size_t buf_size) {
+int transport_broadcast_wire(roj_transport_t* tp, const roj_message_t* msg,
+                             const struct sockaddr_in* addrs,
+                             const roj_wire_t* wires, int addr_count) {
+    /* Each encoding is produced at most once, on first use */
+    char* json_buf = tp->json_buf;
+    char* bin_buf = tp->bin_buf;
+    int json_len = 0, bin_len = 0;
+
+    const char* bufs[ROJ_MAX_PEERS];
+    int lens[ROJ_MAX_PEERS];
+    int success = 0;
+
+    for (int base = 0; base < addr_count; base += ROJ_MAX_PEERS) {
+        int chunk = addr_count - base;
+        if (chunk > ROJ_MAX_PEERS) chunk = ROJ_MAX_PEERS;
+
+        for (int i = 0; i < chunk; i++) {
+            roj_wire_t wire = wires ? wires[base + i] : WIRE_JSON;
+
+            if (wire == WIRE_BINARY) {
+                if (bin_len == 0) {
+                    bin_len = message_to_wire(NULL, msg, WIRE_BINARY, bin_buf, ROJ_MSG_MAX_SIZE);
+                }
+                bufs[i] = bin_buf;
+                lens[i] = bin_len;
+            } else {
+                if (json_len == 0) {
+                    json_len = message_to_wire(tp->templates, msg, WIRE_JSON, json_buf,
+                                               ROJ_MSG_MAX_SIZE);
+                }
+                bufs[i] = json_buf;
+                lens[i] = json_len;
+            }
+        }
+        success += send_fanout(tp, bufs, lens, &addrs[base], chunk);
+    }
+    return success;
+}
+
+void transport_get_shard_stats(const roj_transport_t* tp, int shard,
+                               roj_transport_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (shard < 0 || shard >= tp->shard_count) return;
+
+    for (const roj_recv_ctx_t* ctx = tp->recv_ctx; ctx; ctx = ctx->next) {
+        if (ctx->shard == shard) {
+            merge_stats(stats, &ctx->stats);
+        }
+    }
+    stats->recv_dropped = STAT_LOAD(tp->shard_drops[shard]);
+}
+
+void transport_get_stats(const roj_transport_t* tp, roj_transport_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    merge_stats(stats, &tp->stats);
+    for (int i = 0; i < tp->shard_count; i++) {
+        roj_transport_stats_t shard;
+        transport_get_shard_stats(tp, i, &shard);
+        merge_stats(stats, &shard);
+    }
+}
+
+void transport_print_stats(const roj_transport_t* tp) {
+    roj_transport_stats_t s;
+    transport_get_stats(tp, &s);
+
+    printf("Transport I/O:\n");
+    printf("  recv: %llu datagrams in %llu syscalls (%.2f/call, max %llu)\n",
+           (unsigned long long)s.recv_datagrams,
+           (unsigned long long)s.recv_calls,
+           s.recv_calls ? (double)s.recv_datagrams / s.recv_calls : 0.0,
+           (unsigned long long)s.recv_max_batch);
+    printf("  send: %llu datagrams in %llu syscalls (%.2f/call, max %llu)\n",
+           (unsigned long long)s.send_datagrams,
+           (unsigned long long)s.send_calls,
+           s.send_calls ? (double)s.send_datagrams / s.send_calls : 0.0,
+           (unsigned long long)s.send_max_batch);
+    printf("  truncated: %llu, decode errors: %llu, kernel drops: %llu\n",
+           (unsigned long long)s.recv_truncated,
+           (unsigned long long)s.decode_errors,
+           (unsigned long long)s.recv_dropped);
+
+    if (tp->shard_count > 1) {
+        for (int i = 0; i < tp->shard_count; i++) {
+            roj_transport_stats_t sh;
+            transport_get_shard_stats(tp, i, &sh);
+            printf("  shard[%d]: %llu datagrams in %llu syscalls, %llu kernel drops\n",
+                   i, (unsigned long long)sh.recv_datagrams,
+                   (unsigned long long)sh.recv_calls,
+                   (unsigned long long)sh.recv_dropped);
+        }
+    }
+}
+
+int message_to_wire(const roj_json_templates_t* templates, const roj_message_t* msg,
+                    roj_wire_t wire, char* buf, size_t buf_size) {
+    if (wire == WIRE_BINARY) {
+        return message_to_binary(msg, (uint8_t*)buf, buf_size);
+    }
+    return json_encode_message(templates, msg, buf, buf_size);
+}
+
+int message_from_wire(const uint8_t* buf, size_t len, roj_message_t* msg, roj_intern_t intern) {
+    if (wire_is_binary(buf, len)) {
+        return message_from_binary(buf, len, msg, intern);
+    }
+    return json_decode_message((const char*)buf, len, msg, intern);
+}
+
+static cJSON* entries_to_json(const roj_kv_t* entries, int count) {
+    cJSON* arr = cJSON_CreateArray();
+    for (int i = 0; i < count; i++) {
+        cJSON* entry = cJSON_CreateObject();
+        cJSON_AddStringToObject(entry, "key", symtab_str(entries[i].key));
+        cJSON_AddNumberToObject(entry, "value", (double)entries[i].value);
+        cJSON_AddItemToArray(arr, entry);
+    }
+    return arr;
+}
+
+static cJSON* voters_to_json(const roj_sym_t* voters, int count) {
+    cJSON* arr = cJSON_CreateArray();
+    for (int i = 0; i < count; i++) {
+        cJSON_AddItemToArray(arr, cJSON_CreateString(symtab_str(voters[i])));
+    }
+    return arr;
+}
+
+/* Returns the entry count, or -1 if the batch does not fit */
+static int entries_from_json(const cJSON* arr, roj_kv_t* entries) {
+    int count = 0;
+
+    if (!arr || !cJSON_IsArray(arr)) return 0;
+    for (cJSON* item = arr->child; item; item = item->next) {
+        if (!cJSON_IsObject(item)) continue;
+        if (count == ROJ_MAX_BATCH) return -1;
+
+        cJSON* key = cJSON_GetObjectItem(item, "key");
+        cJSON* value = cJSON_GetObjectItem(item, "value");
+        entries[count].key = (key && cJSON_IsString(key))
+                             ? symtab_intern_str(key->valuestring) : ROJ_SYM_EMPTY;
+        entries[count].value = (value && cJSON_IsNumber(value))
+                               ? (int64_t)value->valuedouble : 0;
+        count++;
+    }
+    return count;
+}
+
+static int voters_from_json(const cJSON* arr, roj_sym_t* voters) {
+    if (!arr || !cJSON_IsArray(arr)) return 0;
+
+    int count = cJSON_GetArraySize(arr);
+    if (count > ROJ_MAX_VOTERS) count = ROJ_MAX_VOTERS;
+    for (int i = 0; i < count; i++) {
+        cJSON* voter = cJSON_GetArrayItem(arr, i);
+        if (voter && cJSON_IsString(voter)) {
+            voters[i] = symtab_intern_str(voter->valuestring);
+        }
+    }
+    return count;
+}
+
+static uint64_t id_from_json(const cJSON* id) {
+    return (id && cJSON_IsString(id)) ? proposal_id_from_str(id->valuestring) : 0;
+}
+
+static int64_t int_from_json(const cJSON* n) {
+    return (n && cJSON_IsNumber(n)) ? (int64_t)n->valuedouble : 0;
+}
+
+static cJSON* commits_to_json(const roj_commit_item_t* items, int count) {
+    cJSON* arr = cJSON_CreateArray();
+    char id[ROJ_PROPOSAL_ID_LEN];
+    for (int i = 0; i < count; i++) {
+        cJSON* item = cJSON_CreateObject();
+        proposal_id_to_str(items[i].id, id);
+        cJSON_AddStringToObject(item, "proposal_id", id);
+        cJSON_AddStringToObject(item, "key", symtab_str(items[i].key));
+        cJSON_AddNumberToObject(item, "value", (double)items[i].value);
+        cJSON_AddNumberToObject(item, "voter_bits", (double)items[i].voter_bits);
+        cJSON_AddItemToArray(arr, item);
+    }
+    return arr;
+}
+
+/* Returns the commit count, or -1 if the aggregate does not fit */
+static int commits_from_json(const cJSON* arr, roj_commit_item_t* items) {
+    int count = 0;
+
+    if (!arr || !cJSON_IsArray(arr)) return 0;
+    for (cJSON* item = arr->child; item; item = item->next) {
+        if (!cJSON_IsObject(item)) continue;
+        if (count == ROJ_MAX_AGG) return -1;
+
+        cJSON* key = cJSON_GetObjectItem(item, "key");
+        items[count].id = id_from_json(cJSON_GetObjectItem(item, "proposal_id"));
+        items[count].key = (key && cJSON_IsString(key))
+                           ? symtab_intern_str(key->valuestring) : ROJ_SYM_EMPTY;
+        items[count].value = int_from_json(cJSON_GetObjectItem(item, "value"));
+        items[count].voter_bits =
+            (uint32_t)int_from_json(cJSON_GetObjectItem(item, "voter_bits"));
+        count++;
+    }
+    return count;
+}
+
+/* FORWARD entries (log false) carry no index or term */
+static cJSON* log_entries_to_json(const roj_log_entry_t* entries, int count,
+                                  uint64_t prev_index, bool log) {
+    cJSON* arr = cJSON_CreateArray();
+    char id[ROJ_PROPOSAL_ID_LEN];
+    for (int i = 0; i < count; i++) {
+        const roj_log_entry_t* e = &entries[i];
+        cJSON* entry = cJSON_CreateObject();
+        if (log) {
+            cJSON_AddNumberToObject(entry, "index", (double)(prev_index + 1 + (uint64_t)i));
+            cJSON_AddNumberToObject(entry, "term", (double)e->term);
+        }
+        if (e->id != 0) {
+            proposal_id_to_str(e->id, id);
+            cJSON_AddStringToObject(entry, "id", id);
+        }
+        cJSON_AddStringToObject(entry, "key", symtab_str(e->key));
+        if (e->op != ROJ_OP_SET) {
+            cJSON_AddStringToObject(entry, "op", op_to_str((roj_op_t)e->op));
+        }
+        cJSON_AddNumberToObject(entry, "value", (double)e->value);
+        if (e->op == ROJ_OP_CAS) {
+            cJSON_AddNumberToObject(entry, "expect", (double)e->expect);
+        }
+        cJSON_AddItemToArray(arr, entry);
+    }
+    return arr;
+}
+
+/* Returns the entry count, or -1 if the entries do not fit or name an
+ * unknown op */
+static int log_entries_from_json(const cJSON* arr, roj_log_entry_t* entries) {
+    int count = 0;
+
+    if (!arr || !cJSON_IsArray(arr)) return 0;
+    for (cJSON* item = arr->child; item; item = item->next) {
+        if (!cJSON_IsObject(item)) continue;
+        if (count == ROJ_MAX_BATCH) return -1;
+
+        roj_log_entry_t* e = &entries[count];
+        cJSON* key = cJSON_GetObjectItem(item, "key");
+        cJSON* op = cJSON_GetObjectItem(item, "op");
+        int code = (op && cJSON_IsString(op)) ? str_to_op(op->valuestring) : ROJ_OP_SET;
+        if (code < 0) return -1;
+
+        e->term = (uint64_t)int_from_json(cJSON_GetObjectItem(item, "term"));
+        e->id = id_from_json(cJSON_GetObjectItem(item, "id"));
+        e->key = (key && cJSON_IsString(key))
+                 ? symtab_intern_str(key->valuestring) : ROJ_SYM_EMPTY;
+        e->op = (uint8_t)code;
+        e->value = int_from_json(cJSON_GetObjectItem(item, "value"));
+        e->expect = int_from_json(cJSON_GetObjectItem(item, "expect"));
+        count++;
+    }
+    return count;
+}
+
+static roj_sym_t sym_from_json(const cJSON* s) {
+    return (s && cJSON_IsString(s)) ? symtab_intern_str(s->valuestring) : ROJ_SYM_EMPTY;
+}
+
+static int encode_cjson(const roj_message_t* msg, char* buf, size_t buf_size) {
     cJSON* root = cJSON_CreateObject();
     if (!root) return -1;
 
     switch (msg->type) {
         case MSG_ANNOUNCE:
             cJSON_AddStringToObject(root, "type", "ANNOUNCE");
-            cJSON_AddStringToObject(root, "node_id", msg->data.announce.node_id);
+            cJSON_AddStringToObject(root, "node_id", symtab_str(msg->data.announce.node_id));
             cJSON_AddStringToObject(root, "lang", lang_to_str(msg->data.announce.lang));
-            cJSON_AddItemToObject(root, "capabilities",
-                                  cJSON_CreateStringArray((const char*[]){"consensus"}, 1));
+            {
+                const char* caps[32];
+                int cap_count = 0;
+                for (int bit = 0; bit < 32; bit++) {
+                    const char* name = cap_to_str(1u << bit);
+                    if (name && (msg->data.announce.caps & (1u << bit))) {
+                        caps[cap_count++] = name;
+                    }
+                }
+                cJSON_AddItemToObject(root, "capabilities",
+                                      cJSON_CreateStringArray(caps, cap_count));
+            }
             cJSON_AddStringToObject(root, "version", msg->data.announce.version);
             break;
 
         case MSG_PROPOSE:
             cJSON_AddStringToObject(root, "type", "PROPOSE");
             cJSON_AddStringToObject(root, "proposal_id", msg->data.propose.proposal_id);
-            cJSON_AddStringToObject(root, "from", msg->data.propose.from);
-            cJSON_AddStringToObject(root, "key", msg->data.propose.key);
+            cJSON_AddStringToObject(root, "from", symtab_str(msg->data.propose.from));
+            cJSON_AddStringToObject(root, "key", symtab_str(msg->data.propose.key));
             cJSON_AddNumberToObject(root, "value", (double)msg->data.propose.value);
             cJSON_AddNumberToObject(root, "timestamp", (double)msg->data.propose.timestamp);
             break;
@@ -150,23 +760,120 @@ int message_to_json(const roj_message_t* msg, char* buf, size_t buf_size) {
         case MSG_VOTE:
             cJSON_AddStringToObject(root, "type", "VOTE");
             cJSON_AddStringToObject(root, "proposal_id", msg->data.vote.proposal_id);
-            cJSON_AddStringToObject(root, "from", msg->data.vote.from);
+            cJSON_AddStringToObject(root, "from", symtab_str(msg->data.vote.from));
             cJSON_AddStringToObject(root, "vote", vote_to_str(msg->data.vote.vote));
             break;
 
         case MSG_COMMIT:
             cJSON_AddStringToObject(root, "type", "COMMIT");
             cJSON_AddStringToObject(root, "proposal_id", msg->data.commit.proposal_id);
-            cJSON_AddStringToObject(root, "key", msg->data.commit.key);
+            cJSON_AddStringToObject(root, "key", symtab_str(msg->data.commit.key));
             cJSON_AddNumberToObject(root, "value", (double)msg->data.commit.value);
+            cJSON_AddItemToObject(root, "voters",
+                                  voters_to_json(msg->data.commit.voters,
+                                                 msg->data.commit.voter_count));
+            break;
+
+        case MSG_PROPOSE_BATCH:
+            cJSON_AddStringToObject(root, "type", "PROPOSE_BATCH");
+            cJSON_AddStringToObject(root, "proposal_id", msg->data.propose_batch.proposal_id);
+            cJSON_AddStringToObject(root, "from", symtab_str(msg->data.propose_batch.from));
+            cJSON_AddItemToObject(root, "entries",
+                                  entries_to_json(msg->data.propose_batch.entries,
+                                                  msg->data.propose_batch.count));
+            cJSON_AddNumberToObject(root, "timestamp",
+                                    (double)msg->data.propose_batch.timestamp);
+            break;
+
+        case MSG_COMMIT_BATCH:
+            cJSON_AddStringToObject(root, "type", "COMMIT_BATCH");
+            cJSON_AddStringToObject(root, "proposal_id", msg->data.commit_batch.proposal_id);
+            cJSON_AddItemToObject(root, "entries",
+                                  entries_to_json(msg->data.commit_batch.entries,
+                                                  msg->data.commit_batch.count));
+            cJSON_AddItemToObject(root, "voters",
+                                  voters_to_json(msg->data.commit_batch.voters,
+                                                 msg->data.commit_batch.voter_count));
+            break;
+
+        case MSG_VOTE_AGG:
+            cJSON_AddStringToObject(root, "type", "VOTE_AGG");
+            cJSON_AddStringToObject(root, "from", symtab_str(msg->data.vote_agg.from));
             {
-                cJSON* voters = cJSON_CreateArray();
-                for (int i = 0; i < msg->data.commit.voter_count; i++) {
-                    cJSON_AddItemToArray(voters,
-                        cJSON_CreateString(msg->data.commit.voters[i]));
+                cJSON* ids = cJSON_CreateArray();
+                char id[ROJ_PROPOSAL_ID_LEN];
+                for (int i = 0; i < msg->data.vote_agg.count; i++) {
+                    proposal_id_to_str(msg->data.vote_agg.ids[i], id);
+                    cJSON_AddItemToArray(ids, cJSON_CreateString(id));
                 }
-                cJSON_AddItemToObject(root, "voters", voters);
+                cJSON_AddItemToObject(root, "proposal_ids", ids);
             }
+            cJSON_AddNumberToObject(root, "vote_bits", (double)msg->data.vote_agg.accept_bits);
+            break;
+
+        case MSG_COMMIT_AGG:
+            cJSON_AddStringToObject(root, "type", "COMMIT_AGG");
+            cJSON_AddItemToObject(root, "voters",
+                                  voters_to_json(msg->data.commit_agg.voters,
+                                                 msg->data.commit_agg.voter_count));
+            cJSON_AddItemToObject(root, "commits",
+                                  commits_to_json(msg->data.commit_agg.items,
+                                                  msg->data.commit_agg.count));
+            break;
+
+        case MSG_REQUEST_VOTE:
+            cJSON_AddStringToObject(root, "type", "REQUEST_VOTE");
+            cJSON_AddNumberToObject(root, "term", (double)msg->data.request_vote.term);
+            cJSON_AddStringToObject(root, "candidate_id",
+                                    symtab_str(msg->data.request_vote.candidate_id));
+            cJSON_AddNumberToObject(root, "last_log_index",
+                                    (double)msg->data.request_vote.last_log_index);
+            cJSON_AddNumberToObject(root, "last_log_term",
+                                    (double)msg->data.request_vote.last_log_term);
+            break;
+
+        case MSG_VOTE_RESPONSE:
+            cJSON_AddStringToObject(root, "type", "VOTE_RESPONSE");
+            cJSON_AddNumberToObject(root, "term", (double)msg->data.vote_response.term);
+            cJSON_AddStringToObject(root, "voter_id",
+                                    symtab_str(msg->data.vote_response.voter_id));
+            cJSON_AddBoolToObject(root, "vote_granted", msg->data.vote_response.vote_granted);
+            break;
+
+        case MSG_APPEND_ENTRIES:
+            cJSON_AddStringToObject(root, "type", "APPEND_ENTRIES");
+            cJSON_AddNumberToObject(root, "term", (double)msg->data.append_entries.term);
+            cJSON_AddStringToObject(root, "leader_id",
+                                    symtab_str(msg->data.append_entries.leader_id));
+            cJSON_AddNumberToObject(root, "prev_log_index",
+                                    (double)msg->data.append_entries.prev_log_index);
+            cJSON_AddNumberToObject(root, "prev_log_term",
+                                    (double)msg->data.append_entries.prev_log_term);
+            cJSON_AddItemToObject(root, "entries",
+                                  log_entries_to_json(msg->data.append_entries.entries,
+                                                      msg->data.append_entries.count,
+                                                      msg->data.append_entries.prev_log_index,
+                                                      true));
+            cJSON_AddNumberToObject(root, "leader_commit",
+                                    (double)msg->data.append_entries.leader_commit);
+            break;
+
+        case MSG_APPEND_ENTRIES_RESPONSE:
+            cJSON_AddStringToObject(root, "type", "APPEND_ENTRIES_RESPONSE");
+            cJSON_AddNumberToObject(root, "term", (double)msg->data.append_response.term);
+            cJSON_AddStringToObject(root, "follower_id",
+                                    symtab_str(msg->data.append_response.follower_id));
+            cJSON_AddBoolToObject(root, "success", msg->data.append_response.success);
+            cJSON_AddNumberToObject(root, "match_index",
+                                    (double)msg->data.append_response.match_index);
+            break;
+
+        case MSG_FORWARD:
+            cJSON_AddStringToObject(root, "type", "FORWARD");
+            cJSON_AddStringToObject(root, "from", symtab_str(msg->data.forward.from));
+            cJSON_AddItemToObject(root, "entries",
+                                  log_entries_to_json(msg->data.forward.entries,
+                                                      msg->data.forward.count, 0, false));
             break;
 
         default:
@@ -181,16 +888,24 @@ int message_to_json(const roj_message_t* msg, char* buf, size_t buf_size) {
 
     int len = (int)strlen(json);
     if ((size_t)len >= buf_size) {
-        free(json);
+        cJSON_free(json);
         return -1;
     }
 
     strcpy(buf, json);
-    free(json);
+    cJSON_free(json);
     return len;
 }
 
-int message_from_json(const char* json, roj_message_t* msg) {
+/* The tree and the printed string live in this thread's JSON arena */
+int message_to_json(const roj_message_t* msg, char* buf, size_t buf_size) {
+    json_arena_begin();
+    int len = encode_cjson(msg, buf, buf_size);
+    json_arena_end();
+    return len;
+}
+
+static int decode_cjson(const char* json, roj_message_t* msg) {
     cJSON* root = cJSON_Parse(json);
     if (!root) return -1;
 
@@ -204,16 +919,23 @@ int message_from_json(const char* json, roj_message_t* msg) {
 
     const char* type_str = type->valuestring;
 
+    /* The slow path: a slot whether or not the type needs one */
+    roj_payload_t* payload = payload_recv_slot();
+    if (!payload) {
+        cJSON_Delete(root);
+        return -1;
+    }
+
     if (strcmp(type_str, "ANNOUNCE") == 0) {
         msg->type = MSG_ANNOUNCE;
 
         cJSON* node_id = cJSON_GetObjectItem(root, "node_id");
         cJSON* lang = cJSON_GetObjectItem(root, "lang");
         cJSON* version = cJSON_GetObjectItem(root, "version");
+        cJSON* caps = cJSON_GetObjectItem(root, "capabilities");
 
         if (node_id && cJSON_IsString(node_id)) {
-            strncpy(msg->data.announce.node_id, node_id->valuestring,
-                    ROJ_NODE_ID_MAX - 1);
+            msg->data.announce.node_id = symtab_intern_str(node_id->valuestring);
         }
         if (lang && cJSON_IsString(lang)) {
             msg->data.announce.lang = str_to_lang(lang->valuestring);
@@ -221,6 +943,13 @@ int message_from_json(const char* json, roj_message_t* msg) {
         if (version && cJSON_IsString(version)) {
             strncpy(msg->data.announce.version, version->valuestring, 15);
         }
+        if (caps && cJSON_IsArray(caps)) {
+            for (cJSON* cap = caps->child; cap; cap = cap->next) {
+                if (cJSON_IsString(cap)) {
+                    msg->data.announce.caps |= str_to_cap(cap->valuestring);
+                }
+            }
+        }
     }
     else if (strcmp(type_str, "PROPOSE") == 0) {
         msg->type = MSG_PROPOSE;
@@ -236,10 +965,10 @@ int message_from_json(const char* json, roj_message_t* msg) {
                     ROJ_PROPOSAL_ID_LEN - 1);
         }
         if (from && cJSON_IsString(from)) {
-            strncpy(msg->data.propose.from, from->valuestring, ROJ_NODE_ID_MAX - 1);
+            msg->data.propose.from = symtab_intern_str(from->valuestring);
         }
         if (key && cJSON_IsString(key)) {
-            strncpy(msg->data.propose.key, key->valuestring, ROJ_KEY_MAX - 1);
+            msg->data.propose.key = symtab_intern_str(key->valuestring);
         }
         if (value && cJSON_IsNumber(value)) {
             msg->data.propose.value = (int64_t)value->valuedouble;
@@ -260,7 +989,7 @@ int message_from_json(const char* json, roj_message_t* msg) {
                     ROJ_PROPOSAL_ID_LEN - 1);
         }
         if (from && cJSON_IsString(from)) {
-            strncpy(msg->data.vote.from, from->valuestring, ROJ_NODE_ID_MAX - 1);
+            msg->data.vote.from = symtab_intern_str(from->valuestring);
         }
         if (vote && cJSON_IsString(vote)) {
             msg->data.vote.vote = str_to_vote(vote->valuestring);
@@ -279,24 +1008,158 @@ int message_from_json(const char* json, roj_message_t* msg) {
                     ROJ_PROPOSAL_ID_LEN - 1);
         }
         if (key && cJSON_IsString(key)) {
-            strncpy(msg->data.commit.key, key->valuestring, ROJ_KEY_MAX - 1);
+            msg->data.commit.key = symtab_intern_str(key->valuestring);
         }
         if (value && cJSON_IsNumber(value)) {
             msg->data.commit.value = (int64_t)value->valuedouble;
         }
-        if (voters && cJSON_IsArray(voters)) {
-            int count = cJSON_GetArraySize(voters);
-            if (count > ROJ_MAX_VOTERS) count = ROJ_MAX_VOTERS;
-            msg->data.commit.voter_count = count;
-            for (int i = 0; i < count; i++) {
-                cJSON* voter = cJSON_GetArrayItem(voters, i);
-                if (voter && cJSON_IsString(voter)) {
-                    strncpy(msg->data.commit.voters[i], voter->valuestring,
-                            ROJ_NODE_ID_MAX - 1);
+        msg->data.commit.voter_count = voters_from_json(voters, msg->data.commit.voters);
+    }
+    else if (strcmp(type_str, "PROPOSE_BATCH") == 0) {
+        msg->type = MSG_PROPOSE_BATCH;
+
+        cJSON* proposal_id = cJSON_GetObjectItem(root, "proposal_id");
+        cJSON* from = cJSON_GetObjectItem(root, "from");
+        cJSON* timestamp = cJSON_GetObjectItem(root, "timestamp");
+
+        if (proposal_id && cJSON_IsString(proposal_id)) {
+            strncpy(msg->data.propose_batch.proposal_id, proposal_id->valuestring,
+                    ROJ_PROPOSAL_ID_LEN - 1);
+        }
+        if (from && cJSON_IsString(from)) {
+            msg->data.propose_batch.from = symtab_intern_str(from->valuestring);
+        }
+        if (timestamp && cJSON_IsNumber(timestamp)) {
+            msg->data.propose_batch.timestamp = (int64_t)timestamp->valuedouble;
+        }
+        msg->data.propose_batch.entries = payload->kv;
+        msg->data.propose_batch.count =
+            entries_from_json(cJSON_GetObjectItem(root, "entries"), payload->kv);
+        if (msg->data.propose_batch.count < 0) {
+            cJSON_Delete(root);
+            return -1;
+        }
+    }
+    else if (strcmp(type_str, "COMMIT_BATCH") == 0) {
+        msg->type = MSG_COMMIT_BATCH;
+
+        cJSON* proposal_id = cJSON_GetObjectItem(root, "proposal_id");
+
+        if (proposal_id && cJSON_IsString(proposal_id)) {
+            strncpy(msg->data.commit_batch.proposal_id, proposal_id->valuestring,
+                    ROJ_PROPOSAL_ID_LEN - 1);
+        }
+        msg->data.commit_batch.entries = payload->kv;
+        msg->data.commit_batch.count =
+            entries_from_json(cJSON_GetObjectItem(root, "entries"), payload->kv);
+        if (msg->data.commit_batch.count < 0) {
+            cJSON_Delete(root);
+            return -1;
+        }
+        msg->data.commit_batch.voter_count =
+            voters_from_json(cJSON_GetObjectItem(root, "voters"),
+                             msg->data.commit_batch.voters);
+    }
+    else if (strcmp(type_str, "VOTE_AGG") == 0) {
+        msg->type = MSG_VOTE_AGG;
+
+        cJSON* from = cJSON_GetObjectItem(root, "from");
+        cJSON* ids = cJSON_GetObjectItem(root, "proposal_ids");
+
+        if (from && cJSON_IsString(from)) {
+            msg->data.vote_agg.from = symtab_intern_str(from->valuestring);
+        }
+        msg->data.vote_agg.accept_bits =
+            (uint32_t)int_from_json(cJSON_GetObjectItem(root, "vote_bits"));
+        msg->data.vote_agg.ids = payload->ids;
+        if (ids && cJSON_IsArray(ids)) {
+            for (cJSON* id = ids->child; id; id = id->next) {
+                if (!cJSON_IsString(id)) continue;
+                if (msg->data.vote_agg.count == ROJ_MAX_AGG) {
+                    cJSON_Delete(root);
+                    return -1;
                 }
+                msg->data.vote_agg.ids[msg->data.vote_agg.count++] = id_from_json(id);
             }
         }
     }
+    else if (strcmp(type_str, "COMMIT_AGG") == 0) {
+        msg->type = MSG_COMMIT_AGG;
+
+        msg->data.commit_agg.voter_count =
+            voters_from_json(cJSON_GetObjectItem(root, "voters"),
+                             msg->data.commit_agg.voters);
+        msg->data.commit_agg.items = payload->items;
+        msg->data.commit_agg.count =
+            commits_from_json(cJSON_GetObjectItem(root, "commits"), payload->items);
+        if (msg->data.commit_agg.count < 0) {
+            cJSON_Delete(root);
+            return -1;
+        }
+    }
+    else if (strcmp(type_str, "REQUEST_VOTE") == 0) {
+        msg->type = MSG_REQUEST_VOTE;
+
+        msg->data.request_vote.term = (uint64_t)int_from_json(cJSON_GetObjectItem(root, "term"));
+        msg->data.request_vote.candidate_id =
+            sym_from_json(cJSON_GetObjectItem(root, "candidate_id"));
+        msg->data.request_vote.last_log_index =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "last_log_index"));
+        msg->data.request_vote.last_log_term =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "last_log_term"));
+    }
+    else if (strcmp(type_str, "VOTE_RESPONSE") == 0) {
+        msg->type = MSG_VOTE_RESPONSE;
+
+        msg->data.vote_response.term = (uint64_t)int_from_json(cJSON_GetObjectItem(root, "term"));
+        msg->data.vote_response.voter_id = sym_from_json(cJSON_GetObjectItem(root, "voter_id"));
+        msg->data.vote_response.vote_granted =
+            cJSON_IsTrue(cJSON_GetObjectItem(root, "vote_granted"));
+    }
+    else if (strcmp(type_str, "APPEND_ENTRIES") == 0) {
+        msg->type = MSG_APPEND_ENTRIES;
+
+        msg->data.append_entries.term =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "term"));
+        msg->data.append_entries.leader_id =
+            sym_from_json(cJSON_GetObjectItem(root, "leader_id"));
+        msg->data.append_entries.prev_log_index =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "prev_log_index"));
+        msg->data.append_entries.prev_log_term =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "prev_log_term"));
+        msg->data.append_entries.leader_commit =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "leader_commit"));
+        msg->data.append_entries.entries = payload->log;
+        msg->data.append_entries.count =
+            log_entries_from_json(cJSON_GetObjectItem(root, "entries"), payload->log);
+        if (msg->data.append_entries.count < 0) {
+            cJSON_Delete(root);
+            return -1;
+        }
+    }
+    else if (strcmp(type_str, "APPEND_ENTRIES_RESPONSE") == 0) {
+        msg->type = MSG_APPEND_ENTRIES_RESPONSE;
+
+        msg->data.append_response.term =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "term"));
+        msg->data.append_response.follower_id =
+            sym_from_json(cJSON_GetObjectItem(root, "follower_id"));
+        msg->data.append_response.success = cJSON_IsTrue(cJSON_GetObjectItem(root, "success"));
+        msg->data.append_response.match_index =
+            (uint64_t)int_from_json(cJSON_GetObjectItem(root, "match_index"));
+    }
+    else if (strcmp(type_str, "FORWARD") == 0) {
+        msg->type = MSG_FORWARD;
+
+        msg->data.forward.from = sym_from_json(cJSON_GetObjectItem(root, "from"));
+        msg->data.forward.entries = payload->log;
+        msg->data.forward.count =
+            log_entries_from_json(cJSON_GetObjectItem(root, "entries"), payload->log);
+        if (msg->data.forward.count < 0) {
+            cJSON_Delete(root);
+            return -1;
+        }
+    }
     else {
         msg->type = MSG_UNKNOWN;
     }
@@ -304,3 +1167,10 @@ int message_from_json(const char* json, roj_message_t* msg) {
     cJSON_Delete(root);
     return 0;
 }
+
+int message_from_json(const char* json, roj_message_t* msg) {
+    json_arena_begin();
+    int rc = decode_cjson(json, msg);
+    json_arena_end();
+    return rc;
+}
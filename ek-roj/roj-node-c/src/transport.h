@@ -8,30 +8,108 @@
 #define ROJ_TRANSPORT_H
 
 #include "types.h"
+#include "symtab.h"
+#include "json_encode.h"
 
-/* Initialize transport on specified port */
-int transport_init(int port);
+#define ROJ_RECV_BATCH      32
+#define ROJ_RECV_SLOT_SIZE  ROJ_MSG_MAX_SIZE    /* any datagram the protocol allows */
+#define ROJ_MAX_SHARDS      16
 
-/* Shutdown transport */
-void transport_shutdown(void);
+/* Datagram I/O counters; datagrams/calls is the batching factor */
+typedef struct {
+    uint64_t recv_calls;
+    uint64_t recv_datagrams;
+    uint64_t recv_max_batch;
+    uint64_t recv_truncated;
+    uint64_t recv_dropped;      /* kernel receive queue overflows (Linux) */
+    uint64_t decode_errors;
+    uint64_t send_calls;
+    uint64_t send_datagrams;
+    uint64_t send_max_batch;
+} roj_transport_stats_t;
 
-/* Get socket file descriptor for select() */
-int transport_get_socket(void);
+/* Sockets, receive buffers and counters of one node (opaque) */
+typedef struct roj_transport roj_transport_t;
+
+/* Per-thread batch receive buffers (opaque) */
+typedef struct roj_recv_ctx roj_recv_ctx_t;
+
+/* Open a transport on specified port, NULL on error. shards > 1 binds that
+ * many sockets to the port with SO_REUSEPORT (Linux); the kernel steers each
+ * peer to one of them, so per-peer ordering is kept within a shard. */
+roj_transport_t* transport_new(int port, int shards);
+
+/* Close the sockets and free the transport */
+void transport_free(roj_transport_t* tp);
+
+/* Use templates for the JSON messages this transport sends (NULL = none) */
+void transport_set_templates(roj_transport_t* tp, const roj_json_templates_t* templates);
+
+/* Get socket file descriptor for select() (shard 0, also used to send) */
+int transport_get_socket(const roj_transport_t* tp);
+
+/* Number of receive shards and the socket of one of them */
+int transport_shard_count(const roj_transport_t* tp);
+int transport_get_shard_socket(const roj_transport_t* tp, int shard);
+
+/* Let the peer with discovery index `index` add symbols from now on:
+ * datagrams from addresses never admitted are decoded with
+ * ROJ_INTERN_KNOWN (see symtab.h). Event loop thread. */
+void transport_admit(roj_transport_t* tp, int index, const struct sockaddr_in* addr);
 
 /* Receive a message (non-blocking if used with select) */
-int transport_recv(roj_message_t* msg, struct sockaddr_in* from);
+int transport_recv(roj_transport_t* tp, roj_message_t* msg, struct sockaddr_in* from);
+
+/* Drain up to max queued datagrams with one syscall (recvmmsg on Linux).
+ * Returns the number of decoded messages, 0 if the queue was empty, or -1 */
+int transport_recv_batch(roj_transport_t* tp, roj_message_t* msgs, struct sockaddr_in* froms,
+                         int max);
+
+/* Same, reading one shard into caller-owned buffers so several threads can
+ * receive at once. Create and free contexts before/after their threads
+ * run; their counters are included in transport_get_stats. */
+roj_recv_ctx_t* transport_recv_ctx_new(roj_transport_t* tp, int shard);
+void transport_recv_ctx_free(roj_transport_t* tp, roj_recv_ctx_t* ctx);
+int transport_recv_batch_ctx(roj_transport_t* tp, roj_recv_ctx_t* ctx,
+                             roj_message_t* msgs, struct sockaddr_in* froms, int max);
 
 /* Send a message to specific address */
-int transport_send(const roj_message_t* msg, const struct sockaddr_in* to);
+int transport_send(roj_transport_t* tp, const roj_message_t* msg, const struct sockaddr_in* to);
+
+/* Send a message to specific address using the given encoding */
+int transport_send_wire(roj_transport_t* tp, const roj_message_t* msg, const struct sockaddr_in* to,
+                        roj_wire_t wire);
 
 /* Broadcast a message to multiple addresses */
-int transport_broadcast(const roj_message_t* msg,
-                       const struct sockaddr_in* addrs, int addr_count);
+int transport_broadcast(roj_transport_t* tp, const roj_message_t* msg,
+                        const struct sockaddr_in* addrs, int addr_count);
+
+/* Broadcast with a per-address encoding (wires may be NULL for all-JSON).
+ * Each encoding is produced once and fanned out with sendmmsg on Linux. */
+int transport_broadcast_wire(roj_transport_t* tp, const roj_message_t* msg,
+                             const struct sockaddr_in* addrs,
+                             const roj_wire_t* wires, int addr_count);
+
+/* Snapshot / print datagram I/O counters */
+void transport_get_stats(const roj_transport_t* tp, roj_transport_stats_t* stats);
+void transport_get_shard_stats(const roj_transport_t* tp, int shard,
+                               roj_transport_stats_t* stats);
+void transport_print_stats(const roj_transport_t* tp);
+
+/* Serialize message with the given encoding (JSON templates may be NULL) */
+int message_to_wire(const roj_json_templates_t* templates, const roj_message_t* msg,
+                    roj_wire_t wire, char* buf, size_t buf_size);
+
+/* Parse message, detecting the encoding from the first byte, and resolve
+ * its strings as intern allows */
+int message_from_wire(const uint8_t* buf, size_t len, roj_message_t* msg, roj_intern_t intern);
 
-/* Serialize message to JSON */
+/* Serialize message to JSON (cJSON tree in the JSON arena; the send path uses
+ * json_encode.h) */
 int message_to_json(const roj_message_t* msg, char* buf, size_t buf_size);
 
-/* Parse message from JSON */
+/* Parse message from JSON (cJSON tree in the JSON arena; the receive path uses
+ * json_decode.h) */
 int message_from_json(const char* json, roj_message_t* msg);
 
 #endif /* ROJ_TRANSPORT_H */
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef _WIN32
@@ -26,10 +27,53 @@
 #define ROJ_VERSION         "0.1.0"
 #define ROJ_UDP_PORT        9990
 #define ROJ_MAX_PEERS       32
-#define ROJ_MAX_VOTERS      16
-#define ROJ_PROPOSAL_ID_LEN 9
+#define ROJ_MAX_VOTERS      16     /* voters listed in a COMMIT */
+#define ROJ_MAX_VOTER_SLOTS 256    /* distinct voters tracked per node */
+#define ROJ_VOTER_WORDS     (ROJ_MAX_VOTER_SLOTS / 64)
+#define ROJ_PROPOSAL_ID_LEN 24
 #define ROJ_MSG_MAX_SIZE    65536
 #define ROJ_VOTE_THRESHOLD  0.67
+#define ROJ_ANNOUNCE_INTERVAL_MS 1000
+#define ROJ_PROPOSAL_TIMEOUT_MS  10000  /* received proposal awaiting COMMIT */
+#define ROJ_VOTE_TIMEOUT_MS      5000   /* own proposal collecting votes */
+#define ROJ_PEER_TIMEOUT_MS      5000   /* peer silent for 5 announce rounds */
+#define ROJ_MAX_BATCH       32     /* key updates in one batched proposal */
+#define ROJ_BATCH_DELAY_MS  5      /* default wait for a batch to fill */
+#define ROJ_MAX_AGG         32     /* proposals in one VOTE_AGG / COMMIT_AGG */
+
+/* Capability bits (advertised in ANNOUNCE "capabilities") */
+#define ROJ_CAP_CONSENSUS   (1u << 0)
+#define ROJ_CAP_WIRE_BIN    (1u << 1)
+#define ROJ_CAP_BATCH       (1u << 2)   /* PROPOSE_BATCH / COMMIT_BATCH */
+#define ROJ_CAP_AGG         (1u << 3)   /* VOTE_AGG / COMMIT_AGG */
+#define ROJ_CAP_LOG         (1u << 4)   /* leader mode: elections and log replication */
+
+/* Wire encodings */
+typedef enum {
+    WIRE_JSON = 0,
+    WIRE_BINARY
+} roj_wire_t;
+
+static inline const char* cap_to_str(uint32_t cap) {
+    switch (cap) {
+        case ROJ_CAP_CONSENSUS: return "consensus";
+        case ROJ_CAP_WIRE_BIN:  return "wire-bin/1";
+        case ROJ_CAP_BATCH:     return "batch/1";
+        case ROJ_CAP_AGG:       return "agg/1";
+        case ROJ_CAP_LOG:       return "log/1";
+        default:                return NULL;
+    }
+}
+
+static inline uint32_t str_to_cap(const char* s) {
+    if (!s) return 0;
+    if (strcmp(s, "consensus") == 0) return ROJ_CAP_CONSENSUS;
+    if (strcmp(s, "wire-bin/1") == 0) return ROJ_CAP_WIRE_BIN;
+    if (strcmp(s, "batch/1") == 0) return ROJ_CAP_BATCH;
+    if (strcmp(s, "agg/1") == 0) return ROJ_CAP_AGG;
+    if (strcmp(s, "log/1") == 0) return ROJ_CAP_LOG;
+    return 0;
+}
 
 /* Language enum */
 typedef enum {
@@ -75,17 +119,107 @@ typedef enum {
     MSG_PROPOSE,
     MSG_VOTE,
     MSG_COMMIT,
+    MSG_PROPOSE_BATCH,
+    MSG_COMMIT_BATCH,
+    MSG_VOTE_AGG,
+    MSG_COMMIT_AGG,
+    MSG_REQUEST_VOTE,
+    MSG_VOTE_RESPONSE,
+    MSG_APPEND_ENTRIES,
+    MSG_APPEND_ENTRIES_RESPONSE,
+    MSG_FORWARD,
     MSG_UNKNOWN
 } roj_msg_type_t;
 
+static inline const char* msg_type_to_str(roj_msg_type_t type) {
+    switch (type) {
+        case MSG_ANNOUNCE:                return "ANNOUNCE";
+        case MSG_PROPOSE:                 return "PROPOSE";
+        case MSG_VOTE:                    return "VOTE";
+        case MSG_COMMIT:                  return "COMMIT";
+        case MSG_PROPOSE_BATCH:           return "PROPOSE_BATCH";
+        case MSG_COMMIT_BATCH:            return "COMMIT_BATCH";
+        case MSG_VOTE_AGG:                return "VOTE_AGG";
+        case MSG_COMMIT_AGG:              return "COMMIT_AGG";
+        case MSG_REQUEST_VOTE:            return "REQUEST_VOTE";
+        case MSG_VOTE_RESPONSE:           return "VOTE_RESPONSE";
+        case MSG_APPEND_ENTRIES:          return "APPEND_ENTRIES";
+        case MSG_APPEND_ENTRIES_RESPONSE: return "APPEND_ENTRIES_RESPONSE";
+        case MSG_FORWARD:                 return "FORWARD";
+        default:                          return "UNKNOWN";
+    }
+}
+
+/* Interned string handle (see symtab.h), 0 = "" */
+typedef uint32_t roj_sym_t;
+
+/* One key update of a batched proposal */
+typedef struct {
+    roj_sym_t key;
+    int64_t value;
+} roj_kv_t;
+
+/* One commit of a COMMIT_AGG; voter_bits index the message's voter list */
+typedef struct {
+    uint64_t id;
+    roj_sym_t key;
+    uint32_t voter_bits;
+    int64_t value;
+} roj_commit_item_t;
+
+/* What a log entry does when applied. Every node settles CAS and READ
+ * against its state at the entry's index, so all of them agree. */
+typedef enum {
+    ROJ_OP_SET = 0,         /* key = value */
+    ROJ_OP_CAS,             /* key = value if key holds expect */
+    ROJ_OP_READ             /* changes nothing: puts a read in the log's order */
+} roj_op_t;
+
+static inline const char* op_to_str(roj_op_t op) {
+    switch (op) {
+        case ROJ_OP_CAS:  return "cas";
+        case ROJ_OP_READ: return "read";
+        default:          return "set";
+    }
+}
+
+/* -1 for an unknown name */
+static inline int str_to_op(const char* s) {
+    if (strcmp(s, "set") == 0) return ROJ_OP_SET;
+    if (strcmp(s, "cas") == 0) return ROJ_OP_CAS;
+    if (strcmp(s, "read") == 0) return ROJ_OP_READ;
+    return -1;
+}
+
+/* How an applied entry went */
+typedef enum {
+    ROJ_OP_OK = 0,
+    ROJ_OP_NO_KEY,          /* CAS or READ of a key that was never set */
+    ROJ_OP_DIFFERS          /* CAS found another value */
+} roj_op_result_t;
+
+/* One replicated log entry; its index is implied by its position in an
+ * APPEND_ENTRIES. key 0 ("") is the no-op a new leader appends. id is the
+ * origin's request ID (proposal_id_make), 0 for the no-op. */
+typedef struct {
+    uint64_t term;
+    uint64_t id;
+    roj_sym_t key;
+    uint8_t op;             /* roj_op_t */
+    int64_t value;
+    int64_t expect;         /* ROJ_OP_CAS only */
+} roj_log_entry_t;
+
 /* Peer information */
 typedef struct {
-    char node_id[ROJ_NODE_ID_MAX];
+    roj_sym_t node_id;
     roj_lang_t lang;
     struct sockaddr_in addr;
     char version[16];
+    uint32_t caps;
     time_t last_seen;
     bool active;
+    uint64_t liveness_timer;    /* timer wheel handle */
 } roj_peer_t;
 
 /* Peer list */
@@ -94,21 +228,17 @@ typedef struct {
     int count;
 } roj_peer_list_t;
 
-/* Vote record */
-typedef struct {
-    char node_id[ROJ_NODE_ID_MAX];
-    roj_vote_t vote;
-} roj_vote_record_t;
-
-/* Proposal state */
+/* Proposal metadata (vote counters and bitsets live in proposal_table.h) */
 typedef struct {
     char proposal_id[ROJ_PROPOSAL_ID_LEN];
-    char key[ROJ_KEY_MAX];
+    roj_sym_t key;
     int64_t value;
     int64_t timestamp;
-    roj_vote_record_t votes[ROJ_MAX_VOTERS];
-    int vote_count;
-    bool active;
+    roj_kv_t* batch;            /* batched updates (heap), NULL for key/value */
+    int batch_count;
+    uint64_t deadline_timer;    /* timer wheel handle */
+    uint64_t created_ns;        /* own proposals with metrics on, else 0 */
+    bool own;                   /* opened by this node */
 } roj_proposal_t;
 
 /* State entry */
@@ -117,22 +247,24 @@ typedef struct {
     int64_t value;
 } roj_state_entry_t;
 
-/* Message structures */
+/* Message structures: node IDs and keys are interned, the codecs convert.
+ * Batch, aggregate and log arrays are out of line (payload.h). */
 typedef struct {
     roj_msg_type_t type;
     union {
         /* ANNOUNCE */
         struct {
-            char node_id[ROJ_NODE_ID_MAX];
+            roj_sym_t node_id;
             roj_lang_t lang;
+            uint32_t caps;
             char version[16];
         } announce;
 
         /* PROPOSE */
         struct {
             char proposal_id[ROJ_PROPOSAL_ID_LEN];
-            char from[ROJ_NODE_ID_MAX];
-            char key[ROJ_KEY_MAX];
+            roj_sym_t from;
+            roj_sym_t key;
             int64_t value;
             int64_t timestamp;
         } propose;
@@ -140,18 +272,93 @@ typedef struct {
         /* VOTE */
         struct {
             char proposal_id[ROJ_PROPOSAL_ID_LEN];
-            char from[ROJ_NODE_ID_MAX];
+            roj_sym_t from;
             roj_vote_t vote;
         } vote;
 
         /* COMMIT */
         struct {
             char proposal_id[ROJ_PROPOSAL_ID_LEN];
-            char key[ROJ_KEY_MAX];
+            roj_sym_t key;
             int64_t value;
-            char voters[ROJ_MAX_VOTERS][ROJ_NODE_ID_MAX];
+            roj_sym_t voters[ROJ_MAX_VOTERS];
             int voter_count;
         } commit;
+
+        /* PROPOSE_BATCH: entries are applied together or not at all */
+        struct {
+            char proposal_id[ROJ_PROPOSAL_ID_LEN];
+            roj_sym_t from;
+            int64_t timestamp;
+            int count;
+            roj_kv_t* entries;      /* out of line, see payload.h */
+        } propose_batch;
+
+        /* COMMIT_BATCH */
+        struct {
+            char proposal_id[ROJ_PROPOSAL_ID_LEN];
+            int count;
+            roj_kv_t* entries;
+            roj_sym_t voters[ROJ_MAX_VOTERS];
+            int voter_count;
+        } commit_batch;
+
+        /* VOTE_AGG: one voter's votes on several proposals */
+        struct {
+            roj_sym_t from;
+            int count;
+            uint32_t accept_bits;   /* bit i set: ids[i] is accepted */
+            uint64_t* ids;
+        } vote_agg;
+
+        /* COMMIT_AGG: several single-key commits sharing one voter list */
+        struct {
+            int count;
+            int voter_count;
+            roj_sym_t voters[ROJ_MAX_VOTERS];
+            roj_commit_item_t* items;
+        } commit_agg;
+
+        /* REQUEST_VOTE: a candidate asks for a vote in its term */
+        struct {
+            uint64_t term;
+            roj_sym_t candidate_id;
+            uint64_t last_log_index;
+            uint64_t last_log_term;
+        } request_vote;
+
+        /* VOTE_RESPONSE */
+        struct {
+            uint64_t term;
+            roj_sym_t voter_id;
+            bool vote_granted;
+        } vote_response;
+
+        /* APPEND_ENTRIES: entries follow prev_log_index, none for a heartbeat */
+        struct {
+            uint64_t term;
+            roj_sym_t leader_id;
+            uint64_t prev_log_index;
+            uint64_t prev_log_term;
+            uint64_t leader_commit;
+            int count;
+            roj_log_entry_t* entries;
+        } append_entries;
+
+        /* APPEND_ENTRIES_RESPONSE */
+        struct {
+            uint64_t term;
+            roj_sym_t follower_id;
+            bool success;
+            uint64_t match_index;   /* last index known to match the leader */
+        } append_response;
+
+        /* FORWARD: entries a follower hands to the leader, term unset */
+        struct {
+            roj_sym_t from;
+            int count;
+            roj_log_entry_t* entries;
+        } forward;
     } data;
 } roj_message_t;
 
@@ -0,0 +1,406 @@
+/*
+ * ROJ WAL - write-ahead log for committed state implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#define open(path, flags, mode) _open(path, (flags) | _O_BINARY, mode)
+#define read _read
+#define write _write
+#define close _close
+#define lseek _lseeki64
+#define ftruncate _chsize_s
+#define mkdir(path, mode) _mkdir(path)
+#define access _access
+#define F_OK 0
+#define fdatasync _commit
+typedef int ssize_t;
+#else
+#include <unistd.h>
+#endif
+#include "wal.h"
+#include "crc32c.h"
+#include "logger.h"
+
+#define WAL_MAGIC       "ROJWAL1\n"
+#define WAL_MAGIC_LEN   8
+#define WAL_HEADER      8                               /* crc + length */
+#define WAL_REC_COMMIT  1
+#define WAL_MIN_PAYLOAD (1 + 8)                         /* type + value */
+#define WAL_MAX_PAYLOAD (WAL_MIN_PAYLOAD + ROJ_KEY_MAX - 1)
+
+#if !defined(__linux__) && !defined(_WIN32)
+#define fdatasync fsync     /* no fdatasync on macOS/BSD */
+#endif
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static void put_u64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static int write_all(int fd, const uint8_t* p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Hand the buffered group to the kernel (no fsync) */
+static int flush_buffer(roj_wal_t* wal) {
+    if (wal->buf_len == 0) return 0;
+    if (write_all(wal->fd, wal->buf, wal->buf_len) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: write to %s failed: %s", wal->path, strerror(errno));
+        return -1;
+    }
+    wal->bytes += wal->buf_len;
+    wal->buf_len = 0;
+    return 0;
+}
+
+/* Make renames and new files in the data directory durable */
+static void sync_dir(roj_wal_t* wal) {
+#ifndef _WIN32
+    int fd = open(wal->dir, O_RDONLY, 0);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+/* Apply every intact record after the magic; returns the file offset just
+ * past the last one */
+static long long replay(roj_wal_t* wal, int fd, roj_wal_replay_fn fn, void* ctx,
+                        uint64_t* count) {
+    long long base = WAL_MAGIC_LEN;     /* file offset of wal->buf[0] */
+    size_t have = 0;
+    bool corrupt = false;
+
+    for (;;) {
+        ssize_t n = read(fd, wal->buf + have, sizeof(wal->buf) - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        have += (size_t)n;
+
+        size_t pos = 0;
+        while (!corrupt && have - pos >= WAL_HEADER) {
+            const uint8_t* rec = wal->buf + pos;
+            uint32_t len = get_u32(rec + 4);
+            if (len < WAL_MIN_PAYLOAD || len > WAL_MAX_PAYLOAD) {
+                corrupt = true;
+                break;
+            }
+            if (have - pos < WAL_HEADER + len) {
+                break;  /* record continues past the buffer */
+            }
+            if (crc32c(rec + 4, 4 + len) != get_u32(rec) ||
+                rec[WAL_HEADER] != WAL_REC_COMMIT) {
+                corrupt = true;
+                break;
+            }
+
+            char key[ROJ_KEY_MAX];
+            size_t key_len = len - WAL_MIN_PAYLOAD;
+            memcpy(key, rec + WAL_HEADER + WAL_MIN_PAYLOAD, key_len);
+            key[key_len] = '\0';
+            fn(key, (int64_t)get_u64(rec + WAL_HEADER + 1), ctx);
+
+            pos += WAL_HEADER + len;
+            (*count)++;
+        }
+
+        base += (long long)pos;
+        memmove(wal->buf, wal->buf + pos, have - pos);
+        have -= pos;
+
+        if (corrupt || n == 0) {
+            break;  /* leftovers are a torn or damaged tail */
+        }
+    }
+    return base;
+}
+
+/* Open path and check its magic: 1 if the file is empty, 0 if it is a
+ * log (positioned after the magic), -1 on error */
+static int open_log(const char* path, int flags, int* fd) {
+    char magic[WAL_MAGIC_LEN];
+
+    *fd = open(path, flags, 0644);
+    if (*fd < 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    ssize_t n = read(*fd, magic, sizeof(magic));
+    if (n == 0) {
+        return 1;
+    }
+    if (n != WAL_MAGIC_LEN || memcmp(magic, WAL_MAGIC, WAL_MAGIC_LEN) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: %s is not a ROJ write-ahead log", path);
+        close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Start an empty wal.log */
+static int create_log(roj_wal_t* wal) {
+    wal->fd = open(wal->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (wal->fd < 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot create %s: %s", wal->path, strerror(errno));
+        return -1;
+    }
+    memcpy(wal->buf, WAL_MAGIC, WAL_MAGIC_LEN);
+    wal->buf_len = WAL_MAGIC_LEN;
+    if (flush_buffer(wal) != 0 || fdatasync(wal->fd) != 0) {
+        close(wal->fd);
+        wal->fd = -1;
+        wal->buf_len = 0;
+        unlink(wal->path);  /* no half-written magic left to refuse on open */
+        return -1;
+    }
+    sync_dir(wal);
+    wal->log_records = 0;
+    return 0;
+}
+
+/* Replay the log left by an unconfirmed snapshot (read-only: it is dropped
+ * whole once a snapshot covers it) */
+static int replay_prev(roj_wal_t* wal, roj_wal_replay_fn fn, void* ctx) {
+    uint64_t count = 0;
+    int fd;
+
+    if (access(wal->prev_path, F_OK) != 0) {
+        return 0;
+    }
+    int rc = open_log(wal->prev_path, O_RDONLY, &fd);
+    if (rc < 0) return -1;
+    if (rc == 0 && replay(wal, fd, fn, ctx, &count) < 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot read %s: %s", wal->prev_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    ROJ_LOG(ROJ_LOG_INFO, "WAL: replayed %llu records from %s", (unsigned long long)count,
+            wal->prev_path);
+    return 0;
+}
+
+void wal_init(roj_wal_t* wal) {
+    memset(wal, 0, sizeof(*wal));
+    wal->fd = -1;
+    wal->sync_ms = ROJ_WAL_SYNC_MS;
+}
+
+int wal_open(roj_wal_t* wal, const char* dir, int sync_ms, roj_wal_replay_fn fn, void* ctx) {
+    uint64_t count = 0;
+
+    wal->sync_ms = sync_ms < 0 ? 0 : sync_ms;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot create %s: %s", dir, strerror(errno));
+        return -1;
+    }
+    snprintf(wal->dir, sizeof(wal->dir), "%s", dir);
+    snprintf(wal->path, sizeof(wal->path), "%s/%s", dir, ROJ_WAL_FILE);
+    snprintf(wal->prev_path, sizeof(wal->prev_path), "%s/%s", dir, ROJ_WAL_PREV_FILE);
+
+    /* Oldest records first: the rotated log, then the live one */
+    if (replay_prev(wal, fn, ctx) != 0) {
+        return -1;
+    }
+
+    int rc = open_log(wal->path, O_RDWR | O_CREAT, &wal->fd);
+    if (rc < 0) {
+        return -1;
+    }
+    if (rc > 0) {
+        close(wal->fd);
+        if (create_log(wal) != 0) return -1;
+        ROJ_LOG(ROJ_LOG_INFO, "WAL: created %s", wal->path);
+        return 0;
+    }
+
+    long long good = replay(wal, wal->fd, fn, ctx, &count);
+    long long end = (long long)lseek(wal->fd, 0, SEEK_END);
+    if (good < 0 || end < 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot read %s: %s", wal->path, strerror(errno));
+        wal_close(wal);
+        return -1;
+    }
+    if (good < end) {
+        ROJ_LOG(ROJ_LOG_WARN, "WAL: dropping %lld bytes of torn or corrupt tail", end - good);
+        if (ftruncate(wal->fd, good) != 0 || fdatasync(wal->fd) != 0) {
+            ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot truncate %s: %s", wal->path, strerror(errno));
+            wal_close(wal);
+            return -1;
+        }
+    }
+    lseek(wal->fd, good, SEEK_SET);
+    wal->log_records = count;
+
+    ROJ_LOG(ROJ_LOG_INFO, "WAL: replayed %llu records from %s", (unsigned long long)count,
+            wal->path);
+    return 0;
+}
+
+void wal_close(roj_wal_t* wal) {
+    if (wal->fd < 0) return;
+    wal_sync(wal);
+    close(wal->fd);
+    wal->fd = -1;
+    wal->buf_len = 0;
+    wal->pending = 0;
+}
+
+int wal_rotate(roj_wal_t* wal) {
+    if (wal->fd < 0 || wal_sync(wal) != 0) {
+        return -1;
+    }
+    wal->log_records = 0;
+
+    /* An earlier snapshot never landed: its records stay in wal.prev and
+     * wal.log keeps growing until a snapshot covers both */
+    if (access(wal->prev_path, F_OK) == 0) {
+        return 0;
+    }
+
+    if (rename(wal->path, wal->prev_path) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot rotate %s: %s", wal->path, strerror(errno));
+        return -1;
+    }
+
+    /* The old descriptor stays valid across the rename: keep it until the
+     * new log exists, and fall back to it if that fails */
+    int old_fd = wal->fd;
+    if (create_log(wal) != 0) {
+        wal->fd = old_fd;
+        if (rename(wal->prev_path, wal->path) != 0) {
+            /* Appends still reach the old file, now wal.prev, which is
+             * replayed first and kept until a snapshot lands */
+            ROJ_LOG(ROJ_LOG_ERROR, "WAL: cannot restore %s: %s", wal->path,
+                    strerror(errno));
+        }
+        sync_dir(wal);
+        return -1;
+    }
+    close(old_fd);
+    return 0;
+}
+
+void wal_drop_rotated(roj_wal_t* wal) {
+    if (wal->fd >= 0 && unlink(wal->prev_path) == 0) {
+        sync_dir(wal);
+    }
+}
+
+uint64_t wal_records_since_rotate(const roj_wal_t* wal) {
+    return wal->log_records;
+}
+
+bool wal_is_open(const roj_wal_t* wal) {
+    return wal->fd >= 0;
+}
+
+/* After a failed write or fdatasync the kernel may have dropped the pages
+ * and the next fdatasync may still succeed, so nothing written since can
+ * be trusted: the log refuses everything from then on */
+static int fail(roj_wal_t* wal) {
+    if (!wal->failed) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: %s is no longer durable, refusing further commits",
+                wal->path);
+        wal->failed = true;
+    }
+    return -1;
+}
+
+int wal_append_commit(roj_wal_t* wal, const char* key, int64_t value) {
+    if (wal->fd < 0) return 0;
+    if (wal->failed) return -1;
+
+    size_t key_len = strlen(key);
+    if (key_len > ROJ_KEY_MAX - 1) key_len = ROJ_KEY_MAX - 1;
+    uint32_t len = (uint32_t)(WAL_MIN_PAYLOAD + key_len);
+
+    if (wal->buf_len + WAL_HEADER + len > sizeof(wal->buf) && flush_buffer(wal) != 0) {
+        return fail(wal);
+    }
+
+    uint8_t* rec = wal->buf + wal->buf_len;
+    put_u32(rec + 4, len);
+    rec[WAL_HEADER] = WAL_REC_COMMIT;
+    put_u64(rec + WAL_HEADER + 1, (uint64_t)value);
+    memcpy(rec + WAL_HEADER + WAL_MIN_PAYLOAD, key, key_len);
+    put_u32(rec, crc32c(rec + 4, 4 + len));
+    wal->buf_len += WAL_HEADER + len;
+    wal->pending++;
+    wal->records++;
+    wal->log_records++;
+
+    if (wal->sync_ms == 0 || wal->pending >= ROJ_WAL_GROUP_MAX) {
+        return wal_sync(wal);
+    }
+    return 0;
+}
+
+int wal_sync(roj_wal_t* wal) {
+    if (wal->fd < 0) return 0;
+    if (wal->failed) return -1;
+    if (wal->pending == 0) return 0;
+
+    if (flush_buffer(wal) != 0) return fail(wal);
+    if (fdatasync(wal->fd) != 0) {
+        ROJ_LOG(ROJ_LOG_ERROR, "WAL: fdatasync on %s failed: %s", wal->path, strerror(errno));
+        return fail(wal);
+    }
+    if (wal->pending > wal->max_group) wal->max_group = wal->pending;
+    wal->pending = 0;
+    wal->syncs++;
+    return 0;
+}
+
+int wal_pending(const roj_wal_t* wal) {
+    return wal->pending;
+}
+
+bool wal_failed(const roj_wal_t* wal) {
+    return wal->failed;
+}
+
+void wal_print_stats(const roj_wal_t* wal) {
+    printf("  wal: %llu records in %llu syncs (largest group %d), %llu bytes\n",
+           (unsigned long long)wal->records, (unsigned long long)wal->syncs, wal->max_group,
+           (unsigned long long)wal->bytes);
+}
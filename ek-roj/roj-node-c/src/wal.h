@@ -0,0 +1,111 @@
+/*
+ * ROJ WAL - write-ahead log for committed state
+ *
+ * Every committed key/value is appended to <dir>/wal.log as a checksummed
+ * binary record:
+ *
+ *   u32 crc32c | u32 length | u8 type | i64 value | key bytes
+ *
+ * (little-endian; the CRC covers everything after itself). Records collect
+ * in memory and a whole group is written and fdatasync'ed together, either
+ * when the group fills or when the caller calls wal_sync() at the end of its
+ * sync_ms window, so a burst of commits costs one fsync; a window of 0
+ * syncs every record before wal_append_commit returns.
+ *
+ * A commit is applied to local state once it is logged, but the node holds
+ * everything that reports it (the COMMIT broadcast, the outcome and applied
+ * callbacks, and so Maelstrom's write_ok) until wal_pending() drops to 0,
+ * i.e. until its group's fdatasync has returned. A crash within the window
+ * loses only commits nobody was told about. A write or fdatasync that
+ * fails leaves the log failed: every later append and sync returns -1, and
+ * nothing waiting for them is reported.
+ *
+ * On open the log is replayed from the start; replay stops at the first
+ * torn or corrupt record and the tail is truncated so new records follow
+ * the last good one.
+ *
+ * Snapshots bound the log: wal_rotate() renames it to wal.prev when a
+ * snapshot starts and wal_drop_rotated() deletes that file once the
+ * snapshot is durable. Until then wal.prev is replayed before wal.log.
+ * If the new wal.log cannot be created, wal_rotate() moves the old one back
+ * and keeps appending to it, and reports the failure.
+ * Records set absolute values, so replaying ones a snapshot already covers
+ * is harmless.
+ *
+ * Event loop thread only.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_WAL_H
+#define ROJ_WAL_H
+
+#include <stddef.h>
+#include "types.h"
+
+#define ROJ_WAL_FILE        "wal.log"
+#define ROJ_WAL_PREV_FILE   "wal.prev"  /* rotated log awaiting a snapshot */
+#define ROJ_WAL_SYNC_MS     5           /* default group commit window */
+#define ROJ_WAL_GROUP_MAX   1024        /* records per fsync before the window closes */
+#define ROJ_WAL_BUF_SIZE    (64 * 1024)
+
+typedef void (*roj_wal_replay_fn)(const char* key, int64_t value, void* ctx);
+
+typedef struct {
+    int fd;                 /* -1 while closed */
+    int sync_ms;
+    char dir[512];
+    char path[600];
+    char prev_path[600];
+    uint64_t log_records;   /* in wal.log since the last rotation */
+
+    /* Group commit buffer: records wait here until the next wal_sync */
+    uint8_t buf[ROJ_WAL_BUF_SIZE];
+    size_t buf_len;
+    int pending;
+    bool failed;            /* a write or fdatasync failed; see wal_failed */
+
+    uint64_t records;
+    uint64_t syncs;
+    uint64_t bytes;
+    int max_group;
+} roj_wal_t;
+
+/* Set up a closed log (appends are ignored until wal_open) */
+void wal_init(roj_wal_t* wal);
+
+/* Open (creating dir if needed) and replay the log into fn, then append */
+int wal_open(roj_wal_t* wal, const char* dir, int sync_ms, roj_wal_replay_fn fn, void* ctx);
+
+/* Sync anything pending and close the log */
+void wal_close(roj_wal_t* wal);
+
+/* True while a log is open */
+bool wal_is_open(const roj_wal_t* wal);
+
+/* Log one commit; syncs at once when the group is full or the window is 0.
+ * -1 once the log has failed: the commit must not be applied. */
+int wal_append_commit(roj_wal_t* wal, const char* key, int64_t value);
+
+/* Write and fdatasync every pending record; -1 once the log has failed */
+int wal_sync(roj_wal_t* wal);
+
+/* Sync and move wal.log aside for a snapshot about to be taken */
+int wal_rotate(roj_wal_t* wal);
+
+/* Delete the rotated log once the snapshot covering it is durable */
+void wal_drop_rotated(roj_wal_t* wal);
+
+/* Records in wal.log (replayed or appended) since the last rotation */
+uint64_t wal_records_since_rotate(const roj_wal_t* wal);
+
+/* Records appended but not yet synced */
+int wal_pending(const roj_wal_t* wal);
+
+/* True once a write or fdatasync failed; pending records never sync then */
+bool wal_failed(const roj_wal_t* wal);
+
+/* Print records, syncs and bytes written */
+void wal_print_stats(const roj_wal_t* wal);
+
+#endif /* ROJ_WAL_H */
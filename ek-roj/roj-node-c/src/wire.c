@@ -0,0 +1,481 @@
+/*
+ * ROJ Wire - compact binary message encoding implementation
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <string.h>
+#include "wire.h"
+#include "payload.h"
+#include "symtab.h"
+
+typedef struct {
+    uint8_t* buf;
+    size_t size;
+    size_t pos;
+    bool overflow;
+} wire_writer_t;
+
+typedef struct {
+    const uint8_t* buf;
+    size_t len;
+    size_t pos;
+    bool error;
+    roj_intern_t intern;
+} wire_reader_t;
+
+/* Writer */
+
+static void put_u8(wire_writer_t* w, uint8_t v) {
+    if (w->pos >= w->size) {
+        w->overflow = true;
+        return;
+    }
+    w->buf[w->pos++] = v;
+}
+
+static void put_uvarint(wire_writer_t* w, uint64_t v) {
+    while (v >= 0x80) {
+        put_u8(w, (uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    put_u8(w, (uint8_t)v);
+}
+
+static void put_svarint(wire_writer_t* w, int64_t v) {
+    put_uvarint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static void put_bytes(wire_writer_t* w, const char* s, size_t len) {
+    put_uvarint(w, len);
+    if (w->pos + len > w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->pos, s, len);
+    w->pos += len;
+}
+
+static void put_str(wire_writer_t* w, const char* s) {
+    put_bytes(w, s, strlen(s));
+}
+
+static void put_sym(wire_writer_t* w, roj_sym_t sym) {
+    put_bytes(w, symtab_str(sym), symtab_len(sym));
+}
+
+static void put_entries(wire_writer_t* w, const roj_kv_t* entries, int count) {
+    put_uvarint(w, (uint64_t)count);
+    for (int i = 0; i < count; i++) {
+        put_sym(w, entries[i].key);
+        put_svarint(w, entries[i].value);
+    }
+}
+
+/* Log entries: [term] id key op value [expect]; FORWARD leaves out the term */
+static void put_log_entries(wire_writer_t* w, const roj_log_entry_t* entries, int count,
+                            bool term) {
+    put_uvarint(w, (uint64_t)count);
+    for (int i = 0; i < count; i++) {
+        const roj_log_entry_t* e = &entries[i];
+        if (term) {
+            put_uvarint(w, e->term);
+        }
+        put_uvarint(w, e->id);
+        put_sym(w, e->key);
+        put_u8(w, e->op);
+        put_svarint(w, e->value);
+        if (e->op == ROJ_OP_CAS) {
+            put_svarint(w, e->expect);
+        }
+    }
+}
+
+static void put_voters(wire_writer_t* w, const roj_sym_t* voters, int count) {
+    put_uvarint(w, (uint64_t)count);
+    for (int i = 0; i < count; i++) {
+        put_sym(w, voters[i]);
+    }
+}
+
+/* Reader */
+
+static uint8_t get_u8(wire_reader_t* r) {
+    if (r->pos >= r->len) {
+        r->error = true;
+        return 0;
+    }
+    return r->buf[r->pos++];
+}
+
+static uint64_t get_uvarint(wire_reader_t* r) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = get_u8(r);
+        if (r->error) return 0;
+        if (shift == 63 && b > 1) {
+            break;      /* the tenth byte only has room for bit 63 */
+        }
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    r->error = true;
+    return 0;
+}
+
+static int64_t get_svarint(wire_reader_t* r) {
+    uint64_t v = get_uvarint(r);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* Strings longer than the destination field are rejected, not truncated */
+static void get_str(wire_reader_t* r, char* out, size_t out_size) {
+    uint64_t len = get_uvarint(r);
+    if (r->error) return;
+    if (len >= out_size || len > r->len - r->pos) {
+        r->error = true;
+        return;
+    }
+    memcpy(out, r->buf + r->pos, (size_t)len);
+    out[len] = '\0';
+    r->pos += (size_t)len;
+}
+
+/* Node IDs and keys are interned straight from the datagram, as far as
+ * the sender may add symbols; a string that cannot be resolved fails the
+ * message. An unknown sender's ANNOUNCE (untrusted) may add its own ID. */
+static roj_sym_t get_sym_as(wire_reader_t* r, bool untrusted) {
+    uint64_t len = get_uvarint(r);
+    if (r->error) return ROJ_SYM_EMPTY;
+    if (len > ROJ_SYM_MAX_LEN || len > r->len - r->pos) {
+        r->error = true;
+        return ROJ_SYM_EMPTY;
+    }
+    if (len == 0) return ROJ_SYM_EMPTY;
+
+    const char* s = (const char*)r->buf + r->pos;
+    roj_sym_t sym = untrusted && r->intern == ROJ_INTERN_KNOWN
+        ? symtab_intern_untrusted(s, (size_t)len)
+        : symtab_resolve(r->intern, s, (size_t)len);
+    if (sym == ROJ_SYM_EMPTY) {
+        r->error = true;
+    }
+    r->pos += (size_t)len;
+    return sym;
+}
+
+static roj_sym_t get_sym(wire_reader_t* r) {
+    return get_sym_as(r, false);
+}
+
+/* A batch is applied whole, so an oversized one is an error, not truncated */
+static int get_entries(wire_reader_t* r, roj_kv_t* entries) {
+    uint64_t count = get_uvarint(r);
+    if (count > ROJ_MAX_BATCH) {
+        r->error = true;
+        return 0;
+    }
+    for (int i = 0; i < (int)count && !r->error; i++) {
+        entries[i].key = get_sym(r);
+        entries[i].value = get_svarint(r);
+    }
+    return (int)count;
+}
+
+static int get_log_entries(wire_reader_t* r, roj_log_entry_t* entries, bool term) {
+    uint64_t count = get_uvarint(r);
+    if (count > ROJ_MAX_BATCH) {
+        r->error = true;
+        return 0;
+    }
+    for (int i = 0; i < (int)count && !r->error; i++) {
+        roj_log_entry_t* e = &entries[i];
+        e->term = term ? get_uvarint(r) : 0;
+        e->id = get_uvarint(r);
+        e->key = get_sym(r);
+        e->op = get_u8(r);
+        e->value = get_svarint(r);
+        e->expect = e->op == ROJ_OP_CAS ? get_svarint(r) : 0;
+        if (e->op > ROJ_OP_READ) {
+            r->error = true;
+        }
+    }
+    return (int)count;
+}
+
+static int get_voters(wire_reader_t* r, roj_sym_t* voters) {
+    uint64_t count = get_uvarint(r);
+    if (count > ROJ_MAX_VOTERS) {
+        r->error = true;
+        return 0;
+    }
+    for (int i = 0; i < (int)count && !r->error; i++) {
+        voters[i] = get_sym(r);
+    }
+    return (int)count;
+}
+
+int message_to_binary(const roj_message_t* msg, uint8_t* buf, size_t buf_size) {
+    wire_writer_t w = { buf, buf_size, 0, false };
+
+    put_u8(&w, ROJ_WIRE_BIN_MAGIC);
+    put_u8(&w, ROJ_WIRE_BIN_VERSION);
+    put_u8(&w, (uint8_t)msg->type);
+
+    switch (msg->type) {
+        case MSG_ANNOUNCE:
+            put_sym(&w, msg->data.announce.node_id);
+            put_u8(&w, (uint8_t)msg->data.announce.lang);
+            put_uvarint(&w, msg->data.announce.caps);
+            put_str(&w, msg->data.announce.version);
+            break;
+
+        case MSG_PROPOSE:
+            put_str(&w, msg->data.propose.proposal_id);
+            put_sym(&w, msg->data.propose.from);
+            put_sym(&w, msg->data.propose.key);
+            put_svarint(&w, msg->data.propose.value);
+            put_svarint(&w, msg->data.propose.timestamp);
+            break;
+
+        case MSG_VOTE:
+            put_str(&w, msg->data.vote.proposal_id);
+            put_sym(&w, msg->data.vote.from);
+            put_u8(&w, (uint8_t)msg->data.vote.vote);
+            break;
+
+        case MSG_COMMIT:
+            put_str(&w, msg->data.commit.proposal_id);
+            put_sym(&w, msg->data.commit.key);
+            put_svarint(&w, msg->data.commit.value);
+            put_voters(&w, msg->data.commit.voters, msg->data.commit.voter_count);
+            break;
+
+        case MSG_PROPOSE_BATCH:
+            put_str(&w, msg->data.propose_batch.proposal_id);
+            put_sym(&w, msg->data.propose_batch.from);
+            put_svarint(&w, msg->data.propose_batch.timestamp);
+            put_entries(&w, msg->data.propose_batch.entries, msg->data.propose_batch.count);
+            break;
+
+        case MSG_COMMIT_BATCH:
+            put_str(&w, msg->data.commit_batch.proposal_id);
+            put_entries(&w, msg->data.commit_batch.entries, msg->data.commit_batch.count);
+            put_voters(&w, msg->data.commit_batch.voters, msg->data.commit_batch.voter_count);
+            break;
+
+        case MSG_VOTE_AGG:
+            put_sym(&w, msg->data.vote_agg.from);
+            put_uvarint(&w, msg->data.vote_agg.accept_bits);
+            put_uvarint(&w, (uint64_t)msg->data.vote_agg.count);
+            for (int i = 0; i < msg->data.vote_agg.count; i++) {
+                put_uvarint(&w, msg->data.vote_agg.ids[i]);
+            }
+            break;
+
+        case MSG_COMMIT_AGG:
+            put_voters(&w, msg->data.commit_agg.voters, msg->data.commit_agg.voter_count);
+            put_uvarint(&w, (uint64_t)msg->data.commit_agg.count);
+            for (int i = 0; i < msg->data.commit_agg.count; i++) {
+                const roj_commit_item_t* item = &msg->data.commit_agg.items[i];
+                put_uvarint(&w, item->id);
+                put_sym(&w, item->key);
+                put_svarint(&w, item->value);
+                put_uvarint(&w, item->voter_bits);
+            }
+            break;
+
+        case MSG_REQUEST_VOTE:
+            put_uvarint(&w, msg->data.request_vote.term);
+            put_sym(&w, msg->data.request_vote.candidate_id);
+            put_uvarint(&w, msg->data.request_vote.last_log_index);
+            put_uvarint(&w, msg->data.request_vote.last_log_term);
+            break;
+
+        case MSG_VOTE_RESPONSE:
+            put_uvarint(&w, msg->data.vote_response.term);
+            put_sym(&w, msg->data.vote_response.voter_id);
+            put_u8(&w, msg->data.vote_response.vote_granted ? 1 : 0);
+            break;
+
+        case MSG_APPEND_ENTRIES:
+            put_uvarint(&w, msg->data.append_entries.term);
+            put_sym(&w, msg->data.append_entries.leader_id);
+            put_uvarint(&w, msg->data.append_entries.prev_log_index);
+            put_uvarint(&w, msg->data.append_entries.prev_log_term);
+            put_uvarint(&w, msg->data.append_entries.leader_commit);
+            put_log_entries(&w, msg->data.append_entries.entries,
+                            msg->data.append_entries.count, true);
+            break;
+
+        case MSG_APPEND_ENTRIES_RESPONSE:
+            put_uvarint(&w, msg->data.append_response.term);
+            put_sym(&w, msg->data.append_response.follower_id);
+            put_u8(&w, msg->data.append_response.success ? 1 : 0);
+            put_uvarint(&w, msg->data.append_response.match_index);
+            break;
+
+        case MSG_FORWARD:
+            put_sym(&w, msg->data.forward.from);
+            put_log_entries(&w, msg->data.forward.entries, msg->data.forward.count, false);
+            break;
+
+        default:
+            return -1;
+    }
+
+    return w.overflow ? -1 : (int)w.pos;
+}
+
+int message_from_binary(const uint8_t* buf, size_t len, roj_message_t* msg,
+                        roj_intern_t intern) {
+    wire_reader_t r = { buf, len, 0, false, intern };
+
+    if (get_u8(&r) != ROJ_WIRE_BIN_MAGIC) return -1;
+    if (get_u8(&r) != ROJ_WIRE_BIN_VERSION) return -1;
+
+    memset(msg, 0, sizeof(*msg));
+    uint8_t type = get_u8(&r);
+    roj_payload_t* payload = NULL;
+
+    if (message_type_has_payload(type) && !(payload = payload_recv_slot())) {
+        return -1;
+    }
+
+    switch (type) {
+        case MSG_ANNOUNCE:
+            msg->type = MSG_ANNOUNCE;
+            msg->data.announce.node_id = get_sym_as(&r, true);
+            msg->data.announce.lang = (roj_lang_t)get_u8(&r);
+            msg->data.announce.caps = (uint32_t)get_uvarint(&r);
+            get_str(&r, msg->data.announce.version, sizeof(msg->data.announce.version));
+            if (msg->data.announce.lang > LANG_C) {
+                msg->data.announce.lang = LANG_C;
+            }
+            break;
+
+        case MSG_PROPOSE:
+            msg->type = MSG_PROPOSE;
+            get_str(&r, msg->data.propose.proposal_id, ROJ_PROPOSAL_ID_LEN);
+            msg->data.propose.from = get_sym(&r);
+            msg->data.propose.key = get_sym(&r);
+            msg->data.propose.value = get_svarint(&r);
+            msg->data.propose.timestamp = get_svarint(&r);
+            break;
+
+        case MSG_VOTE:
+            msg->type = MSG_VOTE;
+            get_str(&r, msg->data.vote.proposal_id, ROJ_PROPOSAL_ID_LEN);
+            msg->data.vote.from = get_sym(&r);
+            msg->data.vote.vote = get_u8(&r) == VOTE_REJECT ? VOTE_REJECT : VOTE_ACCEPT;
+            break;
+
+        case MSG_COMMIT:
+            msg->type = MSG_COMMIT;
+            get_str(&r, msg->data.commit.proposal_id, ROJ_PROPOSAL_ID_LEN);
+            msg->data.commit.key = get_sym(&r);
+            msg->data.commit.value = get_svarint(&r);
+            msg->data.commit.voter_count = get_voters(&r, msg->data.commit.voters);
+            break;
+
+        case MSG_PROPOSE_BATCH:
+            msg->type = MSG_PROPOSE_BATCH;
+            get_str(&r, msg->data.propose_batch.proposal_id, ROJ_PROPOSAL_ID_LEN);
+            msg->data.propose_batch.from = get_sym(&r);
+            msg->data.propose_batch.timestamp = get_svarint(&r);
+            msg->data.propose_batch.entries = payload->kv;
+            msg->data.propose_batch.count = get_entries(&r, payload->kv);
+            break;
+
+        case MSG_COMMIT_BATCH:
+            msg->type = MSG_COMMIT_BATCH;
+            get_str(&r, msg->data.commit_batch.proposal_id, ROJ_PROPOSAL_ID_LEN);
+            msg->data.commit_batch.entries = payload->kv;
+            msg->data.commit_batch.count = get_entries(&r, payload->kv);
+            msg->data.commit_batch.voter_count =
+                get_voters(&r, msg->data.commit_batch.voters);
+            break;
+
+        case MSG_VOTE_AGG: {
+            msg->type = MSG_VOTE_AGG;
+            msg->data.vote_agg.from = get_sym(&r);
+            msg->data.vote_agg.accept_bits = (uint32_t)get_uvarint(&r);
+            uint64_t count = get_uvarint(&r);
+            if (count > ROJ_MAX_AGG) {
+                return -1;
+            }
+            msg->data.vote_agg.count = (int)count;
+            msg->data.vote_agg.ids = payload->ids;
+            for (int i = 0; i < (int)count && !r.error; i++) {
+                msg->data.vote_agg.ids[i] = get_uvarint(&r);
+            }
+            break;
+        }
+
+        case MSG_COMMIT_AGG: {
+            msg->type = MSG_COMMIT_AGG;
+            msg->data.commit_agg.voter_count = get_voters(&r, msg->data.commit_agg.voters);
+            uint64_t count = get_uvarint(&r);
+            if (count > ROJ_MAX_AGG) {
+                return -1;
+            }
+            msg->data.commit_agg.count = (int)count;
+            msg->data.commit_agg.items = payload->items;
+            for (int i = 0; i < (int)count && !r.error; i++) {
+                roj_commit_item_t* item = &msg->data.commit_agg.items[i];
+                item->id = get_uvarint(&r);
+                item->key = get_sym(&r);
+                item->value = get_svarint(&r);
+                item->voter_bits = (uint32_t)get_uvarint(&r);
+            }
+            break;
+        }
+
+        case MSG_REQUEST_VOTE:
+            msg->type = MSG_REQUEST_VOTE;
+            msg->data.request_vote.term = get_uvarint(&r);
+            msg->data.request_vote.candidate_id = get_sym(&r);
+            msg->data.request_vote.last_log_index = get_uvarint(&r);
+            msg->data.request_vote.last_log_term = get_uvarint(&r);
+            break;
+
+        case MSG_VOTE_RESPONSE:
+            msg->type = MSG_VOTE_RESPONSE;
+            msg->data.vote_response.term = get_uvarint(&r);
+            msg->data.vote_response.voter_id = get_sym(&r);
+            msg->data.vote_response.vote_granted = get_u8(&r) != 0;
+            break;
+
+        case MSG_APPEND_ENTRIES:
+            msg->type = MSG_APPEND_ENTRIES;
+            msg->data.append_entries.term = get_uvarint(&r);
+            msg->data.append_entries.leader_id = get_sym(&r);
+            msg->data.append_entries.prev_log_index = get_uvarint(&r);
+            msg->data.append_entries.prev_log_term = get_uvarint(&r);
+            msg->data.append_entries.leader_commit = get_uvarint(&r);
+            msg->data.append_entries.entries = payload->log;
+            msg->data.append_entries.count = get_log_entries(&r, payload->log, true);
+            break;
+
+        case MSG_APPEND_ENTRIES_RESPONSE:
+            msg->type = MSG_APPEND_ENTRIES_RESPONSE;
+            msg->data.append_response.term = get_uvarint(&r);
+            msg->data.append_response.follower_id = get_sym(&r);
+            msg->data.append_response.success = get_u8(&r) != 0;
+            msg->data.append_response.match_index = get_uvarint(&r);
+            break;
+
+        case MSG_FORWARD:
+            msg->type = MSG_FORWARD;
+            msg->data.forward.from = get_sym(&r);
+            msg->data.forward.entries = payload->log;
+            msg->data.forward.count = get_log_entries(&r, payload->log, false);
+            break;
+
+        default:
+            msg->type = MSG_UNKNOWN;
+            return r.error ? -1 : 0;
+    }
+
+    return r.error ? -1 : 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * ROJ Wire - compact binary message encoding
+ *
+ * Layout (version 1):
+ *   u8 magic (0xB7), u8 version, u8 type, then the fields of the message
+ *   in a fixed order. Integers are LEB128 varints (signed values zigzag
+ *   encoded), strings are a varint length followed by the raw bytes.
+ *
+ * The magic byte can never start a JSON document, so receivers detect the
+ * encoding from the first byte of each datagram.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_WIRE_H
+#define ROJ_WIRE_H
+
+#include <stddef.h>
+#include "types.h"
+#include "symtab.h"
+
+#define ROJ_WIRE_BIN_MAGIC   0xB7
+#define ROJ_WIRE_BIN_VERSION 1
+
+/* Serialize message to binary, returns encoded length or -1 */
+int message_to_binary(const roj_message_t* msg, uint8_t* buf, size_t buf_size);
+
+/* Parse message from binary, resolving its strings as intern allows;
+ * returns 0 on success or -1 */
+int message_from_binary(const uint8_t* buf, size_t len, roj_message_t* msg,
+                        roj_intern_t intern);
+
+/* Returns true if the datagram carries the binary encoding */
+static inline bool wire_is_binary(const uint8_t* buf, size_t len) {
+    return len > 0 && buf[0] == ROJ_WIRE_BIN_MAGIC;
+}
+
+#endif /* ROJ_WIRE_H */
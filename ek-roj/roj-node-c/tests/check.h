@@ -0,0 +1,31 @@
+/*
+ * ROJ Tests - minimal assertions for the ctest executables
+ *
+ * CHECK reports a failed condition and keeps going, so one run lists every
+ * failure; CHECK_DONE is main's return value (non-zero fails the test).
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#ifndef ROJ_CHECK_H
+#define ROJ_CHECK_H
+
+#include <stdio.h>
+
+static int g_checks = 0;
+static int g_check_failures = 0;
+
+#define CHECK(cond) do {                                                    \
+        g_checks++;                                                         \
+        if (!(cond)) {                                                      \
+            g_check_failures++;                                             \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                    #cond);                                                 \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_DONE()                                                        \
+    (printf("%d checks, %d failed\n", g_checks, g_check_failures),          \
+     g_check_failures == 0 ? 0 : 1)
+
+#endif /* ROJ_CHECK_H */
@@ -0,0 +1,271 @@
+/*
+ * ROJ WAL tests - replay after clean shutdown, torn tails and bad CRCs,
+ * and the order of wal.prev and wal.log
+ *
+ * Each case works in a fresh directory under $TMPDIR (or /tmp). Record
+ * boundaries come from the file size after each wal_sync, so the tests do
+ * not depend on the record layout beyond "a CRC comes first".
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "check.h"
+#include "wal.h"
+
+#define REPLAY_MAX 32
+
+typedef struct {
+    char key[ROJ_KEY_MAX];
+    int64_t value;
+} record_t;
+
+typedef struct {
+    record_t records[REPLAY_MAX];
+    int count;
+} replayed_t;
+
+static void collect(const char* key, int64_t value, void* ctx) {
+    replayed_t* r = ctx;
+    if (r->count < REPLAY_MAX) {
+        snprintf(r->records[r->count].key, ROJ_KEY_MAX, "%s", key);
+        r->records[r->count].value = value;
+    }
+    r->count++;
+}
+
+static bool replayed_is(const replayed_t* r, int index, const char* key, int64_t value) {
+    return index < r->count && strcmp(r->records[index].key, key) == 0 &&
+           r->records[index].value == value;
+}
+
+static bool make_dir(char* dir, size_t size) {
+    const char* tmp = getenv("TMPDIR");
+    snprintf(dir, size, "%s/roj-wal-test-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    return mkdtemp(dir) != NULL;
+}
+
+static void remove_dir(const char* dir) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, ROJ_WAL_FILE);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", dir, ROJ_WAL_PREV_FILE);
+    unlink(path);
+    rmdir(dir);
+}
+
+static long long file_size(const char* dir, const char* name) {
+    char path[600];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+static bool file_exists(const char* dir, const char* name) {
+    return file_size(dir, name) >= 0;
+}
+
+/* Open dir, replaying into r */
+static int open_replay(roj_wal_t* wal, const char* dir, replayed_t* r) {
+    memset(r, 0, sizeof(*r));
+    wal_init(wal);
+    return wal_open(wal, dir, 0, collect, r);
+}
+
+/* Append and sync one record each; ends[i] is the file size after record i */
+static void append_synced(roj_wal_t* wal, const char* dir, const record_t* records, int count,
+                          long long* ends) {
+    for (int i = 0; i < count; i++) {
+        CHECK(wal_append_commit(wal, records[i].key, records[i].value) == 0);
+        CHECK(wal_sync(wal) == 0);
+        if (ends) {
+            ends[i] = file_size(dir, ROJ_WAL_FILE);
+        }
+    }
+}
+
+static void write_at(const char* dir, long long offset, const void* bytes, size_t len) {
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, ROJ_WAL_FILE);
+    int fd = open(path, O_WRONLY);
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        CHECK(pwrite(fd, bytes, len, (off_t)offset) == (ssize_t)len);
+        close(fd);
+    }
+}
+
+static const record_t g_three[] = { { "a", 1 }, { "bb", -2 }, { "ccc", INT64_MAX } };
+
+static void test_clean_replay(void) {
+    char dir[512];
+    roj_wal_t wal;
+    replayed_t r;
+
+    CHECK(make_dir(dir, sizeof(dir)));
+    CHECK(open_replay(&wal, dir, &r) == 0 && r.count == 0);
+    append_synced(&wal, dir, g_three, 3, NULL);
+    wal_close(&wal);
+
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    CHECK(r.count == 3);
+    CHECK(replayed_is(&r, 0, "a", 1));
+    CHECK(replayed_is(&r, 1, "bb", -2));
+    CHECK(replayed_is(&r, 2, "ccc", INT64_MAX));
+    CHECK(wal_records_since_rotate(&wal) == 3);
+    wal_close(&wal);
+    remove_dir(dir);
+}
+
+/* A record cut short by a crash is dropped and the next one takes its place */
+static void test_torn_tail(void) {
+    char dir[512];
+    roj_wal_t wal;
+    replayed_t r;
+    long long ends[3];
+
+    CHECK(make_dir(dir, sizeof(dir)));
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    append_synced(&wal, dir, g_three, 3, ends);
+    wal_close(&wal);
+
+    /* Every cut inside the last record loses exactly that record */
+    for (long long cut = ends[1] + 1; cut < ends[2]; cut++) {
+        char path[600];
+        snprintf(path, sizeof(path), "%s/%s", dir, ROJ_WAL_FILE);
+        CHECK(truncate(path, (off_t)cut) == 0);
+
+        CHECK(open_replay(&wal, dir, &r) == 0);
+        CHECK(r.count == 2);
+        CHECK(file_size(dir, ROJ_WAL_FILE) == ends[1]);
+
+        /* Appends follow the last good record */
+        append_synced(&wal, dir, &g_three[2], 1, NULL);
+        wal_close(&wal);
+        CHECK(file_size(dir, ROJ_WAL_FILE) == ends[2]);
+    }
+
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    CHECK(r.count == 3 && replayed_is(&r, 2, "ccc", INT64_MAX));
+    wal_close(&wal);
+    remove_dir(dir);
+}
+
+/* A damaged record ends replay there; it and everything after it go */
+static void test_bad_crc(void) {
+    char dir[512];
+    roj_wal_t wal;
+    replayed_t r;
+    long long ends[3];
+    uint8_t crc[4];
+
+    CHECK(make_dir(dir, sizeof(dir)));
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    append_synced(&wal, dir, g_three, 3, ends);
+    wal_close(&wal);
+
+    /* Flip the stored CRC of the second record */
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, ROJ_WAL_FILE);
+    int fd = open(path, O_RDONLY);
+    CHECK(fd >= 0 && pread(fd, crc, sizeof(crc), (off_t)ends[0]) == (ssize_t)sizeof(crc));
+    if (fd >= 0) close(fd);
+    crc[0] ^= 0x01;
+    write_at(dir, ends[0], crc, sizeof(crc));
+
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    CHECK(r.count == 1 && replayed_is(&r, 0, "a", 1));
+    CHECK(file_size(dir, ROJ_WAL_FILE) == ends[0]);
+    wal_close(&wal);
+
+    /* So is a damaged byte inside a record whose stored CRC is intact */
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    append_synced(&wal, dir, &g_three[1], 2, &ends[1]);
+    wal_close(&wal);
+    uint8_t byte = 0xFF;
+    write_at(dir, ends[2] - 2, &byte, 1);
+
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    CHECK(r.count == 2 && replayed_is(&r, 1, "bb", -2));
+    CHECK(file_size(dir, ROJ_WAL_FILE) == ends[1]);
+    wal_close(&wal);
+    remove_dir(dir);
+}
+
+/* A rotated log awaiting its snapshot replays before the live one */
+static void test_prev_then_log(void) {
+    static const record_t before[] = { { "x", 1 }, { "y", 1 } };
+    static const record_t after[] = { { "x", 2 }, { "z", 3 } };
+    char dir[512];
+    roj_wal_t wal;
+    replayed_t r;
+
+    CHECK(make_dir(dir, sizeof(dir)));
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    append_synced(&wal, dir, before, 2, NULL);
+    CHECK(wal_rotate(&wal) == 0);
+    CHECK(file_exists(dir, ROJ_WAL_PREV_FILE));
+    CHECK(wal_records_since_rotate(&wal) == 0);
+    append_synced(&wal, dir, after, 2, NULL);
+    wal_close(&wal);
+
+    /* Crash before the snapshot landed: both files, oldest first */
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    CHECK(r.count == 4);
+    CHECK(replayed_is(&r, 0, "x", 1));
+    CHECK(replayed_is(&r, 1, "y", 1));
+    CHECK(replayed_is(&r, 2, "x", 2));
+    CHECK(replayed_is(&r, 3, "z", 3));
+    CHECK(wal_records_since_rotate(&wal) == 2);
+
+    /* A second rotation while wal.prev is pending keeps both files */
+    CHECK(wal_rotate(&wal) == 0);
+    CHECK(file_size(dir, ROJ_WAL_FILE) > 0 && file_exists(dir, ROJ_WAL_PREV_FILE));
+
+    /* Once the snapshot is durable only wal.log is replayed */
+    wal_drop_rotated(&wal);
+    CHECK(!file_exists(dir, ROJ_WAL_PREV_FILE));
+    wal_close(&wal);
+
+    CHECK(open_replay(&wal, dir, &r) == 0);
+    CHECK(r.count == 2 && replayed_is(&r, 0, "x", 2) && replayed_is(&r, 1, "z", 3));
+    wal_close(&wal);
+    remove_dir(dir);
+}
+
+/* Anything that is not a log is refused rather than overwritten */
+static void test_foreign_file(void) {
+    char dir[512];
+    char path[600];
+    roj_wal_t wal;
+    replayed_t r;
+
+    CHECK(make_dir(dir, sizeof(dir)));
+    snprintf(path, sizeof(path), "%s/%s", dir, ROJ_WAL_FILE);
+    FILE* f = fopen(path, "w");
+    CHECK(f != NULL);
+    if (f) {
+        fputs("not a write-ahead log\n", f);
+        fclose(f);
+    }
+    CHECK(open_replay(&wal, dir, &r) == -1);
+    CHECK(file_size(dir, ROJ_WAL_FILE) == 22);
+    remove_dir(dir);
+}
+
+int main(void) {
+    test_clean_replay();
+    test_torn_tail();
+    test_bad_crc();
+    test_prev_then_log();
+    test_foreign_file();
+    return CHECK_DONE();
+}
@@ -0,0 +1,493 @@
+/*
+ * ROJ Wire tests - codec round trips, varint bounds and truncated datagrams
+ *
+ * Every message type goes through the binary codec and both JSON decoders
+ * and must come back field for field. The binary decoder must refuse
+ * varints and counts past their bounds and every proper prefix of a
+ * datagram, and the encoder every buffer that is too small.
+ *
+ * SPDX-License-Identifier: AGPL-3.0
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "check.h"
+#include "json_decode.h"
+#include "json_encode.h"
+#include "payload.h"
+#include "symtab.h"
+#include "transport.h"
+#include "wire.h"
+
+#define SAMPLE_MAX 16
+#define BUF_SIZE   8192
+
+typedef struct {
+    const char* name;
+    roj_message_t msg;
+    roj_payload_t payload;
+} sample_t;
+
+static sample_t g_samples[SAMPLE_MAX];
+static int g_sample_count;
+
+static roj_sym_t sym(const char* s) {
+    return symtab_intern_str(s);
+}
+
+static roj_message_t* add_sample(const char* name, roj_msg_type_t type) {
+    sample_t* s = &g_samples[g_sample_count++];
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->msg.type = type;
+    message_set_payload(&s->msg, &s->payload);
+    return &s->msg;
+}
+
+static void build_samples(void) {
+    static const char* id = "5a3f00000000012c";
+    roj_message_t* m;
+
+    m = add_sample("ANNOUNCE", MSG_ANNOUNCE);
+    m->data.announce.node_id = sym("node-a");
+    m->data.announce.lang = LANG_C;
+    m->data.announce.caps = ROJ_CAP_CONSENSUS | ROJ_CAP_WIRE_BIN | ROJ_CAP_LOG;
+    strcpy(m->data.announce.version, ROJ_VERSION);
+
+    m = add_sample("PROPOSE", MSG_PROPOSE);
+    strcpy(m->data.propose.proposal_id, id);
+    m->data.propose.from = sym("node-a");
+    m->data.propose.key = sym("temp");
+    m->data.propose.value = -2150;
+    m->data.propose.timestamp = 1760000000;
+
+    m = add_sample("VOTE", MSG_VOTE);
+    strcpy(m->data.vote.proposal_id, id);
+    m->data.vote.from = sym("node-b");
+    m->data.vote.vote = VOTE_REJECT;
+
+    m = add_sample("COMMIT", MSG_COMMIT);
+    strcpy(m->data.commit.proposal_id, id);
+    m->data.commit.key = sym("temp");
+    m->data.commit.value = 2150;
+    m->data.commit.voters[0] = sym("node-a");
+    m->data.commit.voters[1] = sym("node-b");
+    m->data.commit.voters[2] = sym("node-c");
+    m->data.commit.voter_count = 3;
+
+    m = add_sample("PROPOSE_BATCH", MSG_PROPOSE_BATCH);
+    strcpy(m->data.propose_batch.proposal_id, id);
+    m->data.propose_batch.from = sym("node-a");
+    m->data.propose_batch.timestamp = 1760000000;
+    m->data.propose_batch.count = ROJ_MAX_BATCH;
+    for (int i = 0; i < ROJ_MAX_BATCH; i++) {
+        m->data.propose_batch.entries[i].key = sym(i % 2 ? "odd" : "even");
+        m->data.propose_batch.entries[i].value = (int64_t)i * 1000 - 7;
+    }
+
+    m = add_sample("COMMIT_BATCH", MSG_COMMIT_BATCH);
+    strcpy(m->data.commit_batch.proposal_id, id);
+    m->data.commit_batch.count = 2;
+    m->data.commit_batch.entries[0].key = sym("x");
+    m->data.commit_batch.entries[0].value = 1;
+    m->data.commit_batch.entries[1].key = sym("y");
+    m->data.commit_batch.entries[1].value = -1;
+    m->data.commit_batch.voters[0] = sym("node-a");
+    m->data.commit_batch.voters[1] = sym("node-c");
+    m->data.commit_batch.voter_count = 2;
+
+    m = add_sample("VOTE_AGG", MSG_VOTE_AGG);
+    m->data.vote_agg.from = sym("node-b");
+    m->data.vote_agg.count = ROJ_MAX_AGG;
+    m->data.vote_agg.accept_bits = 0xA5A5A5A5u;
+    for (int i = 0; i < ROJ_MAX_AGG; i++) {
+        m->data.vote_agg.ids[i] = 0x5a3f000000000100ULL + (uint64_t)i;
+    }
+
+    m = add_sample("COMMIT_AGG", MSG_COMMIT_AGG);
+    m->data.commit_agg.voters[0] = sym("node-a");
+    m->data.commit_agg.voters[1] = sym("node-b");
+    m->data.commit_agg.voter_count = 2;
+    m->data.commit_agg.count = 3;
+    for (int i = 0; i < 3; i++) {
+        roj_commit_item_t* item = &m->data.commit_agg.items[i];
+        item->id = 0x5a3f000000000200ULL + (uint64_t)i;
+        item->key = sym("temp");
+        item->value = 40 + i;
+        item->voter_bits = (uint32_t)(i + 1);
+    }
+
+    m = add_sample("REQUEST_VOTE", MSG_REQUEST_VOTE);
+    m->data.request_vote.term = 7;
+    m->data.request_vote.candidate_id = sym("node-c");
+    m->data.request_vote.last_log_index = 48213;
+    m->data.request_vote.last_log_term = 6;
+
+    m = add_sample("VOTE_RESPONSE", MSG_VOTE_RESPONSE);
+    m->data.vote_response.term = 7;
+    m->data.vote_response.voter_id = sym("node-a");
+    m->data.vote_response.vote_granted = true;
+
+    m = add_sample("APPEND_ENTRIES/0", MSG_APPEND_ENTRIES);
+    m->data.append_entries.term = 7;
+    m->data.append_entries.leader_id = sym("node-c");
+    m->data.append_entries.prev_log_index = 48213;
+    m->data.append_entries.prev_log_term = 7;
+    m->data.append_entries.leader_commit = 48210;
+
+    m = add_sample("APPEND_ENTRIES/4", MSG_APPEND_ENTRIES);
+    m->data.append_entries.term = 8;
+    m->data.append_entries.leader_id = sym("node-c");
+    m->data.append_entries.prev_log_index = 10;
+    m->data.append_entries.prev_log_term = 7;
+    m->data.append_entries.leader_commit = 9;
+    m->data.append_entries.count = 4;
+    m->data.append_entries.entries[0].term = 8;     /* the leader's no-op */
+    for (int i = 1; i < 4; i++) {
+        roj_log_entry_t* e = &m->data.append_entries.entries[i];
+        e->term = 8;
+        e->id = 0xFFFE000000000120ULL + (uint64_t)i;
+        e->key = sym("k");
+        e->op = (uint8_t)(i - 1);                   /* SET, CAS, READ */
+        e->value = -5 * i;
+        e->expect = e->op == ROJ_OP_CAS ? 7 : 0;
+    }
+
+    m = add_sample("APPEND_ENTRIES_RESPONSE", MSG_APPEND_ENTRIES_RESPONSE);
+    m->data.append_response.term = 8;
+    m->data.append_response.follower_id = sym("node-a");
+    m->data.append_response.success = true;
+    m->data.append_response.match_index = 14;
+
+    m = add_sample("FORWARD", MSG_FORWARD);
+    m->data.forward.from = sym("node-b");
+    m->data.forward.count = 2;
+    m->data.forward.entries[0].id = 0x0001000000000002ULL;
+    m->data.forward.entries[0].key = sym("k");
+    m->data.forward.entries[0].op = ROJ_OP_CAS;
+    m->data.forward.entries[0].value = 3;
+    m->data.forward.entries[0].expect = 2;
+    m->data.forward.entries[1].id = 0x0001000000000003ULL;
+    m->data.forward.entries[1].key = sym("j");
+    m->data.forward.entries[1].op = ROJ_OP_READ;
+}
+
+static bool same_kv(const roj_kv_t* a, const roj_kv_t* b, int count) {
+    for (int i = 0; i < count; i++) {
+        if (a[i].key != b[i].key || a[i].value != b[i].value) return false;
+    }
+    return true;
+}
+
+static bool same_log(const roj_log_entry_t* a, const roj_log_entry_t* b, int count) {
+    for (int i = 0; i < count; i++) {
+        if (a[i].term != b[i].term || a[i].id != b[i].id || a[i].key != b[i].key ||
+            a[i].op != b[i].op || a[i].value != b[i].value || a[i].expect != b[i].expect) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool same_items(const roj_commit_item_t* a, const roj_commit_item_t* b, int count) {
+    for (int i = 0; i < count; i++) {
+        if (a[i].id != b[i].id || a[i].key != b[i].key || a[i].value != b[i].value ||
+            a[i].voter_bits != b[i].voter_bits) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Field-for-field equality: the fixed part byte for byte (both sides start
+ * zeroed), the out-of-line array element by element */
+static bool same_message(const roj_message_t* a, const roj_message_t* b) {
+    static roj_payload_t none;
+    roj_message_t x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    message_set_payload(&x, &none);
+    message_set_payload(&y, &none);
+    if (memcmp(&x, &y, sizeof(x)) != 0) {
+        return false;
+    }
+
+    switch (a->type) {
+        case MSG_PROPOSE_BATCH:
+            return same_kv(a->data.propose_batch.entries, b->data.propose_batch.entries,
+                           a->data.propose_batch.count);
+        case MSG_COMMIT_BATCH:
+            return same_kv(a->data.commit_batch.entries, b->data.commit_batch.entries,
+                           a->data.commit_batch.count);
+        case MSG_VOTE_AGG:
+            return memcmp(a->data.vote_agg.ids, b->data.vote_agg.ids,
+                          (size_t)a->data.vote_agg.count * sizeof(uint64_t)) == 0;
+        case MSG_COMMIT_AGG:
+            return same_items(a->data.commit_agg.items, b->data.commit_agg.items,
+                              a->data.commit_agg.count);
+        case MSG_APPEND_ENTRIES:
+            return same_log(a->data.append_entries.entries, b->data.append_entries.entries,
+                            a->data.append_entries.count);
+        case MSG_FORWARD:
+            return same_log(a->data.forward.entries, b->data.forward.entries,
+                            a->data.forward.count);
+        default:
+            return true;
+    }
+}
+
+static int decode_binary(const uint8_t* buf, size_t len, roj_message_t* msg) {
+    return message_from_binary(buf, len, msg, ROJ_INTERN_ALL);
+}
+
+static void test_round_trips(void) {
+    static uint8_t buf[BUF_SIZE];
+    static char json[BUF_SIZE];
+
+    for (int i = 0; i < g_sample_count; i++) {
+        const sample_t* s = &g_samples[i];
+        roj_message_t out;
+        int len;
+
+        len = message_to_binary(&s->msg, buf, sizeof(buf));
+        CHECK(len > 0);
+        CHECK(wire_is_binary(buf, (size_t)len));
+        CHECK(decode_binary(buf, (size_t)len, &out) == 0 && same_message(&s->msg, &out));
+
+        len = json_encode_message(NULL, &s->msg, json, sizeof(json));
+        CHECK(len > 0);
+        CHECK(json_decode_message(json, (size_t)len, &out, ROJ_INTERN_ALL) == 0 &&
+              same_message(&s->msg, &out));
+        CHECK(message_from_json(json, &out) == 0 && same_message(&s->msg, &out));
+
+        len = message_to_json(&s->msg, json, sizeof(json));
+        CHECK(len > 0);
+        CHECK(json_decode_message(json, (size_t)len, &out, ROJ_INTERN_ALL) == 0 &&
+              same_message(&s->msg, &out));
+    }
+}
+
+/* REQUEST_VOTE for candidate "a" whose term is the varint in term[] */
+static size_t request_vote_with_term(uint8_t* buf, const uint8_t* term, size_t term_len) {
+    size_t n = 0;
+    buf[n++] = ROJ_WIRE_BIN_MAGIC;
+    buf[n++] = ROJ_WIRE_BIN_VERSION;
+    buf[n++] = MSG_REQUEST_VOTE;
+    memcpy(buf + n, term, term_len);
+    n += term_len;
+    buf[n++] = 1;           /* candidate_id "a" */
+    buf[n++] = 'a';
+    buf[n++] = 0;           /* last_log_index */
+    buf[n++] = 0;           /* last_log_term */
+    return n;
+}
+
+static void test_varint_bounds(void) {
+    static const uint8_t max[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+    static const uint8_t over[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x02 };
+    static const uint8_t eleven[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+                                      0x80, 0x00 };
+    uint8_t buf[64];
+    roj_message_t out;
+    size_t len;
+
+    /* Ten bytes reach UINT64_MAX; a tenth byte above 1 or an eleventh byte overflow */
+    len = request_vote_with_term(buf, max, sizeof(max));
+    CHECK(decode_binary(buf, len, &out) == 0 && out.data.request_vote.term == UINT64_MAX);
+    len = request_vote_with_term(buf, over, sizeof(over));
+    CHECK(decode_binary(buf, len, &out) == -1);
+    len = request_vote_with_term(buf, eleven, sizeof(eleven));
+    CHECK(decode_binary(buf, len, &out) == -1);
+
+    /* Extremes of unsigned and zigzag fields survive */
+    roj_message_t m;
+    memset(&m, 0, sizeof(m));
+    m.type = MSG_REQUEST_VOTE;
+    m.data.request_vote.term = UINT64_MAX;
+    m.data.request_vote.candidate_id = sym("a");
+    m.data.request_vote.last_log_index = UINT64_MAX - 1;
+    m.data.request_vote.last_log_term = 1;
+    int n = message_to_binary(&m, buf, sizeof(buf));
+    CHECK(n > 0 && decode_binary(buf, (size_t)n, &out) == 0 && same_message(&m, &out));
+
+    int64_t values[] = { INT64_MIN, INT64_MIN + 1, -1, 0, 1, INT64_MAX };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        memset(&m, 0, sizeof(m));
+        m.type = MSG_PROPOSE;
+        strcpy(m.data.propose.proposal_id, "5a3f00000000012c");
+        m.data.propose.from = sym("a");
+        m.data.propose.key = sym("k");
+        m.data.propose.value = values[i];
+        m.data.propose.timestamp = values[i];
+        n = message_to_binary(&m, buf, sizeof(buf));
+        CHECK(n > 0 && decode_binary(buf, (size_t)n, &out) == 0 && same_message(&m, &out));
+    }
+}
+
+/* Counts and lengths one past what a message can hold */
+static void test_count_bounds(void) {
+    static uint8_t buf[BUF_SIZE];
+    roj_message_t out;
+    size_t n;
+
+    /* PROPOSE_BATCH declaring ROJ_MAX_BATCH + 1 entries */
+    n = 0;
+    buf[n++] = ROJ_WIRE_BIN_MAGIC;
+    buf[n++] = ROJ_WIRE_BIN_VERSION;
+    buf[n++] = MSG_PROPOSE_BATCH;
+    buf[n++] = 1;
+    buf[n++] = 'p';
+    buf[n++] = 1;
+    buf[n++] = 'a';
+    buf[n++] = 0;                           /* timestamp */
+    buf[n++] = ROJ_MAX_BATCH + 1;
+    for (int i = 0; i <= ROJ_MAX_BATCH; i++) {
+        buf[n++] = 1;
+        buf[n++] = 'k';
+        buf[n++] = 0;
+    }
+    CHECK(decode_binary(buf, n, &out) == -1);
+
+    /* VOTE_AGG with ROJ_MAX_AGG + 1 IDs */
+    n = 0;
+    buf[n++] = ROJ_WIRE_BIN_MAGIC;
+    buf[n++] = ROJ_WIRE_BIN_VERSION;
+    buf[n++] = MSG_VOTE_AGG;
+    buf[n++] = 1;
+    buf[n++] = 'a';
+    buf[n++] = 0;                           /* accept_bits */
+    buf[n++] = ROJ_MAX_AGG + 1;
+    for (int i = 0; i <= ROJ_MAX_AGG; i++) {
+        buf[n++] = (uint8_t)(i + 1);
+    }
+    CHECK(decode_binary(buf, n, &out) == -1);
+
+    /* COMMIT listing ROJ_MAX_VOTERS + 1 voters */
+    n = 0;
+    buf[n++] = ROJ_WIRE_BIN_MAGIC;
+    buf[n++] = ROJ_WIRE_BIN_VERSION;
+    buf[n++] = MSG_COMMIT;
+    buf[n++] = 1;
+    buf[n++] = 'p';
+    buf[n++] = 1;
+    buf[n++] = 'k';
+    buf[n++] = 0;                           /* value */
+    buf[n++] = ROJ_MAX_VOTERS + 1;
+    for (int i = 0; i <= ROJ_MAX_VOTERS; i++) {
+        buf[n++] = 1;
+        buf[n++] = 'a';
+    }
+    CHECK(decode_binary(buf, n, &out) == -1);
+
+    /* A proposal ID that does not fit its field is refused, not truncated */
+    n = 0;
+    buf[n++] = ROJ_WIRE_BIN_MAGIC;
+    buf[n++] = ROJ_WIRE_BIN_VERSION;
+    buf[n++] = MSG_VOTE;
+    buf[n++] = ROJ_PROPOSAL_ID_LEN;
+    memset(buf + n, 'f', ROJ_PROPOSAL_ID_LEN);
+    n += ROJ_PROPOSAL_ID_LEN;
+    buf[n++] = 1;
+    buf[n++] = 'a';
+    buf[n++] = VOTE_ACCEPT;
+    CHECK(decode_binary(buf, n, &out) == -1);
+
+    /* A log entry with an op past ROJ_OP_READ */
+    n = 0;
+    buf[n++] = ROJ_WIRE_BIN_MAGIC;
+    buf[n++] = ROJ_WIRE_BIN_VERSION;
+    buf[n++] = MSG_FORWARD;
+    buf[n++] = 1;
+    buf[n++] = 'a';
+    buf[n++] = 1;                           /* one entry: id key op value */
+    buf[n++] = 1;
+    buf[n++] = 1;
+    buf[n++] = 'k';
+    buf[n++] = ROJ_OP_READ + 1;
+    buf[n++] = 0;
+    CHECK(decode_binary(buf, n, &out) == -1);
+
+    /* Wrong magic or version */
+    int len = message_to_binary(&g_samples[0].msg, buf, sizeof(buf));
+    buf[1] = ROJ_WIRE_BIN_VERSION + 1;
+    CHECK(decode_binary(buf, (size_t)len, &out) == -1);
+    buf[0] = '{';
+    CHECK(!wire_is_binary(buf, (size_t)len));
+}
+
+static void test_truncated(void) {
+    static uint8_t buf[BUF_SIZE];
+    static uint8_t small[BUF_SIZE];
+    static char json[BUF_SIZE];
+    roj_message_t out;
+
+    for (int i = 0; i < g_sample_count; i++) {
+        const sample_t* s = &g_samples[i];
+        int len = message_to_binary(&s->msg, buf, sizeof(buf));
+        int short_prefixes = 0;
+        int short_buffers = 0;
+
+        for (int cut = 0; cut < len; cut++) {
+            if (decode_binary(buf, (size_t)cut, &out) != 0) {
+                short_prefixes++;
+            }
+            if (message_to_binary(&s->msg, small, (size_t)cut) == -1) {
+                short_buffers++;
+            }
+        }
+        CHECK(short_prefixes == len);
+        CHECK(short_buffers == len);
+
+        int json_len = json_encode_message(NULL, &s->msg, json, sizeof(json));
+        int short_json = 0;
+        for (int cut = 0; cut < json_len; cut++) {
+            if (json_decode_message(json, (size_t)cut, &out, ROJ_INTERN_ALL) != 0) {
+                short_json++;
+            }
+        }
+        CHECK(short_json == json_len);
+        if (short_prefixes != len || short_buffers != len || short_json != json_len) {
+            fprintf(stderr, "  in %s\n", s->name);
+        }
+    }
+}
+
+/* An unknown sender's datagram resolves existing symbols only */
+static void test_intern_known(void) {
+    uint8_t buf[256];
+    roj_message_t m, out;
+
+    memset(&m, 0, sizeof(m));
+    m.type = MSG_VOTE;
+    strcpy(m.data.vote.proposal_id, "5a3f00000000012c");
+    m.data.vote.from = sym("node-a");
+    int len = message_to_binary(&m, buf, sizeof(buf));
+    CHECK(message_from_binary(buf, (size_t)len, &out, ROJ_INTERN_KNOWN) == 0);
+
+    /* Same length as "node-a", so the name can be swapped in place */
+    uint8_t* name = memchr(buf, 'n', (size_t)len);
+    CHECK(name != NULL);
+    if (name) {
+        memcpy(name, "node-z", 6);
+        CHECK(message_from_binary(buf, (size_t)len, &out, ROJ_INTERN_KNOWN) == -1);
+        CHECK(symtab_lookup("node-z", 6) == ROJ_SYM_EMPTY);
+    }
+}
+
+int main(void) {
+    if (symtab_init() != 0) {
+        fprintf(stderr, "symbol table init failed\n");
+        return 1;
+    }
+    build_samples();
+
+    test_round_trips();
+    test_varint_bounds();
+    test_count_bounds();
+    test_truncated();
+    test_intern_known();
+
+    symtab_free();
+    return CHECK_DONE();
+}
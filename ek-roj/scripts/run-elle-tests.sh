@@ -5,6 +5,7 @@
 #   ./scripts/run-elle-tests.sh              # Run full suite
 #   ./scripts/run-elle-tests.sh happy        # Run single scenario
 #   ./scripts/run-elle-tests.sh --download   # Download elle-cli only
+#   ./scripts/run-elle-tests.sh --check <history.json>  # Check a recorded history
 #
 # Environment variables:
 #   ELLE_CLI_JAR - Path to elle-cli JAR (default: ~/.elle-cli/elle-cli.jar)
@@ -126,6 +127,19 @@ run_scenario() {
     fi
 }
 
+# Check an existing history (e.g. from roj-node-c --history) with Elle
+check_history_file() {
+    local history_file="$1"
+
+    if [[ ! -f "${history_file}" ]]; then
+        log_error "History file not found: ${history_file}"
+        exit 1
+    fi
+
+    log_info "Checking ${history_file} with Elle..."
+    ${PROJECT_DIR}/target/release/roj-elle check --history "${history_file}" --elle-jar "${ELLE_CLI_JAR}"
+}
+
 # Run full test suite
 run_suite() {
     local output_dir="${PROJECT_DIR}/results"
@@ -153,6 +167,7 @@ Usage:
     $0                      Run full test suite
     $0 <scenario>           Run single scenario (happy, partition, leader-crash, etc.)
     $0 --download           Download elle-cli only
+    $0 --check <history>    Check a recorded history (e.g. roj-node-c --history)
     $0 --help               Show this help
 
 Scenarios:
@@ -180,6 +195,16 @@ main() {
             download_elle_cli
             exit 0
             ;;
+        --check)
+            if [[ -z "${2:-}" ]]; then
+                log_error "--check needs a history file"
+                print_usage
+                exit 1
+            fi
+            check_prerequisites
+            build_harness
+            check_history_file "$2"
+            ;;
         "")
             check_prerequisites
             build_harness